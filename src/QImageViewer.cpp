@@ -1,6 +1,69 @@
 #include "QImageViewer.h"
 #include <QOpenGLWidget>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QLabel>
+#include <QScreen>
 #include <QGraphicsItem>
+#include <QStyleOptionGraphicsItem>
+#include <QThread>
+#include <cmath>
+#include "minimap.h"
+
+/**
+ * @brief Pixmap item that can also paint straight from a QImage, used in
+ * low memory mode. Only the exposed part is converted while painting.
+ */
+class ImageItem : public QGraphicsPixmapItem
+{
+public:
+    ImageItem()
+    {
+        setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+    }
+
+    void setImage(const QImage &image)
+    {
+        prepareGeometryChange();
+        image_ = image;
+        update();
+    }
+    const QImage &image() const { return image_; }
+
+    QRectF boundingRect() const override
+    {
+        return image_.isNull() ? QGraphicsPixmapItem::boundingRect() : QRectF(image_.rect());
+    }
+
+    QPainterPath shape() const override
+    {
+        QPainterPath path;
+        path.addRect(boundingRect());
+        return path;
+    }
+
+    bool contains(const QPointF &point) const override
+    {
+        return boundingRect().contains(point);
+    }
+
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override
+    {
+        if (image_.isNull()) {
+            QGraphicsPixmapItem::paint(painter, option, widget);
+            return;
+        }
+        const QRect exposed = option->exposedRect.toAlignedRect() & image_.rect();
+        if (exposed.isEmpty())
+            return;
+        painter->setRenderHint(QPainter::SmoothPixmapTransform,
+                               transformationMode() == Qt::SmoothTransformation);
+        painter->drawImage(exposed, image_, exposed);
+    }
+
+private:
+    QImage image_;
+};
 
 QImageViewer::QImageViewer(QWidget *parent, bool useGL)
     : QGraphicsView(parent)
@@ -8,9 +71,26 @@ QImageViewer::QImageViewer(QWidget *parent, bool useGL)
     , zoom_op_scale_(1.0)
     , drag_line_profile_(false)
     , is_bilinear_transform_(false)
+    , drag_roi_(false)
     , last_pos_(4, 0)
+    , low_memory_(false)
+    , preview_(false)
     , pixmap_(nullptr)
     , line_(nullptr)
+    , roi_(nullptr)
+    , minimap_(nullptr)
+    , minimap_enabled_(false)
+    , minimap_serial_(0)
+    , minimap_source_key_(0)
+    , minimap_busy_(false)
+    , render_stats_enabled_(false)
+    , hud_(nullptr)
+    , hud_timer_(nullptr)
+    , hud_frames_(0)
+    , hud_paint_ns_(0)
+    , hud_max_paint_ns_(0)
+    , hud_scaled_bytes_(0)
+    , dropped_frames_(0)
 {
     QGraphicsScene* scene = new QGraphicsScene();
     this->setScene(scene);
@@ -35,6 +115,12 @@ QImageViewer::QImageViewer(QWidget *parent, bool useGL)
     this->setVerticalScrollBarPolicy(Qt::ScrollBarAsNeeded);
     //this->setRenderHint(QPainter::Antialiasing);
     this->setAcceptDrops(true);
+
+    minimap_ = new MiniMap(this);
+    minimap_->hide();
+    connect(minimap_, &MiniMap::centerRequested, this, [this](const QPointF &pos) {
+        centerOn(pos);
+    });
 }
 
 QImageViewer::~QImageViewer()
@@ -49,11 +135,21 @@ void QImageViewer::clear()
         line_ = nullptr;
         drag_line_profile_ = false;
     }
+    clearRoi();
+    retainVirtualTiles(QSet<qint64>());
+    virtual_size_ = QSize();
     if (pixmap_) {
         this->scene()->removeItem((QGraphicsItem*)pixmap_);
         delete pixmap_;
         pixmap_ = nullptr;
     }
+    map_cache_ = QPixmap();
+    preview_ = false;
+    minimap_serial_++; // drop proxies still being computed
+    minimap_source_key_ = 0;
+    minimap_pending_ = QImage();
+    minimap_->clear();
+    updateMiniMap();
 }
 
  QPixmap QImageViewer::grab(const QRect &rectangle)
@@ -80,6 +176,8 @@ void QImageViewer::setBilinearTransform(bool enable)
         else
             pixmap_->setTransformationMode(Qt::FastTransformation);
     }
+    for (ImageItem *tile : qAsConst(tiles_))
+        tile->setTransformationMode(enable ? Qt::SmoothTransformation : Qt::FastTransformation);
 }
 
 void QImageViewer::drawDragLine(bool clear)
@@ -101,10 +199,22 @@ void QImageViewer::drawDragLine(bool clear)
             pen.setWidth(2); pen.setCosmetic(true); // cosmetic is faster
             line_ = this->scene()->addLine(
                 last_pos_[0], last_pos_[1], last_pos_[2], last_pos_[3], pen);
+            line_->setZValue(2); // above virtual image tiles
         }
     }
 }
 
+void QImageViewer::clearRoi()
+{
+    if (roi_) {
+        this->scene()->removeItem((QGraphicsItem*)roi_);
+        delete roi_;
+        roi_ = nullptr;
+    }
+    drag_roi_ = false;
+    roi_rect_ = QRect();
+}
+
 void QImageViewer::update(int width, int height)
 {
     QPixmap map(QSize(width, height));
@@ -113,12 +223,11 @@ void QImageViewer::update(int width, int height)
 
     map.fill(Qt::lightGray);
 
-    if (pixmap_) {
-        pixmap_->setPixmap(map);
-    } else {
-        pixmap_ = this->scene()->addPixmap(map);
-        pixmap_->setCacheMode(QGraphicsItem::DeviceCoordinateCache);
-    }
+    preview_ = false;
+    displayItem()->setImage(QImage());
+    pixmap_->setTransform(QTransform());
+    pixmap_->setPixmap(map);
+    pixmap_->setCacheMode(QGraphicsItem::DeviceCoordinateCache);
 
     if (is_bilinear_transform_)
         pixmap_->setTransformationMode(Qt::SmoothTransformation);
@@ -137,32 +246,159 @@ void QImageViewer::display(const QPixmap& pixmap, bool update)
         return;
 
     map_cache_ = pixmap;
+    if (minimap_enabled_) {
+        // no source image here, a nearest neighbour proxy only reads the
+        // proxy's pixels from the pixmap
+        requestMiniMapProxy(map_cache_.scaled(MiniMap::kProxySize, MiniMap::kProxySize,
+            Qt::KeepAspectRatio, Qt::FastTransformation).toImage(), update);
+    }
 
     internal_display(update);
 }
 
-void QImageViewer::display(const QImage& img, bool update)
+void QImageViewer::display(const QImage& img, bool update, const QImage& proxy)
 {
     if (img.isNull())
         return;
 
-    bool rv = map_cache_.convertFromImage(img);
-    if (!rv)
-        return;
+    if (low_memory_) {
+        // the item shares the caller's buffer, nothing is copied
+        map_cache_ = QPixmap();
+        displayItem()->setImage(img);
+    } else {
+        bool rv = map_cache_.convertFromImage(img);
+        if (!rv)
+            return;
+    }
+    if (minimap_enabled_)
+        requestMiniMapProxy(proxy.isNull() ? img : proxy, update);
 
     internal_display(update);
 }
 
-void QImageViewer::internal_display(bool update)
+void QImageViewer::displayPreview(const QImage& preview, const QSize& size)
 {
-    QRectF mapRect = QRectF(map_cache_.rect());
+    if (preview.isNull() || size.isEmpty())
+        return;
 
-    if (pixmap_) {
-        pixmap_->setPixmap(map_cache_);
+    retainVirtualTiles(QSet<qint64>());
+    virtual_size_ = QSize();
+    preview_ = true;
+    map_cache_ = QPixmap::fromImage(preview);
+    ImageItem *item = displayItem();
+    item->setImage(QImage());
+    item->setPixmap(map_cache_);
+    item->setCacheMode(QGraphicsItem::DeviceCoordinateCache);
+    item->setTransformationMode(Qt::SmoothTransformation);
+    item->setTransform(QTransform::fromScale(double(size.width()) / preview.width(),
+                                             double(size.height()) / preview.height()));
+
+    // the proxy would be of the wrong size
+    minimap_serial_++;
+    minimap_source_key_ = 0;
+    minimap_pending_ = QImage();
+    minimap_->clear();
+
+    setSceneRect(QRectF(QPointF(0, 0), QSizeF(size)));
+    best_fit_ = true;
+    this->update();
+}
+
+void QImageViewer::displayVirtual(const QImage& overview, const QSize& size, bool update)
+{
+    if (overview.isNull() || size.isEmpty())
+        return;
+
+    // the overview is held like any displayed image
+    if (low_memory_)
+        map_cache_ = QPixmap();
+    else if (!map_cache_.convertFromImage(overview))
+        return;
+
+    retainVirtualTiles(QSet<qint64>());
+    preview_ = false;
+    virtual_size_ = size;
+    ImageItem *item = displayItem();
+    if (map_cache_.isNull()) {
+        item->setPixmap(QPixmap());
+        item->setImage(overview);
+        item->setCacheMode(QGraphicsItem::NoCache);
     } else {
-        pixmap_ = this->scene()->addPixmap(map_cache_);
-        pixmap_->setCacheMode(QGraphicsItem::DeviceCoordinateCache);
+        item->setImage(QImage());
+        item->setPixmap(map_cache_);
+        item->setCacheMode(QGraphicsItem::DeviceCoordinateCache);
     }
+    item->setTransformationMode(is_bilinear_transform_ ? Qt::SmoothTransformation : Qt::FastTransformation);
+    item->setTransform(QTransform::fromScale(double(size.width()) / overview.width(),
+                                             double(size.height()) / overview.height()));
+    if (minimap_enabled_)
+        requestMiniMapProxy(overview, update);
+
+    const QRectF rect(QPointF(0, 0), QSizeF(size));
+    const bool changed = sceneRect() != rect;
+    setSceneRect(rect);
+    if (update)
+        best_fit_ = true;
+    if (changed || update)
+        this->update();
+    emit viewChanged();
+}
+
+void QImageViewer::setVirtualTile(qint64 key, const QRect& rect, const QImage& tile)
+{
+    if (!virtual_size_.isValid() || tile.isNull())
+        return;
+
+    ImageItem *item = tiles_.value(key);
+    if (!item) {
+        item = new ImageItem();
+        item->setZValue(1);
+        item->setCacheMode(QGraphicsItem::DeviceCoordinateCache);
+        this->scene()->addItem(item);
+        tiles_.insert(key, item);
+    }
+    item->setImage(tile);
+    item->setTransformationMode(is_bilinear_transform_ ? Qt::SmoothTransformation : Qt::FastTransformation);
+    item->setTransform(QTransform::fromScale(double(rect.width()) / tile.width(),
+                                             double(rect.height()) / tile.height()));
+    item->setPos(rect.topLeft());
+}
+
+void QImageViewer::retainVirtualTiles(const QSet<qint64>& keys)
+{
+    for (auto it = tiles_.begin(); it != tiles_.end();) {
+        if (keys.contains(it.key())) {
+            ++it;
+            continue;
+        }
+        this->scene()->removeItem(it.value());
+        delete it.value();
+        it = tiles_.erase(it);
+    }
+}
+
+QRectF QImageViewer::visibleSceneRect() const
+{
+    return mapToScene(viewport()->rect()).boundingRect() & sceneRect();
+}
+
+void QImageViewer::internal_display(bool update)
+{
+    retainVirtualTiles(QSet<qint64>());
+    virtual_size_ = QSize();
+    preview_ = false;
+    ImageItem *item = displayItem();
+    item->setTransform(QTransform());
+    if (map_cache_.isNull()) {
+        // low memory: painting from the image, a device cache would be one more copy
+        item->setPixmap(QPixmap());
+        item->setCacheMode(QGraphicsItem::NoCache);
+    } else {
+        item->setImage(QImage());
+        item->setPixmap(map_cache_);
+        item->setCacheMode(QGraphicsItem::DeviceCoordinateCache);
+    }
+    QRectF mapRect = QRectF(QRect(QPoint(0, 0), contentSize()));
 
     if (is_bilinear_transform_)
         pixmap_->setTransformationMode(Qt::SmoothTransformation);
@@ -192,6 +428,9 @@ void QImageViewer::update()
         //setTransform(m);
         zoom_op_scale_ = 1.0; // reset
     }
+    updateMiniMap();
+    if (virtual_size_.isValid())
+        emit viewChanged();
 }
 
 void QImageViewer::fitInView(const QRectF &rect, Qt::AspectRatioMode aspectRatioMode)
@@ -238,6 +477,10 @@ void QImageViewer::mouseDoubleClickEvent(QMouseEvent* e)
     if (e->button() == Qt::LeftButton) {
         this->drawDragLine(true);
         last_pos_ = std::vector<int>(4, 0);
+        if (roi_) {
+            clearRoi();
+            emit roiCleared();
+        }
     }
 }
 
@@ -245,22 +488,26 @@ void QImageViewer::mouseMoveEvent(QMouseEvent* e)
 {
     auto scene_pos = mapToScene(e->pos());
     QPoint pos(static_cast<int>(scene_pos.x()), static_cast<int>(scene_pos.y()));
-    if (pixmap_) {
+    if (pixmap_ && !preview_) {
         if (drag_line_profile_) {
             // We didn't add the line in mousePressEvent, so this cond might be invalid
             // Q_ASSERT(line_ != nullptr);
             last_pos_[2] = pos.x();
             last_pos_[3] = pos.y();
             this->drawDragLine();
+        } else if (drag_roi_) {
+            roi_rect_ = QRect(roi_origin_, pos).normalized();
+            roi_->setRect(QRectF(roi_rect_));
+            emit roiChanged(roi_rect_);
         } else if (dragMode() == QGraphicsView::NoDrag) {
-            auto width = pixmap_->pixmap().width();
-            auto height = pixmap_->pixmap().height();
+            auto width = contentSize().width();
+            auto height = contentSize().height();
             if (scene_pos.x() < 0 || scene_pos.y() < 0
                 || scene_pos.x() >= width || scene_pos.y() >= height) {
                 emit pixelValueOnCursor(-1, -1, 0, 0, 0);
             } else {
                 int r, g, b;
-                pixmap_->pixmap().toImage().pixelColor(pos).getRgb(&r, &g, &b);
+                pixelAt(scene_pos).getRgb(&r, &g, &b);
                 emit pixelValueOnCursor(pos.x(), pos.y(), r, g, b);
             }
         }
@@ -282,6 +529,20 @@ void QImageViewer::mousePressEvent(QMouseEvent* e)
             last_pos_[0] = pos.x();
             last_pos_[1] = pos.y();
             drag_line_profile_ = true;
+        } else if (modifiers & Qt::ShiftModifier && pixmap_) {
+            drag_roi_ = true;
+            roi_origin_ = pos;
+            roi_rect_ = QRect(pos, QSize(1, 1));
+            if (roi_) {
+                roi_->setRect(QRectF(roi_rect_));
+            } else {
+                QPen pen(QColor(255, 200, 0));
+                pen.setStyle(Qt::DashLine);
+                pen.setWidth(2); pen.setCosmetic(true);
+                roi_ = this->scene()->addRect(QRectF(roi_rect_), pen);
+                roi_->setZValue(2);
+            }
+            emit roiChanged(roi_rect_);
         } else {
             setDragMode(QGraphicsView::ScrollHandDrag);
         }
@@ -306,12 +567,19 @@ void QImageViewer::mouseReleaseEvent(QMouseEvent* e)
             drag_line_profile_ = false;
             emit lineProfileReady(last_pos_[0], last_pos_[1], last_pos_[2], last_pos_[3]);
         }
+        if (drag_roi_) {
+            roi_rect_ = QRect(roi_origin_, pos).normalized();
+            roi_->setRect(QRectF(roi_rect_));
+            drag_roi_ = false;
+            emit roiChanged(roi_rect_);
+        }
         setDragMode(QGraphicsView::NoDrag);
     }
 }
 
 void QImageViewer::wheelEvent(QWheelEvent* e)
 {
+    wheel_clock_.start();
     int v = e->angleDelta().y() / 120;
     if (v > 0) {
         zoom_op_scale_ = 1.25;
@@ -327,6 +595,418 @@ void QImageViewer::resizeEvent(QResizeEvent * /* unused */)
     update();
 }
 
+void QImageViewer::scrollContentsBy(int dx, int dy)
+{
+    QGraphicsView::scrollContentsBy(dx, dy);
+    updateMiniMap();
+    if (virtual_size_.isValid())
+        emit viewChanged();
+}
+
+void QImageViewer::paintEvent(QPaintEvent *e)
+{
+    if (!render_stats_enabled_) {
+        QGraphicsView::paintEvent(e);
+        emit painted();
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    QGraphicsView::paintEvent(e);
+    if (QOpenGLWidget *gl = qobject_cast<QOpenGLWidget*>(viewport())) {
+        // GL calls are only queued by now, wait for them so the time is real
+        gl->makeCurrent();
+        if (gl->context())
+            gl->context()->functions()->glFinish();
+    }
+    const qint64 ns = timer.nsecsElapsed();
+
+    hud_frames_++;
+    hud_paint_ns_ += ns;
+    hud_max_paint_ns_ = qMax(hud_max_paint_ns_, ns);
+
+    // source pixels under the repainted area, each one is scaled (or
+    // converted, in low memory mode) unless the item cache was still valid
+    if (pixmap_) {
+        const QRectF exposed = mapToScene(e->rect()).boundingRect() & pixmap_->sceneBoundingRect();
+        const int depth = pixmap_->image().isNull() ? pixmap_->pixmap().depth() : pixmap_->image().depth();
+        hud_scaled_bytes_ += qint64(exposed.width() * exposed.height()) * qMax(1, depth / 8);
+    }
+
+    // a paint longer than a refresh interval costs that many frames
+    if (isInteracting()) {
+        const QScreen *screen = window()->windowHandle() ? window()->windowHandle()->screen()
+                                                        : QGuiApplication::primaryScreen();
+        const double hz = screen && screen->refreshRate() > 1 ? screen->refreshRate() : 60.0;
+        dropped_frames_ += qint64(ns * hz / 1e9);
+    }
+    emit painted();
+}
+
+void QImageViewer::drawForeground(QPainter *painter, const QRectF &rect)
+{
+    if (annotations_ && !preview_)
+        drawAnnotations(painter, rect);
+}
+
+void QImageViewer::setAnnotations(const AnnotationSetPtr &annotations)
+{
+    annotations_ = annotations;
+    annotation_mask_ = QVector<uchar>();
+    viewport()->update();
+}
+
+// level of detail, in screen pixels
+static const double kDotSize = 3; // smaller boxes are one dot per screen pixel
+static const double kPolygonSize = 8; // smaller polygons are drawn as their box
+static const double kLabelSize = 12; // boxes need this height for a label
+static const int kMaxLabels = 256; // per paint
+static const int kLabelReach = 160; // width of the longest label drawn in full
+
+/**
+ * @brief Paint the annotations touching @a rect from the spatial index, one
+ * batched call per colour for boxes and dots instead of an item per box.
+ * The paint only costs what is in the exposed rect, and when zoomed out
+ * thousands of tiny boxes collapse to at most one dot per screen pixel.
+ */
+void QImageViewer::drawAnnotations(QPainter *painter, const QRectF &rect)
+{
+    const double scale = getZoomScale();
+    if (scale <= 0)
+        return;
+    // labels stick out above and to the right of their box, and so do
+    // cosmetic pens by a pixel, repaint them when only those are exposed
+    const double pixel = 1 / scale;
+    annotations_->query(rect.adjusted(-kLabelReach * pixel, -pixel, pixel, (kLabelSize + 4) * pixel),
+                        &annotation_hits_);
+    if (annotation_hits_.isEmpty())
+        return;
+
+    const QTransform toDevice = painter->worldTransform();
+    const QSize device = viewport()->size();
+    const qsizetype maskSize = qsizetype(device.width()) * device.height();
+    bool maskClear = false;
+    QVector<int> polygons, labels;
+    for (int i : annotation_hits_) {
+        const Annotation &a = annotations_->at(i);
+        const double extent = qMax(a.box.width(), a.box.height()) * scale;
+        const int color = a.category % AnnotationSet::kColors;
+        if (extent < kDotSize) {
+            const QPoint p = toDevice.map(a.box.center()).toPoint();
+            if (p.x() < 0 || p.y() < 0 || p.x() >= device.width() || p.y() >= device.height())
+                continue;
+            if (!maskClear) {
+                annotation_mask_.fill(0, maskSize);
+                maskClear = true;
+            }
+            uchar &taken = annotation_mask_[qsizetype(p.y()) * device.width() + p.x()];
+            if (!taken) {
+                taken = 1;
+                annotation_dots_[color].append(p);
+            }
+            continue;
+        }
+        if (!a.polygon.isEmpty() && extent >= kPolygonSize)
+            polygons.append(i);
+        else
+            annotation_boxes_[color].append(a.box);
+        if (a.box.height() * scale >= kLabelSize && labels.size() < kMaxLabels)
+            labels.append(i);
+    }
+
+    painter->save();
+    painter->setRenderHint(QPainter::Antialiasing, false);
+    painter->setBrush(Qt::NoBrush);
+    for (int c = 0; c < AnnotationSet::kColors; c++) {
+        if (annotation_boxes_[c].isEmpty())
+            continue;
+        painter->setPen(QPen(AnnotationSet::categoryColor(c), 0)); // cosmetic
+        painter->drawRects(annotation_boxes_[c]);
+        annotation_boxes_[c].clear(); // keeps the capacity
+    }
+    for (int i : polygons) {
+        const Annotation &a = annotations_->at(i);
+        painter->setPen(QPen(AnnotationSet::categoryColor(a.category), 0));
+        painter->drawPolygon(a.polygon);
+    }
+
+    // dots and labels keep their size on screen
+    painter->resetTransform();
+    for (int c = 0; c < AnnotationSet::kColors; c++) {
+        if (annotation_dots_[c].isEmpty())
+            continue;
+        painter->setPen(QPen(AnnotationSet::categoryColor(c), 0));
+        painter->drawPoints(annotation_dots_[c].constData(), annotation_dots_[c].size());
+        annotation_dots_[c].clear();
+    }
+    const QFontMetrics metrics = painter->fontMetrics();
+    for (int i : labels) {
+        const Annotation &a = annotations_->at(i);
+        QString text = annotations_->categories().at(a.category);
+        if (a.score >= 0)
+            text = text.isEmpty() ? QString::number(a.score, 'f', 2)
+                                  : QString("%1 %2").arg(text).arg(a.score, 0, 'f', 2);
+        if (text.isEmpty())
+            continue;
+        text = metrics.elidedText(text, Qt::ElideRight, kLabelReach);
+        const QPoint corner = toDevice.map(a.box.topLeft()).toPoint();
+        const QRect box(corner.x(), corner.y() - metrics.height() - 1,
+                        metrics.horizontalAdvance(text) + 4, metrics.height() + 1);
+        painter->fillRect(box, AnnotationSet::categoryColor(a.category));
+        painter->setPen(Qt::black);
+        painter->drawText(box, Qt::AlignCenter, text);
+    }
+    painter->restore();
+}
+
+bool QImageViewer::isInteracting() const
+{
+    return dragMode() == QGraphicsView::ScrollHandDrag
+        || (wheel_clock_.isValid() && wheel_clock_.elapsed() < 250);
+}
+
+void QImageViewer::setRenderStatsEnabled(bool enable)
+{
+    render_stats_enabled_ = enable;
+    if (!hud_) {
+        hud_ = new QLabel(this);
+        // opaque, so refreshing the text does not repaint the image below it
+        hud_->setAutoFillBackground(true);
+        QPalette palette = hud_->palette();
+        palette.setColor(QPalette::Window, QColor(32, 32, 32));
+        palette.setColor(QPalette::WindowText, Qt::white);
+        hud_->setPalette(palette);
+        hud_->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+        hud_->setMargin(6);
+        hud_->setAttribute(Qt::WA_TransparentForMouseEvents);
+        hud_->hide();
+
+        hud_timer_ = new QTimer(this);
+        hud_timer_->setInterval(500);
+        connect(hud_timer_, &QTimer::timeout, this, &QImageViewer::updateRenderStats);
+    }
+    resetRenderStats();
+    if (enable) {
+        hud_timer_->start();
+        updateRenderStats();
+        hud_->show();
+        hud_->raise();
+    } else {
+        hud_timer_->stop();
+        hud_->hide();
+    }
+}
+
+void QImageViewer::resetRenderStats()
+{
+    hud_frames_ = 0;
+    hud_paint_ns_ = 0;
+    hud_max_paint_ns_ = 0;
+    hud_scaled_bytes_ = 0;
+    dropped_frames_ = 0;
+    hud_clock_.start();
+}
+
+void QImageViewer::updateRenderStats()
+{
+    if (!hud_)
+        return;
+
+    QString mode;
+    switch (viewportUpdateMode()) {
+    case QGraphicsView::FullViewportUpdate: mode = "full"; break;
+    case QGraphicsView::MinimalViewportUpdate: mode = "minimal"; break;
+    case QGraphicsView::SmartViewportUpdate: mode = "smart"; break;
+    case QGraphicsView::BoundingRectViewportUpdate: mode = "bounding rect"; break;
+    case QGraphicsView::NoViewportUpdate: mode = "none"; break;
+    }
+    const bool gl = qobject_cast<QOpenGLWidget*>(viewport()) != nullptr;
+    const double seconds = hud_clock_.nsecsElapsed() / 1e9;
+    const int frames = qMax(1, hud_frames_);
+
+    QStringList lines;
+    lines << tr("%1, %2 updates").arg(gl ? "OpenGL" : "raster", mode);
+    lines << tr("%1 fps  paint %2 ms (max %3)")
+        .arg(seconds > 0 ? hud_frames_ / seconds : 0.0, 0, 'f', 1)
+        .arg(hud_paint_ns_ / 1e6 / frames, 0, 'f', 2)
+        .arg(hud_max_paint_ns_ / 1e6, 0, 'f', 2);
+    lines << tr("scale %1  source %2/frame")
+        .arg(getZoomScale(), 0, 'f', 3)
+        .arg(locale().formattedDataSize(hud_scaled_bytes_ / frames));
+    lines << tr("dropped %1 (pan/zoom)").arg(dropped_frames_);
+    hud_->setText(lines.join('\n'));
+    hud_->adjustSize();
+    const QRect vp = viewport()->geometry();
+    hud_->move(vp.left() + 8, vp.top() + 8);
+
+    // dropped frames add up until reset, the rest is per interval
+    const qint64 dropped = dropped_frames_;
+    resetRenderStats();
+    dropped_frames_ = dropped;
+}
+
+void QImageViewer::setMiniMapEnabled(bool enable)
+{
+    minimap_enabled_ = enable;
+    if (enable && !minimap_->hasProxy() && !map_cache_.isNull()) {
+        requestMiniMapProxy(map_cache_.scaled(MiniMap::kProxySize, MiniMap::kProxySize,
+            Qt::KeepAspectRatio, Qt::FastTransformation).toImage(), false);
+    } else if (enable && !minimap_->hasProxy() && pixmap_ && !pixmap_->image().isNull()) {
+        requestMiniMapProxy(pixmap_->image(), false);
+    }
+    updateMiniMap();
+}
+
+/**
+ * Every displayed frame comes through here while watching, playing or
+ * ingesting. The same buffer shown again is skipped, and at most one proxy
+ * is computed at a time for the newest frame, only while the minimap is
+ * shown. A proxy of an older frame of the same stream is kept meanwhile.
+ */
+void QImageViewer::requestMiniMapProxy(const QImage &img, bool newImage)
+{
+    if (img.cacheKey() == minimap_source_key_ && !newImage)
+        return;
+    minimap_source_key_ = img.cacheKey();
+    if (newImage || img.size() != minimap_source_size_) {
+        minimap_serial_++;
+        minimap_source_size_ = img.size();
+    }
+
+    if (img.width() <= MiniMap::kProxySize && img.height() <= MiniMap::kProxySize) {
+        minimap_pending_ = QImage();
+        minimap_->setProxy(MiniMap::makeProxy(img), QSizeF(contentSize()));
+        updateMiniMap();
+        return;
+    }
+    minimap_pending_ = img;
+    startMiniMapProxy();
+}
+
+void QImageViewer::startMiniMapProxy()
+{
+    if (minimap_busy_ || minimap_pending_.isNull() || !isMiniMapWanted())
+        return;
+
+    QThread* thread = new QThread();
+    MiniMapProxyTask* task = new MiniMapProxyTask();
+    task->setImage(minimap_pending_, minimap_serial_);
+    minimap_pending_ = QImage();
+
+    // move the task object to the thread BEFORE connecting any signal/slots
+    task->moveToThread(thread);
+
+    connect(thread, &QThread::started, task, &MiniMapProxyTask::run);
+    connect(task, &MiniMapProxyTask::workFinished, thread, &QThread::quit);
+    connect(task, &MiniMapProxyTask::resultReady, this, &QImageViewer::miniMapProxyReady);
+
+    // automatically delete thread and task object when work is done:
+    connect(task, &MiniMapProxyTask::workFinished, task, &MiniMapProxyTask::deleteLater);
+    connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+
+    minimap_busy_ = true;
+    emit taskStarted(thread);
+    thread->start();
+}
+
+void QImageViewer::miniMapProxyReady(QImage proxy, int serial)
+{
+    minimap_busy_ = false;
+    if (serial == minimap_serial_)
+        minimap_->setProxy(proxy, QSizeF(contentSize())); // else image changed meanwhile
+    updateMiniMap(); // also starts the proxy of a newer frame
+}
+
+ImageItem *QImageViewer::displayItem()
+{
+    if (!pixmap_) {
+        pixmap_ = new ImageItem();
+        this->scene()->addItem(pixmap_);
+    }
+    return pixmap_;
+}
+
+QColor QImageViewer::pixelAt(const QPointF &scene_pos) const
+{
+    // the finest tile under the cursor, else the (stretched) displayed item
+    const ImageItem *item = pixmap_;
+    for (const ImageItem *tile : tiles_) {
+        if (tile->sceneBoundingRect().contains(scene_pos)
+            && (item == pixmap_ || tile->transform().m11() < item->transform().m11()))
+            item = tile;
+    }
+    // the pixel the cursor is in, as the reported x/y; a stretched item can
+    // map a point on its far edge to its size
+    const QPointF local = item->mapFromScene(scene_pos);
+    const QSize size = item->image().isNull() ? item->pixmap().size() : item->image().size();
+    if (size.isEmpty())
+        return QColor();
+    const QPoint pos(qBound(0, int(std::floor(local.x())), size.width() - 1),
+                     qBound(0, int(std::floor(local.y())), size.height() - 1));
+    if (!item->image().isNull())
+        return item->image().pixelColor(pos);
+    // only the pixel under the cursor leaves the pixmap
+    return item->pixmap().copy(QRect(pos, QSize(1, 1))).toImage().pixelColor(0, 0);
+}
+
+QSize QImageViewer::contentSize() const
+{
+    if (virtual_size_.isValid())
+        return virtual_size_;
+    if (!pixmap_)
+        return map_cache_.size();
+    return pixmap_->image().isNull() ? pixmap_->pixmap().size() : pixmap_->image().size();
+}
+
+QImage QImageViewer::displayedImage() const
+{
+    return pixmap_ ? pixmap_->image() : QImage();
+}
+
+qint64 QImageViewer::pixmapBytes() const
+{
+    if (map_cache_.isNull())
+        return 0;
+    return qint64(map_cache_.width()) * map_cache_.height() * map_cache_.depth() / 8;
+}
+
+qint64 QImageViewer::itemCacheBytes() const
+{
+    if (!pixmap_ || pixmap_->cacheMode() != QGraphicsItem::DeviceCoordinateCache)
+        return 0;
+    // the cache covers at most the visible part of the item
+    const QRect visible = mapFromScene(pixmap_->sceneBoundingRect()).boundingRect() & viewport()->rect();
+    return qint64(visible.width()) * visible.height() * 4;
+}
+
+bool QImageViewer::isMiniMapWanted() const
+{
+    // only useful while part of the image is out of view
+    const QRectF scene_rect = sceneRect();
+    const QRectF visible = mapToScene(viewport()->rect()).boundingRect() & scene_rect;
+    return minimap_enabled_ && pixmap_ && !visible.contains(scene_rect.adjusted(1, 1, -1, -1));
+}
+
+void QImageViewer::updateMiniMap()
+{
+    const bool wanted = isMiniMapWanted();
+    if (wanted)
+        startMiniMapProxy();
+    if (!wanted || !minimap_->hasProxy()) {
+        minimap_->hide();
+        return;
+    }
+
+    const QRectF visible = mapToScene(viewport()->rect()).boundingRect() & sceneRect();
+
+    const QRect vp = viewport()->geometry();
+    minimap_->move(vp.right() - minimap_->width() - 8, vp.bottom() - minimap_->height() - 8);
+    minimap_->setViewRect(visible);
+    minimap_->show();
+    minimap_->raise();
+}
+
 void QImageViewer::leaveEvent(QEvent* e)
 {
     emit pixelValueOnCursor(-1, -1, 0, 0, 0);
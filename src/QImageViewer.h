@@ -2,6 +2,11 @@
 
 #include <QtGui>
 #include <QGraphicsView>
+#include "annotations.h"
+
+class MiniMap;
+class ImageItem;
+class QLabel;
 
 
 class QImageViewer : public QGraphicsView
@@ -16,7 +21,21 @@ public:
 
     void update(int width, int height); // set a blank image (best fit)
     void display(const QPixmap& pixmap, bool update = false);
-    void display(const QImage& img, bool update = false);
+    /// @a proxy, when given, is a small version of @a img for the minimap.
+    /// RGB32 and ARGB32_Premultiplied are wrapped, anything else is converted here
+    void display(const QImage& img, bool update = false, const QImage& proxy = QImage());
+    /// stretch a small preview over a @a size image until the real one is displayed
+    void displayPreview(const QImage& preview, const QSize& size);
+    bool isPreview() const { return preview_; }
+    /// virtual image: @a overview stretched over @a size, full resolution
+    /// tiles are added on top with setVirtualTile()
+    void displayVirtual(const QImage& overview, const QSize& size, bool update = false);
+    bool isVirtual() const { return virtual_size_.isValid(); }
+    /// @a rect in scene (file) pixels, @a tile may be smaller and is stretched
+    void setVirtualTile(qint64 key, const QRect& rect, const QImage& tile);
+    bool hasVirtualTile(qint64 key) const { return tiles_.contains(key); }
+    void retainVirtualTiles(const QSet<qint64>& keys);
+    QRectF visibleSceneRect() const;
     void clear();
 
     QPixmap grab(const QRect &rectangle = QRect(QPoint(0, 0), QSize(-1, -1)));
@@ -39,6 +58,30 @@ public:
     void drawDragLine(bool clear = false); /// draw draged line 
 
     std::vector<int> getDragLinePos() const { return last_pos_; }
+
+    QRect getRoi() const { return roi_rect_; }
+    void clearRoi();
+
+    /// paint straight from the caller's QImage: no pixmap copy, no item
+    /// cache and 8-bit buffers stay 8-bit. Takes effect on the next display().
+    void setLowMemory(bool enable) { low_memory_ = enable; }
+    bool isLowMemory() const { return low_memory_; }
+    QImage displayedImage() const; /// buffer painted in low memory mode, else null
+    qint64 pixmapBytes() const; /// view-side copy of the displayed buffer
+    qint64 itemCacheBytes() const; /// upper bound of the item's device cache
+
+    void setMiniMapEnabled(bool enable);
+    bool isMiniMapEnabled() const { return minimap_enabled_; }
+
+    /// overlay with fps, paint time, scale, source bytes per frame and
+    /// frames dropped while panning or zooming; paints are only timed while it is shown
+    void setRenderStatsEnabled(bool enable);
+    bool isRenderStatsEnabled() const { return render_stats_enabled_; }
+    void resetRenderStats();
+
+    /// drawn over the image, in scene (file) pixels; null for none
+    void setAnnotations(const AnnotationSetPtr &annotations);
+    AnnotationSetPtr annotations() const { return annotations_; }
     //std::vector<double> getDragLineData(int start_x, int start_y, int end_x, int end_y);
 protected:
     virtual void internal_display(bool update);
@@ -53,20 +96,73 @@ protected:
     virtual void dragEnterEvent(QDragEnterEvent * e);
     virtual void dragMoveEvent(QDragMoveEvent *e);
     virtual void dropEvent(QDropEvent *e);
+    virtual void scrollContentsBy(int dx, int dy);
+    virtual void paintEvent(QPaintEvent *e);
+    virtual void drawForeground(QPainter *painter, const QRectF &rect);
 
 signals:
     void pixelValueOnCursor(int x, int y, int r, int g, int b);
     void lineProfileReady(int start_x, int start_y, int end_x, int end_y);
     void filesDropped(QList<QUrl> fileUrl);
+    void roiChanged(const QRect &rect); /// emitted live while dragging with Shift
+    void roiCleared();
+    void viewChanged(); /// zoomed or scrolled, only emitted for virtual images
+    void painted(); /// after every repaint of the viewport
+    void taskStarted(QThread *thread); /// a worker of the viewer, running until it finishes
+private slots:
+    void miniMapProxyReady(QImage proxy, int serial);
 private:
+    void requestMiniMapProxy(const QImage &img, bool newImage);
+    void startMiniMapProxy();
+    bool isMiniMapWanted() const;
+    void updateMiniMap();
+    void updateRenderStats();
+    bool isInteracting() const;
+    ImageItem *displayItem();
+    QSize contentSize() const;
+    QColor pixelAt(const QPointF &scene_pos) const;
+    void drawAnnotations(QPainter *painter, const QRectF &rect);
+
     bool best_fit_;
     double zoom_op_scale_;
     bool drag_line_profile_;
     bool is_bilinear_transform_;
+    bool drag_roi_;
+    QPoint roi_origin_;
+    QRect roi_rect_;
     std::vector<int> last_pos_;
     std::vector<QRectF> zoom_stack_;
     QPixmap map_cache_;
-    QGraphicsPixmapItem *pixmap_;
+    bool low_memory_;
+    bool preview_;
+    ImageItem *pixmap_;
     QGraphicsLineItem *line_;
+    QGraphicsRectItem *roi_;
+    MiniMap *minimap_;
+    bool minimap_enabled_;
+    int minimap_serial_; // changes with the image, not with each frame of a stream
+    qint64 minimap_source_key_; // of the last image a proxy was asked for
+    QSize minimap_source_size_;
+    QImage minimap_pending_; // newest image waiting for a proxy
+    bool minimap_busy_; // one proxy task at a time
+    QSize virtual_size_;
+    QHash<qint64, ImageItem*> tiles_;
+    AnnotationSetPtr annotations_;
+    // reused by every paint
+    QVector<int> annotation_hits_;
+    QVector<QRectF> annotation_boxes_[AnnotationSet::kColors];
+    QVector<QPoint> annotation_dots_[AnnotationSet::kColors];
+    QVector<uchar> annotation_mask_; // viewport pixels that have a dot
+
+    bool render_stats_enabled_;
+    QLabel *hud_;
+    QTimer *hud_timer_;
+    QElapsedTimer hud_clock_; // since the last refresh of hud_
+    QElapsedTimer wheel_clock_;
+    int hud_frames_;
+    qint64 hud_paint_ns_;
+    qint64 hud_max_paint_ns_;
+    qint64 hud_scaled_bytes_;
+    qint64 dropped_frames_;
 };
 
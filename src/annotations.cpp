@@ -0,0 +1,419 @@
+#include <math.h>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QTextStream>
+#include "annotations.h"
+
+static const int kItemsPerCell = 4; // grid cells are sized for about this many
+static const int kMaxCellsPerItem = 16; // larger ones go to large_
+static const double kMinCellSize = 16; // pixels
+static const double kMaxCoordinate = 1e9; // pixels, farther records are dropped
+
+/// number or numeric string
+static bool toNumber(const QJsonValue &value, double *number)
+{
+    if (value.isDouble()) {
+        *number = value.toDouble();
+        return true;
+    }
+    bool ok = false;
+    *number = value.toString().toDouble(&ok);
+    return ok;
+}
+
+static QString toText(const QJsonValue &value)
+{
+    return value.isDouble() ? QString::number(value.toDouble()) : value.toString();
+}
+
+/// [[x, y], ...], [x, y, ...], [[x, y, ...], ...] (COCO rings, the first is used) or "x y x y ..."
+static QPolygonF toPolygon(const QJsonValue &value)
+{
+    QVector<double> flat;
+    if (value.isString()) {
+        static const QRegularExpression separators("[\\s,;]+");
+        const QStringList parts = value.toString().split(separators, Qt::SkipEmptyParts);
+        for (const QString &part : parts)
+            flat.append(part.toDouble());
+    } else {
+        const QJsonArray array = value.toArray();
+        if (!array.isEmpty() && array.first().isArray()) {
+            const QJsonArray first = array.first().toArray();
+            if (first.size() > 2)
+                return toPolygon(first);
+            for (const QJsonValue &point : array) {
+                const QJsonArray xy = point.toArray();
+                if (xy.size() >= 2) {
+                    flat.append(xy[0].toDouble());
+                    flat.append(xy[1].toDouble());
+                }
+            }
+        } else {
+            for (const QJsonValue &v : array)
+                flat.append(v.toDouble());
+        }
+    }
+    QPolygonF polygon;
+    for (int i = 0; i + 1 < flat.size(); i += 2)
+        polygon.append(QPointF(flat[i], flat[i + 1]));
+    return polygon;
+}
+
+/**
+ * @brief Fill @a a and @a label from one record, JSON object or CSV row alike:
+ * @a field returns the value under a key, undefined when there is none.
+ */
+template <class Field>
+static bool readRecord(Field field, const QHash<int, QString> &categoryNames,
+                       Annotation *a, QString *label)
+{
+    auto numbers = [&field](std::initializer_list<const char*> keys, double *out) {
+        int i = 0;
+        for (const char *key : keys) {
+            if (!toNumber(field(QLatin1String(key)), out + i++))
+                return false;
+        }
+        return true;
+    };
+
+    for (const char *key : {"polygon", "points", "segmentation"}) {
+        const QJsonValue value = field(QLatin1String(key));
+        if (!value.isUndefined()) {
+            a->polygon = toPolygon(value);
+            if (a->polygon.size() >= 2)
+                break;
+            a->polygon.clear();
+        }
+    }
+
+    double v[4];
+    const QJsonArray bbox = field(QLatin1String("bbox")).toArray();
+    const QJsonArray box = field(QLatin1String("box")).toArray();
+    if (bbox.size() == 4) {
+        a->box = QRectF(bbox[0].toDouble(), bbox[1].toDouble(), bbox[2].toDouble(), bbox[3].toDouble());
+    } else if (box.size() == 4) {
+        a->box = QRectF(QPointF(box[0].toDouble(), box[1].toDouble()),
+                        QPointF(box[2].toDouble(), box[3].toDouble()));
+    } else if (numbers({"x", "y", "width", "height"}, v) || numbers({"x", "y", "w", "h"}, v)) {
+        a->box = QRectF(v[0], v[1], v[2], v[3]);
+    } else if (numbers({"x1", "y1", "x2", "y2"}, v) || numbers({"xmin", "ymin", "xmax", "ymax"}, v)
+               || numbers({"left", "top", "right", "bottom"}, v)) {
+        a->box = QRectF(QPointF(v[0], v[1]), QPointF(v[2], v[3]));
+    } else if (!a->polygon.isEmpty()) {
+        a->box = a->polygon.boundingRect();
+    } else {
+        return false;
+    }
+    a->box = a->box.normalized();
+
+    // "nan" and "1e999" parse too; the grid of buildIndex() needs finite
+    // bounds, and nothing that far out is ever drawn. NaN fails the test.
+    auto inRange = [](const QPointF &p) {
+        return qAbs(p.x()) <= kMaxCoordinate && qAbs(p.y()) <= kMaxCoordinate;
+    };
+    if (!inRange(a->box.topLeft()) || !inRange(a->box.bottomRight()))
+        return false;
+    for (const QPointF &p : qAsConst(a->polygon)) {
+        if (!inRange(p))
+            return false;
+    }
+    if (a->polygon.size() < 3)
+        a->polygon.clear(); // two corners, as LabelMe writes rectangles
+
+    label->clear();
+    for (const char *key : {"label", "class", "category", "name"}) {
+        const QJsonValue value = field(QLatin1String(key));
+        if (!value.isUndefined() && !value.isNull()) {
+            *label = toText(value);
+            break;
+        }
+    }
+    double id;
+    if (label->isEmpty() && toNumber(field(QLatin1String("category_id")), &id))
+        *label = categoryNames.value(int(id), QString::number(id));
+
+    double score;
+    if (toNumber(field(QLatin1String("score")), &score) || toNumber(field(QLatin1String("confidence")), &score))
+        a->score = float(score);
+    return true;
+}
+
+QString AnnotationSet::sidecarPath(const QString &imagePath)
+{
+    if (imagePath.isEmpty())
+        return QString();
+    const QFileInfo info(imagePath);
+    const QString base = info.dir().filePath(info.completeBaseName());
+    for (const QString &candidate : {base + ".json", base + ".csv", imagePath + ".json", imagePath + ".csv"}) {
+        if (QFileInfo::exists(candidate))
+            return candidate;
+    }
+    return QString();
+}
+
+QSharedPointer<AnnotationSet> AnnotationSet::load(const QString &fileName, QString *error)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        *error = file.errorString();
+        return QSharedPointer<AnnotationSet>();
+    }
+    QSharedPointer<AnnotationSet> set(new AnnotationSet);
+    const bool ok = fileName.endsWith(".csv", Qt::CaseInsensitive) ? set->readCsv(&file, error)
+                                                                   : set->readJson(file.readAll(), error);
+    if (!ok)
+        return QSharedPointer<AnnotationSet>();
+    if (set->items_.isEmpty()) {
+        *error = QString("no boxes or polygons found");
+        return QSharedPointer<AnnotationSet>();
+    }
+    set->buildIndex();
+    return set;
+}
+
+QColor AnnotationSet::categoryColor(int category)
+{
+    return QColor::fromHsv((category % kColors) * 137 % 360, 255, 255); // golden angle steps
+}
+
+void AnnotationSet::append(const Annotation &annotation, const QString &label)
+{
+    auto it = category_index_.constFind(label);
+    if (it == category_index_.constEnd()) {
+        it = category_index_.insert(label, categories_.size());
+        categories_.append(label);
+    }
+    items_.append(annotation);
+    items_.last().category = it.value();
+}
+
+bool AnnotationSet::readJson(const QByteArray &data, QString *error)
+{
+    QJsonParseError parseError;
+    const QJsonDocument doc = QJsonDocument::fromJson(data, &parseError);
+    if (doc.isNull()) {
+        *error = parseError.errorString();
+        return false;
+    }
+
+    QJsonArray records = doc.array();
+    QHash<int, QString> categoryNames;
+    if (doc.isObject()) {
+        const QJsonObject root = doc.object();
+        for (const char *key : {"annotations", "objects", "detections", "shapes"}) {
+            if (root.value(QLatin1String(key)).isArray()) {
+                records = root.value(QLatin1String(key)).toArray();
+                break;
+            }
+        }
+        for (const QJsonValue &category : root.value(QLatin1String("categories")).toArray()) {
+            const QJsonObject o = category.toObject();
+            categoryNames.insert(o.value(QLatin1String("id")).toInt(), o.value(QLatin1String("name")).toString());
+        }
+    }
+
+    items_.reserve(records.size());
+    QString label;
+    for (const QJsonValue &record : records) {
+        const QJsonObject o = record.toObject();
+        Annotation a;
+        if (readRecord([&o](QLatin1String key) { return o.value(key); }, categoryNames, &a, &label))
+            append(a, label);
+    }
+    return true;
+}
+
+/// one CSV line, fields may be quoted to hold the separator
+static QStringList splitCsvLine(const QString &line, QChar separator)
+{
+    QStringList fields;
+    QString field;
+    bool quoted = false;
+    for (int i = 0; i < line.size(); i++) {
+        const QChar c = line[i];
+        if (c == '"') {
+            if (quoted && i + 1 < line.size() && line[i + 1] == '"')
+                field += line[++i];
+            else
+                quoted = !quoted;
+        } else if (c == separator && !quoted) {
+            fields.append(field.trimmed());
+            field.clear();
+        } else {
+            field += c;
+        }
+    }
+    fields.append(field.trimmed());
+    return fields;
+}
+
+bool AnnotationSet::readCsv(QIODevice *device, QString *error)
+{
+    QTextStream stream(device);
+    const QString header = stream.readLine();
+    const QChar separator = header.contains('\t') ? '\t'
+                          : header.contains(';') && !header.contains(',') ? ';' : ',';
+    QHash<QString, int> columns;
+    const QStringList names = splitCsvLine(header, separator);
+    for (int i = 0; i < names.size(); i++)
+        columns.insert(names[i].toLower(), i);
+
+    QStringList fields;
+    auto field = [&](QLatin1String key) {
+        const int column = columns.value(key, -1);
+        if (column < 0 || column >= fields.size())
+            return QJsonValue(QJsonValue::Undefined);
+        bool ok = false;
+        const double number = fields[column].toDouble(&ok);
+        return ok ? QJsonValue(number) : QJsonValue(fields[column]);
+    };
+
+    QString line, label;
+    const QHash<int, QString> noNames;
+    int rows = 0;
+    while (stream.readLineInto(&line)) {
+        if (line.trimmed().isEmpty())
+            continue;
+        rows++;
+        fields = splitCsvLine(line, separator);
+        Annotation a;
+        if (readRecord(field, noNames, &a, &label))
+            append(a, label);
+    }
+    if (rows > 0 && items_.isEmpty()) {
+        *error = QString("no box columns in \"%1\"").arg(header);
+        return false;
+    }
+    return true;
+}
+
+void AnnotationSet::buildIndex()
+{
+    // not QRectF::united(), it skips the zero sized boxes of points
+    double left = items_.first().box.left(), top = items_.first().box.top();
+    double right = left, bottom = top;
+    bytes_ = qint64(items_.size()) * sizeof(Annotation) + categories_.size() * 64;
+    for (const Annotation &a : items_) {
+        left = qMin(left, a.box.left());
+        top = qMin(top, a.box.top());
+        right = qMax(right, a.box.right());
+        bottom = qMax(bottom, a.box.bottom());
+        bytes_ += qint64(a.polygon.size()) * sizeof(QPointF);
+    }
+    bounds_ = QRectF(QPointF(left, top), QPointF(right, bottom));
+
+    // about kItemsPerCell annotations per cell if they were spread evenly
+    const double width = qMax(1.0, bounds_.width());
+    const double height = qMax(1.0, bounds_.height());
+    const int cells = qMax(1, items_.size() / kItemsPerCell);
+    cell_size_ = qMax(kMinCellSize, sqrt(width * height / cells));
+    // capped so columns_ * rows_ stays within 2 * cells + 1, whatever the
+    // aspect of the bounds and the rounding of cell_size_
+    columns_ = int(qMin(width / cell_size_, double(cells))) + 1;
+    rows_ = int(qMin(height / cell_size_, double(cells / columns_))) + 1;
+
+    auto range = [this](const QRectF &box, int *c0, int *r0, int *c1, int *r1) {
+        *c0 = qBound(0, int((box.left() - bounds_.left()) / cell_size_), columns_ - 1);
+        *r0 = qBound(0, int((box.top() - bounds_.top()) / cell_size_), rows_ - 1);
+        *c1 = qBound(0, int((box.right() - bounds_.left()) / cell_size_), columns_ - 1);
+        *r1 = qBound(0, int((box.bottom() - bounds_.top()) / cell_size_), rows_ - 1);
+    };
+
+    // counting sort into cells: count, prefix sum, fill
+    cell_start_.fill(0, columns_ * rows_ + 1);
+    large_.clear();
+    int c0, r0, c1, r1;
+    for (int i = 0; i < items_.size(); i++) {
+        range(items_[i].box, &c0, &r0, &c1, &r1);
+        if ((c1 - c0 + 1) * (r1 - r0 + 1) > kMaxCellsPerItem) {
+            large_.append(i);
+            continue;
+        }
+        for (int r = r0; r <= r1; r++) {
+            for (int c = c0; c <= c1; c++)
+                cell_start_[r * columns_ + c + 1]++;
+        }
+    }
+    for (int c = 0; c < columns_ * rows_; c++)
+        cell_start_[c + 1] += cell_start_[c];
+    cell_items_.resize(cell_start_.last());
+    QVector<int> fill = cell_start_;
+    for (int i = 0; i < items_.size(); i++) {
+        range(items_[i].box, &c0, &r0, &c1, &r1);
+        if ((c1 - c0 + 1) * (r1 - r0 + 1) > kMaxCellsPerItem)
+            continue;
+        for (int r = r0; r <= r1; r++) {
+            for (int c = c0; c <= c1; c++)
+                cell_items_[fill[r * columns_ + c]++] = i;
+        }
+    }
+    bytes_ += qint64(cell_start_.size() + cell_items_.size() + large_.size()) * sizeof(int);
+}
+
+/// closed intervals, so that zero sized boxes (points) are found too
+static inline bool touches(const QRectF &a, const QRectF &b)
+{
+    return a.left() <= b.right() && b.left() <= a.right()
+        && a.top() <= b.bottom() && b.top() <= a.bottom();
+}
+
+void AnnotationSet::query(const QRectF &rect, QVector<int> *hits) const
+{
+    hits->clear();
+    for (int i : large_) {
+        if (touches(items_[i].box, rect))
+            hits->append(i);
+    }
+    if (cell_start_.isEmpty() || !touches(bounds_, rect))
+        return;
+
+    auto column = [this](double x) {
+        return qBound(0, int((x - bounds_.left()) / cell_size_), columns_ - 1);
+    };
+    auto row = [this](double y) {
+        return qBound(0, int((y - bounds_.top()) / cell_size_), rows_ - 1);
+    };
+    const int c0 = column(rect.left()), c1 = column(rect.right());
+    const int r0 = row(rect.top()), r1 = row(rect.bottom());
+    for (int r = r0; r <= r1; r++) {
+        for (int c = c0; c <= c1; c++) {
+            const int cell = r * columns_ + c;
+            for (int k = cell_start_[cell]; k < cell_start_[cell + 1]; k++) {
+                const int i = cell_items_[k];
+                const QRectF &box = items_[i].box;
+                if (!touches(box, rect))
+                    continue;
+                // only from the first cell of the query it is in
+                if (qMax(column(box.left()), c0) == c && qMax(row(box.top()), r0) == r)
+                    hits->append(i);
+            }
+        }
+    }
+}
+
+
+AnnotationLoadTask::AnnotationLoadTask(QObject *parent)
+    :QObject(parent)
+    , serial(0)
+{
+
+}
+
+void AnnotationLoadTask::setFile(const QString &fileName, int serial)
+{
+    this->fileName = fileName;
+    this->serial = serial;
+}
+
+void AnnotationLoadTask::run()
+{
+    QString error;
+    AnnotationSetPtr annotations = AnnotationSet::load(fileName, &error);
+    emit resultReady(serial, annotations, error);
+    emit workFinished();
+}
@@ -0,0 +1,102 @@
+#ifndef ANNOTATIONS_H
+#define ANNOTATIONS_H
+
+#include <QColor>
+#include <QHash>
+#include <QObject>
+#include <QPolygonF>
+#include <QRectF>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QVector>
+
+class QIODevice;
+
+/**
+ * @brief A detection box or polygon in image pixels
+ */
+struct Annotation
+{
+    QRectF box; // bounds of the polygon when there is one
+    QPolygonF polygon; // empty for plain boxes
+    int category = 0; // index into AnnotationSet::categories()
+    float score = -1; // negative when the file has none
+};
+
+/**
+ * @brief Annotations of one image, read from a JSON or CSV sidecar file.
+ *
+ * They are indexed by a uniform grid over their bounds, sized for a few
+ * annotations per cell, so that a query costs about the number of
+ * annotations in the rect rather than in the file. Boxes spanning many
+ * cells are kept aside and tested one by one instead of being copied into
+ * every cell they touch.
+ *
+ * JSON: an array of objects, or an object with one under "annotations",
+ * "objects", "detections" or "shapes". Each object has "bbox" [x, y, w, h],
+ * "box" [x1, y1, x2, y2], x/y/width/height or x1/y1/x2/y2 keys, and
+ * optionally "polygon", "points" or "segmentation" as [[x, y], ...] or a flat
+ * list. The label is "label", "class", "category" or "name", or
+ * "category_id" resolved through a top level "categories" list (COCO).
+ * CSV: a header row naming the same keys, "points" holds "x y x y ...".
+ */
+class AnnotationSet
+{
+public:
+    /// <base>.json, <base>.csv, <file>.json or <file>.csv next to the image; empty if none
+    static QString sidecarPath(const QString &imagePath);
+    static QSharedPointer<AnnotationSet> load(const QString &fileName, QString *error);
+
+    int size() const { return items_.size(); }
+    const Annotation &at(int i) const { return items_[i]; }
+    const QStringList &categories() const { return categories_; }
+    QRectF bounds() const { return bounds_; }
+    qint64 bytes() const { return bytes_; }
+    static const int kColors = 32; // categoryColor() repeats after this many
+    /// distinct hues for neighbouring category indices
+    static QColor categoryColor(int category);
+
+    /// indices of the annotations whose box touches @a rect, each once, into @a hits
+    void query(const QRectF &rect, QVector<int> *hits) const;
+
+private:
+    bool readJson(const QByteArray &data, QString *error);
+    bool readCsv(QIODevice *device, QString *error);
+    void append(const Annotation &annotation, const QString &label);
+    void buildIndex();
+
+    QVector<Annotation> items_;
+    QStringList categories_;
+    QHash<QString, int> category_index_;
+    QRectF bounds_;
+
+    double cell_size_ = 0;
+    int columns_ = 0;
+    int rows_ = 0;
+    // cell c (row-major) holds cell_items_[cell_start_[c] .. cell_start_[c + 1])
+    QVector<int> cell_start_;
+    QVector<int> cell_items_;
+    QVector<int> large_; // spanning too many cells, not in the grid
+    qint64 bytes_ = 0;
+};
+
+typedef QSharedPointer<const AnnotationSet> AnnotationSetPtr;
+Q_DECLARE_METATYPE(AnnotationSetPtr)
+
+class AnnotationLoadTask : public QObject
+{
+    Q_OBJECT
+public:
+    AnnotationLoadTask(QObject *parent = nullptr);
+    void setFile(const QString &fileName, int serial);
+public slots:
+    void run();
+signals:
+    void resultReady(int serial, AnnotationSetPtr annotations, QString error);
+    void workFinished();
+private:
+    QString fileName;
+    int serial;
+};
+
+#endif // ANNOTATIONS_H
@@ -0,0 +1,353 @@
+#include <QBoxLayout>
+#include <QLabel>
+#include <QPainter>
+#include <QThread>
+#include <QTimer>
+#include "channelview.h"
+#include "QImageViewer.h"
+#include "colormap.h"
+#include "parallelfor.h"
+
+static QStringList channelNames(ColorSpace space)
+{
+    switch (space) {
+    case ColorSpace::RGB:
+        return {"R", "G", "B"};
+    case ColorSpace::Lab:
+        return {"L*", "a*", "b*"};
+    case ColorSpace::HSV:
+        return {"H", "S", "V"};
+    case ColorSpace::YCbCr601:
+    case ColorSpace::YCbCr709:
+        return {"Y", "Cb", "Cr"};
+    case ColorSpace::XYZ:
+        return {"X", "Y", "Z"};
+    }
+    return {};
+}
+
+ChannelView::ChannelView(QWidget *parent, bool useGL)
+    : QWidget(parent)
+    , space_(ColorSpace::RGB)
+    , serial_(0)
+    , generation_(new QAtomicInt(0))
+    , busy_(false)
+    , queued_(false)
+    , syncing_(false)
+{
+    layout_ = new QBoxLayout(QBoxLayout::LeftToRight, this);
+    layout_->setContentsMargins(0, 0, 0, 0);
+    layout_->setSpacing(2);
+
+    for (int c = 0; c < 3; c++) {
+        QImageViewer *pane = new QImageViewer(this, useGL);
+        pane->setFrameStyle(QFrame::NoFrame);
+        layout_->addWidget(pane, 1);
+        panes_[c] = pane;
+
+        QLabel *caption = new QLabel(pane);
+        QPalette palette = caption->palette();
+        palette.setColor(QPalette::Window, QColor(32, 32, 32));
+        palette.setColor(QPalette::WindowText, Qt::white);
+        caption->setPalette(palette);
+        caption->setAutoFillBackground(true);
+        caption->setMargin(4);
+        caption->setAttribute(Qt::WA_TransparentForMouseEvents);
+        caption->move(8, 8);
+        captions_[c] = caption;
+
+        connect(pane, &QImageViewer::viewChanged, this, [this, pane] {
+            syncPanes(pane);
+        });
+        connect(pane, &QImageViewer::pixelValueOnCursor, this, [this](int x, int y, int, int, int) {
+            emit pixelValueOnCursor(x, y);
+        });
+        connect(pane, &QImageViewer::filesDropped, this, &ChannelView::filesDropped);
+    }
+
+    // coalesce scrolling and zooming before computing tiles
+    tile_timer_ = new QTimer(this);
+    tile_timer_->setSingleShot(true);
+    tile_timer_->setInterval(30);
+    connect(tile_timer_, &QTimer::timeout, this, &ChannelView::updateTiles);
+    tiles_.setMaxCost(256 * 1024);
+}
+
+void ChannelView::setImage(const QImage &image, ColorSpace space)
+{
+    source_ = image;
+    space_ = space;
+    tiles_.clear();
+    serial_++;
+    generation_->ref();
+    wanted_.clear();
+
+    // same arrangement as the split buffer had
+    layout_->setDirection(image.width() < 2 * image.height() ? QBoxLayout::LeftToRight
+                                                             : QBoxLayout::TopToBottom);
+    const QStringList names = channelNames(space);
+    for (int c = 0; c < 3; c++) {
+        captions_[c]->setText(names.value(c));
+        captions_[c]->adjustSize();
+    }
+
+    QImage small = image;
+    if (qMax(image.width(), image.height()) > kOverviewSize)
+        small = image.scaled(kOverviewSize, kOverviewSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    splitColorPlanes(small, space, overview_);
+    showOverview(true);
+}
+
+void ChannelView::clear()
+{
+    tile_timer_->stop();
+    source_ = QImage();
+    tiles_.clear();
+    serial_++;
+    generation_->ref();
+    wanted_.clear();
+    for (int c = 0; c < 3; c++) {
+        overview_[c] = QImage();
+        panes_[c]->clear();
+    }
+}
+
+bool ChannelView::channelValues(const QPoint &pos, int values[3]) const
+{
+    if (!source_.valid(pos))
+        return false;
+    QImage planes[3];
+    splitColorPlanes(source_.copy(QRect(pos, QSize(1, 1))), space_, planes);
+    if (planes[0].isNull())
+        return false;
+    for (int c = 0; c < 3; c++)
+        values[c] = planes[c].constScanLine(0)[0];
+    return true;
+}
+
+void ChannelView::setColorTable(const QVector<QRgb> &table)
+{
+    color_table_ = table;
+    if (!source_.isNull())
+        showOverview(false); // the tiles come back from the cache
+}
+
+void ChannelView::setBilinearTransform(bool enable)
+{
+    for (QImageViewer *pane : panes_)
+        pane->setBilinearTransform(enable);
+}
+
+void ChannelView::setCacheLimit(int megabytes)
+{
+    tiles_.setMaxCost(qMax(1, megabytes) * 1024);
+}
+
+void ChannelView::zoomIn()
+{
+    panes_[0]->zoomIn();
+}
+
+void ChannelView::zoomOut()
+{
+    panes_[0]->zoomOut();
+}
+
+void ChannelView::zoomOriginal()
+{
+    panes_[0]->zoomOriginal();
+}
+
+void ChannelView::zoomFit()
+{
+    panes_[0]->zoomFit();
+}
+
+void ChannelView::showOverview(bool update)
+{
+    if (overview_[0].isNull())
+        return;
+    for (int c = 0; c < 3; c++)
+        panes_[c]->displayVirtual(shade(overview_[c]), source_.size(), update);
+}
+
+void ChannelView::syncPanes(QImageViewer *lead)
+{
+    if (syncing_)
+        return;
+    syncing_ = true;
+    const QPointF centre = lead->mapToScene(lead->viewport()->rect().center());
+    for (QImageViewer *pane : panes_) {
+        if (pane == lead)
+            continue;
+        if (lead->isBestFit()) {
+            pane->zoomFit();
+        } else {
+            pane->resetBestFit();
+            pane->setTransform(lead->transform());
+            pane->centerOn(centre);
+        }
+    }
+    syncing_ = false;
+    tile_timer_->start();
+}
+
+QImage ChannelView::shade(const QImage &plane) const
+{
+    return color_table_.isEmpty() ? plane : applyColorMap(plane, color_table_);
+}
+
+void ChannelView::showTile(qint64 key, const QRect &rect, const Tile &tile)
+{
+    for (int c = 0; c < 3; c++)
+        panes_[c]->setVirtualTile(key, rect, shade(tile.planes[c]));
+}
+
+void ChannelView::updateTiles()
+{
+    if (source_.isNull() || overview_[0].isNull())
+        return;
+
+    // tiles only once the overview is coarser than the screen
+    const QSize size = source_.size();
+    const double scale = panes_[0]->getZoomScale();
+    QSet<qint64> wanted;
+    QVector<RegionRequest> missing;
+    if (overview_[0].width() < size.width() && scale > double(overview_[0].width()) / size.width()) {
+        const QVector<RegionRequest> tiles = VirtualImage::visibleTiles(
+            panes_[0]->visibleSceneRect(), scale, size);
+        for (const RegionRequest &tile : tiles) {
+            wanted.insert(tile.key);
+            if (panes_[0]->hasVirtualTile(tile.key))
+                continue;
+            if (const Tile *cached = tiles_.object(tile.key)) {
+                showTile(tile.key, tile.rect, *cached);
+                continue;
+            }
+            missing.append(tile);
+        }
+    }
+    if (wanted != wanted_) {
+        // tiles of the batch in flight that are not computed yet are skipped
+        generation_->ref();
+        wanted_ = wanted;
+    }
+    // tiles of other levels or far away go, the overview is below them
+    for (QImageViewer *pane : panes_)
+        pane->retainVirtualTiles(wanted);
+    if (missing.isEmpty())
+        return;
+    if (busy_) {
+        queued_ = true; // asked again by tilesDone()
+        return;
+    }
+    busy_ = true;
+
+    QThread* thread = new QThread();
+    ChannelTileTask* task = new ChannelTileTask();
+    task->setTiles(source_, space_, missing, serial_);
+    task->setGeneration(generation_, generation_->loadAcquire());
+
+    // move the task object to the thread BEFORE connecting any signal/slots
+    task->moveToThread(thread);
+
+    connect(thread, &QThread::started, task, &ChannelTileTask::run);
+    connect(task, &ChannelTileTask::workFinished, thread, &QThread::quit);
+    connect(task, &ChannelTileTask::tileReady, this, &ChannelView::tileReady);
+    connect(task, &ChannelTileTask::workFinished, this, &ChannelView::tilesDone);
+
+    // automatically delete thread and task object when work is done:
+    connect(task, &ChannelTileTask::workFinished, task, &ChannelTileTask::deleteLater);
+    connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+
+    emit taskStarted(thread);
+    thread->start();
+}
+
+void ChannelView::tileReady(int serial, qint64 key, QRect rect, QImage plane0, QImage plane1, QImage plane2)
+{
+    if (serial != serial_)
+        return; // another image meanwhile
+
+    Tile *tile = new Tile;
+    tile->planes[0] = plane0;
+    tile->planes[1] = plane1;
+    tile->planes[2] = plane2;
+    const qint64 bytes = plane0.sizeInBytes() * 3;
+    tiles_.insert(key, tile, qMax(1, int(bytes / 1024)));
+    if (wanted_.contains(key) && !panes_[0]->hasVirtualTile(key)) {
+        if (const Tile *cached = tiles_.object(key))
+            showTile(key, rect, *cached);
+    }
+}
+
+/**
+ * @brief One batch of tiles is computed at a time; the tiles the view wants
+ * by now are asked for once it is done. Its results came in before this.
+ */
+void ChannelView::tilesDone()
+{
+    busy_ = false;
+    if (queued_) {
+        queued_ = false;
+        updateTiles();
+    }
+}
+
+
+ChannelTileTask::ChannelTileTask(QObject *parent)
+    : QObject(parent)
+    , space(ColorSpace::RGB)
+    , serial(0)
+    , generation(0)
+{
+
+}
+
+void ChannelTileTask::setTiles(const QImage &source, ColorSpace space, const QVector<RegionRequest> &tiles, int serial)
+{
+    this->source = source;
+    this->space = space;
+    this->tiles = tiles;
+    this->serial = serial;
+}
+
+void ChannelTileTask::setGeneration(QSharedPointer<QAtomicInt> current, int generation)
+{
+    this->current = current;
+    this->generation = generation;
+}
+
+void ChannelTileTask::run()
+{
+    // all three channels of a tile in one pass, the tiles in parallel
+    parallelFor(tiles.size(), 1, [this](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            if (current && current->loadAcquire() != generation)
+                continue; // the view moved on, the owner asks again for what it wants now
+            const RegionRequest &request = tiles[i];
+            QImage region;
+            if (request.size == request.rect.size()) {
+                region = source.copy(request.rect);
+            } else {
+                // scaled while drawing, the full resolution rect is never copied
+                region = QImage(request.size, QImage::Format_ARGB32);
+                if (region.isNull())
+                    continue;
+                region.fill(Qt::transparent);
+                QPainter painter(&region);
+                painter.setCompositionMode(QPainter::CompositionMode_Source);
+                painter.setRenderHint(QPainter::SmoothPixmapTransform);
+                painter.drawImage(QRect(QPoint(0, 0), request.size), source, request.rect);
+            }
+            if (region.isNull())
+                continue;
+
+            QImage planes[3];
+            splitColorPlanes(region, space, planes);
+            if (!planes[0].isNull())
+                emit tileReady(serial, request.key, request.rect, planes[0], planes[1], planes[2]);
+        }
+    });
+    emit workFinished();
+}
@@ -0,0 +1,120 @@
+#ifndef CHANNELVIEW_H
+#define CHANNELVIEW_H
+
+#include <QWidget>
+#include <QImage>
+#include <QCache>
+#include <QUrl>
+#include <QVector>
+#include <QSet>
+#include <QSharedPointer>
+#include <QAtomicInt>
+#include "imageopstask.h"
+#include "virtualimage.h"
+
+class QBoxLayout;
+class QImageViewer;
+class QLabel;
+class QThread;
+class QTimer;
+
+/**
+ * @brief Three linked panes, one per channel of a colour space, instead of
+ * one split buffer three times the size of the image.
+ *
+ * Each pane is a QImageViewer in virtual mode: a small overview of its
+ * channel for best fit, plus tiles of the visible part computed from the
+ * source image once the view is zoomed in past the overview. Tiles hold
+ * all three channels, are computed by a ChannelTileTask one batch at a
+ * time and kept in an LRU cache. Zoom and scroll of one pane are copied to
+ * the others.
+ */
+class ChannelView : public QWidget
+{
+    Q_OBJECT
+public:
+    static const int kOverviewSize = 1024; // long side of the overview channels
+
+    ChannelView(QWidget *parent = nullptr, bool useGL = false);
+
+    /// @a image is shared, not copied; side by side unless it is wide
+    void setImage(const QImage &image, ColorSpace space);
+    void clear();
+    ColorSpace colorSpace() const { return space_; }
+    /// the three channel values at @a pos of the source image
+    bool channelValues(const QPoint &pos, int values[3]) const;
+
+    void setColorTable(const QVector<QRgb> &table); /// empty: gray
+    void setBilinearTransform(bool enable);
+    void setCacheLimit(int megabytes);
+    qint64 cacheBytes() const { return qint64(tiles_.totalCost()) * 1024; }
+
+    void zoomIn();
+    void zoomOut();
+    void zoomOriginal();
+    void zoomFit();
+
+signals:
+    void pixelValueOnCursor(int x, int y); /// source pixels, -1 outside
+    void filesDropped(QList<QUrl> fileUrl);
+    void taskStarted(QThread *thread); /// a tile worker, running until it finishes
+
+private slots:
+    void updateTiles();
+    void tileReady(int serial, qint64 key, QRect rect, QImage plane0, QImage plane1, QImage plane2);
+    void tilesDone();
+
+private:
+    struct Tile
+    {
+        QImage planes[3];
+    };
+
+    void syncPanes(QImageViewer *lead);
+    void showOverview(bool update);
+    void showTile(qint64 key, const QRect &rect, const Tile &tile);
+    QImage shade(const QImage &plane) const;
+
+    QImage source_;
+    ColorSpace space_;
+    QImage overview_[3];
+    QBoxLayout *layout_;
+    QImageViewer *panes_[3];
+    QLabel *captions_[3];
+    QTimer *tile_timer_;
+    QCache<qint64, Tile> tiles_; // cost in KB
+    int serial_; // of source_, results of an earlier image are dropped
+    QSharedPointer<QAtomicInt> generation_; // bumped when wanted_ changes
+    QSet<qint64> wanted_; // tiles around the viewport
+    bool busy_; // a ChannelTileTask is running
+    bool queued_; // and the view asked for more meanwhile
+    QVector<QRgb> color_table_;
+    bool syncing_;
+};
+
+/**
+ * @brief The three channel planes of tiles of a source image, the tiles in
+ * parallel. Tiles not started yet are skipped once the generation moves on.
+ */
+class ChannelTileTask : public QObject
+{
+    Q_OBJECT
+public:
+    ChannelTileTask(QObject *parent = nullptr);
+    void setTiles(const QImage &source, ColorSpace space, const QVector<RegionRequest> &tiles, int serial);
+    void setGeneration(QSharedPointer<QAtomicInt> current, int generation);
+public slots:
+    void run();
+signals:
+    void tileReady(int serial, qint64 key, QRect rect, QImage plane0, QImage plane1, QImage plane2);
+    void workFinished();
+private:
+    QImage source;
+    ColorSpace space;
+    QVector<RegionRequest> tiles;
+    int serial;
+    QSharedPointer<QAtomicInt> current;
+    int generation;
+};
+
+#endif // CHANNELVIEW_H
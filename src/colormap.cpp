@@ -0,0 +1,134 @@
+#include <QColor>
+#include "colormap.h"
+#include "parallelfor.h"
+
+// 9 evenly spaced stops sampled from matplotlib's maps
+static const char *viridis_stops[] = {
+    "#440154", "#472c7a", "#3b518b", "#2c718e", "#21908d",
+    "#27ad81", "#5cc863", "#aadc32", "#fde725"
+};
+static const char *inferno_stops[] = {
+    "#000004", "#1f0c48", "#550f6d", "#88226a", "#ba3655",
+    "#e35933", "#f98e09", "#f9cb35", "#fcffa4"
+};
+
+static QVector<QRgb> interpolateStops(const QVector<QColor> &stops)
+{
+    QVector<QRgb> table(256);
+    if (stops.size() < 2) {
+        table.fill(stops.isEmpty() ? qRgb(0, 0, 0) : stops.first().rgb());
+        return table;
+    }
+    const int segments = stops.size() - 1;
+    for (int i = 0; i < 256; i++) {
+        const double t = i / 255.0 * segments;
+        const int k = qMin(int(t), segments - 1);
+        const double f = t - k;
+        const QColor &a = stops[k], &b = stops[k + 1];
+        table[i] = qRgb(qRound(a.red() + (b.red() - a.red()) * f),
+                        qRound(a.green() + (b.green() - a.green()) * f),
+                        qRound(a.blue() + (b.blue() - a.blue()) * f));
+    }
+    return table;
+}
+
+template <int N>
+static QVector<QRgb> interpolateStops(const char *(&names)[N])
+{
+    QVector<QColor> stops;
+    for (const char *name : names)
+        stops.append(QColor(name));
+    return interpolateStops(stops);
+}
+
+static QVector<QRgb> jetTable()
+{
+    QVector<QRgb> table(256);
+    for (int i = 0; i < 256; i++) {
+        const double t = i / 255.0;
+        auto ramp = [t](double center) {
+            return qBound(0, qRound(255 * (1.5 - qAbs(4 * t - center))), 255);
+        };
+        table[i] = qRgb(ramp(3), ramp(2), ramp(1));
+    }
+    return table;
+}
+
+QStringList colorMapNames()
+{
+    return QStringList() << "Gray" << "Viridis" << "Jet" << "Inferno" << "Custom";
+}
+
+QVector<QRgb> colorMapTable(const QString &name, const QStringList &customStops)
+{
+    if (name == "Viridis")
+        return interpolateStops(viridis_stops);
+    if (name == "Inferno")
+        return interpolateStops(inferno_stops);
+    if (name == "Jet")
+        return jetTable();
+    if (name == "Custom") {
+        QVector<QColor> stops;
+        for (const QString &stop : customStops) {
+            QColor c(stop.trimmed());
+            if (c.isValid())
+                stops.append(c);
+        }
+        return interpolateStops(stops);
+    }
+    return QVector<QRgb>();
+}
+
+QImage applyColorMap(const QImage &gray, const QVector<QRgb> &table)
+{
+    if (gray.format() != QImage::Format_Grayscale8 || table.size() != 256)
+        return gray;
+
+    QImage dst(gray.size(), QImage::Format_RGB32);
+    if (dst.isNull())
+        return gray;
+
+    const QRgb *lut = table.constData();
+    const int width = gray.width();
+    uchar *dst_bits = dst.bits(); // detach once, not per thread
+    const qsizetype dst_bpl = dst.bytesPerLine();
+    parallelFor(gray.height(), 64, [&](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            const uchar *src_ptr = gray.constScanLine(y);
+            QRgb *dst_ptr = reinterpret_cast<QRgb*>(dst_bits + y * dst_bpl);
+            int x = 0;
+            for (; x + 4 <= width; x += 4) {
+                dst_ptr[x] = lut[src_ptr[x]];
+                dst_ptr[x + 1] = lut[src_ptr[x + 1]];
+                dst_ptr[x + 2] = lut[src_ptr[x + 2]];
+                dst_ptr[x + 3] = lut[src_ptr[x + 3]];
+            }
+            for (; x < width; x++)
+                dst_ptr[x] = lut[src_ptr[x]];
+        }
+    });
+    return dst;
+}
+
+static void releaseGrayBuffer(void *info)
+{
+    delete static_cast<QImage*>(info);
+}
+
+QImage colorMapView(const QImage &gray, const QVector<QRgb> &table)
+{
+    if (gray.format() != QImage::Format_Grayscale8 || table.size() != 256)
+        return gray;
+
+    // a shallow copy owns the pixels for as long as the view lives; the
+    // writable constructor keeps setColorTable() from detaching the view
+    QImage *owner = new QImage(gray);
+    QImage view(const_cast<uchar*>(owner->constBits()), owner->width(), owner->height(),
+                owner->bytesPerLine(), QImage::Format_Indexed8, releaseGrayBuffer, owner);
+    if (view.isNull()) {
+        delete owner;
+        return gray;
+    }
+    view.setColorTable(table);
+    return view;
+}
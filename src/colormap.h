@@ -0,0 +1,30 @@
+#ifndef COLORMAP_H
+#define COLORMAP_H
+
+#include <QImage>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * @brief False-colour lookup tables for 8-bit single channel buffers.
+ *
+ * Tables have 256 entries. An empty table means plain grayscale.
+ */
+QStringList colorMapNames();
+QVector<QRgb> colorMapTable(const QString &name, const QStringList &customStops = QStringList());
+
+/**
+ * @brief Map a Format_Grayscale8 buffer through @a table into Format_RGB32.
+ * The result can be wrapped by QPixmap without another conversion.
+ */
+QImage applyColorMap(const QImage &gray, const QVector<QRgb> &table);
+
+/**
+ * @brief @a gray as a Format_Indexed8 image with @a table, sharing its
+ * pixels instead of mapping them. The lookup happens wherever the view is
+ * converted or painted, so only the pixmap or the painted rect is RGB.
+ * The view keeps @a gray alive and must not be written to.
+ */
+QImage colorMapView(const QImage &gray, const QVector<QRgb> &table);
+
+#endif // COLORMAP_H
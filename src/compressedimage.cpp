@@ -0,0 +1,315 @@
+#include <QAtomicInt>
+#include <string.h>
+#include "compressedimage.h"
+#include "parallelfor.h"
+
+// LZ4-style block format: a token byte (literal count << 4 | match length - 4),
+// extra length bytes of 255 when a nibble is 15, the literals, then a 2 byte
+// little endian offset and extra match length bytes. The last sequence holds
+// literals only.
+static const int kMinMatch = 4;
+static const int kHashBits = 14;
+static const int kMaxOffset = 65535;
+static const int kTailLiterals = 8; // never match into the last bytes
+
+static inline quint32 read32(const uchar *p)
+{
+    quint32 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline int hash32(quint32 v)
+{
+    return int((v * 2654435761u) >> (32 - kHashBits));
+}
+
+static uchar *writeLength(uchar *op, int length)
+{
+    for (; length >= 255; length -= 255)
+        *op++ = 255;
+    *op++ = uchar(length);
+    return op;
+}
+
+static uchar *writeSequence(uchar *op, const uchar *literals, int literalCount,
+                            int offset, int matchLength)
+{
+    uchar *token = op++;
+    const int extraMatch = matchLength - kMinMatch;
+    *token = uchar(qMin(literalCount, 15) << 4);
+    if (literalCount >= 15)
+        op = writeLength(op, literalCount - 15);
+    memcpy(op, literals, size_t(literalCount));
+    op += literalCount;
+    if (matchLength == 0)
+        return op;
+    *token |= uchar(qMin(extraMatch, 15));
+    *op++ = uchar(offset & 0xff);
+    *op++ = uchar(offset >> 8);
+    if (extraMatch >= 15)
+        op = writeLength(op, extraMatch - 15);
+    return op;
+}
+
+/**
+ * @brief Greedy single-probe LZ compression. Returns the packed size, or 0
+ * when the result would not be smaller than the input.
+ */
+static int lzCompress(const uchar *src, int length, uchar *dst)
+{
+    const int bound = length; // anything that does not shrink is stored raw
+    int table[1 << kHashBits];
+    memset(table, 0xff, sizeof(table));
+
+    uchar *op = dst;
+    int anchor = 0;
+    int i = 0;
+    const int limit = length - kTailLiterals - kMinMatch;
+    while (i < limit) {
+        const quint32 sequence = read32(src + i);
+        const int h = hash32(sequence);
+        const int ref = table[h];
+        table[h] = i;
+        if (ref < 0 || i - ref > kMaxOffset || read32(src + ref) != sequence) {
+            // skip faster through data that does not match
+            i += 1 + ((i - anchor) >> 6);
+            continue;
+        }
+        int matchLength = kMinMatch;
+        const int matchLimit = length - kTailLiterals;
+        while (i + matchLength + 8 <= matchLimit) {
+            quint64 a, b;
+            memcpy(&a, src + ref + matchLength, sizeof(a));
+            memcpy(&b, src + i + matchLength, sizeof(b));
+            if (a != b)
+                break;
+            matchLength += 8;
+        }
+        while (i + matchLength < matchLimit && src[ref + matchLength] == src[i + matchLength])
+            matchLength++;
+        const int literalCount = i - anchor;
+        // worst case growth of one sequence
+        if ((op - dst) + literalCount + literalCount / 255 + 8 + matchLength / 255 >= bound)
+            return 0;
+        op = writeSequence(op, src + anchor, literalCount, i - ref, matchLength);
+        i += matchLength;
+        anchor = i;
+    }
+    const int literalCount = length - anchor;
+    if ((op - dst) + literalCount + literalCount / 255 + 2 >= bound)
+        return 0;
+    op = writeSequence(op, src + anchor, literalCount, 0, 0);
+    return int(op - dst);
+}
+
+static bool readLength(const uchar *&ip, const uchar *end, int &length)
+{
+    uchar byte;
+    do {
+        if (ip >= end)
+            return false;
+        byte = *ip++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+static bool lzDecompress(const uchar *src, int length, uchar *dst, int dstLength)
+{
+    const uchar *ip = src;
+    const uchar *end = src + length;
+    uchar *op = dst;
+    uchar *dstEnd = dst + dstLength;
+    while (ip < end) {
+        const uchar token = *ip++;
+        int literalCount = token >> 4;
+        if (literalCount == 15 && !readLength(ip, end, literalCount))
+            return false;
+        if (literalCount > end - ip || literalCount > dstEnd - op)
+            return false;
+        memcpy(op, ip, size_t(literalCount));
+        op += literalCount;
+        ip += literalCount;
+        if (ip == end)
+            break; // last sequence
+
+        if (end - ip < 2)
+            return false;
+        const int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        int matchLength = token & 15;
+        if (matchLength == 15 && !readLength(ip, end, matchLength))
+            return false;
+        matchLength += kMinMatch;
+        if (offset == 0 || offset > op - dst || matchLength > dstEnd - op)
+            return false;
+        const uchar *match = op - offset;
+        // an overlapping match repeats the last offset bytes, the copied span
+        // stays a whole number of periods so it can double every round
+        while (matchLength > 0) {
+            const int chunk = qMin(int(op - match), matchLength);
+            memcpy(op, match, size_t(chunk));
+            op += chunk;
+            matchLength -= chunk;
+        }
+    }
+    return op == dstEnd;
+}
+
+/**
+ * @brief Bytes that step from one pixel to the next, for the difference filter
+ */
+static int filterStride(QImage::Format format, int depth)
+{
+    if (format == QImage::Format_Mono || format == QImage::Format_MonoLSB)
+        return 1;
+    return qMax(1, depth / 8);
+}
+
+CompressedImage CompressedImage::compress(const QImage &inputImage)
+{
+    CompressedImage result;
+    if (inputImage.isNull())
+        return result;
+
+    // wrapped foreign buffers may have any stride, decompress() allocates the default one
+    QImage image = inputImage;
+    if (image.bytesPerLine() != qsizetype((image.width() * image.depth() + 31) / 32 * 4))
+        image = inputImage.copy();
+
+    result.size_ = image.size();
+    result.format_ = image.format();
+    result.bpl_ = image.bytesPerLine();
+    result.colorTable_ = image.colorTable();
+    result.key_ = inputImage.cacheKey();
+
+    const int height = image.height();
+    const int bandCount = (height + kBandRows - 1) / kBandRows;
+    const qsizetype bpl = result.bpl_;
+    const int stride = filterStride(image.format(), image.depth());
+    const uchar *bits = image.constBits();
+    result.bands_.resize(bandCount);
+    QByteArray *bands = result.bands_.data();
+
+    parallelFor(bandCount, 1, [&](int begin, int end) {
+        for (int band = begin; band < end; band++) {
+            const int rows = qMin(kBandRows, height - band * kBandRows);
+            const int length = int(bpl * rows);
+            const uchar *src = bits + qsizetype(band) * kBandRows * bpl;
+
+            QByteArray filtered(length, Qt::Uninitialized);
+            uchar *f = reinterpret_cast<uchar*>(filtered.data());
+            for (int y = 0; y < rows; y++) {
+                const uchar *line = src + y * bpl;
+                uchar *out = f + y * bpl;
+                memcpy(out, line, size_t(qMin<qsizetype>(stride, bpl)));
+                for (qsizetype x = stride; x < bpl; x++)
+                    out[x] = uchar(line[x] - line[x - stride]);
+            }
+
+            QByteArray packed(length, Qt::Uninitialized);
+            const int packedLength = lzCompress(f, length, reinterpret_cast<uchar*>(packed.data()));
+            if (packedLength > 0) {
+                // a copy, resize() would keep the full capacity
+                bands[band] = QByteArray(packed.constData(), packedLength);
+            } else {
+                // a band of raw size is stored unfiltered
+                bands[band] = QByteArray(reinterpret_cast<const char*>(src), length);
+            }
+        }
+    });
+    return result;
+}
+
+QImage CompressedImage::decompress() const
+{
+    if (isNull())
+        return QImage();
+
+    QImage image(size_, format_);
+    if (image.isNull() || image.bytesPerLine() != bpl_)
+        return QImage();
+    if (!colorTable_.isEmpty())
+        image.setColorTable(colorTable_);
+
+    const int height = size_.height();
+    const qsizetype bpl = bpl_;
+    const int stride = filterStride(format_, image.depth());
+    uchar *bits = image.bits();
+    const QByteArray *bands = bands_.constData();
+    QAtomicInt failed;
+
+    parallelFor(bands_.size(), 1, [&](int begin, int end) {
+        for (int band = begin; band < end; band++) {
+            const int rows = qMin(kBandRows, height - band * kBandRows);
+            const int length = int(bpl * rows);
+            uchar *dst = bits + qsizetype(band) * kBandRows * bpl;
+            const QByteArray &packed = bands[band];
+            if (packed.size() == length) {
+                memcpy(dst, packed.constData(), size_t(length));
+                continue;
+            }
+            if (!lzDecompress(reinterpret_cast<const uchar*>(packed.constData()), packed.size(), dst, length)) {
+                failed.storeRelaxed(1);
+                continue;
+            }
+            for (int y = 0; y < rows; y++) {
+                uchar *line = dst + y * bpl;
+                for (qsizetype x = stride; x < bpl; x++)
+                    line[x] = uchar(line[x] + line[x - stride]);
+            }
+        }
+    });
+    if (failed.loadRelaxed())
+        return QImage();
+    return image;
+}
+
+qint64 CompressedImage::compressedBytes() const
+{
+    qint64 bytes = 0;
+    for (const QByteArray &band : bands_)
+        bytes += band.size();
+    return bytes;
+}
+
+
+CompressImageTask::CompressImageTask(QObject *parent)
+    : QObject(parent)
+    , id(-1)
+{
+
+}
+
+void CompressImageTask::setImage(QImage inputImage, int id)
+{
+    image = inputImage;
+    this->id = id;
+}
+
+void CompressImageTask::run()
+{
+    emit resultReady(id, CompressedImage::compress(image));
+    emit workFinished();
+}
+
+
+DecompressImageTask::DecompressImageTask(QObject *parent)
+    : QObject(parent)
+    , serial(0)
+{
+
+}
+
+void DecompressImageTask::setImage(CompressedImage packed, int serial)
+{
+    this->packed = packed;
+    this->serial = serial;
+}
+
+void DecompressImageTask::run()
+{
+    emit resultReady(serial, packed.decompress());
+    emit workFinished();
+}
@@ -0,0 +1,77 @@
+#ifndef COMPRESSEDIMAGE_H
+#define COMPRESSEDIMAGE_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QMetaType>
+#include <QObject>
+#include <QVector>
+
+/**
+ * @brief In-memory compressed copy of a QImage for parked documents.
+ *
+ * Rows are cut into bands that are filtered (byte difference to the
+ * previous pixel) and packed with a small LZ4-style byte codec,
+ * independently and in parallel. Bands that do not shrink are kept raw,
+ * so decompression is a parallel copy at worst.
+ */
+class CompressedImage
+{
+public:
+    CompressedImage() = default;
+
+    static CompressedImage compress(const QImage &image);
+    QImage decompress() const;
+
+    bool isNull() const { return bands_.isEmpty(); }
+    qint64 compressedBytes() const;
+    qint64 rawBytes() const { return qint64(bpl_) * size_.height(); }
+    qint64 cacheKey() const { return key_; } /// of the image it was made from
+
+private:
+    static const int kBandRows = 64;
+
+    QSize size_;
+    QImage::Format format_ = QImage::Format_Invalid;
+    qsizetype bpl_ = 0;
+    QVector<QRgb> colorTable_;
+    qint64 key_ = 0;
+    QVector<QByteArray> bands_;
+};
+
+Q_DECLARE_METATYPE(CompressedImage)
+
+class CompressImageTask : public QObject
+{
+    Q_OBJECT
+public:
+    CompressImageTask(QObject *parent = nullptr);
+    void setImage(QImage inputImage, int id);
+public slots:
+    void run();
+signals:
+    void resultReady(int id, CompressedImage result);
+    void workFinished();
+private:
+    QImage image;
+    int id;
+};
+
+/// the other way, for a document brought back to front
+class DecompressImageTask : public QObject
+{
+    Q_OBJECT
+public:
+    DecompressImageTask(QObject *parent = nullptr);
+    void setImage(CompressedImage packed, int serial);
+public slots:
+    void run();
+signals:
+    void resultReady(int serial, QImage result);
+    void workFinished();
+private:
+    CompressedImage packed;
+    int serial;
+};
+
+#endif // COMPRESSEDIMAGE_H
@@ -0,0 +1,319 @@
+#include <QMutex>
+#include <cmath>
+#include <vector>
+#include "contrast.h"
+#include "parallelfor.h"
+
+static void histogram(const QImage &plane, qint64 *hist)
+{
+    QMutex mutex;
+    const int width = plane.width();
+    parallelFor(plane.height(), 256, [&](int begin, int end) {
+        qint64 local[256] = {0};
+        for (int y = begin; y < end; y++) {
+            const uchar *ptr = plane.constScanLine(y);
+            for (int x = 0; x < width; x++)
+                local[ptr[x]]++;
+        }
+        QMutexLocker locker(&mutex);
+        for (int i = 0; i < 256; i++)
+            hist[i] += local[i];
+    });
+}
+
+static QImage lumaPlane(const QImage &rgb)
+{
+    QImage plane(rgb.size(), QImage::Format_Grayscale8);
+    if (plane.isNull())
+        return plane;
+    const int width = rgb.width();
+    uchar *dst_bits = plane.bits();
+    const qsizetype dst_bpl = plane.bytesPerLine();
+    parallelFor(rgb.height(), 64, [&](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            const QRgb *src_ptr = reinterpret_cast<const QRgb*>(rgb.constScanLine(y));
+            uchar *dst_ptr = dst_bits + y * dst_bpl;
+            for (int x = 0; x < width; x++) {
+                const QRgb p = src_ptr[x];
+                dst_ptr[x] = uchar((qRed(p) * 77 + qGreen(p) * 150 + qBlue(p) * 29 + 128) >> 8);
+            }
+        }
+    });
+    return plane;
+}
+
+static void autoLevelsLut(const qint64 *hist, uchar *lut)
+{
+    qint64 total = 0;
+    for (int i = 0; i < 256; i++)
+        total += hist[i];
+    const qint64 cut = total / 200; // 0.5% at each end
+
+    int lo = 0, hi = 255;
+    for (qint64 acc = 0; lo < 255 && (acc += hist[lo]) <= cut; lo++) {}
+    for (qint64 acc = 0; hi > 0 && (acc += hist[hi]) <= cut; hi--) {}
+
+    for (int i = 0; i < 256; i++)
+        lut[i] = hi > lo ? uchar(qBound(0, ((i - lo) * 255 + (hi - lo) / 2) / (hi - lo), 255)) : uchar(i);
+}
+
+static void equalizeLut(const qint64 *hist, qint64 total, uchar *lut)
+{
+    qint64 cdf_min = 0;
+    for (int i = 0; i < 256 && cdf_min == 0; i++)
+        cdf_min = hist[i];
+
+    qint64 cdf = 0;
+    for (int i = 0; i < 256; i++) {
+        cdf += hist[i];
+        lut[i] = total > cdf_min
+            ? uchar(qBound<qint64>(0, ((cdf - cdf_min) * 255 + (total - cdf_min) / 2) / (total - cdf_min), 255))
+            : uchar(i);
+    }
+}
+
+static QImage applyLut(const QImage &plane, const uchar *lut)
+{
+    QImage dst(plane.size(), QImage::Format_Grayscale8);
+    if (dst.isNull())
+        return dst;
+    const int width = plane.width();
+    uchar *dst_bits = dst.bits();
+    const qsizetype dst_bpl = dst.bytesPerLine();
+    parallelFor(plane.height(), 64, [&](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            const uchar *src_ptr = plane.constScanLine(y);
+            uchar *dst_ptr = dst_bits + y * dst_bpl;
+            for (int x = 0; x < width; x++)
+                dst_ptr[x] = lut[src_ptr[x]];
+        }
+    });
+    return dst;
+}
+
+/**
+ * @brief Contrast limited adaptive histogram equalisation of an 8-bit plane.
+ * Tile LUTs are independent so they are built in parallel; the blend pass
+ * runs in parallel row bands.
+ */
+static QImage clahe(const QImage &plane, double clipLimit, int tiles)
+{
+    const int width = plane.width();
+    const int height = plane.height();
+    const int tileW = (width + qBound(1, tiles, width) - 1) / qBound(1, tiles, width);
+    const int tileH = (height + qBound(1, tiles, height) - 1) / qBound(1, tiles, height);
+    const int tilesX = (width + tileW - 1) / tileW;
+    const int tilesY = (height + tileH - 1) / tileH;
+    std::vector<uchar> luts(size_t(tilesX) * tilesY * 256);
+
+    parallelFor(tilesX * tilesY, 1, [&](int begin, int end) {
+        for (int t = begin; t < end; t++) {
+            const int x0 = t % tilesX * tileW, y0 = t / tilesX * tileH;
+            const int x1 = qMin(width, x0 + tileW), y1 = qMin(height, y0 + tileH);
+            const qint64 pixels = qint64(x1 - x0) * (y1 - y0);
+
+            qint64 hist[256] = {0};
+            for (int y = y0; y < y1; y++) {
+                const uchar *ptr = plane.constScanLine(y);
+                for (int x = x0; x < x1; x++)
+                    hist[ptr[x]]++;
+            }
+
+            // clip and hand the excess back evenly
+            const qint64 limit = qMax<qint64>(1, qint64(clipLimit * pixels / 256));
+            qint64 excess = 0;
+            for (int i = 0; i < 256; i++) {
+                if (hist[i] > limit) {
+                    excess += hist[i] - limit;
+                    hist[i] = limit;
+                }
+            }
+            const qint64 bonus = excess / 256, residual = excess % 256;
+            for (int i = 0; i < 256; i++)
+                hist[i] += bonus + (i < residual ? 1 : 0);
+
+            uchar *lut = &luts[size_t(t) * 256];
+            qint64 cdf = 0;
+            for (int i = 0; i < 256; i++) {
+                cdf += hist[i];
+                lut[i] = uchar(qMin<qint64>(255, (cdf * 255 + pixels / 2) / pixels));
+            }
+        }
+    });
+
+    // neighbouring tile centres and 8-bit blend weight of every column
+    std::vector<int> col0(width), col1(width), colW(width);
+    for (int x = 0; x < width; x++) {
+        const double fx = (x + 0.5) / tileW - 0.5;
+        int i0 = int(std::floor(fx));
+        double w = fx - i0;
+        if (i0 < 0) {
+            i0 = 0;
+            w = 0;
+        } else if (i0 >= tilesX - 1) {
+            i0 = tilesX - 1;
+            w = 0;
+        }
+        col0[x] = i0 * 256;
+        col1[x] = qMin(i0 + 1, tilesX - 1) * 256;
+        colW[x] = int(w * 256 + 0.5);
+    }
+
+    QImage dst(plane.size(), QImage::Format_Grayscale8);
+    if (dst.isNull())
+        return dst;
+    uchar *dst_bits = dst.bits();
+    const qsizetype dst_bpl = dst.bytesPerLine();
+    parallelFor(height, 64, [&](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            const double fy = (y + 0.5) / tileH - 0.5;
+            int j0 = int(std::floor(fy));
+            double w = fy - j0;
+            if (j0 < 0) {
+                j0 = 0;
+                w = 0;
+            } else if (j0 >= tilesY - 1) {
+                j0 = tilesY - 1;
+                w = 0;
+            }
+            const int wy = int(w * 256 + 0.5);
+            const uchar *top = &luts[size_t(j0) * tilesX * 256];
+            const uchar *bottom = &luts[size_t(qMin(j0 + 1, tilesY - 1)) * tilesX * 256];
+
+            const uchar *src_ptr = plane.constScanLine(y);
+            uchar *dst_ptr = dst_bits + y * dst_bpl;
+            for (int x = 0; x < width; x++) {
+                const int v = src_ptr[x];
+                const int wx = colW[x];
+                const int t = top[col0[x] + v] * (256 - wx) + top[col1[x] + v] * wx;
+                const int b = bottom[col0[x] + v] * (256 - wx) + bottom[col1[x] + v] * wx;
+                dst_ptr[x] = uchar((t * (256 - wy) + b * wy + 32768) >> 16);
+            }
+        }
+    });
+    return dst;
+}
+
+/**
+ * @brief Scale each channel of @a rgb by mapped / luma so that the colour
+ * follows the enhanced luma plane.
+ */
+static QImage applyGain(const QImage &rgb, const QImage &luma, const QImage &mapped)
+{
+    static const struct Reciprocal {
+        quint32 v[256];
+        Reciprocal() {
+            v[0] = 0;
+            for (int i = 1; i < 256; i++)
+                v[i] = (1u << 16) / i;
+        }
+    } recip;
+
+    QImage dst(rgb.size(), QImage::Format_RGB32);
+    if (dst.isNull())
+        return dst;
+    const int width = rgb.width();
+    uchar *dst_bits = dst.bits();
+    const qsizetype dst_bpl = dst.bytesPerLine();
+    parallelFor(rgb.height(), 64, [&](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            const QRgb *src_ptr = reinterpret_cast<const QRgb*>(rgb.constScanLine(y));
+            const uchar *luma_ptr = luma.constScanLine(y);
+            const uchar *map_ptr = mapped.constScanLine(y);
+            QRgb *dst_ptr = reinterpret_cast<QRgb*>(dst_bits + y * dst_bpl);
+            for (int x = 0; x < width; x++) {
+                const quint32 l = luma_ptr[x], m = map_ptr[x];
+                if (l == 0) {
+                    dst_ptr[x] = qRgb(m, m, m);
+                    continue;
+                }
+                const QRgb p = src_ptr[x];
+                const quint32 k = recip.v[l];
+                dst_ptr[x] = qRgb(qMin<quint32>(255, (qRed(p) * m * k + 32768) >> 16),
+                                  qMin<quint32>(255, (qGreen(p) * m * k + 32768) >> 16),
+                                  qMin<quint32>(255, (qBlue(p) * m * k + 32768) >> 16));
+            }
+        }
+    });
+    return dst;
+}
+
+QImage enhanceContrast(const QImage &src, ContrastMode mode, double clipLimit, int tiles)
+{
+    if (src.isNull() || mode == ContrastMode::None)
+        return src;
+
+    const bool gray = src.isGrayscale();
+    const QImage work = src.convertToFormat(gray ? QImage::Format_Grayscale8 : QImage::Format_RGB32);
+    const QImage luma = gray ? work : lumaPlane(work);
+    if (luma.isNull())
+        return src;
+
+    QImage mapped;
+    if (mode == ContrastMode::CLAHE) {
+        mapped = clahe(luma, clipLimit, tiles);
+    } else {
+        qint64 hist[256] = {0};
+        histogram(luma, hist);
+        uchar lut[256];
+        if (mode == ContrastMode::AutoLevels) {
+            autoLevelsLut(hist, lut);
+            if (!gray) {
+                // same stretch on every channel
+                QImage dst(work.size(), QImage::Format_RGB32);
+                if (dst.isNull())
+                    return src;
+                const int width = work.width();
+                uchar *dst_bits = dst.bits();
+                const qsizetype dst_bpl = dst.bytesPerLine();
+                parallelFor(work.height(), 64, [&](int begin, int end) {
+                    for (int y = begin; y < end; y++) {
+                        const QRgb *src_ptr = reinterpret_cast<const QRgb*>(work.constScanLine(y));
+                        QRgb *dst_ptr = reinterpret_cast<QRgb*>(dst_bits + y * dst_bpl);
+                        for (int x = 0; x < width; x++) {
+                            const QRgb p = src_ptr[x];
+                            dst_ptr[x] = qRgb(lut[qRed(p)], lut[qGreen(p)], lut[qBlue(p)]);
+                        }
+                    }
+                });
+                return dst;
+            }
+        } else {
+            equalizeLut(hist, qint64(luma.width()) * luma.height(), lut);
+        }
+        mapped = applyLut(luma, lut);
+    }
+
+    if (mapped.isNull())
+        return src;
+    return gray ? mapped : applyGain(work, luma, mapped);
+}
+
+
+ContrastTask::ContrastTask(QObject *parent)
+    :QObject(parent)
+    , mode(ContrastMode::None)
+    , clipLimit(2.0)
+    , tiles(8)
+{
+
+}
+
+void ContrastTask::setImage(QImage inputImage)
+{
+    image = inputImage;
+}
+
+void ContrastTask::setMode(ContrastMode mode, double clipLimit, int tiles)
+{
+    this->mode = mode;
+    this->clipLimit = clipLimit;
+    this->tiles = tiles;
+}
+
+void ContrastTask::run()
+{
+    const QImage enhanced = enhanceContrast(image, mode, clipLimit, tiles);
+    emit resultReady(image.cacheKey(), int(mode), enhanced);
+    emit workFinished();
+}
@@ -0,0 +1,50 @@
+#ifndef CONTRAST_H
+#define CONTRAST_H
+
+#include <QObject>
+#include <QImage>
+
+enum class ContrastMode
+{
+    None,
+    AutoLevels,
+    Equalize,
+    CLAHE
+};
+
+/**
+ * @brief Display-only contrast enhancement of an 8-bit buffer.
+ *
+ * Grayscale input gives Format_Grayscale8, anything else Format_RGB32.
+ * Colour images are enhanced on luma and the channels scaled by the same
+ * gain, so hue is kept. Auto levels instead stretches every channel
+ * between the 0.5% and 99.5% luma percentiles.
+ *
+ * CLAHE splits the image into @a tiles x @a tiles regions, builds a clipped
+ * histogram LUT per region in parallel and blends the four nearest LUTs
+ * bilinearly for every pixel.
+ */
+QImage enhanceContrast(const QImage &src, ContrastMode mode,
+                       double clipLimit = 2.0, int tiles = 8);
+
+/// enhanceContrast() off the GUI thread; the result names its source and mode
+class ContrastTask : public QObject
+{
+    Q_OBJECT
+public:
+    ContrastTask(QObject *parent = nullptr);
+    void setImage(QImage inputImage);
+    void setMode(ContrastMode mode, double clipLimit, int tiles);
+public slots:
+    void run();
+signals:
+    void resultReady(qint64 sourceKey, int mode, QImage enhanced);
+    void workFinished();
+private:
+    QImage image;
+    ContrastMode mode;
+    double clipLimit;
+    int tiles;
+};
+
+#endif // CONTRAST_H
@@ -0,0 +1,247 @@
+#include <QAtomicInt>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QVector>
+#include "decodecache.h"
+#include "minimap.h"
+
+static const quint32 kCacheMagic = 0x43445649; // 'IVDC'
+static const quint32 kCacheVersion = 1;
+static const int kMaxLevels = 32;
+static const qint64 kPageSize = 4096;
+
+struct DecodeCacheHeader
+{
+    quint32 magic;
+    quint32 version;
+    quint32 levels;
+    quint32 reserved;
+};
+
+struct DecodeCacheLevel
+{
+    qint32 width;
+    qint32 height;
+    qint32 format;
+    qint32 bytesPerLine;
+    quint64 offset;
+};
+
+static qint64 alignToPage(qint64 offset)
+{
+    return (offset + kPageSize - 1) / kPageSize * kPageSize;
+}
+
+/**
+ * @brief Whether @a level describes a QImage inside a mapping of @a size
+ * bytes. All of it in 64-bit arithmetic, the fields come from disk.
+ */
+static bool isValidLevel(const DecodeCacheLevel &level, qint64 size)
+{
+    if (level.width <= 0 || level.height <= 0 || level.bytesPerLine <= 0
+        || level.format <= QImage::Format_Invalid || level.format >= QImage::NImageFormats)
+        return false;
+    const QImage::Format format = QImage::Format(level.format);
+    // no colour table is stored, store() expands indexed images
+    if (format == QImage::Format_Mono || format == QImage::Format_MonoLSB
+        || format == QImage::Format_Indexed8)
+        return false;
+    // QImage wants 32-bit aligned rows on a page aligned level
+    const quint64 minBytesPerLine = (quint64(level.width) * QImage::toPixelFormat(format).bitsPerPixel() + 7) / 8;
+    if (quint64(level.bytesPerLine) < minBytesPerLine || level.bytesPerLine % 4 != 0)
+        return false;
+    if (level.offset < quint64(kPageSize) || level.offset % quint64(kPageSize) != 0
+        || level.offset > quint64(size))
+        return false;
+    return quint64(level.bytesPerLine) * quint64(level.height) <= quint64(size) - level.offset;
+}
+
+/**
+ * @brief Keeps the file mapped until the last QImage pointing into it is gone
+ */
+struct CacheMapping
+{
+    QFile *file;
+    uchar *data;
+    QAtomicInt refs;
+};
+
+static void releaseMapping(void *info)
+{
+    CacheMapping *mapping = static_cast<CacheMapping*>(info);
+    if (!mapping->refs.deref()) {
+        mapping->file->unmap(mapping->data);
+        delete mapping->file;
+        delete mapping;
+    }
+}
+
+QString DecodeCache::directory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/decoded";
+}
+
+QString DecodeCache::cacheFile(const QString &fileName)
+{
+    const QFileInfo info(fileName);
+    if (!info.exists())
+        return QString();
+    const QByteArray key = info.absoluteFilePath().toUtf8() + '\n'
+        + QByteArray::number(info.lastModified().toMSecsSinceEpoch()) + '\n'
+        + QByteArray::number(info.size());
+    return directory() + '/'
+        + QString::fromLatin1(QCryptographicHash::hash(key, QCryptographicHash::Sha1).toHex()) + ".ivc";
+}
+
+QImage DecodeCache::load(const QString &fileName, QImage *proxy)
+{
+    const QString path = cacheFile(fileName);
+    if (path.isEmpty() || !QFile::exists(path))
+        return QImage();
+
+    QFile *file = new QFile(path);
+    uchar *data = nullptr;
+    if (file->open(QIODevice::ReadOnly) && file->size() >= kPageSize)
+        data = file->map(0, file->size());
+    if (!data) {
+        delete file;
+        return QImage();
+    }
+
+    const qint64 size = file->size();
+    const DecodeCacheHeader *header = reinterpret_cast<const DecodeCacheHeader*>(data);
+    const DecodeCacheLevel *levels = reinterpret_cast<const DecodeCacheLevel*>(data + sizeof(DecodeCacheHeader));
+    bool valid = header->magic == kCacheMagic && header->version == kCacheVersion
+        && header->levels >= 1 && header->levels <= quint32(kMaxLevels);
+    for (quint32 i = 0; valid && i < header->levels; i++)
+        valid = isValidLevel(levels[i], size);
+    if (!valid) {
+        file->unmap(data);
+        file->close();
+        file->remove(); // written by another version or truncated
+        delete file;
+        return QImage();
+    }
+
+    // LRU stamp
+    file->setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+
+    CacheMapping *mapping = new CacheMapping{file, data, QAtomicInt(1)};
+    auto wrap = [&](const DecodeCacheLevel &level) {
+        mapping->refs.ref();
+        // const data: a write detaches instead of faulting on the read-only mapping
+        return QImage(static_cast<const uchar*>(data + level.offset),
+                      level.width, level.height, level.bytesPerLine,
+                      QImage::Format(level.format), releaseMapping, mapping);
+    };
+    const QImage image = wrap(levels[0]);
+    if (proxy && header->levels > 1)
+        *proxy = wrap(levels[header->levels - 1]);
+    releaseMapping(mapping); // drop the reference held while wrapping
+    return image;
+}
+
+static QVector<QImage> buildPyramid(const QImage &image)
+{
+    QVector<QImage> levels;
+    const QImage::Format format = image.isGrayscale() ? QImage::Format_Grayscale8
+        : image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+
+    QImage level = image;
+    while (qMax(level.width(), level.height()) > 2 * MiniMap::kProxySize) {
+        level = level.scaled(level.width() / 2, level.height() / 2,
+                             Qt::IgnoreAspectRatio, Qt::SmoothTransformation).convertToFormat(format);
+        levels.append(level);
+    }
+    if (qMax(level.width(), level.height()) > MiniMap::kProxySize) {
+        levels.append(level.scaled(MiniMap::kProxySize, MiniMap::kProxySize,
+                                   Qt::KeepAspectRatio, Qt::SmoothTransformation).convertToFormat(format));
+    }
+    return levels;
+}
+
+bool DecodeCache::store(const QString &fileName, const QImage &image, qint64 maxBytes)
+{
+    const QString path = cacheFile(fileName);
+    if (path.isEmpty() || image.isNull() || image.sizeInBytes() > maxBytes)
+        return false;
+
+    // the colour table is not stored, expand indexed images
+    QImage base = image;
+    if (image.colorCount() > 0) {
+        base = image.convertToFormat(image.isGrayscale() ? QImage::Format_Grayscale8
+            : image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32);
+    }
+
+    QVector<QImage> levels;
+    levels.append(base);
+    levels += buildPyramid(base).mid(0, kMaxLevels - 1);
+
+    QVector<DecodeCacheLevel> table;
+    qint64 offset = alignToPage(qint64(sizeof(DecodeCacheHeader) + kMaxLevels * sizeof(DecodeCacheLevel)));
+    for (const QImage &level : qAsConst(levels)) {
+        table.append(DecodeCacheLevel{level.width(), level.height(), int(level.format()),
+                                      int(level.bytesPerLine()), quint64(offset)});
+        offset = alignToPage(offset + level.sizeInBytes());
+    }
+
+    evict(maxBytes, offset);
+    if (!QDir().mkpath(directory()))
+        return false;
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    const DecodeCacheHeader header = {kCacheMagic, kCacheVersion, quint32(levels.size()), 0};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(table.constData()), table.size() * sizeof(DecodeCacheLevel));
+    for (int i = 0; i < levels.size(); i++) {
+        if (!file.seek(qint64(table[i].offset))
+            || file.write(reinterpret_cast<const char*>(levels[i].constBits()), levels[i].sizeInBytes())
+               != levels[i].sizeInBytes())
+            return false; // QSaveFile discards the partial file
+    }
+    return file.commit();
+}
+
+void DecodeCache::evict(qint64 maxBytes, qint64 reserve)
+{
+    QDir dir(directory());
+    // oldest stamp first
+    const QFileInfoList entries = dir.entryInfoList(QStringList("*.ivc"), QDir::Files,
+                                                    QDir::Time | QDir::Reversed);
+    qint64 total = reserve;
+    for (const QFileInfo &entry : entries)
+        total += entry.size();
+    for (const QFileInfo &entry : entries) {
+        if (total <= maxBytes)
+            break;
+        if (QFile::remove(entry.absoluteFilePath()))
+            total -= entry.size();
+    }
+}
+
+
+DecodeCacheStoreTask::DecodeCacheStoreTask(QObject *parent)
+    : QObject(parent)
+    , maxBytes(0)
+{
+
+}
+
+void DecodeCacheStoreTask::setImage(const QString &fileName, QImage inputImage, qint64 maxBytes)
+{
+    this->fileName = fileName;
+    image = inputImage;
+    this->maxBytes = maxBytes;
+}
+
+void DecodeCacheStoreTask::run()
+{
+    emit stored(DecodeCache::store(fileName, image, maxBytes), fileName);
+    emit workFinished();
+}
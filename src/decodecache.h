@@ -0,0 +1,47 @@
+#ifndef DECODECACHE_H
+#define DECODECACHE_H
+
+#include <QObject>
+#include <QImage>
+
+/**
+ * @brief Opt-in disk cache of decoded images for slow formats.
+ *
+ * One file per source under the user cache directory, named after a hash of
+ * the source's path, mtime and size. The file holds the decoded pixels and a
+ * pyramid of 8-bit levels, uncompressed and page aligned, so a hit is a
+ * single mmap and the returned QImages point straight into the mapping.
+ *
+ * The cache is capped in bytes. Files are stamped on every hit and the
+ * least recently used ones are removed first.
+ */
+class DecodeCache
+{
+public:
+    static QString directory();
+    static QString cacheFile(const QString &fileName); // empty if the source is gone
+
+    /// @a proxy receives the smallest pyramid level (fits MiniMap::kProxySize)
+    static QImage load(const QString &fileName, QImage *proxy = nullptr);
+    static bool store(const QString &fileName, const QImage &image, qint64 maxBytes);
+    static void evict(qint64 maxBytes, qint64 reserve = 0);
+};
+
+class DecodeCacheStoreTask : public QObject
+{
+    Q_OBJECT
+public:
+    DecodeCacheStoreTask(QObject *parent = nullptr);
+    void setImage(const QString &fileName, QImage inputImage, qint64 maxBytes);
+public slots:
+    void run();
+signals:
+    void stored(bool ok, QString fileName);
+    void workFinished();
+private:
+    QString fileName;
+    QImage image;
+    qint64 maxBytes;
+};
+
+#endif // DECODECACHE_H
@@ -0,0 +1,262 @@
+#include <QMutex>
+#include <QVector>
+#include <limits.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#  include <emmintrin.h>
+#  define DEMOSAIC_SSE2
+#endif
+#include "demosaic.h"
+#include "parallelfor.h"
+
+// samples are interpolated at 10 bits: every 5x5 sum of them fits a 16-bit lane
+static const int kWorkBits = 10;
+static const int kWorkMax = (1 << kWorkBits) - 1;
+static const int kPad = 2; // mirrored samples on each side of a work row
+
+// [pattern][2 * (y & 1) + (x & 1)]: 0 red, 1 green, 2 blue
+static const int kCfa[4][4] = {
+    {0, 1, 1, 2}, // RGGB
+    {2, 1, 1, 0}, // BGGR
+    {1, 0, 2, 1}, // GRBG
+    {1, 2, 0, 1}  // GBRG
+};
+
+bool canDemosaic(const QImage &raw)
+{
+    switch (raw.format()) {
+    case QImage::Format_Grayscale8:
+    case QImage::Format_Grayscale16:
+        return true;
+    case QImage::Format_Indexed8:
+        return raw.isGrayscale();
+    default:
+        return false;
+    }
+}
+
+/// reflection about the border keeps the pattern phase: -1 -> 1, size -> size - 2
+static inline int mirror(int i, int size)
+{
+    if (i < 0)
+        return -i;
+    if (i >= size)
+        return 2 * (size - 1) - i;
+    return i;
+}
+
+template <typename T>
+static void loadRow(const T *in, int width, int up, int down, qint16 *row)
+{
+    for (int x = 0; x < width; x++)
+        row[x] = qint16(qMin((int(in[x]) << up) >> down, kWorkMax));
+    row[-1] = row[1];
+    row[-2] = row[2];
+    row[width] = row[width - 2];
+    row[width + 1] = row[width - 3];
+}
+
+static inline uchar toByte(int sum)
+{
+    return uchar(qBound(0, (sum + 32) >> 6, 255));
+}
+
+/**
+ * @brief One output row from the work rows @a r[0..4] around it.
+ *
+ * All estimates are in 1/16 work units, 64 per output step: the sample
+ * itself, green and the opposite colour at red and blue sites, and the
+ * colours of the horizontal and vertical neighbours at green sites. The
+ * row's own non-green colour is red when @a redRow.
+ */
+template <bool Mhc>
+static void demosaicRow(const qint16 *const *r, QRgb *out, int width, int nonGreenParity, bool redRow)
+{
+    int x = 0;
+#ifdef DEMOSAIC_SSE2
+    // the loads go up to x + 9, which is still inside the mirrored border
+    const __m128i mask = nonGreenParity == 0 ? _mm_set_epi16(0, -1, 0, -1, 0, -1, 0, -1)
+                                             : _mm_set_epi16(-1, 0, -1, 0, -1, 0, -1, 0);
+    const __m128i alpha = _mm_set1_epi8(char(0xff));
+    const __m128i round = _mm_set1_epi16(32);
+    auto load = [](const qint16 *p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); };
+    auto select = [&mask](__m128i a, __m128i b) {
+        return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+    };
+    auto toBytes = [&round](__m128i sum) {
+        return _mm_packus_epi16(_mm_srai_epi16(_mm_add_epi16(sum, round), 6), _mm_setzero_si128());
+    };
+    for (; x + 8 <= width; x += 8) {
+        const __m128i v = load(r[2] + x);
+        const __m128i hsum = _mm_add_epi16(load(r[2] + x - 1), load(r[2] + x + 1));
+        const __m128i vsum = _mm_add_epi16(load(r[1] + x), load(r[3] + x));
+        const __m128i diag = _mm_add_epi16(_mm_add_epi16(load(r[1] + x - 1), load(r[1] + x + 1)),
+                                           _mm_add_epi16(load(r[3] + x - 1), load(r[3] + x + 1)));
+        const __m128i centre = _mm_slli_epi16(v, 4);
+        __m128i green, opposite, horizontal, vertical;
+        if (Mhc) {
+            const __m128i hsum2 = _mm_add_epi16(load(r[2] + x - 2), load(r[2] + x + 2));
+            const __m128i vsum2 = _mm_add_epi16(load(r[0] + x), load(r[4] + x));
+            const __m128i sum2 = _mm_add_epi16(hsum2, vsum2);
+            const __m128i v10 = _mm_mullo_epi16(v, _mm_set1_epi16(10));
+            const __m128i diag2 = _mm_slli_epi16(diag, 1);
+            green = _mm_sub_epi16(_mm_add_epi16(_mm_slli_epi16(v, 3), _mm_slli_epi16(_mm_add_epi16(hsum, vsum), 2)),
+                                  _mm_slli_epi16(sum2, 1));
+            opposite = _mm_sub_epi16(_mm_add_epi16(_mm_mullo_epi16(v, _mm_set1_epi16(12)), _mm_slli_epi16(diag, 2)),
+                                     _mm_mullo_epi16(sum2, _mm_set1_epi16(3)));
+            horizontal = _mm_add_epi16(_mm_sub_epi16(_mm_add_epi16(v10, _mm_slli_epi16(hsum, 3)),
+                                                     _mm_add_epi16(_mm_slli_epi16(hsum2, 1), diag2)), vsum2);
+            vertical = _mm_add_epi16(_mm_sub_epi16(_mm_add_epi16(v10, _mm_slli_epi16(vsum, 3)),
+                                                   _mm_add_epi16(_mm_slli_epi16(vsum2, 1), diag2)), hsum2);
+        } else {
+            green = _mm_slli_epi16(_mm_add_epi16(hsum, vsum), 2);
+            opposite = _mm_slli_epi16(diag, 2);
+            horizontal = _mm_slli_epi16(hsum, 3);
+            vertical = _mm_slli_epi16(vsum, 3);
+        }
+        const __m128i own = toBytes(select(centre, horizontal));
+        const __m128i other = toBytes(select(opposite, vertical));
+        const __m128i bg = _mm_unpacklo_epi8(redRow ? other : own, toBytes(select(green, centre)));
+        const __m128i ra = _mm_unpacklo_epi8(redRow ? own : other, alpha);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_unpacklo_epi16(bg, ra));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x + 4), _mm_unpackhi_epi16(bg, ra));
+    }
+#endif
+    for (; x < width; x++) {
+        const int v = r[2][x];
+        const int hsum = r[2][x - 1] + r[2][x + 1];
+        const int vsum = r[1][x] + r[3][x];
+        const int diag = r[1][x - 1] + r[1][x + 1] + r[3][x - 1] + r[3][x + 1];
+        const int centre = 16 * v;
+        int green, opposite, horizontal, vertical;
+        if (Mhc) {
+            const int hsum2 = r[2][x - 2] + r[2][x + 2];
+            const int vsum2 = r[0][x] + r[4][x];
+            green = 8 * v + 4 * (hsum + vsum) - 2 * (hsum2 + vsum2);
+            opposite = 12 * v + 4 * diag - 3 * (hsum2 + vsum2);
+            horizontal = 10 * v + 8 * hsum - 2 * hsum2 - 2 * diag + vsum2;
+            vertical = 10 * v + 8 * vsum - 2 * vsum2 - 2 * diag + hsum2;
+        } else {
+            green = 4 * (hsum + vsum);
+            opposite = 4 * diag;
+            horizontal = 8 * hsum;
+            vertical = 8 * vsum;
+        }
+        const bool site = (x & 1) == nonGreenParity;
+        const int own = toByte(site ? centre : horizontal);
+        const int other = toByte(site ? opposite : vertical);
+        const int g = toByte(site ? green : centre);
+        out[x] = redRow ? qRgb(own, g, other) : qRgb(other, g, own);
+    }
+}
+
+/// largest sample rounded up to 8, 10, 12, 14 or 16 bits
+static int guessBitDepth(const QImage &wide)
+{
+    QMutex mutex;
+    int peak = 0;
+    const int width = wide.width();
+    parallelFor(wide.height(), 256, [&](int begin, int end) {
+        int local = 0;
+        for (int y = begin; y < end; y++) {
+            const quint16 *ptr = reinterpret_cast<const quint16*>(wide.constScanLine(y));
+            for (int x = 0; x < width; x++)
+                local = qMax(local, int(ptr[x]));
+        }
+        QMutexLocker locker(&mutex);
+        peak = qMax(peak, local);
+    });
+    int bits = 8;
+    while (bits < 16 && peak >= (1 << bits))
+        bits += 2;
+    return bits;
+}
+
+QImage demosaic(const QImage &raw, BayerPattern pattern, DemosaicMethod method, int bitDepth)
+{
+    if (!canDemosaic(raw))
+        return QImage();
+    const int width = raw.width();
+    const int height = raw.height();
+    if (width < 4 || height < 4)
+        return raw.convertToFormat(QImage::Format_RGB32);
+
+    const QImage src = raw.format() == QImage::Format_Indexed8
+        ? raw.convertToFormat(QImage::Format_Grayscale8) : raw;
+    const bool wide = src.format() == QImage::Format_Grayscale16;
+    const int bits = wide ? (bitDepth > 0 ? qBound(8, bitDepth, 16) : guessBitDepth(src)) : 8;
+    const int up = qMax(0, kWorkBits - bits);
+    const int down = qMax(0, bits - kWorkBits);
+
+    QImage dst(raw.size(), QImage::Format_RGB32);
+    if (dst.isNull())
+        return dst;
+
+    const uchar *in = src.constBits();
+    const qsizetype sbpl = src.bytesPerLine();
+    uchar *out = dst.bits();
+    const qsizetype dbpl = dst.bytesPerLine();
+    const bool mhc = method == DemosaicMethod::MalvarHeCutler;
+    parallelFor(height, 32, [&](int begin, int end) {
+        // five work rows, each source row of the band is converted once
+        const int stride = width + 2 * kPad;
+        QVector<qint16> ring(5 * stride);
+        int loaded[5] = {INT_MIN, INT_MIN, INT_MIN, INT_MIN, INT_MIN};
+        for (int y = begin; y < end; y++) {
+            const qint16 *rows[5];
+            for (int k = 0; k < 5; k++) {
+                const int row = y + k - 2;
+                const int slot = (row + 5) % 5;
+                qint16 *work = ring.data() + slot * stride + kPad;
+                if (loaded[slot] != row) {
+                    const uchar *line = in + mirror(row, height) * sbpl;
+                    if (wide)
+                        loadRow(reinterpret_cast<const quint16*>(line), width, up, down, work);
+                    else
+                        loadRow(line, width, up, down, work);
+                    loaded[slot] = row;
+                }
+                rows[k] = work;
+            }
+
+            const int *cfa = kCfa[int(pattern)] + 2 * (y & 1);
+            const int nonGreenParity = cfa[0] == 1 ? 1 : 0;
+            const bool redRow = cfa[nonGreenParity] == 0;
+            QRgb *line = reinterpret_cast<QRgb*>(out + y * dbpl);
+            if (mhc)
+                demosaicRow<true>(rows, line, width, nonGreenParity, redRow);
+            else
+                demosaicRow<false>(rows, line, width, nonGreenParity, redRow);
+        }
+    });
+    dst.setDotsPerMeterX(raw.dotsPerMeterX());
+    dst.setDotsPerMeterY(raw.dotsPerMeterY());
+    return dst;
+}
+
+DemosaicTask::DemosaicTask(QObject *parent)
+    :QObject(parent)
+    , pattern(BayerPattern::RGGB)
+    , method(DemosaicMethod::MalvarHeCutler)
+    , bitDepth(0)
+{
+
+}
+
+void DemosaicTask::setImage(QImage raw)
+{
+    this->raw = raw;
+}
+
+void DemosaicTask::setMode(BayerPattern pattern, DemosaicMethod method, int bitDepth)
+{
+    this->pattern = pattern;
+    this->method = method;
+    this->bitDepth = bitDepth;
+}
+
+void DemosaicTask::run()
+{
+    const QImage rgb = demosaic(raw, pattern, method, bitDepth);
+    emit resultReady(raw, rgb);
+    emit workFinished();
+}
@@ -0,0 +1,56 @@
+#ifndef DEMOSAIC_H
+#define DEMOSAIC_H
+
+#include <QImage>
+#include <QObject>
+
+/// colours of the top left 2x2 block of the sensor
+enum class BayerPattern
+{
+    RGGB,
+    BGGR,
+    GRBG,
+    GBRG
+};
+
+enum class DemosaicMethod
+{
+    Bilinear,
+    MalvarHeCutler // gradient-corrected 5x5, Malvar, He and Cutler (ICASSP 2004)
+};
+
+/// single channel frames only: Grayscale8, Grayscale16 or a gray Indexed8
+bool canDemosaic(const QImage &raw);
+
+/**
+ * @brief Colour image from a raw Bayer mosaic, always Format_RGB32.
+ *
+ * 16-bit frames are scaled from @a bitDepth bits; 0 guesses it from the
+ * largest sample, rounded up to 10, 12, 14 or 16 bits. Samples are
+ * interpolated at 10 bits in 16-bit lanes, eight pixels at a time with SSE2,
+ * in parallel row bands that convert each source row once. Borders are
+ * mirrored by two pixels so the pattern phase is kept.
+ */
+QImage demosaic(const QImage &raw, BayerPattern pattern, DemosaicMethod method, int bitDepth = 0);
+
+/// demosaic() off the GUI thread, for the frames of a stream
+class DemosaicTask : public QObject
+{
+    Q_OBJECT
+public:
+    DemosaicTask(QObject *parent = nullptr);
+    void setImage(QImage raw);
+    void setMode(BayerPattern pattern, DemosaicMethod method, int bitDepth);
+public slots:
+    void run();
+signals:
+    void resultReady(QImage raw, QImage rgb); // rgb is null without the memory for it
+    void workFinished();
+private:
+    QImage raw;
+    BayerPattern pattern;
+    DemosaicMethod method;
+    int bitDepth;
+};
+
+#endif // DEMOSAIC_H
@@ -0,0 +1,364 @@
+#include <algorithm>
+#include <QAtomicInt>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QMutex>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtAlgorithms>
+#include <QtMath>
+#include "duplicates.h"
+#include "parallelfor.h"
+
+static const quint32 kIndexMagic = 0x48445649; // 'IVDH'
+static const quint32 kIndexVersion = 1;
+static const int kDecodeSize = 64; // both hashes start from this, or the image if smaller
+static const int kMaxThreshold = 11; // probe radius 2 in each of the four chunks
+
+quint64 dHash(const QImage &image)
+{
+    const QImage small = image.convertToFormat(QImage::Format_Grayscale8)
+        .scaled(9, 8, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    quint64 hash = 0;
+    for (int y = 0; y < 8; y++) {
+        const uchar *row = small.constScanLine(y);
+        for (int x = 0; x < 8; x++)
+            hash = (hash << 1) | (row[x + 1] > row[x] ? 1 : 0);
+    }
+    return hash;
+}
+
+quint64 pHash(const QImage &image)
+{
+    // the first eight DCT-II basis functions over 32 samples
+    static const struct Basis {
+        double c[8][32];
+        Basis() {
+            for (int u = 0; u < 8; u++) {
+                for (int x = 0; x < 32; x++)
+                    c[u][x] = cos((2 * x + 1) * u * M_PI / 64);
+            }
+        }
+    } basis;
+
+    const QImage small = image.convertToFormat(QImage::Format_Grayscale8)
+        .scaled(32, 32, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    // separable: rows first, then only the 8x8 corner along the columns
+    double rows[32][8];
+    for (int y = 0; y < 32; y++) {
+        const uchar *row = small.constScanLine(y);
+        for (int v = 0; v < 8; v++) {
+            double sum = 0;
+            for (int x = 0; x < 32; x++)
+                sum += row[x] * basis.c[v][x];
+            rows[y][v] = sum;
+        }
+    }
+    double coef[64];
+    for (int u = 0; u < 8; u++) {
+        for (int v = 0; v < 8; v++) {
+            double sum = 0;
+            for (int y = 0; y < 32; y++)
+                sum += basis.c[u][y] * rows[y][v];
+            coef[u * 8 + v] = sum;
+        }
+    }
+
+    // median of the AC terms, the DC term is only the mean brightness
+    double ac[63];
+    std::copy(coef + 1, coef + 64, ac);
+    std::nth_element(ac, ac + 31, ac + 63);
+    const double median = ac[31];
+    quint64 hash = 0;
+    for (int i = 0; i < 64; i++)
+        hash = (hash << 1) | (coef[i] > median ? 1 : 0);
+    return hash;
+}
+
+bool hashImageFile(const QString &fileName, ImageHash *hash)
+{
+    QImageReader reader(fileName);
+    reader.setAutoTransform(true);
+    const QSize size = reader.size();
+    if (size.isValid() && (size.width() > kDecodeSize || size.height() > kDecodeSize))
+        reader.setScaledSize(QSize(kDecodeSize, kDecodeSize)); // the hashes ignore the aspect anyway
+    const QImage image = reader.read();
+    if (image.isNull())
+        return false;
+    const QImage gray = image.convertToFormat(QImage::Format_Grayscale8);
+    hash->dhash = dHash(gray);
+    hash->phash = pHash(gray);
+    return true;
+}
+
+static inline int chunkOf(quint64 hash, int c)
+{
+    return int((hash >> (16 * c)) & 0xffff);
+}
+
+static int findRoot(QVector<int> &parent, int i)
+{
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]]; // path halving
+        i = parent[i];
+    }
+    return i;
+}
+
+QVector<QVector<int>> findNearDuplicates(const QVector<quint64> &hashes, int threshold)
+{
+    threshold = qBound(0, threshold, kMaxThreshold);
+
+    // identical hashes are merged first, so that a crowd of them (blank
+    // frames, say) costs one table entry instead of a quadratic bucket
+    QHash<quint64, int> uniqueIndex;
+    QVector<quint64> unique;
+    QVector<int> owner(hashes.size());
+    for (int i = 0; i < hashes.size(); i++) {
+        auto it = uniqueIndex.constFind(hashes[i]);
+        if (it == uniqueIndex.constEnd()) {
+            it = uniqueIndex.insert(hashes[i], unique.size());
+            unique.append(hashes[i]);
+        }
+        owner[i] = it.value();
+    }
+    const int count = unique.size();
+
+    // one table per chunk: hashes sorted by chunk value, start offsets per value
+    QVector<int> starts[4], items[4];
+    for (int c = 0; c < 4; c++) {
+        starts[c].fill(0, 65536 + 1);
+        for (int i = 0; i < count; i++)
+            starts[c][chunkOf(unique[i], c) + 1]++;
+        for (int k = 0; k < 65536; k++)
+            starts[c][k + 1] += starts[c][k];
+        items[c].resize(count);
+        QVector<int> fill = starts[c];
+        for (int i = 0; i < count; i++)
+            items[c][fill[chunkOf(unique[i], c)]++] = i;
+    }
+
+    // the chunk itself, then every key one or two bits away
+    const int radius = threshold / 4;
+    QVector<int> probes = {0};
+    for (int a = 0; radius >= 1 && a < 16; a++) {
+        probes.append(1 << a);
+        for (int b = a + 1; radius >= 2 && b < 16; b++)
+            probes.append((1 << a) | (1 << b));
+    }
+
+    QMutex mutex;
+    QVector<QPair<int, int>> pairs;
+    parallelFor(count, 256, [&](int begin, int end) {
+        QVector<QPair<int, int>> local;
+        for (int i = begin; i < end; i++) {
+            const quint64 hash = unique[i];
+            for (int c = 0; c < 4; c++) {
+                const int key = chunkOf(hash, c);
+                for (int probe : probes) {
+                    const int k = key ^ probe;
+                    for (int p = starts[c][k]; p < starts[c][k + 1]; p++) {
+                        const int j = items[c][p];
+                        if (j > i && int(qPopulationCount(hash ^ unique[j])) <= threshold)
+                            local.append(qMakePair(i, j)); // may repeat from another chunk
+                    }
+                }
+            }
+        }
+        QMutexLocker locker(&mutex);
+        pairs += local;
+    });
+
+    QVector<int> parent(count);
+    for (int i = 0; i < count; i++)
+        parent[i] = i;
+    for (const auto &pair : pairs)
+        parent[findRoot(parent, pair.first)] = findRoot(parent, pair.second);
+
+    QHash<int, int> groupOf; // root -> group
+    QVector<QVector<int>> groups;
+    for (int i = 0; i < hashes.size(); i++) {
+        const int root = findRoot(parent, owner[i]);
+        auto it = groupOf.constFind(root);
+        if (it == groupOf.constEnd()) {
+            it = groupOf.insert(root, groups.size());
+            groups.append(QVector<int>());
+        }
+        groups[it.value()].append(i);
+    }
+    groups.erase(std::remove_if(groups.begin(), groups.end(), [](const QVector<int> &group) {
+        return group.size() < 2;
+    }), groups.end());
+    std::stable_sort(groups.begin(), groups.end(), [](const QVector<int> &a, const QVector<int> &b) {
+        return a.size() > b.size();
+    });
+    return groups;
+}
+
+QString HashIndex::indexFile(const QString &folder)
+{
+    const QByteArray key = QDir(folder).absolutePath().toUtf8();
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/hashes/"
+        + QString::fromLatin1(QCryptographicHash::hash(key, QCryptographicHash::Sha1).toHex()) + ".ivh";
+}
+
+bool HashIndex::load(const QString &folder)
+{
+    entries_.clear();
+    QFile file(indexFile(folder));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_6);
+    quint32 magic = 0, version = 0;
+    qint32 count = 0;
+    in >> magic >> version >> count;
+    if (in.status() != QDataStream::Ok || magic != kIndexMagic || version != kIndexVersion || count < 0)
+        return false; // written by another version
+
+    entries_.reserve(count);
+    QString path;
+    Entry entry;
+    for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+        in >> path >> entry.mtime >> entry.size >> entry.hash.dhash >> entry.hash.phash;
+        entries_.insert(path, entry);
+    }
+    if (in.status() != QDataStream::Ok) {
+        entries_.clear(); // truncated, everything is hashed again
+        return false;
+    }
+    return true;
+}
+
+bool HashIndex::save(const QString &folder) const
+{
+    const QString path = indexFile(folder);
+    if (!QDir().mkpath(QFileInfo(path).absolutePath()))
+        return false;
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_6);
+    out << kIndexMagic << kIndexVersion << qint32(entries_.size());
+    for (auto it = entries_.constBegin(); it != entries_.constEnd(); ++it) {
+        out << it.key() << it.value().mtime << it.value().size
+            << it.value().hash.dhash << it.value().hash.phash;
+    }
+    return out.status() == QDataStream::Ok && file.commit();
+}
+
+const HashIndex::Entry *HashIndex::find(const QString &path, qint64 mtime, qint64 size) const
+{
+    auto it = entries_.constFind(path);
+    if (it == entries_.constEnd() || it.value().mtime != mtime || it.value().size != size)
+        return nullptr;
+    return &it.value();
+}
+
+
+DuplicateScanTask::DuplicateScanTask(QObject *parent)
+    :QObject(parent)
+    , threshold(6)
+    , useDHash(false)
+{
+
+}
+
+void DuplicateScanTask::setFolder(const QString &folder, int threshold, bool useDHash)
+{
+    this->folder = folder;
+    this->threshold = threshold;
+    this->useDHash = useDHash;
+}
+
+void DuplicateScanTask::run()
+{
+    QElapsedTimer timer;
+    timer.start();
+    DuplicateScanResult result;
+    result.folder = folder;
+
+    struct File
+    {
+        QString path; // relative to the folder
+        qint64 mtime;
+        qint64 size;
+        ImageHash hash;
+        bool ok;
+    };
+    QStringList nameFilters;
+    for (const QByteArray &format : QImageReader::supportedImageFormats())
+        nameFilters.append(QLatin1String("*.") + QString::fromLatin1(format));
+    const QDir root(folder);
+    QVector<File> files;
+    QDirIterator it(folder, nameFilters, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        const QFileInfo info = it.fileInfo(); // stat()ed by the iterator already
+        files.append(File{root.relativeFilePath(info.absoluteFilePath()),
+                          info.lastModified().toMSecsSinceEpoch(), info.size(), ImageHash(), true});
+    }
+
+    // only new or changed files are decoded
+    HashIndex index;
+    index.load(folder);
+    QVector<int> todo;
+    for (int i = 0; i < files.size(); i++) {
+        if (const HashIndex::Entry *entry = index.find(files[i].path, files[i].mtime, files[i].size))
+            files[i].hash = entry->hash;
+        else
+            todo.append(i);
+    }
+    result.hashed = todo.size();
+
+    QAtomicInt done(0);
+    parallelFor(todo.size(), 4, [&](int begin, int end) {
+        for (int k = begin; k < end; k++) {
+            File &file = files[todo[k]];
+            file.ok = hashImageFile(root.filePath(file.path), &file.hash);
+        }
+        const int now = done.fetchAndAddRelaxed(end - begin) + (end - begin);
+        if (now / 64 != (now - (end - begin)) / 64 || now == todo.size())
+            emit progress(now, todo.size());
+    });
+
+    // rewritten from this scan, so that removed files drop out; failed ones are retried
+    HashIndex fresh;
+    QVector<quint64> hashes;
+    QVector<int> owners;
+    for (int i = 0; i < files.size(); i++) {
+        if (!files[i].ok) {
+            result.failed++;
+            continue;
+        }
+        HashIndex::Entry entry;
+        entry.mtime = files[i].mtime;
+        entry.size = files[i].size;
+        entry.hash = files[i].hash;
+        fresh.insert(files[i].path, entry);
+        hashes.append(useDHash ? files[i].hash.dhash : files[i].hash.phash);
+        owners.append(i);
+    }
+    if (result.hashed > 0 || fresh.size() != index.size())
+        fresh.save(folder);
+
+    for (const QVector<int> &group : findNearDuplicates(hashes, threshold)) {
+        QStringList paths;
+        for (int k : group)
+            paths.append(root.absoluteFilePath(files[owners[k]].path));
+        result.groups.append(paths);
+    }
+    result.files = files.size();
+    result.ms = timer.elapsed();
+    emit resultReady(result);
+    emit workFinished();
+}
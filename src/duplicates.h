@@ -0,0 +1,95 @@
+#ifndef DUPLICATES_H
+#define DUPLICATES_H
+
+#include <QObject>
+#include <QHash>
+#include <QImage>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * @brief Perceptual hashes of one image, 64 bits each
+ */
+struct ImageHash
+{
+    quint64 dhash = 0;
+    quint64 phash = 0;
+};
+
+/// difference hash: 9x8 gray, one bit per horizontal gradient sign
+quint64 dHash(const QImage &image);
+/// DCT hash: 32x32 gray, the 8x8 lowest frequencies against their median
+quint64 pHash(const QImage &image);
+/// decoded at a small size through QImageReader::setScaledSize(), which JPEG does in the IDCT
+bool hashImageFile(const QString &fileName, ImageHash *hash);
+
+/**
+ * @brief Groups of two or more hashes within @a threshold bits of each other,
+ * transitively, as indices into @a hashes, largest group first.
+ *
+ * Multi-index hashing: the 64 bits are cut into four 16-bit chunks, each
+ * with a table from chunk value to hashes. Two hashes at most t bits apart
+ * have a chunk at most t / 4 bits apart, so a lookup only probes the keys
+ * within that radius in each table instead of comparing all pairs.
+ * @a threshold is capped at 11, a radius of 2.
+ */
+QVector<QVector<int>> findNearDuplicates(const QVector<quint64> &hashes, int threshold);
+
+/**
+ * @brief Hashes of the images under a folder, kept in the user cache
+ * directory between scans. An entry is only reused while the file's
+ * relative path, mtime and size are unchanged.
+ */
+class HashIndex
+{
+public:
+    struct Entry
+    {
+        qint64 mtime = 0; // ms since epoch
+        qint64 size = 0;
+        ImageHash hash;
+    };
+
+    static QString indexFile(const QString &folder);
+    bool load(const QString &folder); // false if there is none or it is unreadable
+    bool save(const QString &folder) const;
+
+    const Entry *find(const QString &path, qint64 mtime, qint64 size) const;
+    void insert(const QString &path, const Entry &entry) { entries_.insert(path, entry); }
+    int size() const { return entries_.size(); }
+
+private:
+    QHash<QString, Entry> entries_; // relative path
+};
+
+struct DuplicateScanResult
+{
+    QString folder;
+    QVector<QStringList> groups; // absolute paths
+    int files = 0;
+    int hashed = 0; // new or changed since the last scan
+    int failed = 0; // could not be decoded
+    qint64 ms = 0;
+};
+Q_DECLARE_METATYPE(DuplicateScanResult)
+
+class DuplicateScanTask : public QObject
+{
+    Q_OBJECT
+public:
+    DuplicateScanTask(QObject *parent = nullptr);
+    /// @a useDHash groups by the difference hash instead of the DCT one
+    void setFolder(const QString &folder, int threshold, bool useDHash);
+public slots:
+    void run();
+signals:
+    void progress(int done, int total);
+    void resultReady(DuplicateScanResult result);
+    void workFinished();
+private:
+    QString folder;
+    int threshold;
+    bool useDHash;
+};
+
+#endif // DUPLICATES_H
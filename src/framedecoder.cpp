@@ -0,0 +1,223 @@
+#include <QColorSpace>
+#include <QImageReader>
+#include <QMutexLocker>
+#include <string.h>
+#include "framedecoder.h"
+#include "parallelfor.h"
+
+
+FrameRingBuffer::FrameRingBuffer(int capacity)
+    : frames_(qMax(1, capacity))
+    , displays_(qMax(1, capacity))
+    , indices_(qMax(1, capacity), -1)
+    , head_(0)
+    , count_(0)
+    , aborted_(false)
+{
+}
+
+bool FrameRingBuffer::push(int index, const QImage &frame, const QImage &display)
+{
+    QMutexLocker locker(&mutex_);
+    while (count_ == frames_.size() && !aborted_)
+        not_full_.wait(&mutex_);
+    if (aborted_)
+        return false;
+
+    const int tail = (head_ + count_) % frames_.size();
+    frames_[tail] = frame;
+    displays_[tail] = display;
+    indices_[tail] = index;
+    count_++;
+    return true;
+}
+
+bool FrameRingBuffer::pop(int *index, QImage *frame, QImage *display)
+{
+    QMutexLocker locker(&mutex_);
+    if (count_ == 0)
+        return false;
+
+    *index = indices_[head_];
+    *frame = frames_[head_];
+    if (display)
+        *display = displays_[head_];
+    frames_[head_] = QImage(); // release the slot's pixels
+    displays_[head_] = QImage();
+    head_ = (head_ + 1) % frames_.size();
+    count_--;
+    not_full_.wakeOne();
+    return true;
+}
+
+int FrameRingBuffer::size() const
+{
+    QMutexLocker locker(&mutex_);
+    return count_;
+}
+
+void FrameRingBuffer::abort()
+{
+    QMutexLocker locker(&mutex_);
+    aborted_ = true;
+    not_full_.wakeAll();
+}
+
+bool FrameRingBuffer::isAborted() const
+{
+    QMutexLocker locker(&mutex_);
+    return aborted_;
+}
+
+
+/**
+ * @brief Convert to sRGB and to a format QPixmap can wrap without another
+ * conversion, so the GUI thread only uploads the frame.
+ *
+ * Rows are converted in parallel bands: 8-bit gray and RGB888 (what the
+ * splits and most decoders give) directly, anything else by converting a
+ * view of the band with QImage and copying the rows out while still hot.
+ */
+QImage toDisplayFormat(const QImage &frame)
+{
+    QImage img = frame;
+    if (img.colorSpace().isValid())
+        img.convertToColorSpace(QColorSpace::SRgb);
+    if (img.isNull() || img.format() == QImage::Format_RGB32
+        || img.format() == QImage::Format_ARGB32_Premultiplied)
+        return img;
+
+    const QImage::Format format = img.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied
+                                                        : QImage::Format_RGB32;
+    QImage dst(img.size(), format);
+    if (dst.isNull())
+        return dst;
+
+    const int width = img.width();
+    const uchar *in = img.constBits();
+    const qsizetype sbpl = img.bytesPerLine();
+    uchar *out = dst.bits(); // detach once, not per thread
+    const qsizetype dbpl = dst.bytesPerLine();
+    const QImage::Format source = img.format();
+    const QVector<QRgb> table = img.colorTable();
+    parallelFor(img.height(), 64, [&](int begin, int end) {
+        if (source == QImage::Format_Grayscale8) {
+            for (int y = begin; y < end; y++) {
+                const uchar *src_ptr = in + y * sbpl;
+                QRgb *dst_ptr = reinterpret_cast<QRgb*>(out + y * dbpl);
+                for (int x = 0; x < width; x++)
+                    dst_ptr[x] = 0xff000000u | src_ptr[x] * 0x010101u;
+            }
+        } else if (source == QImage::Format_RGB888) {
+            for (int y = begin; y < end; y++) {
+                const uchar *src_ptr = in + y * sbpl;
+                QRgb *dst_ptr = reinterpret_cast<QRgb*>(out + y * dbpl);
+                for (int x = 0; x < width; x++, src_ptr += 3)
+                    dst_ptr[x] = qRgb(src_ptr[0], src_ptr[1], src_ptr[2]);
+            }
+        } else {
+            QImage band(in + begin * sbpl, width, end - begin, sbpl, source);
+            if (!table.isEmpty())
+                band.setColorTable(table);
+            const QImage converted = band.convertToFormat(format);
+            for (int y = begin; y < end; y++)
+                memcpy(out + y * dbpl, converted.constScanLine(y - begin), size_t(width) * 4);
+        }
+    });
+    dst.setDotsPerMeterX(img.dotsPerMeterX());
+    dst.setDotsPerMeterY(img.dotsPerMeterY());
+    return dst;
+}
+
+
+FrameDecodeTask::FrameDecodeTask(FrameRingBufferPtr buffer, QObject *parent)
+    : QObject(parent)
+    , buffer(buffer)
+    , firstFrame(0)
+    , frameCount(0)
+{
+
+}
+
+void FrameDecodeTask::setFile(const QString &fileName, int firstFrame, int frameCount)
+{
+    this->fileName = fileName;
+    this->firstFrame = firstFrame;
+    this->frameCount = frameCount;
+}
+
+void FrameDecodeTask::run()
+{
+    QImageReader reader(fileName);
+    reader.setAutoTransform(true);
+
+    int index = 0;
+    if (firstFrame > 0) {
+        if (reader.jumpToImage(firstFrame)) {
+            index = firstFrame;
+        } else {
+            // sequential formats (e.g. GIF) can only skip by decoding
+            for (; index < firstFrame && !buffer->isAborted(); index++) {
+                reader.read();
+                if (!reader.supportsAnimation())
+                    reader.jumpToNextImage();
+            }
+        }
+    }
+
+    while (!buffer->isAborted()) {
+        QImage frame = reader.read();
+        if (frame.isNull()) {
+            if (index == 0) {
+                emit decodeError(reader.errorString());
+                break;
+            }
+            // end of the sequence, start over
+            reader.setFileName(fileName);
+            index = 0;
+            continue;
+        }
+
+        // the frame stays in its own format, the GUI only uploads the copy
+        if (!buffer->push(index, frame, toDisplayFormat(frame)))
+            break;
+
+        // animations move on by reading, multi-page files (TIFF) read the
+        // same page until told to move on
+        index++;
+        const bool more = reader.supportsAnimation() || reader.jumpToNextImage();
+        if (!more || (frameCount > 0 && index >= frameCount)) {
+            reader.setFileName(fileName);
+            index = 0;
+        }
+    }
+    emit workFinished();
+}
+
+
+ImageLoadTask::ImageLoadTask(QObject *parent)
+    : QObject(parent)
+    , serial(0)
+    , displayFormat(true)
+{
+
+}
+
+void ImageLoadTask::setFile(const QString &fileName, int serial, bool displayFormat)
+{
+    this->fileName = fileName;
+    this->serial = serial;
+    this->displayFormat = displayFormat;
+}
+
+void ImageLoadTask::run()
+{
+    QImageReader reader(fileName);
+    reader.setAutoTransform(true);
+    const QImage img = reader.read();
+    if (img.isNull())
+        emit resultReady(serial, img, reader.errorString());
+    else
+        emit resultReady(serial, displayFormat ? toDisplayFormat(img) : img, QString());
+    emit workFinished();
+}
@@ -0,0 +1,86 @@
+#ifndef FRAMEDECODER_H
+#define FRAMEDECODER_H
+
+#include <QObject>
+#include <QImage>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QVector>
+#include <QWaitCondition>
+
+/**
+ * @brief Fixed-size single producer / single consumer frame queue.
+ *
+ * The decoder blocks in push() while the ring is full, the GUI side polls
+ * with pop() and never blocks. abort() releases a waiting producer. Each
+ * slot holds the frame as decoded and, optionally, its display copy.
+ */
+class FrameRingBuffer
+{
+public:
+    explicit FrameRingBuffer(int capacity = 8);
+
+    bool push(int index, const QImage &frame, const QImage &display = QImage()); // false once aborted
+    bool pop(int *index, QImage *frame, QImage *display = nullptr);
+    int size() const;
+    int capacity() const { return frames_.size(); }
+    void abort();
+    bool isAborted() const;
+
+private:
+    mutable QMutex mutex_;
+    QWaitCondition not_full_;
+    QVector<QImage> frames_;
+    QVector<QImage> displays_;
+    QVector<int> indices_;
+    int head_;
+    int count_;
+    bool aborted_;
+};
+
+typedef QSharedPointer<FrameRingBuffer> FrameRingBufferPtr;
+
+QImage toDisplayFormat(const QImage &frame);
+
+class FrameDecodeTask : public QObject
+{
+    Q_OBJECT
+public:
+    FrameDecodeTask(FrameRingBufferPtr buffer, QObject *parent = nullptr);
+    void setFile(const QString &fileName, int firstFrame, int frameCount);
+public slots:
+    void run();
+signals:
+    void decodeError(QString message);
+    void workFinished();
+private:
+    FrameRingBufferPtr buffer;
+    QString fileName;
+    int firstFrame;
+    int frameCount;
+};
+
+/**
+ * @brief Decode a single file off the GUI thread, used by the watch mode and
+ * by loadFile behind a thumbnail preview. The serial number lets the receiver
+ * drop results that arrive out of order. Without displayFormat the decoded
+ * image is passed on in its own format.
+ */
+class ImageLoadTask : public QObject
+{
+    Q_OBJECT
+public:
+    ImageLoadTask(QObject *parent = nullptr);
+    void setFile(const QString &fileName, int serial, bool displayFormat = true);
+public slots:
+    void run();
+signals:
+    void resultReady(int serial, QImage image, QString error);
+    void workFinished();
+private:
+    QString fileName;
+    int serial;
+    bool displayFormat;
+};
+
+#endif // FRAMEDECODER_H
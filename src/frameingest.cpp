@@ -0,0 +1,210 @@
+#include <QLocalServer>
+#include <QLocalSocket>
+#include "frameingest.h"
+#include "shmframe.h"
+
+
+FrameIngestServer::FrameIngestServer(QObject *parent)
+    : QObject(parent)
+    , server_(new QLocalServer(this))
+    , socket_(nullptr)
+    , slot_count_(0)
+    , slot_size_(0)
+    , held_slot_(-1)
+    , frames_received_(0)
+    , frames_skipped_(0)
+{
+    connect(server_, &QLocalServer::newConnection, this, &FrameIngestServer::newConnection);
+}
+
+FrameIngestServer::~FrameIngestServer()
+{
+    blockSignals(true); // the receiver may already be half destroyed
+    close();
+}
+
+bool FrameIngestServer::listen(const QString &name)
+{
+    close();
+    if (!server_->listen(name)) {
+        // a viewer that answers keeps its socket, else it is left from a crash
+        QLocalSocket probe;
+        probe.connectToServer(name);
+        if (probe.waitForConnected(200)) {
+            probe.abort();
+            error_ = tr("Another viewer is listening on \"%1\"").arg(name);
+            return false;
+        }
+        QLocalServer::removeServer(name);
+        if (!server_->listen(name)) {
+            error_ = server_->errorString();
+            return false;
+        }
+    }
+    frames_received_ = 0;
+    frames_skipped_ = 0;
+    return true;
+}
+
+void FrameIngestServer::close()
+{
+    if (socket_) {
+        socket_->disconnect(this);
+        socket_->abort();
+        socket_->deleteLater();
+        socket_ = nullptr;
+    }
+    detach();
+    server_->close();
+}
+
+bool FrameIngestServer::isListening() const
+{
+    return server_->isListening();
+}
+
+void FrameIngestServer::newConnection()
+{
+    while (QLocalSocket *s = server_->nextPendingConnection()) {
+        if (socket_) {
+            // one producer at a time
+            s->abort();
+            s->deleteLater();
+            continue;
+        }
+        socket_ = s;
+        connect(socket_, &QLocalSocket::readyRead, this, &FrameIngestServer::readSocket);
+        connect(socket_, &QLocalSocket::disconnected, this, &FrameIngestServer::socketDisconnected);
+        emit streamStatus(tr("Producer connected"));
+    }
+}
+
+void FrameIngestServer::socketDisconnected()
+{
+    detach();
+    if (socket_) {
+        socket_->deleteLater();
+        socket_ = nullptr;
+    }
+    emit streamStatus(tr("Producer disconnected"));
+}
+
+bool FrameIngestServer::attach(const QString &key)
+{
+    detach();
+    shm_.setKey(key);
+    if (!shm_.attach(QSharedMemory::ReadOnly)) {
+        error_ = shm_.errorString();
+        return false;
+    }
+
+    if (shm_.size() < kShmHeaderSize) {
+        error_ = tr("Unsupported shared memory layout");
+        shm_.detach();
+        return false;
+    }
+    const ShmFrameHeader *header = static_cast<const ShmFrameHeader*>(shm_.constData());
+    if (header->magic != kShmFrameMagic || header->version != kShmFrameVersion
+        || shmSlotOffset(header->slotCount, header->slotSize) > shm_.size()) {
+        error_ = tr("Unsupported shared memory layout");
+        shm_.detach();
+        return false;
+    }
+    slot_count_ = header->slotCount;
+    slot_size_ = header->slotSize;
+    return true;
+}
+
+void FrameIngestServer::detach()
+{
+    if (!shm_.isAttached())
+        return;
+
+    held_slot_ = -1;
+    shm_.detach();
+}
+
+void FrameIngestServer::readSocket()
+{
+    // only the newest frame is shown, older notifications are released at once
+    int newest = -1;
+    while (socket_ && socket_->canReadLine()) {
+        const QList<QByteArray> cmd = socket_->readLine().trimmed().split(' ');
+        if (cmd.size() != 2)
+            continue;
+
+        if (cmd[0] == "ATTACH") {
+            newest = -1;
+            if (attach(QString::fromUtf8(cmd[1])))
+                emit streamStatus(tr("Attached to \"%1\"").arg(QString::fromUtf8(cmd[1])));
+            else
+                emit streamStatus(tr("Cannot attach to \"%1\": %2").arg(QString::fromUtf8(cmd[1]), error_));
+        } else if (cmd[0] == "FRAME") {
+            if (newest >= 0) {
+                release(newest);
+                frames_skipped_++;
+            }
+            newest = cmd[1].toInt();
+        }
+    }
+    if (newest >= 0)
+        processFrame(newest);
+}
+
+void FrameIngestServer::processFrame(int slot)
+{
+    if (!shm_.isAttached() || slot < 0 || slot >= int(slot_count_))
+        return;
+
+    // a frame handed out but never painted, e.g. while minimized
+    if (held_slot_ >= 0) {
+        release(held_slot_);
+        held_slot_ = -1;
+        frames_skipped_++;
+    }
+
+    const uchar *base = static_cast<const uchar*>(shm_.constData()) + shmSlotOffset(slot, slot_size_);
+    // read once, the producer could change it between the checks and the copy
+    const ShmSlotHeader header = *reinterpret_cast<const ShmSlotHeader*>(base);
+    const bool validFormat = header.format > QImage::Format_Invalid
+        && header.format < QImage::NImageFormats;
+    // rows must hold a full line of pixels and start 32-bit aligned, as QImage's own do
+    const qint64 lineBytes = validFormat
+        ? (qint64(header.width) * QImage::toPixelFormat(QImage::Format(header.format)).bitsPerPixel() + 7) / 8
+        : 0;
+    if (!validFormat || header.width <= 0 || header.height <= 0
+        || header.stride < lineBytes || header.stride % 4 != 0
+        || qint64(header.stride) * header.height + kShmSlotDataOffset > slot_size_) {
+        release(slot);
+        return;
+    }
+
+    // copied once here, see the class comment
+    const QImage frame = QImage(base + kShmSlotDataOffset, header.width, header.height,
+                                header.stride, QImage::Format(header.format)).copy();
+    const double latency = (shmNowUs() - header.timestampUs) / 1000.0;
+    if (frame.isNull()) {
+        release(slot); // out of memory
+        return;
+    }
+    frames_received_++;
+
+    held_slot_ = slot;
+    emit frameReady(frame, header.sequence, latency);
+}
+
+void FrameIngestServer::frameShown()
+{
+    if (held_slot_ < 0)
+        return;
+    if (socket_ && socket_->state() == QLocalSocket::ConnectedState)
+        socket_->write("SHOWN " + QByteArray::number(held_slot_) + '\n');
+    release(held_slot_);
+    held_slot_ = -1;
+}
+
+void FrameIngestServer::release(int slot)
+{
+    if (socket_ && socket_->state() == QLocalSocket::ConnectedState)
+        socket_->write("DONE " + QByteArray::number(slot) + '\n');
+}
@@ -0,0 +1,67 @@
+#ifndef FRAMEINGEST_H
+#define FRAMEINGEST_H
+
+#include <QObject>
+#include <QImage>
+#include <QSharedMemory>
+
+QT_BEGIN_NAMESPACE
+class QLocalServer;
+class QLocalSocket;
+QT_END_NAMESPACE
+
+/**
+ * @brief Receive frames from a local producer through shared memory.
+ *
+ * Each frame is copied out of its slot once, before it is handed out: the
+ * viewer passes frames on to tasks on other threads that may still read
+ * them after the producer has reused the slot or detached. The slot is held
+ * until frameShown() reports the frame painted, so the producer measures
+ * latency to the screen (see shmframe.h).
+ */
+class FrameIngestServer : public QObject
+{
+    Q_OBJECT
+public:
+    FrameIngestServer(QObject *parent = nullptr);
+    ~FrameIngestServer();
+
+    bool listen(const QString &name);
+    void close();
+    bool isListening() const;
+    QString errorString() const { return error_; }
+
+    qint64 framesReceived() const { return frames_received_; }
+    qint64 framesSkipped() const { return frames_skipped_; }
+
+public slots:
+    /// the view was repainted, the last frame handed out is on screen
+    void frameShown();
+
+signals:
+    void frameReady(const QImage &frame, quint64 sequence, double latencyMs);
+    void streamStatus(const QString &message);
+
+private slots:
+    void newConnection();
+    void readSocket();
+    void socketDisconnected();
+
+private:
+    bool attach(const QString &key);
+    void detach();
+    void processFrame(int slot);
+    void release(int slot);
+
+    QLocalServer *server_;
+    QLocalSocket *socket_;
+    QSharedMemory shm_;
+    quint32 slot_count_;
+    quint32 slot_size_;
+    int held_slot_; // handed out, not painted yet
+    qint64 frames_received_;
+    qint64 frames_skipped_;
+    QString error_;
+};
+
+#endif // FRAMEINGEST_H
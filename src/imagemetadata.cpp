@@ -0,0 +1,402 @@
+#include <QBuffer>
+#include <QColorSpace>
+#include <QCoreApplication>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QLocale>
+#include <QMap>
+#include <QTransform>
+#include <QtEndian>
+#include "imagemetadata.h"
+
+namespace {
+
+enum TiffTag : quint16
+{
+    NewSubfileType = 0x00FE,
+    ImageWidth = 0x0100,
+    ImageLength = 0x0101,
+    BitsPerSample = 0x0102,
+    Make = 0x010F,
+    Model = 0x0110,
+    Orientation = 0x0112,
+    SamplesPerPixel = 0x0115,
+    DateTime = 0x0132,
+    JpegOffset = 0x0201,
+    JpegLength = 0x0202,
+    ExposureTime = 0x829A,
+    FNumber = 0x829D,
+    ExifIfd = 0x8769,
+    IccProfile = 0x8773,
+    IsoSpeed = 0x8827,
+    DateTimeOriginal = 0x9003,
+    FocalLength = 0x920A
+};
+
+struct TiffEntry
+{
+    quint16 tag = 0;
+    quint16 type = 0;
+    quint32 count = 0;
+    quint32 offset = 0;  // value offset, or the value itself when it fits
+    QByteArray value;    // the raw 4 value/offset bytes
+};
+
+typedef QMap<quint16, TiffEntry> TiffIfd;
+
+/**
+ * @brief Minimal TIFF IFD walker, enough for baseline tags and EXIF.
+ * Runs on a TIFF file or on the payload of a JPEG APP1 segment; only the
+ * IFD tables and the values asked for are read.
+ */
+class TiffReader
+{
+public:
+    explicit TiffReader(QIODevice *device) : dev_(device) {}
+
+    bool open()
+    {
+        if (!dev_->seek(0))
+            return false;
+        const QByteArray header = dev_->read(8);
+        if (header.size() < 8)
+            return false;
+        if (header.startsWith("II"))
+            little_ = true;
+        else if (header.startsWith("MM"))
+            little_ = false;
+        else
+            return false;
+        if (u16(header.constData() + 2) != 42)
+            return false;
+        first_ = u32(header.constData() + 4);
+        return true;
+    }
+
+    quint32 firstIfd() const { return first_; }
+
+    TiffIfd readIfd(quint32 offset, quint32 *next = nullptr) const
+    {
+        TiffIfd ifd;
+        if (next)
+            *next = 0;
+        if (offset == 0 || !dev_->seek(offset))
+            return ifd;
+        const QByteArray countBytes = dev_->read(2);
+        if (countBytes.size() < 2)
+            return ifd;
+        const int count = qMin<int>(u16(countBytes.constData()), 1024);
+        const QByteArray table = dev_->read(qint64(count) * 12 + 4);
+        if (table.size() < count * 12)
+            return ifd;
+        for (int i = 0; i < count; i++) {
+            const char *p = table.constData() + i * 12;
+            TiffEntry entry;
+            entry.tag = u16(p);
+            entry.type = u16(p + 2);
+            entry.count = u32(p + 4);
+            entry.offset = u32(p + 8);
+            entry.value = QByteArray(p + 8, 4);
+            ifd.insert(entry.tag, entry);
+        }
+        if (next && table.size() >= count * 12 + 4)
+            *next = u32(table.constData() + count * 12);
+        return ifd;
+    }
+
+    QByteArray data(const TiffEntry &entry, qint64 limit = 1 << 20) const
+    {
+        const qint64 size = qint64(typeSize(entry.type)) * entry.count;
+        if (size <= 0 || size > limit)
+            return QByteArray();
+        if (size <= 4)
+            return entry.value.left(int(size));
+        if (!dev_->seek(entry.offset))
+            return QByteArray();
+        return dev_->read(size);
+    }
+
+    quint32 number(const TiffEntry &entry, int index = 0) const
+    {
+        const QByteArray d = data(entry);
+        if (entry.type == 3 && d.size() >= (index + 1) * 2)
+            return u16(d.constData() + index * 2);
+        if ((entry.type == 4 || entry.type == 9) && d.size() >= (index + 1) * 4)
+            return u32(d.constData() + index * 4);
+        if ((entry.type == 1 || entry.type == 7) && d.size() > index)
+            return quint8(d[index]);
+        return 0;
+    }
+
+    bool rational(const TiffEntry &entry, double *value) const
+    {
+        if (entry.type != 5 && entry.type != 10)
+            return false;
+        const QByteArray d = data(entry);
+        if (d.size() < 8 || u32(d.constData() + 4) == 0)
+            return false;
+        *value = double(u32(d.constData())) / u32(d.constData() + 4);
+        return true;
+    }
+
+    QString string(const TiffEntry &entry) const
+    {
+        QByteArray d = data(entry, 4096);
+        const int nul = d.indexOf('\0');
+        if (nul >= 0)
+            d.truncate(nul);
+        return QString::fromLatin1(d).trimmed();
+    }
+
+private:
+    static int typeSize(quint16 type)
+    {
+        switch (type) {
+        case 1: case 2: case 6: case 7:
+            return 1;
+        case 3: case 8:
+            return 2;
+        case 4: case 9: case 11:
+            return 4;
+        case 5: case 10: case 12:
+            return 8;
+        }
+        return 0;
+    }
+
+    quint16 u16(const char *p) const
+    {
+        return little_ ? qFromLittleEndian<quint16>(p) : qFromBigEndian<quint16>(p);
+    }
+    quint32 u32(const char *p) const
+    {
+        return little_ ? qFromLittleEndian<quint32>(p) : qFromBigEndian<quint32>(p);
+    }
+
+    QIODevice *dev_;
+    bool little_ = true;
+    quint32 first_ = 0;
+};
+
+} // namespace
+
+/**
+ * @brief Fill @a meta from IFD0, the EXIF IFD and IFD1.
+ * @return true when IFD1 is a small reduced-resolution page of a TIFF file
+ */
+static bool parseTiff(const TiffReader &tiff, ImageMetadata &meta, bool tiffFile)
+{
+    quint32 next = 0;
+    const TiffIfd ifd0 = tiff.readIfd(tiff.firstIfd(), &next);
+
+    if (ifd0.contains(Make))
+        meta.make = tiff.string(ifd0[Make]);
+    if (ifd0.contains(Model))
+        meta.model = tiff.string(ifd0[Model]);
+    if (ifd0.contains(DateTime))
+        meta.dateTime = tiff.string(ifd0[DateTime]);
+    if (ifd0.contains(Orientation))
+        meta.orientation = qBound<int>(1, tiff.number(ifd0[Orientation]), 8);
+
+    if (tiffFile) {
+        const int samples = ifd0.contains(SamplesPerPixel) ? tiff.number(ifd0[SamplesPerPixel]) : 1;
+        if (ifd0.contains(BitsPerSample))
+            meta.bitDepth = int(tiff.number(ifd0[BitsPerSample])) * qMax(1, samples);
+        if (ifd0.contains(IccProfile))
+            meta.iccProfile = tiff.data(ifd0[IccProfile], 16 << 20);
+    }
+
+    if (ifd0.contains(ExifIfd)) {
+        const TiffIfd exif = tiff.readIfd(tiff.number(ifd0[ExifIfd]));
+        double value = 0;
+        if (exif.contains(ExposureTime) && tiff.rational(exif[ExposureTime], &value) && value > 0) {
+            meta.exposureTime = value < 0.5
+                ? QStringLiteral("1/%1 s").arg(qRound(1 / value))
+                : QStringLiteral("%1 s").arg(value, 0, 'g', 3);
+        }
+        if (exif.contains(FNumber) && tiff.rational(exif[FNumber], &value))
+            meta.fNumber = QStringLiteral("f/%1").arg(value, 0, 'g', 3);
+        if (exif.contains(IsoSpeed))
+            meta.iso = QString::number(tiff.number(exif[IsoSpeed]));
+        if (exif.contains(FocalLength) && tiff.rational(exif[FocalLength], &value))
+            meta.focalLength = QStringLiteral("%1 mm").arg(value, 0, 'g', 4);
+        if (exif.contains(DateTimeOriginal))
+            meta.dateTimeOriginal = tiff.string(exif[DateTimeOriginal]);
+    }
+
+    const TiffIfd ifd1 = tiff.readIfd(next);
+    if (ifd1.contains(JpegOffset) && ifd1.contains(JpegLength)) {
+        TiffEntry blob = ifd1[JpegOffset];
+        blob.type = 7;
+        blob.count = tiff.number(ifd1[JpegLength]);
+        blob.offset = tiff.number(ifd1[JpegOffset]);
+        meta.thumbnail = QImage::fromData(tiff.data(blob), "JPEG");
+        return false;
+    }
+    return tiffFile && ifd1.contains(NewSubfileType) && (tiff.number(ifd1[NewSubfileType]) & 1)
+        && ifd1.contains(ImageWidth) && ifd1.contains(ImageLength)
+        && qint64(tiff.number(ifd1[ImageWidth])) * tiff.number(ifd1[ImageLength]) <= 1024 * 1024;
+}
+
+static bool isStartOfFrame(int marker)
+{
+    return marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+}
+
+/**
+ * @brief Walk the JPEG markers up to the first scan: EXIF from APP1, the ICC
+ * profile from APP2 chunks and precision x components from SOFn.
+ */
+static void parseJpeg(QFile &file, ImageMetadata &meta)
+{
+    if (!file.seek(0) || file.read(2) != QByteArray("\xFF\xD8", 2))
+        return;
+
+    QMap<int, QByteArray> icc;
+    bool exif = false;
+    char c = 0;
+    while (file.getChar(&c)) {
+        if (quint8(c) != 0xFF)
+            continue;
+        while (file.getChar(&c) && quint8(c) == 0xFF) {} // fill bytes
+        const int marker = quint8(c);
+        if (marker == 0xD9 || marker == 0xDA)
+            break; // pixels start here
+        if ((marker >= 0xD0 && marker <= 0xD7) || marker == 0x01 || marker == 0x00)
+            continue;
+
+        const QByteArray lengthBytes = file.read(2);
+        if (lengthBytes.size() < 2)
+            break;
+        const int length = qFromBigEndian<quint16>(lengthBytes.constData()) - 2;
+        if (length < 0)
+            break;
+        const qint64 next = file.pos() + length;
+
+        if (marker == 0xE1 || marker == 0xE2 || isStartOfFrame(marker)) {
+            const QByteArray payload = file.read(length);
+            if (marker == 0xE1 && !exif && payload.startsWith(QByteArray("Exif\0\0", 6))) {
+                exif = true;
+                QBuffer buffer;
+                buffer.setData(payload.mid(6));
+                buffer.open(QIODevice::ReadOnly);
+                TiffReader tiff(&buffer);
+                if (tiff.open())
+                    parseTiff(tiff, meta, false);
+            } else if (marker == 0xE2 && payload.size() > 14
+                       && payload.startsWith(QByteArray("ICC_PROFILE\0", 12))) {
+                icc.insert(quint8(payload[12]), payload.mid(14));
+            } else if (isStartOfFrame(marker) && payload.size() >= 6) {
+                meta.bitDepth = quint8(payload[0]) * quint8(payload[5]);
+            }
+        }
+        if (!file.seek(next))
+            break;
+    }
+
+    for (const QByteArray &chunk : qAsConst(icc))
+        meta.iccProfile += chunk;
+}
+
+static QImage orient(const QImage &image, int orientation)
+{
+    switch (orientation) {
+    case 2: return image.mirrored(true, false);
+    case 3: return image.mirrored(true, true);
+    case 4: return image.mirrored(false, true);
+    case 5: return image.transformed(QTransform().rotate(90)).mirrored(true, false);
+    case 6: return image.transformed(QTransform().rotate(90));
+    case 7: return image.transformed(QTransform().rotate(270)).mirrored(true, false);
+    case 8: return image.transformed(QTransform().rotate(270));
+    }
+    return image;
+}
+
+ImageMetadata readImageMetadata(const QString &fileName)
+{
+    ImageMetadata meta;
+    meta.fileName = fileName;
+    const QFileInfo info(fileName);
+    meta.fileSize = info.size();
+    meta.modified = info.lastModified();
+
+    QImageReader reader(fileName);
+    if (!reader.canRead()) {
+        meta.error = reader.errorString();
+        return meta;
+    }
+    meta.format = QString::fromLatin1(reader.format());
+    meta.size = reader.size();
+    meta.imageCount = qMax(1, reader.imageCount());
+    const QImage::Format format = reader.imageFormat();
+    if (format != QImage::Format_Invalid)
+        meta.bitDepth = QImage::toPixelFormat(format).bitsPerPixel();
+
+    QFile file(fileName);
+    bool reducedPage = false;
+    if (file.open(QIODevice::ReadOnly)) {
+        if (meta.format == "jpeg") {
+            parseJpeg(file, meta);
+        } else if (meta.format == "tiff") {
+            TiffReader tiff(&file);
+            if (tiff.open())
+                reducedPage = parseTiff(tiff, meta, true);
+        }
+    }
+    if (reducedPage) {
+        QImageReader pages(fileName);
+        if (pages.jumpToImage(1))
+            meta.thumbnail = pages.read();
+    }
+
+    if (meta.orientation >= 5)
+        meta.size.transpose();
+    if (!meta.thumbnail.isNull())
+        meta.thumbnail = orient(meta.thumbnail, meta.orientation);
+    return meta;
+}
+
+QVector<QPair<QString, QString>> describeMetadata(const ImageMetadata &meta)
+{
+    QVector<QPair<QString, QString>> rows;
+    auto add = [&rows](const char *label, const QString &value) {
+        if (!value.isEmpty())
+            rows.append(qMakePair(QCoreApplication::translate("ImageMetadata", label), value));
+    };
+    const QLocale locale;
+
+    add(QT_TRANSLATE_NOOP("ImageMetadata", "File"), QFileInfo(meta.fileName).fileName());
+    add(QT_TRANSLATE_NOOP("ImageMetadata", "Format"), meta.format.toUpper());
+    if (meta.size.isValid())
+        add(QT_TRANSLATE_NOOP("ImageMetadata", "Dimensions"),
+            QStringLiteral("%1 x %2").arg(meta.size.width()).arg(meta.size.height()));
+    if (meta.bitDepth > 0)
+        add(QT_TRANSLATE_NOOP("ImageMetadata", "Bit depth"), QString::number(meta.bitDepth));
+    if (meta.imageCount > 1)
+        add(QT_TRANSLATE_NOOP("ImageMetadata", "Frames"), QString::number(meta.imageCount));
+    add(QT_TRANSLATE_NOOP("ImageMetadata", "File size"), locale.formattedDataSize(meta.fileSize));
+    add(QT_TRANSLATE_NOOP("ImageMetadata", "Modified"), meta.modified.toString(Qt::ISODate));
+    add(QT_TRANSLATE_NOOP("ImageMetadata", "Camera"), QStringList({meta.make, meta.model}).join(' ').trimmed());
+    add(QT_TRANSLATE_NOOP("ImageMetadata", "Taken"), meta.dateTimeOriginal);
+    add(QT_TRANSLATE_NOOP("ImageMetadata", "Date/time"), meta.dateTime);
+    add(QT_TRANSLATE_NOOP("ImageMetadata", "Exposure"), meta.exposureTime);
+    add(QT_TRANSLATE_NOOP("ImageMetadata", "Aperture"), meta.fNumber);
+    add(QT_TRANSLATE_NOOP("ImageMetadata", "ISO"), meta.iso);
+    add(QT_TRANSLATE_NOOP("ImageMetadata", "Focal length"), meta.focalLength);
+    if (meta.orientation != 1)
+        add(QT_TRANSLATE_NOOP("ImageMetadata", "Orientation"), QString::number(meta.orientation));
+    if (!meta.iccProfile.isEmpty()) {
+        QString icc = locale.formattedDataSize(meta.iccProfile.size());
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+        const QColorSpace space = QColorSpace::fromIccProfile(meta.iccProfile);
+        if (space.isValid() && !space.description().isEmpty())
+            icc = QStringLiteral("%1 (%2)").arg(space.description(), icc);
+#endif
+        add(QT_TRANSLATE_NOOP("ImageMetadata", "ICC profile"), icc);
+    }
+    if (!meta.thumbnail.isNull())
+        add(QT_TRANSLATE_NOOP("ImageMetadata", "Thumbnail"),
+            QStringLiteral("%1 x %2").arg(meta.thumbnail.width()).arg(meta.thumbnail.height()));
+    return rows;
+}
@@ -0,0 +1,51 @@
+#ifndef IMAGEMETADATA_H
+#define IMAGEMETADATA_H
+
+#include <QDateTime>
+#include <QImage>
+#include <QPair>
+#include <QSize>
+#include <QString>
+#include <QVector>
+
+/**
+ * @brief What can be known about an image file without decoding its pixels.
+ *
+ * JPEG markers up to the first scan and TIFF/EXIF IFDs are parsed directly,
+ * everything else comes from QImageReader's header queries. The embedded
+ * EXIF thumbnail (or a TIFF reduced-resolution page) is decoded since it is
+ * only a few kilobytes.
+ */
+struct ImageMetadata
+{
+    QString fileName;
+    QString format;
+    QSize size;          // after EXIF orientation
+    int bitDepth = 0;    // bits per pixel as stored, 0 if unknown
+    int imageCount = 1;
+    qint64 fileSize = 0;
+    QDateTime modified;
+    int orientation = 1; // EXIF orientation, 1 is upright
+    QString make;
+    QString model;
+    QString dateTime;
+    QString dateTimeOriginal;
+    QString exposureTime;
+    QString fNumber;
+    QString iso;
+    QString focalLength;
+    QByteArray iccProfile;
+    QImage thumbnail;    // already oriented like the full image
+    QString error;
+
+    bool isValid() const { return error.isEmpty(); }
+};
+
+ImageMetadata readImageMetadata(const QString &fileName);
+
+/**
+ * @brief Human readable (label, value) rows of the non-empty fields
+ */
+QVector<QPair<QString, QString>> describeMetadata(const ImageMetadata &meta);
+
+#endif // IMAGEMETADATA_H
@@ -1,68 +1,9 @@
 #include <math.h>
+#include <string.h>
 #include <emmintrin.h>
 #include "imageopstask.h"
-
-
-QImage splitRGBImage(const QImage &inputImage)
-{
-    if (!inputImage.isGrayscale()) {
-        QImage src = inputImage.convertToFormat(QImage::Format_RGB888);
-        int width, height;
-        if (src.width() < 2 * src.height()) {
-            width = 3 * src.width();
-            height = src.height();
-            QImage buf(width, height, QImage::Format_Grayscale8);
-            for (int y = 0; y < src.height(); y++) {
-                unsigned char* src_ptr = src.scanLine(y);
-                unsigned char* dst_ptr = buf.scanLine(y);
-                int offset_x = src.width();
-                for (int x = 0, idx = 0; x < src.width(); x++, idx += 3) {
-                    dst_ptr[x] = src_ptr[idx];
-                    dst_ptr[x + offset_x] = src_ptr[idx + 1];
-                    dst_ptr[x + offset_x + offset_x] = src_ptr[idx + 2];
-                }
-            }
-            return buf;
-        } else {
-            width = src.width();
-            height= 3 * src.height();
-            QImage buf(width, height, QImage::Format_Grayscale8);
-            for (int y = 0; y < src.height(); y++) {
-                unsigned char* src_ptr = src.scanLine(y);
-                unsigned char* dst_chn1_ptr = buf.scanLine(y);
-                unsigned char* dst_chn2_ptr = buf.scanLine(y + src.height());
-                unsigned char* dst_chn3_ptr = buf.scanLine(y + 2 * src.height());
-                for (int x = 0, idx = 0; x < src.width(); x++, idx += 3) {
-                    dst_chn1_ptr[x] = src_ptr[idx];
-                    dst_chn2_ptr[x] = src_ptr[idx + 1];
-                    dst_chn3_ptr[x] = src_ptr[idx + 2];
-                }
-            }
-            return buf;
-        }
-    } else {
-        return inputImage;
-    }
-}
-
-
-SplitRGBImageTask::SplitRGBImageTask(QObject *parent)
-    :QObject(parent)
-{
-
-}
-
-void SplitRGBImageTask::setImage(QImage inputImage)
-{
-    image = inputImage;
-}
-
-void SplitRGBImageTask::run()
-{
-    QImage buf = splitRGBImage(image);
-    emit resultReady(QPixmap::fromImage(buf));
-    emit workFinished();
-}
+#include "framedecoder.h"
+#include "parallelfor.h"
 
 /** rgb2lab function from colorspace.c
  * @url https://getreuer.info/posts/colorspace/index.html
@@ -74,14 +15,6 @@ void SplitRGBImageTask::run()
 #define WHITEPOINT_Y	1.0
 #define WHITEPOINT_Z	1.088754
 
-/**
- * @brief sRGB gamma correction, transforms R to R'
- * http://en.wikipedia.org/wiki/SRGB
- */
-#define GAMMACORRECTION(t)	\
-    (((t) <= 0.0031306684425005883) ? \
-    (12.92*(t)) : (1.055*pow((t), 0.416666666666666667) - 0.055))
-
 /**
  * @brief Inverse sRGB gamma correction, transforms R' to R
  */
@@ -89,119 +22,288 @@ void SplitRGBImageTask::run()
     (((t) <= 0.0404482362771076) ? \
     ((t)/12.92) : pow(((t) + 0.055)/1.055, 2.4))
 
+/**
+ * @brief Cube root of t > 0: a guess from the exponent bits, then two Halley
+ * steps. Matches cbrt() to ~1e-14 over the range of LABF, so every 8-bit
+ * Lab value is the same, at well under half the cost.
+ */
+static inline double fastCbrt(double t)
+{
+    quint64 bits;
+    memcpy(&bits, &t, sizeof(bits));
+    bits = bits / 3 + 0x2A9F7893782DA1CEull;
+    double y;
+    memcpy(&y, &bits, sizeof(y));
+    double y3 = y * y * y;
+    y = y * (y3 + 2 * t) / (2 * y3 + t);
+    y3 = y * y * y;
+    return y * (y3 + 2 * t) / (2 * y3 + t);
+}
+
 /**
  * @brief CIE L*a*b* f function (used to convert XYZ to L*a*b*)
  * http://en.wikipedia.org/wiki/Lab_color_space
  */
 #define LABF(t)	\
     ((t >= 8.85645167903563082e-3) ? \
-    pow(t,0.333333333333333) : (841.0/108.0)*(t) + (4.0/29.0))
+    fastCbrt(t) : (841.0/108.0)*(t) + (4.0/29.0))
+
+#define MATH_CAST_8U(t)  (unsigned char)(!((t) & ~255) ? (t) : (t) > 0 ? 255 : 0)
+static inline int math_round (double x)
+{
+    return _mm_cvtsd_si32(_mm_set_sd(x));
+}
 
 /**
- * @brief CIE L*a*b* inverse f function
- * http://en.wikipedia.org/wiki/Lab_color_space
+ * @brief Linear light of the 256 sRGB code values, input is 8-bit so the
+ * table is exact and saves a pow() per channel.
  */
-#define LABINVF(t)	\
-    ((t >= 0.206896551724137931) ? \
-    ((t)*(t)*(t)) : (108.0/841.0)*((t) - (4.0/29.0)))
-
-void rgb2xyz(double *X, double *Y, double *Z, double R, double G, double B)
-{
-    R = INVGAMMACORRECTION(R);
-    G = INVGAMMACORRECTION(G);
-    B = INVGAMMACORRECTION(B);
-    *X = (double)(0.4123955889674142161*R + 0.3575834307637148171*G + 0.1804926473817015735*B);
-    *Y = (double)(0.2125862307855955516*R + 0.7151703037034108499*G + 0.07220049864333622685*B);
-    *Z = (double)(0.01929721549174694484*R + 0.1191838645808485318*G + 0.9504971251315797660*B);
+static const double *linearTable()
+{
+    static const struct Table {
+        double v[256];
+        Table() {
+            for (int i = 0; i < 256; i++)
+                v[i] = INVGAMMACORRECTION(i / 255.0);
+        }
+    } table;
+    return table.v;
 }
 
-void xyz2lab(double *L, double *a, double *b, double X, double Y, double Z)
-{
-    X /= WHITEPOINT_X;
-    Y /= WHITEPOINT_Y;
-    Z /= WHITEPOINT_Z;
-    X = LABF(X);
-    Y = LABF(Y);
-    Z = LABF(Z);
-    *L = 116*Y - 16;
-    *a = 500*(X - Y);
-    *b = 200*(Y - Z);
+/**
+ * Per-pixel transforms. Each one is a stateless struct with a static inline
+ * convert() so that splitChannels() below is instantiated with the transform
+ * inlined into its inner loop.
+ */
+struct RGBSpace
+{
+    static inline void convert(uchar r, uchar g, uchar b, uchar &c0, uchar &c1, uchar &c2)
+    {
+        c0 = r; c1 = g; c2 = b;
+    }
+};
+
+struct LabSpace
+{
+    static inline void convert(uchar r, uchar g, uchar b, uchar &c0, uchar &c1, uchar &c2)
+    {
+        const double *lin = linearTable();
+        const double R = lin[r], G = lin[g], B = lin[b];
+        double X = (0.4123955889674142161*R + 0.3575834307637148171*G + 0.1804926473817015735*B) / WHITEPOINT_X;
+        double Y = (0.2125862307855955516*R + 0.7151703037034108499*G + 0.07220049864333622685*B) / WHITEPOINT_Y;
+        double Z = (0.01929721549174694484*R + 0.1191838645808485318*G + 0.9504971251315797660*B) / WHITEPOINT_Z;
+        X = LABF(X);
+        Y = LABF(Y);
+        Z = LABF(Z);
+        const double L = 116*Y - 16;
+        const double a = 500*(X - Y);
+        const double bb = 200*(Y - Z);
+        c0 = MATH_CAST_8U(math_round(L * 255 / 100));
+        c1 = MATH_CAST_8U(math_round(a + 128));
+        c2 = MATH_CAST_8U(math_round(bb + 128));
+    }
+};
+
+struct HSVSpace
+{
+    /// H is scaled from [0, 360) to [0, 255]
+    static inline void convert(uchar r, uchar g, uchar b, uchar &c0, uchar &c1, uchar &c2)
+    {
+        const int v = qMax(r, qMax(g, b));
+        const int diff = v - qMin(r, qMin(g, b));
+        int h = 0;
+        if (diff != 0) {
+            if (v == r)
+                h = 60 * (g - b) / diff;
+            else if (v == g)
+                h = 120 + 60 * (b - r) / diff;
+            else
+                h = 240 + 60 * (r - g) / diff;
+            if (h < 0)
+                h += 360;
+        }
+        c0 = uchar(h * 255 / 360);
+        c1 = uchar(v == 0 ? 0 : (diff * 255 + v / 2) / v);
+        c2 = uchar(v);
+    }
+};
+
+/**
+ * Full range YCbCr in 16.16 fixed point, integer only so the compiler can
+ * vectorize the loop.
+ */
+template <int KR, int KG, int KB, int CB_R, int CB_G, int CR_G, int CR_B>
+struct YCbCrSpace
+{
+    static inline void convert(uchar r, uchar g, uchar b, uchar &c0, uchar &c1, uchar &c2)
+    {
+        const int half = 1 << 15;
+        const int y = (KR * r + KG * g + KB * b + half) >> 16;
+        const int cb = (128 << 16) + (-CB_R * r - CB_G * g + (1 << 15) * b) + half;
+        const int cr = (128 << 16) + ((1 << 15) * r - CR_G * g - CR_B * b) + half;
+        c0 = MATH_CAST_8U(y);
+        c1 = MATH_CAST_8U(cb >> 16);
+        c2 = MATH_CAST_8U(cr >> 16);
+    }
+};
+
+// BT.601: Kr 0.299, Kb 0.114
+typedef YCbCrSpace<19595, 38470, 7471, 11058, 21710, 27439, 5329> YCbCr601Space;
+// BT.709: Kr 0.2126, Kb 0.0722
+typedef YCbCrSpace<13933, 46871, 4732, 7509, 25259, 29763, 3005> YCbCr709Space;
+
+struct XYZSpace
+{
+    /// each axis is normalised so the D65 white point maps to 255
+    static inline void convert(uchar r, uchar g, uchar b, uchar &c0, uchar &c1, uchar &c2)
+    {
+        const double *lin = linearTable();
+        const double R = lin[r], G = lin[g], B = lin[b];
+        const double X = 0.4123955889674142161*R + 0.3575834307637148171*G + 0.1804926473817015735*B;
+        const double Y = 0.2125862307855955516*R + 0.7151703037034108499*G + 0.07220049864333622685*B;
+        const double Z = 0.01929721549174694484*R + 0.1191838645808485318*G + 0.9504971251315797660*B;
+        c0 = MATH_CAST_8U(math_round(X * 255 / WHITEPOINT_X));
+        c1 = MATH_CAST_8U(math_round(Y * 255 / WHITEPOINT_Y));
+        c2 = MATH_CAST_8U(math_round(Z * 255 / WHITEPOINT_Z));
+    }
+};
+
+/**
+ * @brief Split an RGB888 image into three planes of Space, plane c starting
+ * at @a planes[c] with @a bpl[c] bytes per line. Rows run in parallel
+ * unless the caller is parallel already.
+ */
+template <class Space>
+static void splitChannels(const QImage &src, uchar *const planes[3], const qsizetype bpl[3], bool parallel)
+{
+    const int width = src.width();
+    auto rows = [&](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            const uchar *src_ptr = src.constScanLine(y);
+            uchar *dst_chn1_ptr = planes[0] + y * bpl[0];
+            uchar *dst_chn2_ptr = planes[1] + y * bpl[1];
+            uchar *dst_chn3_ptr = planes[2] + y * bpl[2];
+            for (int x = 0, idx = 0; x < width; x++, idx += 3) {
+                Space::convert(src_ptr[idx], src_ptr[idx + 1], src_ptr[idx + 2],
+                               dst_chn1_ptr[x], dst_chn2_ptr[x], dst_chn3_ptr[x]);
+            }
+        }
+    };
+    if (parallel)
+        parallelFor(src.height(), 32, rows);
+    else
+        rows(0, src.height());
 }
 
-void rgb2lab(double *L, double *a, double *b, double R, double G, double B)
+typedef void (*SplitKernel)(const QImage &, uchar *const [3], const qsizetype [3], bool);
+
+static SplitKernel splitKernel(ColorSpace space)
 {
-    double X, Y, Z;
-    rgb2xyz(&X, &Y, &Z, R, G, B);
-    xyz2lab(L, a, b, X, Y, Z);
+    switch (space) {
+    case ColorSpace::RGB:
+        return splitChannels<RGBSpace>;
+    case ColorSpace::Lab:
+        return splitChannels<LabSpace>;
+    case ColorSpace::HSV:
+        return splitChannels<HSVSpace>;
+    case ColorSpace::YCbCr601:
+        return splitChannels<YCbCr601Space>;
+    case ColorSpace::YCbCr709:
+        return splitChannels<YCbCr709Space>;
+    case ColorSpace::XYZ:
+        return splitChannels<XYZSpace>;
+    }
+    return splitChannels<RGBSpace>;
 }
 
-#define MATH_CAST_8U(t)  (unsigned char)(!((t) & ~255) ? (t) : (t) > 0 ? 255 : 0)
-static inline int math_round (double x)
+QImage splitColorSpace(const QImage &inputImage, ColorSpace space)
 {
-    return _mm_cvtsd_si32(_mm_set_sd(x));
+    if (inputImage.isGrayscale())
+        return inputImage;
+
+    const QImage src = inputImage.convertToFormat(QImage::Format_RGB888);
+    const int width = src.width();
+    const int height = src.height();
+    // stacked planes for wide images, otherwise side by side
+    const bool stacked = width >= 2 * height;
+    QImage buf(stacked ? width : 3 * width, stacked ? 3 * height : height, QImage::Format_Grayscale8);
+    if (buf.isNull())
+        return buf;
+
+    uchar *bits = buf.bits();
+    const qsizetype bpl = buf.bytesPerLine();
+    uchar *const planes[3] = {
+        bits,
+        stacked ? bits + height * bpl : bits + width,
+        stacked ? bits + 2 * height * bpl : bits + 2 * width
+    };
+    const qsizetype planeBpl[3] = {bpl, bpl, bpl};
+    splitKernel(space)(src, planes, planeBpl, true);
+    return buf;
 }
 
-QImage splitLabImageTask(const QImage &inputImage)
-{
-    if (!inputImage.isGrayscale()) {
-        double L, a, b;
-        QImage src = inputImage.convertToFormat(QImage::Format_RGB888);
-        int width, height;
-        if (src.width() < 2 * src.height()) {
-            width = 3 * src.width();
-            height = src.height();
-            QImage buf(width, height, QImage::Format_Grayscale8);
-            for (int y = 0; y < src.height(); y++) {
-                unsigned char* src_ptr = src.scanLine(y);
-                unsigned char* dst_ptr = buf.scanLine(y);
-                int offset_x = src.width();
-                for (int x = 0, idx = 0; x < src.width(); x++, idx += 3) {
-                    rgb2lab(&L, &a, &b,
-                            src_ptr[idx]/255.0, src_ptr[idx + 1]/255.0, src_ptr[idx + 2]/255.0);
-                    dst_ptr[x] = MATH_CAST_8U(math_round(L * 255 / 100));
-                    dst_ptr[x + offset_x] = MATH_CAST_8U(math_round(a + 128));
-                    dst_ptr[x + offset_x + offset_x] = MATH_CAST_8U(math_round(b + 128));
-                }
-            }
-            return buf;
-        } else {
-            width = src.width();
-            height= 3 * src.height();
-            QImage buf(width, height, QImage::Format_Grayscale8);
-            for (int y = 0; y < src.height(); y++) {
-                unsigned char* src_ptr = src.scanLine(y);
-                unsigned char* dst_chn1_ptr = buf.scanLine(y);
-                unsigned char* dst_chn2_ptr = buf.scanLine(y + src.height());
-                unsigned char* dst_chn3_ptr = buf.scanLine(y + 2 * src.height());
-                for (int x = 0, idx = 0; x < src.width(); x++, idx += 3) {
-                    rgb2lab(&L, &a, &b,
-                            src_ptr[idx]/255.0, src_ptr[idx + 1]/255.0, src_ptr[idx + 2]/255.0);
-                    dst_chn1_ptr[x] = MATH_CAST_8U(math_round(L * 255 / 100));
-                    dst_chn2_ptr[x] = MATH_CAST_8U(math_round(a + 128));
-                    dst_chn3_ptr[x] = MATH_CAST_8U(math_round(b + 128));
-                }
-            }
-            return buf;
+void splitColorPlanes(const QImage &inputImage, ColorSpace space, QImage planes[3])
+{
+    const QImage src = inputImage.convertToFormat(QImage::Format_RGB888);
+    uchar *bits[3];
+    qsizetype bpl[3];
+    for (int c = 0; c < 3; c++) {
+        planes[c] = QImage(src.size(), QImage::Format_Grayscale8);
+        if (planes[c].isNull()) {
+            planes[0] = planes[1] = planes[2] = QImage();
+            return;
         }
-    } else {
-        return inputImage;
+        bits[c] = planes[c].bits();
+        bpl[c] = planes[c].bytesPerLine();
     }
+    splitKernel(space)(src, bits, bpl, false);
 }
 
-SplitLabImageTask::SplitLabImageTask(QObject *parent)
+QStringList channelNames(ColorSpace space)
+{
+    switch (space) {
+    case ColorSpace::RGB:
+        return {"R", "G", "B"};
+    case ColorSpace::Lab:
+        return {"L", "a", "b"};
+    case ColorSpace::HSV:
+        return {"H", "S", "V"};
+    case ColorSpace::YCbCr601:
+    case ColorSpace::YCbCr709:
+        return {"Y", "Cb", "Cr"};
+    case ColorSpace::XYZ:
+        return {"X", "Y", "Z"};
+    }
+    return {"R", "G", "B"};
+}
+
+
+SplitColorSpaceTask::SplitColorSpaceTask(QObject *parent)
     :QObject(parent)
+    , space(ColorSpace::RGB)
+    , displayFormat(false)
 {
 
 }
 
-void SplitLabImageTask::setImage(QImage inputImage)
+void SplitColorSpaceTask::setImage(QImage inputImage)
 {
     image = inputImage;
 }
 
-void SplitLabImageTask::run()
+void SplitColorSpaceTask::setColorSpace(ColorSpace space)
+{
+    this->space = space;
+}
+
+void SplitColorSpaceTask::setDisplayFormat(bool enable)
+{
+    displayFormat = enable;
+}
+
+void SplitColorSpaceTask::run()
 {
-    QImage buf = splitLabImageTask(image);
-    emit resultReady(QPixmap::fromImage(buf));
+    QImage buf = splitColorSpace(image, space);
+    emit resultReady(buf, displayFormat ? toDisplayFormat(buf) : QImage());
     emit workFinished();
 }
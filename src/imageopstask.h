@@ -4,40 +4,53 @@
 #include <QObject>
 #include <QImage>
 #include <QPixmap>
+#include <QStringList>
 
-QImage splitRGBImage(const QImage &inputImage);
-
-class SplitRGBImageTask : public QObject
+enum class ColorSpace
 {
-    Q_OBJECT
-public:
-    SplitRGBImageTask(QObject *parent = nullptr);
-    void setImage(QImage inputImage);
-public slots:
-    void run();
-signals:
-    void resultReady(QPixmap RGBPix);
-    void workFinished();
-private:
-    QImage image;
+    RGB,
+    Lab,
+    HSV,
+    YCbCr601,
+    YCbCr709,
+    XYZ
 };
 
-QImage splitLabImageTask(const QImage &inputImage);
+/**
+ * @brief Split a colour image into three 8-bit channel planes of @a space,
+ * side by side (or stacked for wide images) in one Format_Grayscale8 buffer.
+ * Grayscale images are returned unchanged.
+ */
+QImage splitColorSpace(const QImage &inputImage, ColorSpace space);
+
+/**
+ * @brief The three channels of @a space as separate Format_Grayscale8
+ * planes of the size of @a inputImage. Single threaded, meant for tiles
+ * that are computed in parallel by the caller.
+ */
+void splitColorPlanes(const QImage &inputImage, ColorSpace space, QImage planes[3]);
+
+/// short names of the three channels of @a space, e.g. "L", "a", "b"
+QStringList channelNames(ColorSpace space);
 
-class SplitLabImageTask : public QObject
+class SplitColorSpaceTask : public QObject
 {
     Q_OBJECT
 public:
-    SplitLabImageTask(QObject *parent = nullptr);
+    SplitColorSpaceTask(QObject *parent = nullptr);
     void setImage(QImage inputImage);
+    void setColorSpace(ColorSpace space);
+    /// also emit the result as RGB32, converted here rather than in QPixmap
+    void setDisplayFormat(bool enable);
 public slots:
     void run();
 signals:
-    void resultReady(QPixmap RGBPix);
+    void resultReady(QImage result, QImage display); /// display is null unless asked for
     void workFinished();
 private:
     QImage image;
-    double r, g;
+    ColorSpace space;
+    bool displayFormat;
 };
 
 #endif // IMAGEOPSTASK_H
@@ -0,0 +1,217 @@
+#include <math.h>
+#include "imagestats.h"
+#include "parallelfor.h"
+
+
+IntegralImage::IntegralImage(const QImage &image)
+{
+    if (image.isNull())
+        return;
+
+    key_ = image.cacheKey();
+    if (image.isGrayscale()) {
+        src_ = image.convertToFormat(QImage::Format_Grayscale8);
+        channels_ = 1;
+    } else {
+        src_ = image.convertToFormat(QImage::Format_RGB888);
+        channels_ = 3;
+    }
+
+    const int w = src_.width();
+    const int h = src_.height();
+    const int ch = channels_;
+    stride_ = size_t(w + 1) * ch;
+    const quint64 pixels = quint64(w) * h;
+    if (pixels * 255 * 255 <= 0xffffffffu)
+        accumulate(sum32_, sqsum32_);
+    else if (pixels * 255 <= 0xffffffffu)
+        accumulate(sum32_, sqsum64_);
+    else
+        accumulate(sum64_, sqsum64_);
+
+    // tile min/max summary
+    tiles_x_ = (w + kTileSize - 1) / kTileSize;
+    tiles_y_ = (h + kTileSize - 1) / kTileSize;
+    tile_min_.assign(size_t(tiles_x_) * tiles_y_ * ch, 255);
+    tile_max_.assign(size_t(tiles_x_) * tiles_y_ * ch, 0);
+    parallelFor(tiles_y_, 4, [&](int begin, int end) {
+        for (int ty = begin; ty < end; ty++) {
+            const int y_end = qMin(h, (ty + 1) * kTileSize);
+            for (int y = ty * kTileSize; y < y_end; y++) {
+                const uchar *src_ptr = src_.constScanLine(y);
+                for (int x = 0; x < w; x++) {
+                    const size_t t = (size_t(ty) * tiles_x_ + x / kTileSize) * ch;
+                    for (int c = 0; c < ch; c++) {
+                        const uchar v = src_ptr[x * ch + c];
+                        tile_min_[t + c] = qMin(tile_min_[t + c], v);
+                        tile_max_[t + c] = qMax(tile_max_[t + c], v);
+                    }
+                }
+            }
+        }
+    });
+}
+
+template <typename S, typename Q>
+void IntegralImage::accumulate(std::vector<S> &sum, std::vector<Q> &sqsum)
+{
+    const int w = src_.width();
+    const int h = src_.height();
+    const int ch = channels_;
+    sum.assign(stride_ * (h + 1), 0);
+    sqsum.assign(stride_ * (h + 1), 0);
+
+    // pass 1: running sums along each row, rows are independent
+    parallelFor(h, 64, [&](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            const uchar *src_ptr = src_.constScanLine(y);
+            S *s = &sum[(y + 1) * stride_ + ch];
+            Q *q = &sqsum[(y + 1) * stride_ + ch];
+            S acc[3] = {0, 0, 0};
+            Q acc_sq[3] = {0, 0, 0};
+            for (int x = 0, idx = 0; x < w; x++) {
+                for (int c = 0; c < ch; c++, idx++) {
+                    const S v = src_ptr[idx];
+                    acc[c] += v;
+                    acc_sq[c] += Q(v) * v;
+                    s[idx] = acc[c];
+                    q[idx] = acc_sq[c];
+                }
+            }
+        }
+    });
+
+    // pass 2: accumulate down the columns, split into column bands
+    parallelFor(int(stride_), 4096, [&](int begin, int end) {
+        for (int y = 2; y <= h; y++) {
+            S *s = &sum[y * stride_];
+            const S *s_prev = &sum[(y - 1) * stride_];
+            Q *q = &sqsum[y * stride_];
+            const Q *q_prev = &sqsum[(y - 1) * stride_];
+            for (int i = begin; i < end; i++) {
+                s[i] += s_prev[i];
+                q[i] += q_prev[i];
+            }
+        }
+    });
+}
+
+template <typename T>
+quint64 IntegralImage::area(const std::vector<T> &table,
+                            int x0, int y0, int x1, int y1, int c) const
+{
+    // unsigned wrap-around cancels out, the result is exact
+    return T(table[y1 * stride_ + x1 * channels_ + c]
+           - table[y0 * stride_ + x1 * channels_ + c]
+           - table[y1 * stride_ + x0 * channels_ + c]
+           + table[y0 * stride_ + x0 * channels_ + c]);
+}
+
+quint64 IntegralImage::sumArea(int x0, int y0, int x1, int y1, int c) const
+{
+    return sum64_.empty() ? area(sum32_, x0, y0, x1, y1, c) : area(sum64_, x0, y0, x1, y1, c);
+}
+
+quint64 IntegralImage::sqsumArea(int x0, int y0, int x1, int y1, int c) const
+{
+    return sqsum64_.empty() ? area(sqsum32_, x0, y0, x1, y1, c) : area(sqsum64_, x0, y0, x1, y1, c);
+}
+
+bool IntegralImage::mean(const QRect &roi, double *values) const
+{
+    const QRect r = roi.normalized() & rect();
+    if (isNull() || r.isEmpty())
+        return false;
+
+    const double n = double(r.width()) * r.height();
+    for (int c = 0; c < channels_; c++)
+        values[c] = sumArea(r.left(), r.top(), r.right() + 1, r.bottom() + 1, c) / n;
+    return true;
+}
+
+void IntegralImage::scanMinMax(const QRect &r, int *mn, int *mx) const
+{
+    for (int y = r.top(); y <= r.bottom(); y++) {
+        const uchar *src_ptr = src_.constScanLine(y);
+        for (int x = r.left(); x <= r.right(); x++) {
+            for (int c = 0; c < channels_; c++) {
+                const int v = src_ptr[x * channels_ + c];
+                mn[c] = qMin(mn[c], v);
+                mx[c] = qMax(mx[c], v);
+            }
+        }
+    }
+}
+
+RegionStats IntegralImage::stats(const QRect &roi) const
+{
+    RegionStats st;
+    const QRect r = roi.normalized() & rect();
+    if (isNull() || r.isEmpty())
+        return st;
+
+    const int x0 = r.left(), y0 = r.top(), x1 = r.right() + 1, y1 = r.bottom() + 1;
+    const double n = double(r.width()) * r.height();
+    st.channels = channels_;
+    st.count = qint64(r.width()) * r.height();
+    for (int c = 0; c < channels_; c++) {
+        const double m = sumArea(x0, y0, x1, y1, c) / n;
+        const double var = sqsumArea(x0, y0, x1, y1, c) / n - m * m;
+        st.mean[c] = m;
+        st.stddev[c] = sqrt(qMax(0.0, var));
+        st.min[c] = 255;
+        st.max[c] = 0;
+    }
+
+    // tiles completely inside the region come from the summary
+    const int tx0 = (x0 + kTileSize - 1) / kTileSize, tx1 = x1 / kTileSize;
+    const int ty0 = (y0 + kTileSize - 1) / kTileSize, ty1 = y1 / kTileSize;
+    if (tx0 >= tx1 || ty0 >= ty1) {
+        scanMinMax(r, st.min, st.max);
+        return st;
+    }
+
+    for (int ty = ty0; ty < ty1; ty++) {
+        for (int tx = tx0; tx < tx1; tx++) {
+            const size_t t = (size_t(ty) * tiles_x_ + tx) * channels_;
+            for (int c = 0; c < channels_; c++) {
+                st.min[c] = qMin(st.min[c], int(tile_min_[t + c]));
+                st.max[c] = qMax(st.max[c], int(tile_max_[t + c]));
+            }
+        }
+    }
+
+    // only the unaligned border is scanned
+    const int ix0 = tx0 * kTileSize, ix1 = tx1 * kTileSize;
+    const int iy0 = ty0 * kTileSize, iy1 = ty1 * kTileSize;
+    const QRect border[4] = {
+        QRect(QPoint(x0, y0), QPoint(x1 - 1, iy0 - 1)),  // top
+        QRect(QPoint(x0, iy1), QPoint(x1 - 1, y1 - 1)),  // bottom
+        QRect(QPoint(x0, iy0), QPoint(ix0 - 1, iy1 - 1)), // left
+        QRect(QPoint(ix1, iy0), QPoint(x1 - 1, iy1 - 1)), // right
+    };
+    for (const QRect &b : border) {
+        if (b.isValid())
+            scanMinMax(b, st.min, st.max);
+    }
+    return st;
+}
+
+
+IntegralImageTask::IntegralImageTask(QObject *parent)
+    :QObject(parent)
+{
+
+}
+
+void IntegralImageTask::setImage(QImage inputImage)
+{
+    image = inputImage;
+}
+
+void IntegralImageTask::run()
+{
+    IntegralImagePtr integral(new IntegralImage(image));
+    emit resultReady(integral);
+    emit workFinished();
+}
@@ -0,0 +1,96 @@
+#ifndef IMAGESTATS_H
+#define IMAGESTATS_H
+
+#include <QObject>
+#include <QImage>
+#include <QSharedPointer>
+#include <vector>
+
+/**
+ * @brief Per-channel statistics of a rectangular region
+ */
+struct RegionStats
+{
+    int channels = 0;
+    qint64 count = 0;
+    double mean[3] = {0, 0, 0};
+    double stddev[3] = {0, 0, 0};
+    int min[3] = {0, 0, 0};
+    int max[3] = {0, 0, 0};
+};
+
+/**
+ * @brief Summed-area tables (sum and sum of squares) of an 8-bit image.
+ *
+ * Mean and variance of any rectangle are answered with four lookups per
+ * channel. Min/max use a coarse tile summary so that only the unaligned
+ * border of a region has to be scanned. A table is 32-bit while the sum
+ * over the whole image fits, the lookups are exact modulo 2^32 then.
+ */
+class IntegralImage
+{
+public:
+    IntegralImage() = default;
+    explicit IntegralImage(const QImage &image);
+
+    bool isNull() const { return sum32_.empty() && sum64_.empty(); }
+    qint64 cacheKey() const { return key_; }
+    int width() const { return src_.width(); }
+    int height() const { return src_.height(); }
+    int channels() const { return channels_; }
+    QRect rect() const { return src_.rect(); }
+    qint64 bytes() const
+    {
+        return qint64((sum32_.size() + sqsum32_.size()) * sizeof(quint32)
+                      + (sum64_.size() + sqsum64_.size()) * sizeof(quint64)
+                      + tile_min_.size() + tile_max_.size())
+            + (src_.cacheKey() != key_ ? src_.sizeInBytes() : 0);
+    }
+
+    bool mean(const QRect &roi, double *values) const; // O(1)
+    RegionStats stats(const QRect &roi) const;
+
+private:
+    template <typename S, typename Q>
+    void accumulate(std::vector<S> &sum, std::vector<Q> &sqsum);
+    template <typename T>
+    quint64 area(const std::vector<T> &table, int x0, int y0, int x1, int y1, int c) const;
+    quint64 sumArea(int x0, int y0, int x1, int y1, int c) const;
+    quint64 sqsumArea(int x0, int y0, int x1, int y1, int c) const;
+    void scanMinMax(const QRect &r, int *mn, int *mx) const;
+
+    static const int kTileSize = 32;
+
+    qint64 key_ = 0;
+    int channels_ = 0;
+    size_t stride_ = 0;
+    QImage src_; // Grayscale8 or RGB888
+    std::vector<quint32> sum32_; // one of each pair is used
+    std::vector<quint64> sum64_;
+    std::vector<quint32> sqsum32_;
+    std::vector<quint64> sqsum64_;
+    int tiles_x_ = 0;
+    int tiles_y_ = 0;
+    std::vector<uchar> tile_min_;
+    std::vector<uchar> tile_max_;
+};
+
+typedef QSharedPointer<const IntegralImage> IntegralImagePtr;
+Q_DECLARE_METATYPE(IntegralImagePtr)
+
+class IntegralImageTask : public QObject
+{
+    Q_OBJECT
+public:
+    IntegralImageTask(QObject *parent = nullptr);
+    void setImage(QImage inputImage);
+public slots:
+    void run();
+signals:
+    void resultReady(IntegralImagePtr integral);
+    void workFinished();
+private:
+    QImage image;
+};
+
+#endif // IMAGESTATS_H
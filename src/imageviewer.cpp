@@ -52,9 +52,12 @@
 
 #include <QApplication>
 #include <QClipboard>
+#include <QCloseEvent>
 #include <QColorSpace>
 #include <QDir>
+#include <QDockWidget>
 #include <QFileDialog>
+#include <QFileSystemWatcher>
 #include <QImageReader>
 #include <QImageWriter>
 #include <QLabel>
@@ -67,8 +70,15 @@
 #include <QScrollBar>
 #include <QStandardPaths>
 #include <QStatusBar>
+#include <QTabBar>
 #include <QSettings>
+#include <QSlider>
 #include <QProgressBar>
+#include <QThread>
+#include <QTimer>
+#include <QTreeWidget>
+#include <QVBoxLayout>
+#include <algorithm>
 
 #if defined(QT_PRINTSUPPORT_LIB)
 #  include <QtPrintSupport/qtprintsupportglobal.h>
@@ -79,18 +89,39 @@
 #endif
 
 #include "imageopstask.h"
+#include "startupreport.h"
+#include "colormap.h"
+#include "printtask.h"
+#include "decodecache.h"
+#include "demosaic.h"
 
-ImageViewer::ImageViewer(QWidget *parent)
+ImageViewer::ImageViewer(QWidget *parent, QSettings *settings)
    : QMainWindow(parent)
-   , imageViewer(new QImageViewer(nullptr))
+   , imageViewer(nullptr)
    , imgPixVal(nullptr)
 {
+    if (settings) {
+        setting = settings;
+        setting->setParent(this);
+    } else {
+        setting = new QSettings(
+            QSettings::NativeFormat,
+            QSettings::UserScope,
+            "HF_AIO", "ImageViewer",
+            this);
+    }
+
+    imageViewer = new QImageViewer(nullptr, setting->value("use_opengl", false).toBool());
+    connect(imageViewer, &QImageViewer::taskStarted, this, &ImageViewer::countTask);
     imageViewer->setFrameStyle(QFrame::NoFrame);
-    setting = new QSettings(
-        QSettings::NativeFormat,
-        QSettings::UserScope,
-        "HF_AIO", "ImageViewer",
-        this);
+    if (setting->contains("viewport_update_mode")) {
+        imageViewer->setViewportUpdateMode(
+            QGraphicsView::ViewportUpdateMode(setting->value("viewport_update_mode").toInt()));
+    }
+
+    channelView = new ChannelView(nullptr, setting->value("use_opengl", false).toBool());
+    channelView->setCacheLimit(setting->value("channel_cache_mb", 256).toInt());
+    channelView->hide();
 
     progressBar = new QProgressBar(this);
     progressBar->setFixedSize(200, 16);
@@ -105,23 +136,185 @@ ImageViewer::ImageViewer(QWidget *parent)
     imgPixVal->setFont(QFont("Arial", 10));
     imgPixVal->hide();
 
-    setCentralWidget(imageViewer);
+    roiStats = new QLabel(this);
+    roiStats->setToolTip(tr("Shift + drag to select a region, double click to clear"));
+    roiStats->hide();
+
+    probeWindow = setting->value("probe_window_size", 1).toInt();
+
+    memoryInfo = new QLabel(this);
+    memoryInfo->hide();
+
+    frameInfo = new QLabel(this);
+    frameInfo->hide();
+
+    maskOverlay = new MaskOverlay(imageViewer, this);
+    maskOverlay->setCacheLimit(setting->value("mask_cache_mb", 256).toInt());
+    maskOverlay->setOpacity(setting->value("mask_opacity", 50).toInt());
+    connect(maskOverlay, &MaskOverlay::taskStarted, this, &ImageViewer::countTask);
+    maskOpacity = new QSlider(Qt::Horizontal, this);
+    maskOpacity->setRange(0, 100);
+    maskOpacity->setValue(maskOverlay->opacity());
+    maskOpacity->setFixedWidth(120);
+    maskOpacity->setToolTip(tr("Mask opacity"));
+    maskOpacity->hide();
+    connect(maskOpacity, &QSlider::valueChanged, this, [this](int percent) {
+        maskOverlay->setOpacity(percent);
+        setting->setValue("mask_opacity", percent);
+    });
+
+    playTimer = new QTimer(this);
+    playTimer->setTimerType(Qt::PreciseTimer);
+    connect(playTimer, &QTimer::timeout, this, &ImageViewer::playbackTick);
+
+    // writers touch the file several times per frame, reload once they stop
+    reloadTimer = new QTimer(this);
+    reloadTimer->setSingleShot(true);
+    reloadTimer->setInterval(setting->value("watch_debounce_ms", 15).toInt());
+    connect(reloadTimer, &QTimer::timeout, this, &ImageViewer::reloadWatched);
+
+    regionGeneration.reset(new QAtomicInt(0));
+    // coalesce scrolling and zooming before asking for tiles of a virtual image
+    regionTimer = new QTimer(this);
+    regionTimer->setSingleShot(true);
+    regionTimer->setInterval(60);
+    connect(regionTimer, &QTimer::timeout, this, &ImageViewer::requestRegions);
+    regionCache.setMaxCost(setting->value("virtual_cache_mb", 512).toInt() * 1024);
+
+    ingest = new FrameIngestServer(this);
+    connect(ingest, &FrameIngestServer::frameReady, this, &ImageViewer::ingestFrameReady);
+    connect(imageViewer, &QImageViewer::painted, ingest, &FrameIngestServer::frameShown);
+    connect(ingest, &FrameIngestServer::streamStatus, this, [this](const QString &message) {
+        statusBar()->showMessage(message);
+    });
+
+    metadataView = new QTreeWidget(this);
+    metadataView->setColumnCount(2);
+    metadataView->setHeaderLabels({tr("Property"), tr("Value")});
+    metadataView->setRootIsDecorated(false);
+    metadataDock = new QDockWidget(tr("Metadata"), this);
+    metadataDock->setObjectName("metadata");
+    metadataDock->setWidget(metadataView);
+    addDockWidget(Qt::RightDockWidgetArea, metadataDock);
+    metadataDock->setVisible(setting->value("show_metadata", false).toBool());
+
+    duplicatesView = new QTreeWidget(this);
+    duplicatesView->setColumnCount(1);
+    duplicatesView->setHeaderHidden(true);
+    duplicatesDock = new QDockWidget(tr("Duplicates"), this);
+    duplicatesDock->setObjectName("duplicates");
+    duplicatesDock->setWidget(duplicatesView);
+    addDockWidget(Qt::RightDockWidgetArea, duplicatesDock);
+    duplicatesDock->hide();
+    connect(duplicatesView, &QTreeWidget::itemActivated, this, [this](QTreeWidgetItem *item) {
+        const QString path = item->data(0, Qt::UserRole).toString();
+        if (!path.isEmpty())
+            loadFile(path);
+    });
+
+    // one viewer for all documents, the tab bar only selects what it shows
+    tabBar = new QTabBar(this);
+    tabBar->setDocumentMode(true);
+    tabBar->setTabsClosable(true);
+    tabBar->setExpanding(false);
+    tabBar->hide();
+    connect(tabBar, &QTabBar::currentChanged, this, &ImageViewer::activateDocument);
+    connect(tabBar, &QTabBar::tabCloseRequested, this, &ImageViewer::closeDocument);
+
+    QWidget *central = new QWidget(this);
+    QVBoxLayout *layout = new QVBoxLayout(central);
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->setSpacing(0);
+    layout->addWidget(tabBar);
+    layout->addWidget(imageViewer);
+    layout->addWidget(channelView);
+    setCentralWidget(central);
 
     createActions();
+    updateFrameInfo();
 
     statusBar()->insertPermanentWidget(0, progressBar);
+    statusBar()->insertPermanentWidget(0, roiStats);
+    statusBar()->insertPermanentWidget(0, memoryInfo);
+    statusBar()->insertPermanentWidget(0, frameInfo);
+    statusBar()->insertPermanentWidget(0, maskOpacity);
     resize(QGuiApplication::primaryScreen()->availableSize() * 2 / 5);
 
     connect(imageViewer, &QImageViewer::pixelValueOnCursor,
         this, QOverload<int,int,int,int,int>::of(&ImageViewer::updatePixelValueOnCursor));
     connect(imageViewer, &QImageViewer::filesDropped,
             this, &ImageViewer::loadDroppedFiles);
+    connect(imageViewer, &QImageViewer::roiChanged,
+            this, &ImageViewer::updateRoiStatistics);
+    connect(imageViewer, &QImageViewer::roiCleared,
+            this, &ImageViewer::clearRoiStatistics);
+    connect(imageViewer, &QImageViewer::viewChanged,
+            regionTimer, QOverload<>::of(&QTimer::start));
+    connect(channelView, &ChannelView::pixelValueOnCursor, this, [this](int x, int y) {
+        int values[3];
+        if (x < 0 || y < 0 || !channelView->channelValues(QPoint(x, y), values))
+            updatePixelValueOnCursor(-1, -1, 0, 0, 0);
+        else
+            updatePixelValueOnCursor(x, y, values[0], values[1], values[2]);
+    });
+    connect(channelView, &ChannelView::filesDropped,
+            this, &ImageViewer::loadDroppedFiles);
+    connect(channelView, &ChannelView::taskStarted, this, &ImageViewer::countTask);
+
+    qRegisterMetaType<IntegralImagePtr>("IntegralImagePtr");
+    qRegisterMetaType<CompressedImage>("CompressedImage");
+    qRegisterMetaType<AnnotationSetPtr>("AnnotationSetPtr");
+    qRegisterMetaType<DuplicateScanResult>("DuplicateScanResult");
 
     filter = new BusyAppFilter(this);
+
+    StartupReport::watchFirstPaint(imageViewer->viewport());
 }
 
 bool ImageViewer::loadFile(const QString &fileName)
 {
+    stopWatching();
+
+    // headers only, no pixel is decoded yet
+    const ImageMetadata meta = readImageMetadata(fileName);
+    if (!meta.isValid()) {
+        QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
+                                 tr("Cannot load %1: %2")
+                                 .arg(QDir::toNativeSeparators(fileName), meta.error));
+        emit loadFinished(fileName, false);
+        return false;
+    }
+    const int serial = ++loadSerial; // a decode still in flight for this document is dropped
+
+    if (setting->value("virtual_image", false).toBool() && openVirtual(fileName, meta, serial))
+        return true; // virtualOverviewReady() emits loadFinished()
+
+    if (setting->value("decode_cache", false).toBool()) {
+        QImage proxy;
+        const QImage cached = DecodeCache::load(fileName, &proxy);
+        if (!cached.isNull()) {
+            beginDocument(fileName);
+            showMetadata(meta);
+            documents[currentDocument].loadSerial = serial;
+            imageProxy = proxy;
+            imageProxyKey = cached.cacheKey();
+            finishLoad(fileName, cached, meta.imageCount, 0);
+            statusBar()->showMessage(statusBar()->currentMessage() + tr(" (decode cache)"));
+            emit loadFinished(fileName, true);
+            return true;
+        }
+    }
+    loadClock.start();
+
+    if (!meta.thumbnail.isNull() && meta.size.isValid()) {
+        // show the embedded thumbnail now, decode the full image in the background
+        beginPendingLoad(fileName, meta, serial);
+        startImageLoad(fileName, serial);
+        statusBar()->showMessage(tr("Loading \"%1\", %2x%3 ...")
+            .arg(QDir::toNativeSeparators(fileName)).arg(meta.size.width()).arg(meta.size.height()));
+        return true; // loadedImageReady() emits loadFinished()
+    }
+
     QImageReader reader(fileName);
     reader.setAutoTransform(true);
     const QImage newImage = reader.read();
@@ -129,31 +322,701 @@ bool ImageViewer::loadFile(const QString &fileName)
         QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
                                  tr("Cannot load %1: %2")
                                  .arg(QDir::toNativeSeparators(fileName), reader.errorString()));
+        emit loadFinished(fileName, false);
         return false;
     }
+    beginDocument(fileName);
+    showMetadata(meta);
+    documents[currentDocument].loadSerial = serial;
+    finishLoad(fileName, newImage, reader.imageCount(),
+               reader.supportsAnimation() ? reader.nextImageDelay() : 0);
+    storeDecoded(fileName);
+    emit loadFinished(fileName, true);
+    return true;
+}
+
+/**
+ * @brief Make @a fileName the current document while its pixels are decoded
+ * in a task, with the embedded thumbnail of @a meta shown meanwhile.
+ */
+void ImageViewer::beginPendingLoad(const QString &fileName, const ImageMetadata &meta, int serial)
+{
+    beginDocument(fileName);
+    showMetadata(meta);
+    documents[currentDocument].loadSerial = serial;
+    pendingLoads.insert(serial, documents[currentDocument].id);
+    image = QImage();
+    displayBuffer = QImage();
+    integral.reset();
+    clearRoiStatistics();
+    stopPlayback();
+    printAct->setEnabled(false);
+    updateActions();
+    if (!meta.thumbnail.isNull() && meta.size.isValid())
+        imageViewer->displayPreview(meta.thumbnail, meta.size);
+    else
+        imageViewer->clear();
+    filePath = fileName;
+    setWindowFilePath(fileName);
+    progressBar->show();
+    progressBar->setRange(0, 0);
+}
+
+void ImageViewer::startImageLoad(const QString &fileName, int serial)
+{
+    QThread* thread = new QThread();
+    ImageLoadTask* task = new ImageLoadTask();
+    task->setFile(fileName, serial, false);
+
+    // move the task object to the thread BEFORE connecting any signal/slots
+    task->moveToThread(thread);
+
+    connect(thread, &QThread::started, task, &ImageLoadTask::run);
+    connect(task, &ImageLoadTask::workFinished, thread, &QThread::quit);
+    connect(task, &ImageLoadTask::resultReady, this, &ImageViewer::loadedImageReady);
+
+    // automatically delete thread and task object when work is done:
+    connect(task, &ImageLoadTask::workFinished, task, &ImageLoadTask::deleteLater);
+    connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+
+    startTask(thread);
+}
+
+void ImageViewer::loadedImageReady(int serial, const QImage &newImage, const QString &error)
+{
+    const int index = documentIndex(pendingLoads.take(serial));
+    if (pendingLoads.isEmpty()) {
+        progressBar->reset();
+        progressBar->hide();
+    }
+    if (index < 0 || documents[index].loadSerial != serial)
+        return; // closed, or opened again meanwhile
+    const QString fileName = documents[index].filePath;
+    if (newImage.isNull()) {
+        QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
+                                 tr("Cannot load %1: %2")
+                                 .arg(QDir::toNativeSeparators(fileName), error));
+        closeDocument(index);
+        emit loadFinished(fileName, false);
+        return;
+    }
+    if (index != currentDocument) {
+        // finished behind another tab, parked like any inactive document
+        documents[index].image = newImage;
+        compressDocuments();
+        emit loadFinished(fileName, true);
+        return;
+    }
+    finishLoad(fileName, newImage, metadata.imageCount, 0);
+    storeDecoded(fileName);
+    emit loadFinished(fileName, true);
+}
+
+void ImageViewer::storeDecoded(const QString &fileName)
+{
+    // only worth a disk write when decoding was slow
+    if (!setting->value("decode_cache", false).toBool()
+        || loadClock.elapsed() < setting->value("decode_cache_min_ms", 250).toInt())
+        return;
+
+    QThread* thread = new QThread();
+    DecodeCacheStoreTask* task = new DecodeCacheStoreTask();
+    // what the file decodes to: a mosaic is demosaiced again by setImage()
+    // after DecodeCache::load(), with the pattern and method chosen by then
+    task->setImage(fileName, bayerRaw.isNull() ? image : bayerRaw,
+                   qint64(setting->value("decode_cache_mb", 4096).toInt()) << 20);
+
+    // move the task object to the thread BEFORE connecting any signal/slots
+    task->moveToThread(thread);
+
+    connect(thread, &QThread::started, task, &DecodeCacheStoreTask::run);
+    connect(task, &DecodeCacheStoreTask::workFinished, thread, &QThread::quit);
+
+    // automatically delete thread and task object when work is done:
+    connect(task, &DecodeCacheStoreTask::workFinished, task, &DecodeCacheStoreTask::deleteLater);
+    connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+
+    startTask(thread);
+}
+
+void ImageViewer::finishLoad(const QString &fileName, const QImage &newImage, int frames, int frameDelay)
+{
     filePath = fileName;
     setImage(newImage);
 
+    frameCount = qMax(1, frames);
+    if (frameCount > 1) {
+        playbackFps = frameDelay > 0 ? qMax(1, 1000 / frameDelay)
+                                     : setting->value("playback_fps", 30).toInt();
+    }
+    updateFrameInfo();
+
     setWindowFilePath(fileName);
 
     const QString message = tr("Opened \"%1\", %2x%3, Depth: %4")
         .arg(QDir::toNativeSeparators(fileName)).arg(image.width()).arg(image.height()).arg(image.depth());
     statusBar()->showMessage(message);
+}
+
+/**
+ * @brief Open @a fileName as a virtual image if it is large enough and its
+ * format decodes clip rects, see VirtualImage. The overview is decoded in a
+ * task, virtualOverviewReady() shows it.
+ */
+bool ImageViewer::openVirtual(const QString &fileName, const ImageMetadata &meta, int serial)
+{
+    QSize size;
+    {
+        QImageReader reader(fileName);
+        size = reader.size();
+    }
+    const qint64 minPixels = qint64(setting->value("virtual_image_mpix", 100).toInt()) * 1000000;
+    if (!size.isValid() || qint64(size.width()) * size.height() < minPixels
+        || !VirtualImage::canDecodeRegions(fileName))
+        return false;
+
+    loadClock.start();
+    beginPendingLoad(fileName, meta, serial);
+
+    QThread* thread = new QThread();
+    VirtualOverviewTask* task = new VirtualOverviewTask();
+    task->setFile(fileName, size, setting->value("virtual_overview_size", 4096).toInt(), serial);
+
+    // move the task object to the thread BEFORE connecting any signal/slots
+    task->moveToThread(thread);
+
+    connect(thread, &QThread::started, task, &VirtualOverviewTask::run);
+    connect(task, &VirtualOverviewTask::workFinished, thread, &QThread::quit);
+    connect(task, &VirtualOverviewTask::resultReady, this, &ImageViewer::virtualOverviewReady);
+
+    // automatically delete thread and task object when work is done:
+    connect(task, &VirtualOverviewTask::workFinished, task, &VirtualOverviewTask::deleteLater);
+    connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+
+    statusBar()->showMessage(tr("Opening \"%1\" as a virtual image, %2x%3 ...")
+        .arg(QDir::toNativeSeparators(fileName)).arg(size.width()).arg(size.height()));
+    startTask(thread);
     return true;
 }
 
+void ImageViewer::virtualOverviewReady(int serial, QSize size, const QImage &overview)
+{
+    const int index = documentIndex(pendingLoads.value(serial));
+    if (index < 0 || documents[index].loadSerial != serial) {
+        pendingLoads.remove(serial);
+        if (pendingLoads.isEmpty()) {
+            progressBar->reset();
+            progressBar->hide();
+        }
+        return; // closed, or opened again meanwhile
+    }
+    const QString fileName = documents[index].filePath;
+    if (overview.isNull()) {
+        // try the regular way, still pending under the same serial
+        startImageLoad(fileName, serial);
+        return;
+    }
+    pendingLoads.remove(serial);
+    if (pendingLoads.isEmpty()) {
+        progressBar->reset();
+        progressBar->hide();
+    }
+    if (index != currentDocument) {
+        // finished behind another tab, parked like any inactive document
+        documents[index].image = overview;
+        documents[index].virtualSize = size;
+        compressDocuments();
+        emit loadFinished(fileName, true);
+        return;
+    }
+
+    virtualSize = size;
+    virtualKey = overview.cacheKey();
+    finishLoad(fileName, overview, 1, 0);
+    statusBar()->showMessage(tr("Opened \"%1\" as a virtual image, %2x%3, overview %4x%5 in %6 ms")
+        .arg(QDir::toNativeSeparators(fileName)).arg(size.width()).arg(size.height())
+        .arg(overview.width()).arg(overview.height()).arg(loadClock.elapsed()));
+    emit loadFinished(fileName, true);
+}
+
+void ImageViewer::requestRegions()
+{
+    if (!virtualSize.isValid() || !imageViewer->isVirtual() || image.isNull())
+        return;
+
+    // tiles only once the overview is coarser than the screen
+    const double scale = imageViewer->getZoomScale();
+    QSet<qint64> wanted;
+    QVector<RegionRequest> requests;
+    if (scale > double(image.width()) / virtualSize.width()) {
+        const QVector<RegionRequest> tiles = VirtualImage::visibleTiles(
+            imageViewer->visibleSceneRect(), scale, virtualSize);
+        for (const RegionRequest &tile : tiles) {
+            wanted.insert(tile.key);
+            if (imageViewer->hasVirtualTile(tile.key))
+                continue;
+            if (const QImage *cached = regionCache.object(tile.key)) {
+                imageViewer->setVirtualTile(tile.key, tile.rect, *cached);
+                continue;
+            }
+            requests.append(tile);
+        }
+    }
+    if (wanted != regionsWanted) {
+        // tiles of the batch in flight that are not decoded yet are skipped
+        regionGeneration->ref();
+        regionsWanted = wanted;
+    }
+    // tiles of other levels or far away go, the overview is below them
+    imageViewer->retainVirtualTiles(wanted);
+    if (requests.isEmpty())
+        return;
+    if (regionsBusy) {
+        regionsQueued = true; // asked again by regionsDone()
+        return;
+    }
+    regionsBusy = true;
+
+    QThread* thread = new QThread();
+    RegionDecodeTask* task = new RegionDecodeTask();
+    task->setRegions(filePath, requests, regionSerial);
+    task->setGeneration(regionGeneration, regionGeneration->loadAcquire());
+
+    // move the task object to the thread BEFORE connecting any signal/slots
+    task->moveToThread(thread);
+
+    connect(thread, &QThread::started, task, &RegionDecodeTask::run);
+    connect(task, &RegionDecodeTask::workFinished, thread, &QThread::quit);
+    connect(task, &RegionDecodeTask::regionReady, this, &ImageViewer::regionReady);
+    connect(task, &RegionDecodeTask::workFinished, this, &ImageViewer::regionsDone);
+
+    // automatically delete thread and task object when work is done:
+    connect(task, &RegionDecodeTask::workFinished, task, &RegionDecodeTask::deleteLater);
+    connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+
+    startTask(thread);
+}
+
+void ImageViewer::regionReady(int serial, qint64 key, QRect rect, QImage region)
+{
+    if (serial != regionSerial || region.isNull())
+        return; // another image meanwhile
+
+    regionCache.insert(key, new QImage(region), qMax(1, int(region.sizeInBytes() / 1024)));
+    if (regionsWanted.contains(key) && imageViewer->isVirtual())
+        imageViewer->setVirtualTile(key, rect, region);
+    updateMemoryInfo();
+}
+
+/**
+ * @brief One batch of tiles is decoded at a time; the tiles the view wants
+ * by now are asked for once it is done. Its results came in before this.
+ */
+void ImageViewer::regionsDone()
+{
+    regionsBusy = false;
+    if (regionsQueued) {
+        regionsQueued = false;
+        requestRegions();
+    }
+}
+
+/**
+ * @brief Overlay the sidecar annotations of filePath, read on a worker
+ * thread. They are read again only when the sidecar or its time changes.
+ */
+void ImageViewer::loadAnnotations()
+{
+    const QString path = annotationsAct->isChecked() ? AnnotationSet::sidecarPath(filePath) : QString();
+    const QDateTime time = path.isEmpty() ? QDateTime() : QFileInfo(path).lastModified();
+    if (path == annotationPath && time == annotationTime)
+        return;
+    annotationPath = path;
+    annotationTime = time;
+    annotationSerial++;
+    imageViewer->setAnnotations(AnnotationSetPtr());
+    if (path.isEmpty())
+        return;
+
+    QThread* thread = new QThread();
+    AnnotationLoadTask* task = new AnnotationLoadTask();
+    task->setFile(path, annotationSerial);
+
+    // move the task object to the thread BEFORE connecting any signal/slots
+    task->moveToThread(thread);
+
+    connect(thread, &QThread::started, task, &AnnotationLoadTask::run);
+    connect(task, &AnnotationLoadTask::workFinished, thread, &QThread::quit);
+    connect(task, &AnnotationLoadTask::resultReady, this, &ImageViewer::annotationsReady);
+
+    // automatically delete thread and task object when work is done:
+    connect(task, &AnnotationLoadTask::workFinished, task, &AnnotationLoadTask::deleteLater);
+    connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+
+    startTask(thread);
+}
+
+void ImageViewer::annotationsReady(int serial, AnnotationSetPtr annotations, const QString &error)
+{
+    if (serial != annotationSerial)
+        return; // another file meanwhile
+    if (!annotations) {
+        statusBar()->showMessage(tr("Cannot read annotations \"%1\": %2")
+            .arg(QDir::toNativeSeparators(annotationPath), error));
+        return;
+    }
+    imageViewer->setAnnotations(annotations);
+    updateMemoryInfo();
+    statusBar()->showMessage(tr("%1 annotations in %2 categories from \"%3\"")
+        .arg(annotations->size()).arg(annotations->categories().size())
+        .arg(QDir::toNativeSeparators(annotationPath)));
+}
+
+void ImageViewer::showMetadata(const ImageMetadata &meta)
+{
+    metadata = meta;
+    metadataView->clear();
+    for (const auto &row : describeMetadata(meta))
+        new QTreeWidgetItem(metadataView, QStringList({row.first, row.second}));
+    metadataView->resizeColumnToContents(0);
+}
+
+/**
+ * @brief Make @a fileName the current document, in a new tab unless it is
+ * open already. The previous document is parked, the caller sets the image.
+ */
+void ImageViewer::beginDocument(const QString &fileName)
+{
+    int index = -1;
+    for (int i = 0; !fileName.isEmpty() && i < documents.size(); i++) {
+        if (documents[i].filePath == fileName)
+            index = i;
+    }
+    if (index >= 0 && index == currentDocument)
+        return; // opened again, replaced in place
+
+    parkCurrentDocument();
+    const QSignalBlocker blocker(tabBar); // the new tab has no pixels yet
+    if (index < 0) {
+        Document doc;
+        doc.id = nextDocumentId++;
+        doc.filePath = fileName;
+        documents.append(doc);
+        index = documents.size() - 1;
+        tabBar->addTab(QString());
+    } else {
+        // read from the file again
+        documents[index].image = QImage();
+        documents[index].packed = CompressedImage();
+    }
+    currentDocument = index;
+
+    Document &doc = documents[index];
+    doc.lastShown = ++documentClock;
+    tabBar->setTabText(index, fileName.isEmpty() ? tr("Clipboard") : QFileInfo(fileName).fileName());
+    tabBar->setTabToolTip(index, QDir::toNativeSeparators(fileName));
+    tabBar->setCurrentIndex(index);
+    tabBar->setVisible(documents.size() > 1);
+}
+
+/**
+ * @brief Move the pixels of the current document into its tab, they are
+ * compressed in the background once it stays inactive. @a next is the tab
+ * shown instead, it is neither compressed nor dropped meanwhile.
+ */
+void ImageViewer::parkCurrentDocument(int next)
+{
+    if (currentDocument < 0)
+        return;
+    stopWatching();
+    stopPlayback();
+
+    Document &doc = documents[currentDocument];
+    doc.filePath = filePath; // watching a folder follows the newest file
+    doc.metadata = metadata;
+    doc.image = bayerRaw.isNull() ? image : bayerRaw; // demosaiced again when shown
+    doc.frameCount = frameCount;
+    doc.playbackFps = playbackFps;
+    doc.virtualSize = virtualSize;
+    doc.lastShown = ++documentClock;
+    if (!filePath.isEmpty())
+        tabBar->setTabText(currentDocument, QFileInfo(filePath).fileName());
+    currentDocument = -1;
+    compressDocuments(next);
+}
+
+int ImageViewer::documentIndex(int id) const
+{
+    for (int i = 0; i < documents.size(); i++) {
+        if (documents[i].id == id)
+            return i;
+    }
+    return -1;
+}
+
+void ImageViewer::activateDocument(int index)
+{
+    if (index < 0 || index == currentDocument || index >= documents.size())
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+    parkCurrentDocument(index);
+    currentDocument = index;
+
+    Document &doc = documents[index];
+    doc.lastShown = ++documentClock;
+    const QImage pixels = doc.image;
+    doc.image = QImage();
+    if (pixels.isNull() && !doc.packed.isNull()) {
+        // unpacked on a worker, documentUnpacked() shows it; the packed copy
+        // stays with the document in case it is parked again meanwhile
+        const int serial = ++loadSerial;
+        doc.loadSerial = serial;
+        pendingLoads.insert(serial, doc.id);
+
+        QThread* thread = new QThread();
+        DecompressImageTask* task = new DecompressImageTask();
+        task->setImage(doc.packed, serial);
+
+        // move the task object to the thread BEFORE connecting any signal/slots
+        task->moveToThread(thread);
+
+        connect(thread, &QThread::started, task, &DecompressImageTask::run);
+        connect(task, &DecompressImageTask::workFinished, thread, &QThread::quit);
+        connect(task, &DecompressImageTask::resultReady, this, &ImageViewer::documentUnpacked);
+
+        // automatically delete thread and task object when work is done:
+        connect(task, &DecompressImageTask::workFinished, task, &DecompressImageTask::deleteLater);
+        connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+
+        startTask(thread);
+    } else {
+        doc.packed = CompressedImage();
+    }
+    showMetadata(doc.metadata);
+    filePath = doc.filePath;
+    setWindowFilePath(filePath);
+
+    if (pixels.isNull()) {
+        image = QImage();
+        displayBuffer = QImage();
+        integral.reset();
+        printAct->setEnabled(false);
+        updateActions();
+        if (pendingLoads.key(doc.id, 0)) {
+            // still decoding or unpacking, loadedImageReady() or documentUnpacked() shows it
+            if (!doc.metadata.thumbnail.isNull())
+                imageViewer->displayPreview(doc.metadata.thumbnail, doc.metadata.size);
+            else
+                imageViewer->clear();
+        } else if (!filePath.isEmpty()) {
+            // evicted under the memory budget
+            imageViewer->clear();
+            loadFile(filePath);
+        }
+        return;
+    }
+
+    if (doc.virtualSize.isValid()) {
+        virtualSize = doc.virtualSize;
+        virtualKey = pixels.cacheKey();
+    }
+    setImage(pixels);
+    frameCount = doc.frameCount;
+    playbackFps = doc.playbackFps;
+    updateFrameInfo();
+    statusBar()->showMessage(tr("Switched to \"%1\", %2x%3 in %4 ms")
+        .arg(tabBar->tabText(index)).arg(image.width()).arg(image.height()).arg(timer.elapsed()));
+}
+
+void ImageViewer::documentUnpacked(int serial, const QImage &pixels)
+{
+    const int index = documentIndex(pendingLoads.take(serial));
+    if (pendingLoads.isEmpty()) {
+        progressBar->reset();
+        progressBar->hide();
+    }
+    if (index < 0 || documents[index].loadSerial != serial || index != currentDocument)
+        return; // closed, replaced, or parked again still packed
+    Document &doc = documents[index];
+    if (pixels.isNull()) {
+        statusBar()->showMessage(tr("Not enough memory to show \"%1\"").arg(tabBar->tabText(index)));
+        return; // the packed copy is tried again when the tab is shown next
+    }
+    doc.packed = CompressedImage();
+
+    if (doc.virtualSize.isValid()) {
+        virtualSize = doc.virtualSize;
+        virtualKey = pixels.cacheKey();
+    }
+    setImage(pixels);
+    frameCount = doc.frameCount;
+    playbackFps = doc.playbackFps;
+    updateFrameInfo();
+    statusBar()->showMessage(tr("Switched to \"%1\", %2x%3")
+        .arg(tabBar->tabText(index)).arg(image.width()).arg(image.height()));
+}
+
+void ImageViewer::closeDocument(int index)
+{
+    if (index < 0 || index >= documents.size())
+        return;
+
+    if (index == currentDocument) {
+        stopWatching();
+        stopPlayback();
+        currentDocument = -1; // nothing to park
+        if (documents.size() > 1) {
+            activateDocument(index + 1 < documents.size() ? index + 1 : index - 1);
+        } else {
+            filePath.clear();
+            image = QImage();
+            displayBuffer = QImage();
+            integral.reset();
+            clearRoiStatistics();
+            hideChannelPanes();
+            imageViewer->clear();
+            loadAnnotations();
+            metadataView->clear();
+            frameCount = 1;
+            updateFrameInfo();
+            printAct->setEnabled(false);
+            setWindowFilePath(QString());
+            updateActions();
+            updateMemoryInfo();
+        }
+    }
+
+    documents.remove(index);
+    if (currentDocument > index)
+        currentDocument--;
+    const QSignalBlocker blocker(tabBar);
+    tabBar->removeTab(index);
+    tabBar->setCurrentIndex(currentDocument);
+    tabBar->setVisible(documents.size() > 1);
+    updateMemoryInfo();
+}
+
+/**
+ * @brief Compress inactive documents one at a time on a worker, then drop
+ * the least recently shown ones that can be read again while over budget.
+ * @a keep is about to be shown, it only counts towards the budget.
+ */
+void ImageViewer::compressDocuments(int keep)
+{
+    QVector<int> order;
+    for (int i = 0; i < documents.size(); i++) {
+        if (i != currentDocument && i != keep)
+            order.append(i);
+    }
+    std::sort(order.begin(), order.end(), [this](int a, int b) {
+        return documents[a].lastShown < documents[b].lastShown;
+    });
+
+    if (!compressingDocument) {
+        for (int i : qAsConst(order)) {
+            if (documents[i].image.isNull())
+                continue;
+            compressingDocument = documents[i].id;
+
+            QThread* thread = new QThread();
+            CompressImageTask* task = new CompressImageTask();
+            task->setImage(documents[i].image, documents[i].id);
+
+            // move the task object to the thread BEFORE connecting any signal/slots
+            task->moveToThread(thread);
+
+            connect(thread, &QThread::started, task, &CompressImageTask::run);
+            connect(task, &CompressImageTask::workFinished, thread, &QThread::quit);
+            connect(task, &CompressImageTask::resultReady, this, &ImageViewer::documentCompressed);
+
+            // automatically delete thread and task object when work is done:
+            connect(task, &CompressImageTask::workFinished, task, &CompressImageTask::deleteLater);
+            connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+
+            startTask(thread);
+            break;
+        }
+    }
+
+    const qint64 budget = qint64(setting->value("document_budget_mb", 2048).toInt()) << 20;
+    qint64 used = currentDocument >= 0 ? image.sizeInBytes() : 0; // else parked just now
+    if (keep >= 0)
+        used += documents[keep].image.sizeInBytes() + documents[keep].packed.compressedBytes();
+    for (int i : qAsConst(order))
+        used += documents[i].image.sizeInBytes() + documents[i].packed.compressedBytes();
+    for (int i : qAsConst(order)) {
+        if (used <= budget)
+            break;
+        // pasted images cannot be read again, pending ones shrink soon
+        Document &doc = documents[i];
+        if (doc.packed.isNull() || !QFileInfo::exists(doc.filePath))
+            continue;
+        used -= doc.packed.compressedBytes();
+        doc.packed = CompressedImage();
+    }
+    updateMemoryInfo();
+}
+
+void ImageViewer::documentCompressed(int id, CompressedImage packed)
+{
+    compressingDocument = 0;
+    const int index = documentIndex(id);
+    if (index >= 0 && index != currentDocument && !packed.isNull()
+        && documents[index].image.cacheKey() == packed.cacheKey()) {
+        documents[index].image = QImage();
+        documents[index].packed = packed;
+    }
+    compressDocuments();
+}
+
 void ImageViewer::setImage(const QImage &newImage)
 {
-    image = newImage;
+    frameCount = 1;
+    currentFrame = 0;
+    stopPlayback();
+
+    // tiles belong to the file of a virtual image
+    regionSerial++;
+    regionsWanted.clear();
+    regionGeneration->ref();
+    regionCache.clear();
+    if (newImage.cacheKey() != virtualKey) {
+        virtualSize = QSize();
+        virtualKey = 0;
+    }
+
+    // a stream frame still being demosaiced is older than this image
+    mosaicKey = 0;
+    mosaicQueued = QImage();
+    image = demosaicked(newImage);
+    if (image.cacheKey() != imageProxyKey) {
+        // the proxy keeps its cache file mapped
+        imageProxy = QImage();
+        imageProxyKey = 0;
+    }
+    if (contrastCache.size() != image.size()) {
+        // a reloaded or streamed frame keeps the last enhanced one up until
+        // its own is ready, see showBuffer()
+        contrastCache = QImage();
+        contrastCacheKey = 0;
+    }
     if (image.colorSpace().isValid())
         image.convertToColorSpace(QColorSpace::SRgb);
 
+    // statistics tables belong to the previous image, the ROI is measured
+    // again once the new one is shown
+    integral.reset();
+
     // change default behavior
     printAct->setEnabled(true);
     dispOrigAct->setChecked(true);
     fitToWindowAct->setEnabled(true);
+    updateActions(); // no rotating a virtual image
 
     displayImage(true);
+    loadAnnotations();
 //    splitAct->setChecked(false);
 //    convertAct->setChecked(false);
 //    mergeAct->setChecked(false);
@@ -187,12 +1050,16 @@ static void initializeImageFileDialog(QFileDialog &dialog, QFileDialog::AcceptMo
         dialog.setDirectory(directory);
     }
 
-    QStringList mimeTypeFilters;
-    const QByteArrayList supportedMimeTypes = acceptMode == QFileDialog::AcceptOpen
-        ? QImageReader::supportedMimeTypes() : QImageWriter::supportedMimeTypes();
-    for (const QByteArray &mimeTypeName : supportedMimeTypes)
-        mimeTypeFilters.append(mimeTypeName);
-    mimeTypeFilters.sort();
+    // listing the mime types loads every image plugin, do it once on first use
+    static QStringList readFilters, writeFilters;
+    QStringList &mimeTypeFilters = acceptMode == QFileDialog::AcceptOpen ? readFilters : writeFilters;
+    if (mimeTypeFilters.isEmpty()) {
+        const QByteArrayList supportedMimeTypes = acceptMode == QFileDialog::AcceptOpen
+            ? QImageReader::supportedMimeTypes() : QImageWriter::supportedMimeTypes();
+        for (const QByteArray &mimeTypeName : supportedMimeTypes)
+            mimeTypeFilters.append(mimeTypeName);
+        mimeTypeFilters.sort();
+    }
     dialog.setMimeTypeFilters(mimeTypeFilters);
     dialog.selectMimeTypeFilter("image/jpeg");
     if (acceptMode == QFileDialog::AcceptSave)
@@ -205,7 +1072,86 @@ void ImageViewer::open()
     QFileDialog dialog(this, tr("Open File"));
     initializeImageFileDialog(dialog, QFileDialog::AcceptOpen);
 
-    while (dialog.exec() == QDialog::Accepted && !loadFile(dialog.selectedFiles().first())) {}
+    while (dialog.exec() == QDialog::Accepted) {
+        const QString fileName = dialog.selectedFiles().first();
+        if (!loadFile(fileName))
+            continue;
+        if (pendingLoads.key(documents[currentDocument].id, 0)) {
+            // still decoding: ask again if that fails, as for a file that fails up front
+            auto connection = QSharedPointer<QMetaObject::Connection>::create();
+            *connection = connect(this, &ImageViewer::loadFinished, this,
+                                  [this, connection, fileName](const QString &name, bool ok) {
+                if (name != fileName)
+                    return;
+                disconnect(*connection);
+                if (!ok)
+                    open();
+            });
+        }
+        break;
+    }
+}
+
+void ImageViewer::loadMask()
+{
+    QFileDialog dialog(this, tr("Open Mask"));
+    initializeImageFileDialog(dialog, QFileDialog::AcceptOpen);
+    if (dialog.exec() != QDialog::Accepted)
+        return;
+    maskPath = dialog.selectedFiles().first();
+
+    QThread* thread = new QThread();
+    ImageLoadTask* task = new ImageLoadTask();
+    task->setFile(maskPath, ++maskSerial, false); // labels, not pixels
+
+    // move the task object to the thread BEFORE connecting any signal/slots
+    task->moveToThread(thread);
+
+    connect(thread, &QThread::started, task, &ImageLoadTask::run);
+    connect(task, &ImageLoadTask::workFinished, thread, &QThread::quit);
+    connect(task, &ImageLoadTask::resultReady, this, &ImageViewer::maskLoaded);
+
+    // automatically delete thread and task object when work is done:
+    connect(task, &ImageLoadTask::workFinished, task, &ImageLoadTask::deleteLater);
+    connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+
+    statusBar()->showMessage(tr("Loading mask \"%1\" ...").arg(QDir::toNativeSeparators(maskPath)));
+    startTask(thread);
+}
+
+void ImageViewer::maskLoaded(int serial, const QImage &mask, const QString &error)
+{
+    if (serial != maskSerial)
+        return; // another mask was picked meanwhile
+    const QString name = QDir::toNativeSeparators(maskPath);
+    if (mask.isNull()) {
+        statusBar()->showMessage(tr("Cannot load mask \"%1\": %2").arg(name, error));
+        return;
+    }
+    if (!canUseAsMask(mask)) {
+        statusBar()->showMessage(tr("\"%1\" is not a label image (8 or 16-bit gray, or indexed)").arg(name));
+        return;
+    }
+
+    maskOverlay->setMask(mask);
+    maskOpacity->show();
+    if (!displayBuffer.isNull() && channelView->isHidden())
+        showBuffer(displayBuffer, false);
+    QString message = tr("Mask \"%1\", %2x%3, %4-bit labels")
+        .arg(name).arg(mask.width()).arg(mask.height()).arg(mask.depth());
+    if (!image.isNull() && image.size() != mask.size())
+        message += tr(", shown over %1x%2 images only").arg(mask.width()).arg(mask.height());
+    statusBar()->showMessage(message);
+}
+
+void ImageViewer::clearMask()
+{
+    maskSerial++;
+    maskOverlay->clearMask();
+    maskOpacity->hide();
+    if (!displayBuffer.isNull() && channelView->isHidden())
+        showBuffer(displayBuffer, false);
+    updateMemoryInfo();
 }
 
 void ImageViewer::saveAs()
@@ -217,23 +1163,89 @@ void ImageViewer::saveAs()
     while (dialog.exec() == QDialog::Accepted && !saveFile(dialog.selectedFiles().first())) {}
 }
 
+/// start a task thread, counted until it finishes
+void ImageViewer::startTask(QThread *thread)
+{
+    countTask(thread);
+    thread->start();
+}
+
+void ImageViewer::countTask(QThread *thread)
+{
+    runningTasks++;
+    connect(thread, &QThread::finished, this, [this] {
+        if (--runningTasks == 0)
+            emit tasksFinished();
+    });
+}
+
 void ImageViewer::print()
 {
     Q_ASSERT(!image.isNull());
 #if defined(QT_PRINTSUPPORT_LIB) && QT_CONFIG(printdialog)
-    QPrintDialog dialog(&printer, this);
+    if (printCancel) {
+        statusBar()->showMessage(tr("A print job is still running"));
+        return;
+    }
+    // constructing a QPrinter queries the print system, only do it when needed
+    if (!printer)
+        printer.reset(new QPrinter(QPrinter::HighResolution));
+    QPrintDialog dialog(printer.data(), this);
     if (dialog.exec()) {
-        QPainter painter(&printer);
-        //QPixmap pixmap = imageLabel->pixmap(Qt::ReturnByValue);
-        QPixmap pixmap = imageViewer->grab();
-        QRect rect = painter.viewport();
-        QSize size = pixmap.size();
-        size.scale(rect.size(), Qt::KeepAspectRatio);
-        painter.setViewport(rect.x(), rect.y(), size.width(), size.height());
-        painter.setWindow(pixmap.rect());
-        painter.drawPixmap(0, 0, pixmap);
+        // print what is on screen, at the printer's resolution
+        QImage source = displayBuffer.isNull() ? image : displayBuffer;
+        if (contrastMode != ContrastMode::None && contrastCacheKey == source.cacheKey())
+            source = contrastCache;
+
+        QThread* thread = new QThread();
+        PrintTask* task = new PrintTask();
+        task->setPrinter(printer);
+        printCancel.reset(new QAtomicInt(0));
+        task->setCancelFlag(printCancel);
+        task->setImage(source, colorTable);
+        task->setBandBytes(qint64(setting->value("print_band_mb", 64).toInt()) << 20);
+
+        // move the task object to the thread BEFORE connecting any signal/slots
+        task->moveToThread(thread);
+
+        connect(thread, &QThread::started, task, &PrintTask::run);
+        connect(task, &PrintTask::workFinished, thread, &QThread::quit);
+        connect(task, &PrintTask::progress, progressBar, &QProgressBar::setValue);
+        connect(task, &PrintTask::printFinished, this, [this](bool, const QString &message) {
+            printCancel.reset();
+            progressBar->reset();
+            progressBar->hide();
+            statusBar()->showMessage(message);
+        });
+
+        // automatically delete thread and task object when work is done:
+        connect(task, &PrintTask::workFinished, task, &PrintTask::deleteLater);
+        connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+
+        progressBar->show();
+        progressBar->setRange(0, 100);
+        progressBar->setValue(0);
+        statusBar()->showMessage(tr("Printing..."));
+        printThread = thread;
+        startTask(thread);
+    }
+#endif
+}
+
+void ImageViewer::closeEvent(QCloseEvent *event)
+{
+#if defined(QT_PRINTSUPPORT_LIB) && QT_CONFIG(printer)
+    // the task holds its own reference to the printer; it stops at the next
+    // band, and is waited for so that it is not painting while the
+    // application tears down
+    if (printCancel)
+        printCancel->storeRelaxed(1);
+    if (printThread) {
+        printThread->quit();
+        printThread->wait();
     }
 #endif
+    QMainWindow::closeEvent(event);
 }
 
 void ImageViewer::copy()
@@ -264,6 +1276,7 @@ void ImageViewer::paste()
     if (newImage.isNull()) {
         statusBar()->showMessage(tr("No image in clipboard"));
     } else {
+        beginDocument(QString());
         filePath.clear();
         setImage(newImage);
         setWindowFilePath(QString());
@@ -276,23 +1289,37 @@ void ImageViewer::paste()
 
 void ImageViewer::zoomIn()
 {
-    imageViewer->zoomIn();
+    if (!channelView->isHidden())
+        channelView->zoomIn();
+    else
+        imageViewer->zoomIn();
 }
 
 void ImageViewer::zoomOut()
 {
-    imageViewer->zoomOut();
+    if (!channelView->isHidden())
+        channelView->zoomOut();
+    else
+        imageViewer->zoomOut();
 }
 
 void ImageViewer::normalSize()
 {
-    imageViewer->zoomOriginal();
+    if (!channelView->isHidden())
+        channelView->zoomOriginal();
+    else
+        imageViewer->zoomOriginal();
 }
 
 void ImageViewer::fitToWindow()
 {
     bool fitToWindow = fitToWindowAct->isChecked();
-    if (!fitToWindow) {
+    if (!channelView->isHidden()) {
+        if (fitToWindow)
+            channelView->zoomFit();
+        else
+            channelView->zoomOriginal();
+    } else if (!fitToWindow) {
         imageViewer->zoomOriginal();
     } else {
         imageViewer->zoomFit();
@@ -324,6 +1351,54 @@ void ImageViewer::createActions()
 
     fileMenu->addSeparator();
 
+    watchAct = fileMenu->addAction(tr("&Watch File"), this, &ImageViewer::toggleWatchFile);
+    watchAct->setShortcut(tr("Ctrl+L"));
+    watchAct->setCheckable(true);
+    watchAct->setEnabled(false);
+
+    fileMenu->addAction(tr("Watch &Folder..."), this, &ImageViewer::watchFolder);
+    fileMenu->addAction(tr("Find D&uplicates in Folder..."), this, &ImageViewer::findDuplicates);
+
+    listenAct = fileMenu->addAction(tr("&Listen for Frames"), this, &ImageViewer::toggleFrameIngest);
+    listenAct->setCheckable(true);
+
+    QAction *decodeCacheAct = fileMenu->addAction(tr("Cache &Decoded Images"));
+    decodeCacheAct->setCheckable(true);
+    decodeCacheAct->setChecked(setting->value("decode_cache", false).toBool());
+    decodeCacheAct->setToolTip(tr("Keep slow-to-decode images under %1")
+                               .arg(QDir::toNativeSeparators(DecodeCache::directory())));
+    connect(decodeCacheAct, &QAction::toggled, this, [this](bool enable) {
+        setting->setValue("decode_cache", enable);
+    });
+
+    QAction *virtualAct = fileMenu->addAction(tr("&Region Decoding for Large Images"));
+    virtualAct->setCheckable(true);
+    virtualAct->setChecked(setting->value("virtual_image", false).toBool());
+    virtualAct->setToolTip(tr("Decode an overview, then only the tiles in view, for images above %1 MP")
+                           .arg(setting->value("virtual_image_mpix", 100).toInt()));
+    connect(virtualAct, &QAction::toggled, this, [this](bool enable) {
+        setting->setValue("virtual_image", enable);
+    });
+
+    fileMenu->addSeparator();
+
+    QAction *closeTabAct = fileMenu->addAction(tr("&Close Tab"), this, [this]() {
+        closeDocument(currentDocument);
+    });
+    closeTabAct->setShortcut(QKeySequence::Close);
+    QAction *nextTabAct = fileMenu->addAction(tr("&Next Tab"), this, [this]() {
+        if (documents.size() > 1)
+            tabBar->setCurrentIndex((currentDocument + 1) % documents.size());
+    });
+    nextTabAct->setShortcut(QKeySequence::NextChild);
+    QAction *prevTabAct = fileMenu->addAction(tr("Pre&vious Tab"), this, [this]() {
+        if (documents.size() > 1)
+            tabBar->setCurrentIndex((currentDocument + documents.size() - 1) % documents.size());
+    });
+    prevTabAct->setShortcut(QKeySequence::PreviousChild);
+
+    fileMenu->addSeparator();
+
     QAction *exitAct = fileMenu->addAction(tr("E&xit"), this, &QWidget::close);
     exitAct->setShortcut(tr("Ctrl+Q"));
 
@@ -353,6 +1428,34 @@ void ImageViewer::createActions()
     split2Act->setEnabled(false);
     split2Act->setCheckable(true);
 
+    splitHsvAct = editMenu->addAction(tr("Split H&SV"), this, [this](bool enable) {
+        splitImageDisplay(ColorSpace::HSV, enable);
+    });
+    splitHsvAct->setShortcut(QKeySequence::fromString("Alt+S"));
+    splitHsvAct->setEnabled(false);
+    splitHsvAct->setCheckable(true);
+
+    splitYcc601Act = editMenu->addAction(tr("Split &YCbCr (BT.601)"), this, [this](bool enable) {
+        splitImageDisplay(ColorSpace::YCbCr601, enable);
+    });
+    splitYcc601Act->setShortcut(QKeySequence::fromString("Alt+Y"));
+    splitYcc601Act->setEnabled(false);
+    splitYcc601Act->setCheckable(true);
+
+    splitYcc709Act = editMenu->addAction(tr("Split YCbCr (BT.&709)"), this, [this](bool enable) {
+        splitImageDisplay(ColorSpace::YCbCr709, enable);
+    });
+    splitYcc709Act->setShortcut(QKeySequence::fromString("Alt+7"));
+    splitYcc709Act->setEnabled(false);
+    splitYcc709Act->setCheckable(true);
+
+    splitXyzAct = editMenu->addAction(tr("Split &XYZ"), this, [this](bool enable) {
+        splitImageDisplay(ColorSpace::XYZ, enable);
+    });
+    splitXyzAct->setShortcut(QKeySequence::fromString("Alt+X"));
+    splitXyzAct->setEnabled(false);
+    splitXyzAct->setCheckable(true);
+
     convertAct = editMenu->addAction(tr("&Illuminance"), this, &ImageViewer::toggleGrayscaleImageDisplay);
     convertAct->setShortcut(QKeySequence::fromString("Alt+I"));
     convertAct->setEnabled(false);
@@ -362,9 +1465,88 @@ void ImageViewer::createActions()
     actGrp->addAction(dispOrigAct);
     actGrp->addAction(split1Act);
     actGrp->addAction(split2Act);
+    actGrp->addAction(splitHsvAct);
+    actGrp->addAction(splitYcc601Act);
+    actGrp->addAction(splitYcc709Act);
+    actGrp->addAction(splitXyzAct);
     actGrp->addAction(convertAct);
     actGrp->setExclusive(true);
 
+    QMenu *demosaicMenu = editMenu->addMenu(tr("&Demosaic"));
+    demosaicAct = demosaicMenu->addAction(tr("&Demosaic Bayer Frames"), this, [this](bool enable) {
+        setting->setValue("demosaic", enable);
+        redemosaic();
+    });
+    demosaicAct->setShortcut(QKeySequence::fromString("Alt+B"));
+    demosaicAct->setCheckable(true);
+    demosaicAct->setChecked(setting->value("demosaic", false).toBool());
+
+    demosaicMenu->addSeparator();
+    bayerPattern = BayerPattern(qBound(0, setting->value("bayer_pattern", 0).toInt(), 3));
+    QActionGroup *patternGrp = new QActionGroup(this);
+    const QList<QPair<QString, BayerPattern>> patterns = {
+        {tr("RGGB"), BayerPattern::RGGB},
+        {tr("BGGR"), BayerPattern::BGGR},
+        {tr("GRBG"), BayerPattern::GRBG},
+        {tr("GBRG"), BayerPattern::GBRG}
+    };
+    for (const auto &pattern : patterns) {
+        QAction *act = demosaicMenu->addAction(pattern.first);
+        act->setData(int(pattern.second));
+        act->setCheckable(true);
+        act->setChecked(pattern.second == bayerPattern);
+        patternGrp->addAction(act);
+    }
+    patternGrp->setExclusive(true);
+    connect(patternGrp, &QActionGroup::triggered, this, [this](QAction *act) {
+        bayerPattern = BayerPattern(act->data().toInt());
+        setting->setValue("bayer_pattern", int(bayerPattern));
+        redemosaic();
+    });
+
+    demosaicMenu->addSeparator();
+    demosaicMethod = DemosaicMethod(qBound(0, setting->value("demosaic_method", 1).toInt(), 1));
+    QActionGroup *methodGrp = new QActionGroup(this);
+    const QList<QPair<QString, DemosaicMethod>> methods = {
+        {tr("&Bilinear"), DemosaicMethod::Bilinear},
+        {tr("&Malvar-He-Cutler"), DemosaicMethod::MalvarHeCutler}
+    };
+    for (const auto &method : methods) {
+        QAction *act = demosaicMenu->addAction(method.first);
+        act->setData(int(method.second));
+        act->setCheckable(true);
+        act->setChecked(method.second == demosaicMethod);
+        methodGrp->addAction(act);
+    }
+    methodGrp->setExclusive(true);
+    connect(methodGrp, &QActionGroup::triggered, this, [this](QAction *act) {
+        demosaicMethod = DemosaicMethod(act->data().toInt());
+        setting->setValue("demosaic_method", int(demosaicMethod));
+        redemosaic();
+    });
+
+    editMenu->addSeparator();
+
+    rotateMenu = editMenu->addMenu(tr("&Rotate / Flip"));
+    rotateMenu->setEnabled(false);
+    const struct {
+        QString name;
+        RotateFlip op;
+        QKeySequence shortcut;
+    } rotations[] = {
+        {tr("Rotate &Right"), RotateFlip::Rotate90, QKeySequence(tr("Ctrl+R"))},
+        {tr("Rotate &Left"), RotateFlip::Rotate270, QKeySequence(tr("Ctrl+Shift+R"))},
+        {tr("Rotate &180°"), RotateFlip::Rotate180, QKeySequence()},
+        {tr("Flip &Horizontal"), RotateFlip::FlipHorizontal, QKeySequence(tr("Ctrl+Shift+H"))},
+        {tr("Flip &Vertical"), RotateFlip::FlipVertical, QKeySequence(tr("Ctrl+Shift+V"))}
+    };
+    for (const auto &rotation : rotations) {
+        QAction *act = rotateMenu->addAction(rotation.name);
+        act->setData(int(rotation.op));
+        act->setShortcut(rotation.shortcut);
+    }
+    connect(rotateMenu, &QMenu::triggered, this, &ImageViewer::rotateImage);
+
     editMenu->addSeparator();
 
     launchAct = editMenu->addAction(tr("Ope&n Containing Folder"), this, &ImageViewer::openContainingFolder);
@@ -397,12 +1579,173 @@ void ImageViewer::createActions()
     bilinearTransform->setCheckable(true);
     bilinearTransform->setShortcut(tr("Ctrl+B"));
 
-    QMenu *helpMenu = menuBar()->addMenu(tr("&Help"));
-    helpMenu->addAction(tr("&About"), this, &ImageViewer::about);
-}
+    QAction *miniMapAct = viewMenu->addAction(tr("&Minimap"));
+    miniMapAct->setCheckable(true);
+    miniMapAct->setShortcut(tr("Ctrl+M"));
+    connect(miniMapAct, &QAction::toggled, this, [this](bool enable) {
+        imageViewer->setMiniMapEnabled(enable);
+        setting->setValue("show_minimap", enable);
+    });
+    miniMapAct->setChecked(setting->value("show_minimap", true).toBool());
+
+    QAction *renderStatsAct = viewMenu->addAction(tr("Render &Statistics"));
+    renderStatsAct->setCheckable(true);
+    renderStatsAct->setShortcut(tr("Ctrl+Shift+S"));
+    connect(renderStatsAct, &QAction::toggled, this, [this](bool enable) {
+        imageViewer->setRenderStatsEnabled(enable);
+        setting->setValue("show_render_stats", enable);
+    });
+    renderStatsAct->setChecked(setting->value("show_render_stats", false).toBool());
+
+    annotationsAct = viewMenu->addAction(tr("&Annotations"));
+    annotationsAct->setCheckable(true);
+    annotationsAct->setShortcut(tr("Ctrl+Shift+A"));
+    connect(annotationsAct, &QAction::toggled, this, [this](bool enable) {
+        setting->setValue("show_annotations", enable);
+        loadAnnotations();
+    });
+    annotationsAct->setChecked(setting->value("show_annotations", true).toBool());
+
+    QMenu *maskMenu = viewMenu->addMenu(tr("Segmentation Mas&k"));
+    QAction *loadMaskAct = maskMenu->addAction(tr("&Load..."), this, &ImageViewer::loadMask);
+    loadMaskAct->setShortcut(tr("Ctrl+Shift+M"));
+    maskAct = maskMenu->addAction(tr("&Show"));
+    maskAct->setCheckable(true);
+    maskAct->setChecked(setting->value("show_mask", true).toBool());
+    connect(maskAct, &QAction::toggled, this, [this](bool enable) {
+        setting->setValue("show_mask", enable);
+        if (maskOverlay->hasMask() && !displayBuffer.isNull() && channelView->isHidden())
+            showBuffer(displayBuffer, false);
+    });
+    maskMenu->addAction(tr("&Clear"), this, &ImageViewer::clearMask);
+
+    QMenu *updateModeMenu = viewMenu->addMenu(tr("Viewport &Updates"));
+    QActionGroup *updateModeGrp = new QActionGroup(this);
+    const QList<QPair<QString, QGraphicsView::ViewportUpdateMode>> updateModes = {
+        {tr("&Full"), QGraphicsView::FullViewportUpdate},
+        {tr("&Minimal"), QGraphicsView::MinimalViewportUpdate},
+        {tr("&Smart"), QGraphicsView::SmartViewportUpdate},
+        {tr("&Bounding Rect"), QGraphicsView::BoundingRectViewportUpdate}
+    };
+    for (const auto &mode : updateModes) {
+        QAction *act = updateModeMenu->addAction(mode.first);
+        act->setData(int(mode.second));
+        act->setCheckable(true);
+        act->setChecked(mode.second == imageViewer->viewportUpdateMode());
+        updateModeGrp->addAction(act);
+    }
+    updateModeGrp->setExclusive(true);
+    connect(updateModeGrp, &QActionGroup::triggered, this, [this](QAction *act) {
+        imageViewer->setViewportUpdateMode(QGraphicsView::ViewportUpdateMode(act->data().toInt()));
+        imageViewer->resetRenderStats(); // numbers of the previous mode
+        imageViewer->viewport()->update();
+        setting->setValue("viewport_update_mode", act->data().toInt());
+        statusBar()->showMessage(tr("Viewport updates: %1").arg(act->text().remove('&')));
+    });
+
+    QAction *metadataAct = metadataDock->toggleViewAction();
+    metadataAct->setShortcut(tr("Ctrl+Shift+I"));
+    viewMenu->addAction(metadataAct);
+    connect(metadataAct, &QAction::toggled, this, [this](bool visible) {
+        setting->setValue("show_metadata", visible);
+    });
+    viewMenu->addAction(duplicatesDock->toggleViewAction());
+
+    QAction *lowMemoryAct = viewMenu->addAction(tr("&Low Memory Mode"));
+    lowMemoryAct->setCheckable(true);
+    connect(lowMemoryAct, &QAction::toggled, this, [this](bool enable) {
+        imageViewer->setLowMemory(enable);
+        setting->setValue("low_memory", enable);
+        if (!displayBuffer.isNull() && channelView->isHidden())
+            showBuffer(displayBuffer, false);
+        statusBar()->showMessage(enable ? tr("Low memory mode on") : tr("Low memory mode off"));
+    });
+    lowMemoryAct->setChecked(setting->value("low_memory", false).toBool());
+
+    QAction *channelPanesAct = viewMenu->addAction(tr("Split into Linked Pan&es"));
+    channelPanesAct->setCheckable(true);
+    channelPanesAct->setChecked(setting->value("channel_panes", false).toBool());
+    channelPanesAct->setToolTip(tr("Less memory for large images, but no ROI statistics, contrast, annotations or mask"));
+    connect(channelPanesAct, &QAction::toggled, this, [this](bool enable) {
+        setting->setValue("channel_panes", enable);
+        // show the current split the other way
+        QAction *mode = dispOrigAct->actionGroup()->checkedAction();
+        if (mode && mode != dispOrigAct && mode != convertAct && !image.isNull())
+            mode->trigger();
+    });
+
+    QMenu *colorMapMenu = viewMenu->addMenu(tr("&Colormap"));
+    QActionGroup *colorMapGrp = new QActionGroup(this);
+    const QString colorMapName = setting->value("colormap", "Gray").toString();
+    for (const QString &name : colorMapNames()) {
+        QAction *act = colorMapMenu->addAction(name);
+        act->setData(name);
+        act->setCheckable(true);
+        act->setChecked(name == colorMapName);
+        colorMapGrp->addAction(act);
+    }
+    colorMapGrp->setExclusive(true);
+    connect(colorMapGrp, &QActionGroup::triggered, this, &ImageViewer::setColorMap);
+    colorTable = colorMapTable(colorMapName,
+        setting->value("custom_colormap", QStringList({"#000000", "#ff0000", "#ffff00", "#ffffff"})).toStringList());
+
+    QMenu *contrastMenu = viewMenu->addMenu(tr("Con&trast"));
+    QActionGroup *contrastGrp = new QActionGroup(this);
+    const QList<QPair<QString, ContrastMode>> contrastModes = {
+        {tr("&Off"), ContrastMode::None},
+        {tr("&Auto Levels"), ContrastMode::AutoLevels},
+        {tr("&Equalize Histogram"), ContrastMode::Equalize},
+        {tr("&CLAHE"), ContrastMode::CLAHE}
+    };
+    for (const auto &mode : contrastModes) {
+        QAction *act = contrastMenu->addAction(mode.first);
+        act->setData(int(mode.second));
+        act->setCheckable(true);
+        act->setChecked(mode.second == contrastMode);
+        contrastGrp->addAction(act);
+    }
+    contrastGrp->setExclusive(true);
+    connect(contrastGrp, &QActionGroup::triggered, this, &ImageViewer::setContrastMode);
+
+    QMenu *probeMenu = viewMenu->addMenu(tr("&Probe Window"));
+    QActionGroup *probeGrp = new QActionGroup(this);
+    for (int n : {1, 3, 5, 9, 15}) {
+        QAction *act = probeMenu->addAction(tr("%1 x %1").arg(n));
+        act->setData(n);
+        act->setCheckable(true);
+        act->setChecked(n == probeWindow);
+        probeGrp->addAction(act);
+    }
+    probeGrp->setExclusive(true);
+    connect(probeGrp, &QActionGroup::triggered, this, &ImageViewer::setProbeWindow);
+
+    QMenu *frameMenu = menuBar()->addMenu(tr("Fr&ames"));
+
+    playAct = frameMenu->addAction(tr("&Play"), this, &ImageViewer::togglePlayback);
+    playAct->setShortcut(tr("Space"));
+    playAct->setCheckable(true);
+
+    frameMenu->addSeparator();
+
+    nextFrameAct = frameMenu->addAction(tr("&Next Frame"), this, &ImageViewer::nextFrame);
+    nextFrameAct->setShortcut(tr("Ctrl+Right"));
+
+    prevFrameAct = frameMenu->addAction(tr("P&revious Frame"), this, &ImageViewer::previousFrame);
+    prevFrameAct->setShortcut(tr("Ctrl+Left"));
+
+    firstFrameAct = frameMenu->addAction(tr("&First Frame"), this, &ImageViewer::firstFrame);
+    firstFrameAct->setShortcut(tr("Ctrl+Home"));
+
+    lastFrameAct = frameMenu->addAction(tr("&Last Frame"), this, &ImageViewer::lastFrame);
+    lastFrameAct->setShortcut(tr("Ctrl+End"));
+
+    QMenu *helpMenu = menuBar()->addMenu(tr("&Help"));
+    helpMenu->addAction(tr("&About"), this, &ImageViewer::about);
+}
 
 void ImageViewer::updateActions()
 {
+    watchAct->setEnabled(!filePath.isEmpty() || watchAct->isChecked());
     saveAsAct->setEnabled(!image.isNull());
     copyAct->setEnabled(!image.isNull());
     launchAct->setEnabled(!image.isNull());
@@ -410,6 +1753,11 @@ void ImageViewer::updateActions()
     split1Act->setEnabled(!image.isNull());
     convertAct->setEnabled(!image.isNull());
     split2Act->setEnabled(!image.isNull());
+    splitHsvAct->setEnabled(!image.isNull());
+    splitYcc601Act->setEnabled(!image.isNull());
+    splitYcc709Act->setEnabled(!image.isNull());
+    splitXyzAct->setEnabled(!image.isNull());
+    rotateMenu->setEnabled(!image.isNull() && !virtualSize.isValid()); // tiles are in file orientation
     zoomInAct->setEnabled(!fitToWindowAct->isChecked());
     zoomOutAct->setEnabled(!fitToWindowAct->isChecked());
     normalSizeAct->setEnabled(!fitToWindowAct->isChecked());
@@ -424,12 +1772,38 @@ void ImageViewer::updatePixelValueOnCursor(int x, int y, int r, int g, int b)
     } else if(image.isNull()) {
         imgPixVal->hide();
     } else {
-        x = x % image.width();
-        y = y % image.height();
+        // report the value, not the false colour or enhanced pixel on screen,
+        // read from the buffer rather than the pixmap; the channel panes
+        // already give all three channels of the source
+        if (channelView->isHidden() && !virtualSize.isValid() && displayBuffer.valid(x, y)) {
+            const QRgb px = displayBuffer.pixel(x, y);
+            r = qRed(px);
+            g = qGreen(px);
+            b = qBlue(px);
+        }
+        // the probe averages what is shown, a split pane included
+        const QRect win(x - probeWindow / 2, y - probeWindow / 2, probeWindow, probeWindow);
+        if (!virtualSize.isValid()) {
+            x = x % image.width();
+            y = y % image.height();
+        }
         QString strCurrentPixelValOnCursor = tr("X: %1\tY: %2\n %3,%4,%5").arg(x, 4).arg(y, 4)
             .arg(r, 3, 'f', 0, QChar('0'))
             .arg(g, 3, 'f', 0, QChar('0'))
             .arg(b, 3, 'f', 0, QChar('0'));
+        const int label = maskOverlay->labelAt(QPoint(x, y));
+        if (label >= 0)
+            strCurrentPixelValOnCursor += tr("\n class %1").arg(label);
+        // the statistics of a virtual image would be those of its overview
+        if (probeWindow > 1 && !virtualSize.isValid() && requestIntegralImage()) {
+            double avg[3];
+            if (integral->mean(win, avg)) {
+                if (integral->channels() == 1)
+                    avg[1] = avg[2] = avg[0];
+                strCurrentPixelValOnCursor += tr("\n avg %1x%1: %2,%3,%4").arg(probeWindow)
+                    .arg(avg[0], 5, 'f', 1).arg(avg[1], 5, 'f', 1).arg(avg[2], 5, 'f', 1);
+            }
+        }
         imgPixVal->setText(strCurrentPixelValOnCursor);
         imgPixVal->move(QCursor::pos() + QPoint(10, 16));
         imgPixVal->show();
@@ -463,7 +1837,7 @@ void ImageViewer::displayImage(bool)
         installEventFilter(filter);
     }
 
-    imageViewer->display(image, true);
+    showBuffer(image, true);
     fitToWindowAct->setChecked(true);
     fitToWindow();
 
@@ -475,8 +1849,33 @@ void ImageViewer::displayImage(bool)
 
 void ImageViewer::toggleRGBImageDisplay(bool enable)
 {
+    splitImageDisplay(ColorSpace::RGB, enable);
+}
+
+void ImageViewer::toggleLabImageDisplay(bool enable)
+{
+    splitImageDisplay(ColorSpace::Lab, enable);
+}
+
+void ImageViewer::splitImageDisplay(ColorSpace space, bool enable)
+{
+    static const char *names[] = {"RGB", "Lab", "HSV", "YCbCr (BT.601)", "YCbCr (BT.709)", "XYZ"};
+    const QString name = QLatin1String(names[int(space)]);
+    if (enable)
+        splitSpace = space;
+
     if (image.isNull() || image.isGrayscale()) {
-        statusBar()->showMessage(tr("Split RGB operation ignored as source image is null or grayscale image"));
+        statusBar()->showMessage(tr("Split %1 operation ignored as source image is null or grayscale image").arg(name));
+        return;
+    }
+
+    if (enable && setting->value("channel_panes", false).toBool()) {
+        QElapsedTimer timer;
+        timer.start();
+        qApp->setOverrideCursor(QCursor(Qt::WaitCursor));
+        showChannelPanes(space);
+        qApp->restoreOverrideCursor();
+        statusBar()->showMessage(tr("Split color image into %1 channel panes (%2 ms)").arg(name).arg(timer.elapsed()));
         return;
     }
 
@@ -485,22 +1884,26 @@ void ImageViewer::toggleRGBImageDisplay(bool enable)
     QImage buf;
     if (enable) {
         if(!large_image) {
-            buf = splitRGBImage(image);
-            statusBar()->showMessage(tr("Split color image into R,G,B channels"));
+            buf = splitColorSpace(image, space);
+            statusBar()->showMessage(tr("Split color image into %1 channels").arg(name));
         } else {
             QThread* thread = new QThread();
-            SplitRGBImageTask* task = new SplitRGBImageTask();
+            SplitColorSpaceTask* task = new SplitColorSpaceTask();
             task->setImage(image);
+            task->setColorSpace(space);
+            // the view can only use the converted copy when it shows the split as is
+            task->setDisplayFormat(colorTable.isEmpty() && contrastMode == ContrastMode::None
+                                   && !imageViewer->isLowMemory());
 
             // move the task object to the thread BEFORE connecting any signal/slots
             task->moveToThread(thread);
 
-            connect(thread, &QThread::started, task, &SplitRGBImageTask::run);
-            connect(task, &SplitRGBImageTask::workFinished, thread, &QThread::quit);
-            connect(task, &SplitRGBImageTask::resultReady, this, QOverload<const QPixmap&>::of(&ImageViewer::displayImage));
+            connect(thread, &QThread::started, task, &SplitColorSpaceTask::run);
+            connect(task, &SplitColorSpaceTask::workFinished, thread, &QThread::quit);
+            connect(task, &SplitColorSpaceTask::resultReady, this, QOverload<const QImage&, const QImage&>::of(&ImageViewer::displayImage));
 
             // automatically delete thread and task object when work is done:
-            connect(task, &SplitRGBImageTask::workFinished, task, &SplitRGBImageTask::deleteLater);
+            connect(task, &SplitColorSpaceTask::workFinished, task, &SplitColorSpaceTask::deleteLater);
             connect(thread, &QThread::finished, thread, &QThread::deleteLater);
 
             qApp->setOverrideCursor(QCursor(Qt::WaitCursor));
@@ -508,7 +1911,7 @@ void ImageViewer::toggleRGBImageDisplay(bool enable)
 
             progressBar->show();
             progressBar->setRange(0, 0);
-            thread->start();
+            startTask(thread);
             return;
         }
     } else {
@@ -521,7 +1924,7 @@ void ImageViewer::toggleRGBImageDisplay(bool enable)
         installEventFilter(filter);
     }
 
-    imageViewer->display(buf, true);
+    showBuffer(buf, true);
     fitToWindowAct->setChecked(true);
     fitToWindow();
 
@@ -531,7 +1934,7 @@ void ImageViewer::toggleRGBImageDisplay(bool enable)
     }
 }
 
-void ImageViewer::displayImage(const QPixmap& image_)
+void ImageViewer::displayImage(const QImage& image_, const QImage& display)
 {
     removeEventFilter(filter);
     qApp->restoreOverrideCursor();
@@ -540,11 +1943,61 @@ void ImageViewer::displayImage(const QPixmap& image_)
     progressBar->hide();
     statusBar()->showMessage(tr("Image operation done"));
 
-    imageViewer->display(image_, true);
+    showBuffer(image_, true, display);
     fitToWindowAct->setChecked(true);
     fitToWindow();
 }
 
+void ImageViewer::rotateImage(QAction *act)
+{
+    if (image.isNull() || virtualSize.isValid())
+        return; // the tiles of a virtual image are decoded unturned
+
+    const RotateFlip op = RotateFlip(act->data().toInt());
+    QElapsedTimer timer;
+    timer.start();
+    qApp->setOverrideCursor(QCursor(Qt::WaitCursor));
+
+    // a split or grayscale view is turned along, not computed again;
+    // channel panes compute their tiles from the turned image anyway
+    QAction *mode = dispOrigAct->actionGroup()->checkedAction();
+    const bool panes = !channelView->isHidden();
+    const bool derived = !panes && mode && mode != dispOrigAct && !displayBuffer.isNull()
+        && displayBuffer.cacheKey() != image.cacheKey();
+    // the panes of a one-buffer split are turned each on its own, a mirror
+    // of the whole buffer would swap the outer two
+    const bool sideBySide = displayBuffer.width() == 3 * image.width() && displayBuffer.height() == image.height();
+    const bool stacked = displayBuffer.height() == 3 * image.height() && displayBuffer.width() == image.width();
+    const QImage derivedBuffer = !derived ? QImage()
+        : sideBySide || stacked ? rotateFlipPanes(displayBuffer, stacked, op)
+        : rotateFlip(displayBuffer, op);
+
+    const QImage rotated = rotateFlip(image, op);
+    if (!rotated.isNull()) {
+        setImage(rotated);
+        // annotations are in file pixels and no longer line up; a read
+        // still in flight is dropped, the sidecar is read again on reload
+        annotationPath.clear();
+        annotationTime = QDateTime();
+        annotationSerial++;
+        imageViewer->setAnnotations(AnnotationSetPtr());
+        if (panes) {
+            mode->trigger();
+        } else if (!derivedBuffer.isNull()) {
+            const QSignalBlocker blocker(mode);
+            mode->setChecked(true);
+            showBuffer(derivedBuffer, true);
+            fitToWindow();
+        }
+    }
+    qApp->restoreOverrideCursor();
+
+    if (rotated.isNull())
+        statusBar()->showMessage(tr("Not enough memory to %1").arg(act->text().remove('&').toLower()));
+    else
+        statusBar()->showMessage(tr("%1 (%2 ms)").arg(act->text().remove('&')).arg(timer.elapsed()));
+}
+
 void ImageViewer::toggleGrayscaleImageDisplay(bool enable)
 {
     if (image.isNull() || image.isGrayscale()) {
@@ -558,86 +2011,968 @@ void ImageViewer::toggleGrayscaleImageDisplay(bool enable)
     else
         buf = image;
 
-    imageViewer->display(buf, true);
+    showBuffer(buf, true);
     fitToWindowAct->setChecked(true);
     fitToWindow();
 }
 
-void ImageViewer::toggleLabImageDisplay(bool enable)
+void ImageViewer::toggleBilinearTransform(bool enable)
 {
-    if (image.isNull() || image.isGrayscale()) {
-        statusBar()->showMessage(tr("Split Lab operation ignored as source image is null or grayscale image"));
+    imageViewer->setBilinearTransform(enable);
+    channelView->setBilinearTransform(enable);
+    if (enable) {
+        statusBar()->showMessage(tr("Enable Bilinear Transform (smooth image)"));
+    } else {
+        statusBar()->showMessage(tr("Disable Bilinear Transform (nearest neighbour)"));
+    }
+}
+
+void ImageViewer::openForwardedFiles(const QStringList &files)
+{
+    if (isMinimized())
+        showNormal();
+    raise();
+    activateWindow();
+
+    for (const QString &file : files)
+        loadFile(file);
+}
+
+void ImageViewer::loadDroppedFiles(QList<QUrl> files)
+{
+    // one tab each, the last one is shown
+    for (const QUrl &url : files) {
+        if (url.isLocalFile())
+            loadFile(url.toLocalFile());
+    }
+}
+
+/**
+ * @brief Buffer the ROI and probe statistics are taken from: what the
+ * viewer shows before colormap and contrast, so a split or grayscale view
+ * is measured in its own channels. The channel panes measure the image.
+ */
+QImage ImageViewer::statsBuffer() const
+{
+    return displayBuffer.isNull() || !channelView->isHidden() ? image : displayBuffer;
+}
+
+bool ImageViewer::requestIntegralImage()
+{
+    const QImage buffer = statsBuffer();
+    if (buffer.isNull())
+        return false;
+    if (integral && integral->cacheKey() == buffer.cacheKey())
+        return true;
+    if (integralPending)
+        return false;
+
+    QThread* thread = new QThread();
+    IntegralImageTask* task = new IntegralImageTask();
+    task->setImage(buffer);
+
+    // move the task object to the thread BEFORE connecting any signal/slots
+    task->moveToThread(thread);
+
+    connect(thread, &QThread::started, task, &IntegralImageTask::run);
+    connect(task, &IntegralImageTask::workFinished, thread, &QThread::quit);
+    connect(task, &IntegralImageTask::resultReady, this, &ImageViewer::integralImageReady);
+
+    // automatically delete thread and task object when work is done:
+    connect(task, &IntegralImageTask::workFinished, task, &IntegralImageTask::deleteLater);
+    connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+
+    integralPending = true;
+    startTask(thread);
+    return false;
+}
+
+void ImageViewer::integralImageReady(IntegralImagePtr result)
+{
+    integralPending = false;
+    if (result->cacheKey() != statsBuffer().cacheKey()) {
+        // image or view changed while the tables were built
+        if (roiRect.isValid() || probeWindow > 1)
+            requestIntegralImage();
         return;
     }
+    integral = result;
+    if (roiRect.isValid())
+        updateRoiStatistics(roiRect);
+    updateMemoryInfo();
+}
 
-    // double r = setting->value("merge_rg_r", 0.33).toDouble();
-    // double g = setting->value("merge_rg_g", 0.66).toDouble();
+void ImageViewer::updateRoiStatistics(const QRect &rect)
+{
+    roiRect = rect;
+    if (image.isNull())
+        return;
 
-    int size = image.size().width() * image.size().height();
-    bool large_image = size > setting->value("large_image_size", 8192*8192).toInt() ? true : false;
-    QImage buf;
-    if (enable) {
-        if(!large_image) {
-            buf = splitLabImageTask(image);
-            statusBar()->showMessage(tr("Split color image into Lab space"));
-        } else {
-            QThread* thread = new QThread();
-            SplitLabImageTask* task = new SplitLabImageTask();
-            task->setImage(image);
+    if (!requestIntegralImage()) {
+        roiStats->setText(tr("ROI: computing statistics..."));
+        roiStats->show();
+        return;
+    }
 
-            // move the task object to the thread BEFORE connecting any signal/slots
-            task->moveToThread(thread);
+    // a one-buffer split has its three channels side by side or stacked, the
+    // ROI is measured at the same place in each of them
+    const QImage buffer = statsBuffer();
+    QPoint step;
+    if (buffer.size() != image.size() && buffer.format() == QImage::Format_Grayscale8) {
+        if (buffer.width() == 3 * image.width() && buffer.height() == image.height())
+            step = QPoint(image.width(), 0);
+        else if (buffer.height() == 3 * image.height() && buffer.width() == image.width())
+            step = QPoint(0, image.height());
+    }
+    const QRect roi = rect.normalized();
+    const int pane = step.isNull() ? 0
+        : qBound(0, step.x() ? roi.left() / step.x() : roi.top() / step.y(), 2);
+    const QRect paneRect = step.isNull() ? buffer.rect() : image.rect().translated(step * pane);
+    const QRect r = (roi & paneRect).translated(-paneRect.topLeft());
+
+    RegionStats st;
+    QStringList names;
+    if (step.isNull()) {
+        st = integral->stats(r);
+        names = st.channels == 1 ? QStringList({"I"}) : channelNames(ColorSpace::RGB);
+    } else {
+        for (int c = 0; c < 3; c++) {
+            const RegionStats plane = integral->stats(r.translated(step * c));
+            st.count = plane.count;
+            st.mean[c] = plane.mean[0];
+            st.stddev[c] = plane.stddev[0];
+            st.min[c] = plane.min[0];
+            st.max[c] = plane.max[0];
+        }
+        st.channels = 3;
+        names = channelNames(splitSpace);
+    }
+    if (st.count == 0) {
+        roiStats->hide();
+        return;
+    }
 
-            connect(thread, &QThread::started, task, &SplitLabImageTask::run);
-            connect(task, &SplitLabImageTask::workFinished, thread, &QThread::quit);
-            connect(task, &SplitLabImageTask::resultReady, this, QOverload<const QPixmap&>::of(&ImageViewer::displayImage));
+    QString text = tr("ROI %1,%2 %3x%4 (%5 px)").arg(r.x()).arg(r.y())
+        .arg(r.width()).arg(r.height()).arg(st.count);
+    if (!paneRect.contains(roi))
+        text += step.isNull() ? tr(" clipped to the image") : tr(" clipped to the %1 pane").arg(names[pane]);
+    for (int c = 0; c < st.channels; c++) {
+        text += tr("  %1: %2 (sd %3) [%4, %5]")
+            .arg(names[c])
+            .arg(st.mean[c], 0, 'f', 2).arg(st.stddev[c], 0, 'f', 2)
+            .arg(st.min[c]).arg(st.max[c]);
+    }
+    roiStats->setText(text);
+    roiStats->show();
+}
 
-            // automatically delete thread and task object when work is done:
-            connect(task, &SplitLabImageTask::workFinished, task, &SplitLabImageTask::deleteLater);
-            connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+void ImageViewer::clearRoiStatistics()
+{
+    roiRect = QRect();
+    roiStats->clear();
+    roiStats->hide();
+}
 
-            qApp->setOverrideCursor(QCursor(Qt::WaitCursor));
-            installEventFilter(filter);
+/**
+ * @a display, when given, is @a buf already in a format QPixmap wraps as is;
+ * otherwise the shown buffer is converted in presentBuffer(), unless the low
+ * memory mode paints it as it is.
+ */
+void ImageViewer::showBuffer(const QImage &buf, bool update, const QImage &display)
+{
+    hideChannelPanes();
+    displayBuffer = buf;
+    // another view of the image, measured in its own channels
+    if (update && roiRect.isValid())
+        updateRoiStatistics(roiRect);
+
+    QImage shown = buf;
+    if (contrastMode != ContrastMode::None) {
+        if (contrastCacheKey == buf.cacheKey() && contrastCacheMode == contrastMode) {
+            shown = contrastCache;
+        } else {
+            // enhanced in a task, contrastReady() shows it
+            requestContrast();
+            if (!update && buf.cacheKey() == image.cacheKey()
+                && contrastCacheMode == contrastMode && contrastCache.size() == buf.size()) {
+                // a frame of the same stream: the enhanced previous one stays
+                // up rather than flashing this one plain
+                updateMemoryInfo();
+                return;
+            }
+        }
+    } else if (imageViewer->isLowMemory() && !contrastCache.isNull()) {
+        contrastCache = QImage();
+        contrastCacheKey = 0;
+    }
+    presentBuffer(shown, update, shown.cacheKey() == buf.cacheKey() ? display : QImage());
+}
 
-            progressBar->show();
-            progressBar->setRange(0, 0);
-            thread->start();
-            return;
+/// colormap, mask and the viewer for @a shown, displayBuffer after contrast
+void ImageViewer::presentBuffer(QImage shown, bool update, const QImage &display)
+{
+    // the colormap is a palette over the shown pixels, never a mapped copy;
+    // the same view is handed out again so caches keyed on it stay valid
+    if (!colorTable.isEmpty() && shown.format() == QImage::Format_Grayscale8) {
+        if (colorViewKey != shown.cacheKey() || colorView.colorTable() != colorTable) {
+            colorView = colorMapView(shown, colorTable);
+            colorViewKey = shown.cacheKey();
         }
+        shown = colorView;
     } else {
-        buf = image;
-        statusBar()->showMessage(tr("Display color image"));
+        colorView = QImage();
+        colorViewKey = 0;
     }
 
-    if (large_image) {
-        qApp->setOverrideCursor(QCursor(Qt::WaitCursor));
-        installEventFilter(filter);
+    // a mask goes over what would be shown, colormap included; never over
+    // a virtual image or the one-buffer split, its labels would not line up
+    if (maskAct->isChecked() && maskOverlay->hasMask() && !virtualSize.isValid()
+        && shown.size() == maskOverlay->size()) {
+        maskOverlay->show(shown, update);
+        updateMemoryInfo();
+        return;
     }
+    maskOverlay->release();
+
+    if (!colorView.isNull())
+        imageViewer->display(shown, update); // Qt looks the colours up while converting or painting
+    else if (virtualSize.isValid() && shown.cacheKey() == image.cacheKey())
+        imageViewer->displayVirtual(shown, virtualSize, update); // tiles follow in requestRegions()
+    else if (imageViewer->isLowMemory())
+        imageViewer->display(shown, update,
+                             shown.cacheKey() == imageProxyKey ? imageProxy : QImage());
+    else
+        imageViewer->display(!display.isNull() ? display : toDisplayFormat(shown),
+                             update, shown.cacheKey() == imageProxyKey ? imageProxy : QImage());
+    updateMemoryInfo();
+}
 
-    imageViewer->display(buf, true);
+void ImageViewer::showChannelPanes(ColorSpace space)
+{
+    // the panes read the image itself, nothing is split up front
+    displayBuffer = image;
+    channelView->setColorTable(colorTable);
+    channelView->setBilinearTransform(imageViewer->getBilinearTransform());
+    clearRoiStatistics();
+    imageViewer->clear(); // drop its pixmap while it is hidden
+    imageViewer->hide();
+    channelView->show();
+    channelView->setImage(image, space);
     fitToWindowAct->setChecked(true);
-    fitToWindow();
+    updateMemoryInfo();
+}
 
-    if (large_image) {
-        removeEventFilter(filter);
-        qApp->restoreOverrideCursor();
+void ImageViewer::hideChannelPanes()
+{
+    if (channelView->isHidden())
+        return;
+    channelView->clear();
+    channelView->hide();
+    imageViewer->show();
+}
+
+void ImageViewer::updateMemoryInfo()
+{
+    if (image.isNull()) {
+        memoryInfo->hide();
+        return;
     }
+
+    // buffers sharing pixels with one listed before them are not counted again
+    QList<const uchar*> seen;
+    QStringList parts;
+    qint64 total = 0;
+    auto add = [&](const QString &name, qint64 bytes, const uchar *bits = nullptr) {
+        if (bytes <= 0 || (bits && seen.contains(bits)))
+            return;
+        if (bits)
+            seen.append(bits);
+        total += bytes;
+        parts.append(tr("%1 %2").arg(name, locale().formattedDataSize(bytes)));
+    };
+    add(tr("image"), image.sizeInBytes(), image.constBits());
+    add(tr("mosaic"), bayerRaw.sizeInBytes(), bayerRaw.constBits());
+    add(tr("display"), displayBuffer.sizeInBytes(), displayBuffer.constBits());
+    add(tr("contrast"), contrastCache.sizeInBytes(), contrastCache.constBits());
+    const QImage painted = imageViewer->displayedImage();
+    add(tr("painted"), painted.sizeInBytes(), painted.constBits());
+    add(tr("pixmap"), imageViewer->pixmapBytes());
+    add(tr("item cache"), imageViewer->itemCacheBytes());
+    if (integral)
+        add(tr("stats"), integral->bytes());
+    qint64 parked = 0;
+    for (int i = 0; i < documents.size(); i++) {
+        if (i != currentDocument)
+            parked += documents[i].image.sizeInBytes() + documents[i].packed.compressedBytes();
+    }
+    add(tr("channel tiles"), channelView->cacheBytes());
+    add(tr("mask"), maskOverlay->bytes());
+    add(tr("other tabs"), parked);
+    add(tr("regions"), qint64(regionCache.totalCost()) * 1024);
+    if (const AnnotationSetPtr annotations = imageViewer->annotations())
+        add(tr("annotations"), annotations->bytes());
+
+    memoryInfo->setText(tr("Memory: %1").arg(parts.join(", ")));
+    memoryInfo->setToolTip(tr("%1 held by the viewer").arg(locale().formattedDataSize(total)));
+    memoryInfo->show();
 }
 
-void ImageViewer::toggleBilinearTransform(bool enable)
+void ImageViewer::setContrastMode(QAction *act)
 {
-    imageViewer->setBilinearTransform(enable);
-    if (enable) {
-        statusBar()->showMessage(tr("Enable Bilinear Transform (smooth image)"));
+    contrastMode = ContrastMode(act->data().toInt());
+    statusBar()->showMessage(tr("Contrast: %1").arg(act->text().remove('&')));
+    if (!displayBuffer.isNull() && channelView->isHidden())
+        showBuffer(displayBuffer, false);
+}
+
+/**
+ * One ContrastTask at a time, for the current displayBuffer; frames that
+ * arrive meanwhile are never enhanced, only the latest one when it lands.
+ */
+void ImageViewer::requestContrast()
+{
+    if (contrastPending || displayBuffer.isNull())
+        return;
+    contrastOfImage = displayBuffer.cacheKey() == image.cacheKey();
+
+    QThread* thread = new QThread();
+    ContrastTask* task = new ContrastTask();
+    task->setImage(displayBuffer);
+    task->setMode(contrastMode,
+                  setting->value("clahe_clip_limit", 2.0).toDouble(),
+                  setting->value("clahe_tiles", 8).toInt());
+
+    // move the task object to the thread BEFORE connecting any signal/slots
+    task->moveToThread(thread);
+
+    connect(thread, &QThread::started, task, &ContrastTask::run);
+    connect(task, &ContrastTask::workFinished, thread, &QThread::quit);
+    connect(task, &ContrastTask::resultReady, this, &ImageViewer::contrastReady);
+
+    // automatically delete thread and task object when work is done:
+    connect(task, &ContrastTask::workFinished, task, &ContrastTask::deleteLater);
+    connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+
+    contrastPending = true;
+    startTask(thread);
+}
+
+void ImageViewer::contrastReady(qint64 sourceKey, int mode, const QImage &enhanced)
+{
+    contrastPending = false;
+    if (contrastMode == ContrastMode::None || displayBuffer.isNull() || !channelView->isHidden())
+        return;
+    if (ContrastMode(mode) != contrastMode) {
+        requestContrast();
+        return;
+    }
+    if (sourceKey == displayBuffer.cacheKey()) {
+        contrastCache = enhanced;
+        contrastCacheKey = sourceKey;
+        contrastCacheMode = contrastMode;
+        showBuffer(displayBuffer, false);
+        return;
+    }
+    if (contrastOfImage && displayBuffer.cacheKey() == image.cacheKey()
+        && enhanced.size() == image.size()) {
+        // frames of a stream came faster than they are enhanced: this one is
+        // older than the image but newer than what is up, show it meanwhile
+        contrastCache = enhanced;
+        contrastCacheKey = sourceKey;
+        contrastCacheMode = contrastMode;
+        presentBuffer(enhanced, false);
+    }
+    requestContrast();
+}
+
+/**
+ * While demosaicing is on, single channel frames are shown, split and probed
+ * as the colour image. The mosaic is kept to redo it with other settings.
+ */
+QImage ImageViewer::demosaicked(const QImage &frame)
+{
+    bayerRaw = QImage();
+    // the overview of a virtual image is scaled, its pattern is lost
+    if (!demosaicAct->isChecked() || virtualSize.isValid() || !canDemosaic(frame))
+        return frame;
+
+    const QImage rgb = demosaic(frame, bayerPattern, demosaicMethod,
+                                setting->value("bayer_bits", 0).toInt());
+    if (rgb.isNull())
+        return frame; // not enough memory, keep showing the mosaic
+    bayerRaw = frame;
+    return rgb;
+}
+
+/**
+ * Frames of a stream (playback, a watched file, ingest) are demosaiced in a
+ * DemosaicTask, one at a time; the last frame stays up meanwhile and only
+ * the newest one that comes in is kept waiting.
+ */
+void ImageViewer::showStreamFrame(const QImage &frame, bool update, bool measure, const QImage &display)
+{
+    mosaicKey = 0;
+    mosaicQueued = QImage();
+    if (!demosaicAct->isChecked() || virtualSize.isValid() || !canDemosaic(frame)) {
+        presentStreamFrame(frame, QImage(), update, measure, display);
+        return;
+    }
+
+    mosaicKey = frame.cacheKey();
+    mosaicUpdate = mosaicUpdate || update;
+    mosaicMeasure = mosaicMeasure || measure;
+    if (demosaicPending)
+        mosaicQueued = frame;
+    else
+        requestDemosaic(frame);
+}
+
+/// @a rgb null shows the mosaic @a raw itself
+void ImageViewer::presentStreamFrame(const QImage &raw, const QImage &rgb, bool update, bool measure, const QImage &display)
+{
+    bayerRaw = rgb.isNull() ? QImage() : raw;
+    image = rgb.isNull() ? raw : rgb;
+    integral.reset();
+    // the display copy is of the decoded frame, not of a demosaiced one
+    showBuffer(image, update, rgb.isNull() ? display : QImage());
+    if (update) {
+        printAct->setEnabled(true);
+        fitToWindowAct->setEnabled(true);
+        fitToWindowAct->setChecked(true);
+        fitToWindow();
+    }
+    if (measure && roiRect.isValid())
+        updateRoiStatistics(roiRect);
+}
+
+void ImageViewer::requestDemosaic(const QImage &raw)
+{
+    QThread* thread = new QThread();
+    DemosaicTask* task = new DemosaicTask();
+    task->setImage(raw);
+    task->setMode(bayerPattern, demosaicMethod, setting->value("bayer_bits", 0).toInt());
+
+    // move the task object to the thread BEFORE connecting any signal/slots
+    task->moveToThread(thread);
+
+    connect(thread, &QThread::started, task, &DemosaicTask::run);
+    connect(task, &DemosaicTask::workFinished, thread, &QThread::quit);
+    connect(task, &DemosaicTask::resultReady, this, &ImageViewer::demosaicReady);
+
+    // automatically delete thread and task object when work is done:
+    connect(task, &DemosaicTask::workFinished, task, &DemosaicTask::deleteLater);
+    connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+
+    demosaicPending = true;
+    startTask(thread);
+}
+
+void ImageViewer::demosaicReady(const QImage &raw, const QImage &rgb)
+{
+    demosaicPending = false;
+    // a frame older than the one waiting is still newer than what is up;
+    // anything else shown since makes it stale
+    if (mosaicKey && (raw.cacheKey() == mosaicKey || !mosaicQueued.isNull())) {
+        const bool update = mosaicUpdate;
+        const bool measure = mosaicMeasure && mosaicQueued.isNull();
+        mosaicUpdate = false;
+        if (mosaicQueued.isNull()) {
+            mosaicKey = 0;
+            mosaicMeasure = false;
+        }
+        presentStreamFrame(raw, rgb, update, measure);
+    }
+    if (!mosaicQueued.isNull()) {
+        const QImage next = mosaicQueued;
+        mosaicQueued = QImage();
+        requestDemosaic(next);
+    }
+}
+
+void ImageViewer::redemosaic()
+{
+    const QImage raw = bayerRaw.isNull() ? image : bayerRaw;
+    if (raw.isNull() || (bayerRaw.isNull() && !demosaicAct->isChecked()))
+        return;
+    if (!canDemosaic(raw)) {
+        statusBar()->showMessage(tr("Demosaic ignored as source image is not a single channel frame"));
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    qApp->setOverrideCursor(QCursor(Qt::WaitCursor));
+    image = demosaicked(raw);
+    integral.reset();
+    const qint64 elapsed = timer.elapsed();
+
+    // a split view is computed again from the new colours
+    QAction *mode = dispOrigAct->actionGroup()->checkedAction();
+    if (!mode || mode == dispOrigAct || bayerRaw.isNull()) {
+        dispOrigAct->setChecked(true);
+        showBuffer(image, false);
     } else {
-        statusBar()->showMessage(tr("Disable Bilinear Transform (nearest neighbour)"));
+        mode->trigger();
     }
+    if (roiRect.isValid())
+        updateRoiStatistics(roiRect);
+    qApp->restoreOverrideCursor();
+
+    static const char *patternNames[] = {"RGGB", "BGGR", "GRBG", "GBRG"};
+    if (bayerRaw.isNull())
+        statusBar()->showMessage(tr("Showing the raw mosaic"));
+    else
+        statusBar()->showMessage(tr("Demosaiced %1 with %2 (%3 ms)")
+            .arg(QLatin1String(patternNames[int(bayerPattern)]))
+            .arg(demosaicMethod == DemosaicMethod::Bilinear ? tr("bilinear") : tr("Malvar-He-Cutler"))
+            .arg(elapsed));
 }
 
-void ImageViewer::loadDroppedFiles(QList<QUrl> files)
+void ImageViewer::setColorMap(QAction *act)
+{
+    const QString name = act->data().toString();
+    setting->setValue("colormap", name);
+    colorTable = colorMapTable(name,
+        setting->value("custom_colormap", QStringList({"#000000", "#ff0000", "#ffff00", "#ffffff"})).toStringList());
+
+    // the grayscale buffer is kept, only the lookup runs again
+    if (!channelView->isHidden())
+        channelView->setColorTable(colorTable);
+    else if (displayBuffer.format() == QImage::Format_Grayscale8)
+        showBuffer(displayBuffer, false);
+    statusBar()->showMessage(tr("Colormap: %1").arg(act->text()));
+}
+
+void ImageViewer::setProbeWindow(QAction *act)
+{
+    probeWindow = act->data().toInt();
+    setting->setValue("probe_window_size", probeWindow);
+    if (probeWindow > 1)
+        requestIntegralImage();
+    statusBar()->showMessage(tr("Probe window %1 x %1").arg(probeWindow));
+}
+
+void ImageViewer::updateFrameInfo()
+{
+    const bool multiFrame = frameCount > 1;
+    playAct->setEnabled(multiFrame);
+    nextFrameAct->setEnabled(multiFrame);
+    prevFrameAct->setEnabled(multiFrame);
+    firstFrameAct->setEnabled(multiFrame);
+    lastFrameAct->setEnabled(multiFrame);
+    if (!multiFrame) {
+        frameInfo->hide();
+        return;
+    }
+
+    QString text = tr("Frame %1/%2").arg(currentFrame + 1).arg(frameCount);
+    if (playTimer->isActive()) {
+        const qint64 elapsed = qMax<qint64>(1, playClock.elapsed());
+        const double fps = (framesShown - droppedFrames) * 1000.0 / elapsed;
+        text += tr("  %1/%2 fps  buffered %3  dropped %4")
+            .arg(fps, 0, 'f', 1).arg(playbackFps)
+            .arg(frameBuffer ? frameBuffer->size() : 0).arg(droppedFrames);
+    }
+    frameInfo->setText(text);
+    frameInfo->show();
+}
+
+void ImageViewer::startPlayback()
+{
+    if (frameCount < 2 || filePath.isEmpty())
+        return;
+
+    stopPlayback();
+    dispOrigAct->setChecked(true);
+
+    const int capacity = setting->value("playback_buffer_frames", 8).toInt();
+    frameBuffer.reset(new FrameRingBuffer(capacity));
+
+    QThread* thread = new QThread();
+    FrameDecodeTask* task = new FrameDecodeTask(frameBuffer);
+    task->setFile(filePath, (currentFrame + 1) % frameCount, frameCount);
+
+    // move the task object to the thread BEFORE connecting any signal/slots
+    task->moveToThread(thread);
+
+    connect(thread, &QThread::started, task, &FrameDecodeTask::run);
+    connect(task, &FrameDecodeTask::workFinished, thread, &QThread::quit);
+    connect(task, &FrameDecodeTask::decodeError, this, [this](QString message) {
+        stopPlayback();
+        statusBar()->showMessage(tr("Playback stopped: %1").arg(message));
+    });
+
+    // automatically delete thread and task object when work is done:
+    connect(task, &FrameDecodeTask::workFinished, task, &FrameDecodeTask::deleteLater);
+    connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+
+    startTask(thread);
+
+    framesShown = 0;
+    droppedFrames = 0;
+    playClock.start();
+    playTimer->start(qMax(1, 1000 / playbackFps));
+    playAct->setChecked(true);
+    updateFrameInfo();
+}
+
+void ImageViewer::stopPlayback()
+{
+    playTimer->stop();
+    if (frameBuffer) {
+        frameBuffer->abort(); // the decoder thread exits on its own
+        frameBuffer.reset();
+    }
+    playAct->setChecked(false);
+    updateFrameInfo();
+}
+
+void ImageViewer::playbackTick()
+{
+    if (!frameBuffer)
+        return;
+
+    // number of frames that should be on screen by now
+    const qint64 due = playClock.elapsed() * playbackFps / 1000 + 1;
+
+    int index = -1;
+    QImage frame;
+    QImage display;
+    while (framesShown < due) {
+        int i;
+        QImage f, d;
+        if (!frameBuffer->pop(&i, &f, &d))
+            break; // decoder is behind, keep the current frame
+        if (index >= 0)
+            droppedFrames++; // superseded before it was shown
+        index = i;
+        frame = f;
+        display = d;
+        framesShown++;
+    }
+
+    if (index >= 0)
+        displayFrame(index, frame, display);
+    updateFrameInfo();
+}
+
+void ImageViewer::displayFrame(int index, const QImage &frame, const QImage &display, bool measure)
+{
+    currentFrame = index;
+    showStreamFrame(frame, false, measure, display);
+}
+
+void ImageViewer::showFrame(int index)
+{
+    stopPlayback();
+
+    QImageReader reader(filePath);
+    reader.setAutoTransform(true);
+    if (!reader.jumpToImage(index)) {
+        for (int i = 0; i < index; i++) {
+            reader.read();
+            if (!reader.supportsAnimation())
+                reader.jumpToNextImage();
+        }
+    }
+    const QImage frame = reader.read();
+    if (frame.isNull()) {
+        statusBar()->showMessage(tr("Cannot read frame %1: %2").arg(index + 1).arg(reader.errorString()));
+        return;
+    }
+
+    displayFrame(index, frame, QImage(), true); // converted for display by showBuffer()
+    updateFrameInfo();
+}
+
+void ImageViewer::togglePlayback(bool enable)
+{
+    if (enable)
+        startPlayback();
+    else
+        stopPlayback();
+}
+
+void ImageViewer::nextFrame()
+{
+    showFrame((currentFrame + 1) % frameCount);
+}
+
+void ImageViewer::previousFrame()
+{
+    showFrame((currentFrame + frameCount - 1) % frameCount);
+}
+
+void ImageViewer::firstFrame()
+{
+    showFrame(0);
+}
+
+void ImageViewer::lastFrame()
+{
+    showFrame(frameCount - 1);
+}
+
+void ImageViewer::startWatching(const QString &fileName, const QString &folder)
+{
+    stopWatching();
+    stopPlayback();
+
+    if (!watcher) {
+        watcher = new QFileSystemWatcher(this);
+        connect(watcher, &QFileSystemWatcher::fileChanged, this, &ImageViewer::watchedPathChanged);
+        connect(watcher, &QFileSystemWatcher::directoryChanged, this, &ImageViewer::watchedPathChanged);
+    }
+
+    filePath = fileName;
+    watchDir = folder;
+    if (!filePath.isEmpty())
+        watcher->addPath(filePath);
+    if (!watchDir.isEmpty())
+        watcher->addPath(watchDir);
+
+    reloadCount = 0;
+    skippedReloads = 0;
+    watchAct->setChecked(true);
+    statusBar()->showMessage(tr("Watching \"%1\"")
+        .arg(QDir::toNativeSeparators(watchDir.isEmpty() ? filePath : watchDir)));
+}
+
+void ImageViewer::stopWatching()
+{
+    if (watcher && !watcher->files().isEmpty())
+        watcher->removePaths(watcher->files());
+    if (watcher && !watcher->directories().isEmpty())
+        watcher->removePaths(watcher->directories());
+    watchDir.clear();
+    reloadTimer->stop();
+    reloadDirty = false;
+    watchAct->setChecked(false);
+}
+
+void ImageViewer::toggleWatchFile(bool enable)
 {
-    if (files.empty())
+    if (enable && !filePath.isEmpty())
+        startWatching(filePath, QString());
+    else
+        stopWatching();
+}
+
+void ImageViewer::watchFolder()
+{
+    const QString folder = QFileDialog::getExistingDirectory(this, tr("Watch Folder"),
+        filePath.isEmpty() ? QDir::currentPath() : QFileInfo(filePath).absolutePath());
+    if (folder.isEmpty())
+        return;
+
+    startWatching(QString(), folder);
+    reloadTimer->start();
+}
+
+/**
+ * @brief Group the similar images of a folder, see DuplicateScanTask. Hashes
+ * of unchanged files come from the previous scan of the same folder.
+ */
+void ImageViewer::findDuplicates()
+{
+    if (scanningDuplicates) {
+        statusBar()->showMessage(tr("A duplicate scan is still running"));
+        return;
+    }
+    const QString folder = QFileDialog::getExistingDirectory(this, tr("Find Duplicates in Folder"),
+        filePath.isEmpty() ? QDir::currentPath() : QFileInfo(filePath).absolutePath());
+    if (folder.isEmpty())
         return;
+    scanningDuplicates = true;
+
+    QThread* thread = new QThread();
+    DuplicateScanTask* task = new DuplicateScanTask();
+    task->setFolder(folder, setting->value("duplicate_threshold", 6).toInt(),
+                    setting->value("duplicate_hash", "phash").toString() == "dhash");
+
+    // move the task object to the thread BEFORE connecting any signal/slots
+    task->moveToThread(thread);
+
+    connect(thread, &QThread::started, task, &DuplicateScanTask::run);
+    connect(task, &DuplicateScanTask::workFinished, thread, &QThread::quit);
+    connect(task, &DuplicateScanTask::progress, this, [this](int done, int total) {
+        progressBar->setRange(0, total);
+        progressBar->setValue(done);
+    });
+    connect(task, &DuplicateScanTask::resultReady, this, &ImageViewer::duplicatesReady);
+
+    // automatically delete thread and task object when work is done:
+    connect(task, &DuplicateScanTask::workFinished, task, &DuplicateScanTask::deleteLater);
+    connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+
+    progressBar->show();
+    progressBar->setRange(0, 0);
+    statusBar()->showMessage(tr("Hashing images in \"%1\" ...").arg(QDir::toNativeSeparators(folder)));
+    startTask(thread);
+}
+
+void ImageViewer::duplicatesReady(DuplicateScanResult result)
+{
+    scanningDuplicates = false;
+    progressBar->hide();
+
+    const QDir root(result.folder);
+    duplicatesView->clear();
+    int files = 0;
+    for (const QStringList &group : result.groups) {
+        QTreeWidgetItem *top = new QTreeWidgetItem(duplicatesView,
+            QStringList(tr("%1 similar images").arg(group.size())));
+        for (const QString &path : group) {
+            QTreeWidgetItem *item = new QTreeWidgetItem(top, QStringList(root.relativeFilePath(path)));
+            item->setData(0, Qt::UserRole, path);
+            item->setToolTip(0, QDir::toNativeSeparators(path));
+        }
+        files += group.size();
+    }
+    duplicatesView->expandAll();
+    duplicatesDock->show();
+
+    statusBar()->showMessage(tr("%1 groups of %2 similar images among %3 in \"%4\", "
+                                "%5 hashed, %6 unreadable, %7 ms")
+        .arg(result.groups.size()).arg(files).arg(result.files)
+        .arg(QDir::toNativeSeparators(result.folder))
+        .arg(result.hashed - result.failed).arg(result.failed).arg(result.ms));
+}
+
+void ImageViewer::watchedPathChanged(const QString &path)
+{
+    // writers that save through a rename drop the old inode from the watcher
+    if (path == filePath && !watcher->files().contains(path) && QFileInfo::exists(path))
+        watcher->addPath(path);
 
-    loadFile(files.front().toLocalFile());
+    // trailing debounce: reload once the writer has been quiet for the interval
+    reloadTimer->start();
+}
+
+void ImageViewer::reloadWatched()
+{
+    if (!watchDir.isEmpty()) {
+        QStringList nameFilters;
+        for (const QByteArray &format : QImageReader::supportedImageFormats())
+            nameFilters.append(QLatin1String("*.") + QString::fromLatin1(format));
+        const QFileInfoList entries = QDir(watchDir).entryInfoList(nameFilters, QDir::Files, QDir::Time);
+        if (entries.isEmpty())
+            return;
+        const QString newest = entries.first().absoluteFilePath();
+        if (newest != filePath) {
+            if (!filePath.isEmpty())
+                watcher->removePath(filePath);
+            filePath = newest;
+            watcher->addPath(filePath);
+        }
+    }
+    if (filePath.isEmpty())
+        return;
+
+    // never queue more decodes than can run, the newest write wins
+    if (reloadsInFlight >= qMax(1, setting->value("watch_max_inflight", 2).toInt())) {
+        reloadDirty = true;
+        skippedReloads++;
+        return;
+    }
+
+    QThread* thread = new QThread();
+    ImageLoadTask* task = new ImageLoadTask();
+    task->setFile(filePath, ++reloadSerial, false); // as decoded, like loadFile(); showBuffer() converts
+
+    // move the task object to the thread BEFORE connecting any signal/slots
+    task->moveToThread(thread);
+
+    connect(thread, &QThread::started, task, &ImageLoadTask::run);
+    connect(task, &ImageLoadTask::workFinished, thread, &QThread::quit);
+    connect(task, &ImageLoadTask::resultReady, this, &ImageViewer::watchedImageReady);
+
+    // automatically delete thread and task object when work is done:
+    connect(task, &ImageLoadTask::workFinished, task, &ImageLoadTask::deleteLater);
+    connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+
+    reloadsInFlight++;
+    startTask(thread);
+}
+
+void ImageViewer::watchedImageReady(int serial, const QImage &newImage, const QString &error)
+{
+    reloadsInFlight--;
+    if (reloadDirty && watchAct->isChecked()) {
+        reloadDirty = false;
+        reloadWatched();
+    }
+
+    if (!watchAct->isChecked())
+        return;
+    if (serial < shownSerial) {
+        skippedReloads++; // a newer write is already on screen
+        return;
+    }
+    if (newImage.isNull()) {
+        // most likely caught the writer half way, the next notification retries
+        statusBar()->showMessage(tr("Reload failed: %1").arg(error));
+        return;
+    }
+
+    shownSerial = serial;
+    reloadCount++;
+    // the document has new pixels, a decode still in flight for it is stale
+    if (currentDocument >= 0)
+        documents[currentDocument].loadSerial = ++loadSerial;
+
+    // swap the pixels only, zoom and pan stay where the user left them
+    const bool firstImage = image.isNull();
+    if (!dispOrigAct->isChecked())
+        dispOrigAct->setChecked(true);
+    showStreamFrame(newImage, firstImage, true);
+
+    setWindowFilePath(filePath);
+    updateActions();
+    loadAnnotations(); // a watched folder moves on to the next file
+    statusBar()->showMessage(tr("Reloaded \"%1\", %2x%3 (%4 updates, %5 skipped)")
+        .arg(QDir::toNativeSeparators(filePath)).arg(newImage.width()).arg(newImage.height())
+        .arg(reloadCount).arg(skippedReloads));
+}
+
+void ImageViewer::toggleFrameIngest(bool enable)
+{
+    if (!enable) {
+        ingest->close();
+        statusBar()->showMessage(tr("Stopped listening for frames"));
+        return;
+    }
+
+    const QString name = setting->value("ingest_server_name", "ImageViewerIngest").toString();
+    if (!ingest->listen(name)) {
+        listenAct->setChecked(false);
+        statusBar()->showMessage(tr("Cannot listen on \"%1\": %2").arg(name, ingest->errorString()));
+        return;
+    }
+    ingestFrames = 0;
+    ingestClock.start();
+    statusBar()->showMessage(tr("Listening for frames on \"%1\"").arg(name));
+}
+
+void ImageViewer::ingestFrameReady(const QImage &frame, quint64 sequence, double latencyMs)
+{
+    stopWatching();
+    stopPlayback();
+
+    // frame is our own copy, the server answers SHOWN on the next paint
+    const bool firstImage = image.isNull() || image.size() != frame.size();
+    if (currentDocument >= 0)
+        documents[currentDocument].loadSerial = ++loadSerial;
+    filePath.clear();
+    if (!dispOrigAct->isChecked())
+        dispOrigAct->setChecked(true);
+    showStreamFrame(frame, firstImage, false);
+    if (firstImage)
+        loadAnnotations(); // frames have no sidecar
+
+    ingestFrames++;
+    const double fps = ingestFrames * 1000.0 / qMax<qint64>(1, ingestClock.elapsed());
+    statusBar()->showMessage(tr("Frame #%1, %2x%3, %4 ms latency, %5 fps, %6 skipped")
+        .arg(sequence).arg(frame.width()).arg(frame.height())
+        .arg(latencyMs, 0, 'f', 1).arg(fps, 0, 'f', 1).arg(ingest->framesSkipped()));
 }
@@ -53,6 +53,14 @@
 
 #include <QMainWindow>
 #include <QImage>
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QCache>
+#include <QHash>
+#include <QSet>
+#include <QSharedPointer>
+#include <QPointer>
+#include <QAtomicInt>
 #if defined(QT_PRINTSUPPORT_LIB)
 #  include <QtPrintSupport/qtprintsupportglobal.h>
 
@@ -62,6 +70,20 @@
 #endif
 #include "QImageViewer.h"
 #include "busyappfilter.h"
+#include "imagestats.h"
+#include "imageopstask.h"
+#include "contrast.h"
+#include "framedecoder.h"
+#include "frameingest.h"
+#include "imagemetadata.h"
+#include "compressedimage.h"
+#include "rotateflip.h"
+#include "virtualimage.h"
+#include "demosaic.h"
+#include "channelview.h"
+#include "annotations.h"
+#include "maskoverlay.h"
+#include "duplicates.h"
 
 QT_BEGIN_NAMESPACE
 class QSettings;
@@ -69,18 +91,42 @@ class QAction;
 class QLabel;
 class QMenu;
 class QProgressBar;
+class QSlider;
 class QPixmap;
+class QTimer;
+class QFileSystemWatcher;
+class QDockWidget;
+class QTreeWidget;
+class QTabBar;
+class QCloseEvent;
+class QThread;
 QT_END_NAMESPACE
 
 //! [0]
 class ImageViewer : public QMainWindow
 {
     Q_OBJECT
+    friend class UiBench;
 
 public:
-    ImageViewer(QWidget *parent = nullptr);
+    /// @a settings replaces the user's settings and is adopted, e.g. for benchmarks
+    ImageViewer(QWidget *parent = nullptr, QSettings *settings = nullptr);
+    /// false when the file cannot be opened; true once it is shown or while
+    /// its pixels decode in the background, loadFinished() tells how it ends
     bool loadFile(const QString &);
 
+signals:
+    /// every loadFile() ends here, after the decode when that runs in a task
+    void loadFinished(const QString &fileName, bool ok);
+    /// the last running task thread of the window or its viewer is done
+    void tasksFinished();
+
+public slots:
+    void openForwardedFiles(const QStringList &files);
+
+protected:
+    void closeEvent(QCloseEvent *event) override;
+
 private slots:
     void open();
     void saveAs();
@@ -96,46 +142,250 @@ private slots:
     void openContainingFolder();
 
     void displayImage(bool enable);
-    void displayImage(const QPixmap& image);
+    void displayImage(const QImage& image, const QImage& display = QImage());
 
     void toggleRGBImageDisplay(bool enable);
     void toggleLabImageDisplay(bool enable);
     void toggleGrayscaleImageDisplay(bool enable);
     void toggleBilinearTransform(bool enable);
+    void rotateImage(QAction *act);
     void loadDroppedFiles(QList<QUrl> files);
 
+    void updateRoiStatistics(const QRect &rect);
+    void clearRoiStatistics();
+    void integralImageReady(IntegralImagePtr result);
+    void setProbeWindow(QAction *act);
+    void setColorMap(QAction *act);
+    void setContrastMode(QAction *act);
+    void contrastReady(qint64 sourceKey, int mode, const QImage &enhanced);
+    void demosaicReady(const QImage &raw, const QImage &rgb);
+
+    void togglePlayback(bool enable);
+    void nextFrame();
+    void previousFrame();
+    void firstFrame();
+    void lastFrame();
+    void playbackTick();
+
+    void toggleWatchFile(bool enable);
+    void watchFolder();
+    void watchedPathChanged(const QString &path);
+    void reloadWatched();
+    void watchedImageReady(int serial, const QImage &newImage, const QString &error);
+
+    void toggleFrameIngest(bool enable);
+    void ingestFrameReady(const QImage &frame, quint64 sequence, double latencyMs);
+
+    void loadedImageReady(int serial, const QImage &newImage, const QString &error);
+    void virtualOverviewReady(int serial, QSize size, const QImage &overview);
+
+    void activateDocument(int index);
+    void closeDocument(int index);
+    void documentCompressed(int id, CompressedImage packed);
+    void documentUnpacked(int serial, const QImage &pixels);
+
+    void requestRegions();
+    void regionReady(int serial, qint64 key, QRect rect, QImage region);
+    void regionsDone();
+
+    void annotationsReady(int serial, AnnotationSetPtr annotations, const QString &error);
+
+    void loadMask();
+    void maskLoaded(int serial, const QImage &mask, const QString &error);
+    void clearMask();
+
+    void findDuplicates();
+    void duplicatesReady(DuplicateScanResult result);
+
 private:
     void createActions();
+    void startTask(QThread *thread);
+    void countTask(QThread *thread);
     void createMenus();
     void updateActions();
     bool saveFile(const QString &fileName);
     void setImage(const QImage &newImage);
+    void finishLoad(const QString &fileName, const QImage &newImage, int frames, int frameDelay);
+    void beginPendingLoad(const QString &fileName, const ImageMetadata &meta, int serial);
+    void startImageLoad(const QString &fileName, int serial);
+    bool openVirtual(const QString &fileName, const ImageMetadata &meta, int serial);
+    void showMetadata(const ImageMetadata &meta);
+    void storeDecoded(const QString &fileName);
+    bool requestIntegralImage();
+    void requestContrast();
+    QImage statsBuffer() const;
+    void showBuffer(const QImage &buf, bool update, const QImage &display = QImage());
+    void presentBuffer(QImage shown, bool update, const QImage &display = QImage());
+    void showChannelPanes(ColorSpace space);
+    void hideChannelPanes();
+    void loadAnnotations();
+    QImage demosaicked(const QImage &frame);
+    void showStreamFrame(const QImage &frame, bool update, bool measure, const QImage &display = QImage());
+    void presentStreamFrame(const QImage &raw, const QImage &rgb, bool update, bool measure, const QImage &display = QImage());
+    void requestDemosaic(const QImage &raw);
+    void redemosaic();
+    void updateMemoryInfo();
+    void splitImageDisplay(ColorSpace space, bool enable);
+    void startPlayback();
+    void stopPlayback();
+    void showFrame(int index);
+    void displayFrame(int index, const QImage &frame, const QImage &display = QImage(), bool measure = false);
+    void updateFrameInfo();
+    void startWatching(const QString &fileName, const QString &folder);
+    void stopWatching();
+    void beginDocument(const QString &fileName);
+    void parkCurrentDocument(int next = -1);
+    void compressDocuments(int keep = -1);
+    int documentIndex(int id) const;
+
+    /// an open file or pasted image, one per tab
+    struct Document
+    {
+        int id = 0;
+        QString filePath; // empty for pasted images
+        ImageMetadata metadata;
+        QImage image; // inactive, not compressed yet
+        CompressedImage packed; // inactive; both null: evicted, read again from filePath
+        int frameCount = 1;
+        int playbackFps = 30;
+        QSize virtualSize;
+        qint64 lastShown = 0;
+        int loadSerial = 0;
+    };
 
-    QImage image;
+    QImage image; // of the current document
     QImageViewer *imageViewer;
+    ChannelView *channelView; // shown instead of imageViewer for linked split panes
+    QTabBar *tabBar;
+    QVector<Document> documents;
+    int currentDocument = -1;
+    int nextDocumentId = 1;
+    int compressingDocument = 0; // id, 0 when idle
+    qint64 documentClock = 0;
     QLabel *imgPixVal;
     QString filePath;
     QSettings *setting;
+    int runningTasks = 0; // threads passed to countTask() that have not finished
     QProgressBar *progressBar;
     BusyAppFilter *filter;
+    QLabel *roiStats;
+    QLabel *memoryInfo;
+    QDockWidget *metadataDock;
+    QTreeWidget *metadataView;
+    QDockWidget *duplicatesDock;
+    QTreeWidget *duplicatesView; // groups of similar images, a file opens on activation
+    bool scanningDuplicates = false;
+    ImageMetadata metadata; // of the last file opened
+    int loadSerial = 0;
+    QHash<int, int> pendingLoads; // load or unpack serial -> document id
+    QElapsedTimer loadClock;
+    QImage imageProxy; // smallest pyramid level from the decode cache
+    qint64 imageProxyKey = 0;
+
+    QSize virtualSize; // full size when image is the overview of a virtual image
+    qint64 virtualKey = 0; // of that overview
+    int regionSerial = 0;
+    QSet<qint64> regionsWanted; // tiles around the viewport
+    QSharedPointer<QAtomicInt> regionGeneration; // bumped when regionsWanted changes
+    bool regionsBusy = false; // a RegionDecodeTask is running
+    bool regionsQueued = false; // and the view asked for more meanwhile
+    QCache<qint64, QImage> regionCache; // cost in KB
+    QTimer *regionTimer;
+
+    QString annotationPath; // sidecar of filePath shown or being read
+    QDateTime annotationTime; // of that file
+    int annotationSerial = 0;
+
+    MaskOverlay *maskOverlay; // blends a label image over what is shown
+    QSlider *maskOpacity; // in the status bar while a mask is loaded
+    QString maskPath;
+    int maskSerial = 0;
+
+    IntegralImagePtr integral;
+    bool integralPending = false;
+    QRect roiRect;
+    int probeWindow = 1;
+
+    QImage displayBuffer; // what is on screen before the colormap
+    ColorSpace splitSpace = ColorSpace::RGB; // of the last split shown
+    QVector<QRgb> colorTable; // empty: no colormap
+    QImage colorView; // Indexed8 over the shown Grayscale8 pixels with colorTable
+    qint64 colorViewKey = 0; // of those pixels
+
+    BayerPattern bayerPattern = BayerPattern::RGGB;
+    DemosaicMethod demosaicMethod = DemosaicMethod::MalvarHeCutler;
+    QImage bayerRaw; // mosaic behind image while demosaicing, else null
+    bool demosaicPending = false; // a DemosaicTask is running
+    qint64 mosaicKey = 0; // newest stream frame being demosaiced, 0 when none
+    QImage mosaicQueued; // newest stream frame waiting for the task
+    bool mosaicUpdate = false; // of the frames in flight: fit the first one shown
+    bool mosaicMeasure = false; // measure the ROI of the ones shown
+
+    ContrastMode contrastMode = ContrastMode::None;
+    ContrastMode contrastCacheMode = ContrastMode::None;
+    qint64 contrastCacheKey = 0;
+    QImage contrastCache; // enhanced displayBuffer, kept while it is shown
+    bool contrastPending = false; // a ContrastTask is running
+    bool contrastOfImage = false; // of image itself, not a derived view
+
+    int frameCount = 1;
+    int currentFrame = 0;
+    int playbackFps = 30;
+    qint64 framesShown = 0;
+    qint64 droppedFrames = 0;
+    QTimer *playTimer;
+    QElapsedTimer playClock;
+    FrameRingBufferPtr frameBuffer;
+    QLabel *frameInfo;
+
+    QFileSystemWatcher *watcher = nullptr; // created on first watch
+    QTimer *reloadTimer;
+    QString watchDir;
+    int reloadSerial = 0;
+    int shownSerial = 0;
+    int reloadsInFlight = 0;
+    bool reloadDirty = false;
+    int reloadCount = 0;
+    int skippedReloads = 0;
+
+    FrameIngestServer *ingest;
+    QElapsedTimer ingestClock;
+    qint64 ingestFrames = 0;
 
     bool mouseInView = false;
 #if defined(QT_PRINTSUPPORT_LIB) && QT_CONFIG(printer)
-    QPrinter printer;
+    QSharedPointer<QPrinter> printer; // created on first print, shared with a PrintTask
+    QSharedPointer<QAtomicInt> printCancel; // while printing, set to stop the PrintTask
+    QPointer<QThread> printThread; // waited for on close, it paints on the printer
 #endif
 
     QAction *saveAsAct;
     QAction *printAct;
+    QAction *watchAct;
+    QAction *listenAct;
     QAction *copyAct;
     QAction *launchAct;
     QAction *dispOrigAct;
     QAction *convertAct;
+    QMenu *rotateMenu;
+    QAction *demosaicAct;
+    QAction *annotationsAct;
+    QAction *maskAct;
     QAction *split1Act;
     QAction *split2Act;
+    QAction *splitHsvAct;
+    QAction *splitYcc601Act;
+    QAction *splitYcc709Act;
+    QAction *splitXyzAct;
     QAction *zoomInAct;
     QAction *zoomOutAct;
     QAction *normalSizeAct;
     QAction *fitToWindowAct;
+    QAction *playAct;
+    QAction *nextFrameAct;
+    QAction *prevFrameAct;
+    QAction *firstFrameAct;
+    QAction *lastFrameAct;
 };
 //! [0]
 
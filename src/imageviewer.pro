@@ -1,15 +1,57 @@
-QT += widgets
+QT += widgets concurrent network
 requires(qtConfig(filedialog))
 qtHaveModule(printsupport): QT += printsupport
 
 HEADERS       = imageviewer.h \
     QImageViewer.h \
     busyappfilter.h \
-    imageopstask.h
+    imageopstask.h \
+    imagestats.h \
+    framedecoder.h \
+    frameingest.h \
+    shmframe.h \
+    singleinstance.h \
+    startupreport.h \
+    minimap.h \
+    colormap.h \
+    contrast.h \
+    printtask.h \
+    imagemetadata.h \
+    decodecache.h \
+    compressedimage.h \
+    rotateflip.h \
+    virtualimage.h \
+    demosaic.h \
+    channelview.h \
+    uibench.h \
+    annotations.h \
+    maskoverlay.h \
+    duplicates.h \
+    parallelfor.h
 SOURCES       = imageviewer.cpp \
                 QImageViewer.cpp \
                 busyappfilter.cpp \
                 imageopstask.cpp \
+                imagestats.cpp \
+                framedecoder.cpp \
+                frameingest.cpp \
+                singleinstance.cpp \
+                startupreport.cpp \
+                minimap.cpp \
+                colormap.cpp \
+                contrast.cpp \
+                printtask.cpp \
+                imagemetadata.cpp \
+                decodecache.cpp \
+                compressedimage.cpp \
+                rotateflip.cpp \
+                virtualimage.cpp \
+                demosaic.cpp \
+                channelview.cpp \
+                uibench.cpp \
+                annotations.cpp \
+                maskoverlay.cpp \
+                duplicates.cpp \
                 main.cpp
 
 # install
@@ -50,25 +50,117 @@
 
 #include <QApplication>
 #include <QCommandLineParser>
+#include <QSettings>
+#include <QTemporaryDir>
 
 #include "imageviewer.h"
+#include "singleinstance.h"
+#include "startupreport.h"
+#include "uibench.h"
+
+/**
+ * @brief Forward the files to a running viewer before paying for the GUI.
+ * Only a QCoreApplication is created here, no platform plugin is loaded.
+ * Any other option (--help, --startup-report, --ui-bench, --bench-sizes,
+ * Qt's own) is for this process, so nothing is forwarded then.
+ */
+static bool forwardToRunningInstance(int argc, char *argv[])
+{
+    bool enabled = QSettings(QSettings::NativeFormat, QSettings::UserScope,
+                             "HF_AIO", "ImageViewer").value("single_instance", false).toBool();
+    for (int i = 1; i < argc; i++) {
+        if (qstrcmp(argv[i], "--single-instance") == 0)
+            enabled = true;
+        else if (argv[i][0] == '-')
+            return false;
+    }
+    if (!enabled)
+        return false;
+
+    QCoreApplication core(argc, argv);
+    QStringList files = QCoreApplication::arguments().mid(1);
+    files.removeAll(QStringLiteral("--single-instance"));
+    return SingleInstance::forward(files);
+}
 
 int main(int argc, char *argv[])
 {
+    bool startupReport = false;
+    bool uiBench = false;
+    for (int i = 1; i < argc; i++) {
+        startupReport |= qstrcmp(argv[i], "--startup-report") == 0;
+        uiBench |= qstrcmp(argv[i], "--ui-bench") == 0;
+    }
+    StartupReport::start(startupReport);
+    // the platform plugin is picked when QApplication is created
+    if (uiBench && qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    if (forwardToRunningInstance(argc, argv))
+        return 0;
+
     QApplication app(argc, argv);
+    StartupReport::mark("QApplication");
     QGuiApplication::setApplicationDisplayName(ImageViewer::tr("Image Viewer"));
     QCommandLineParser commandLineParser;
     commandLineParser.addHelpOption();
     commandLineParser.addPositionalArgument(ImageViewer::tr("[file]"), ImageViewer::tr("Image file to open."));
+    QCommandLineOption singleInstanceOption("single-instance",
+        ImageViewer::tr("Open files in the running viewer if there is one."));
+    commandLineParser.addOption(singleInstanceOption);
+    QCommandLineOption startupReportOption("startup-report",
+        ImageViewer::tr("Print startup timings up to the first painted frame."));
+    commandLineParser.addOption(startupReportOption);
+    QCommandLineOption uiBenchOption("ui-bench",
+        ImageViewer::tr("Replay scripted interactions on synthetic images and print latency percentiles."));
+    commandLineParser.addOption(uiBenchOption);
+    QCommandLineOption benchSizesOption("bench-sizes",
+        ImageViewer::tr("Comma separated image sizes in megapixels for --ui-bench."),
+        ImageViewer::tr("list"), "1,4,16,64");
+    commandLineParser.addOption(benchSizesOption);
     commandLineParser.process(QCoreApplication::arguments());
 
     app.setWindowIcon(QIcon("icon.svg"));
 
-    ImageViewer imageViewer;
-    if (!commandLineParser.positionalArguments().isEmpty()
-        && !imageViewer.loadFile(commandLineParser.positionalArguments().front())) {
-        return -1;
+    // the bench starts from default settings and leaves the user's alone
+    QTemporaryDir benchDir;
+    ImageViewer imageViewer(nullptr, commandLineParser.isSet(uiBenchOption) && benchDir.isValid()
+        ? new QSettings(benchDir.filePath("ui-bench.ini"), QSettings::IniFormat) : nullptr);
+    StartupReport::mark("ImageViewer");
+
+    if (commandLineParser.isSet(uiBenchOption)) {
+        QList<int> sizes;
+        for (const QString &size : commandLineParser.value(benchSizesOption).split(',', Qt::SkipEmptyParts))
+            sizes.append(qMax(1, size.toInt()));
+        return UiBench::run(&imageViewer, sizes);
+    }
+
+    SingleInstance instance;
+    const bool singleInstance = commandLineParser.isSet(singleInstanceOption)
+        || QSettings(QSettings::NativeFormat, QSettings::UserScope,
+                     "HF_AIO", "ImageViewer").value("single_instance", false).toBool();
+    if (singleInstance && instance.listen()) {
+        QObject::connect(&instance, &SingleInstance::filesReceived,
+                         &imageViewer, &ImageViewer::openForwardedFiles);
+    }
+
+    QMetaObject::Connection firstLoad;
+    if (!commandLineParser.positionalArguments().isEmpty()) {
+        const QString fileName = commandLineParser.positionalArguments().front();
+        // a file that only fails once its background decode ends quits too
+        firstLoad = QObject::connect(&imageViewer, &ImageViewer::loadFinished,
+            &app, [&, fileName](const QString &name, bool ok) {
+                if (name != fileName)
+                    return;
+                QObject::disconnect(firstLoad);
+                if (!ok)
+                    app.exit(-1);
+            });
+        if (!imageViewer.loadFile(fileName))
+            return -1;
     }
+    StartupReport::mark("loadFile");
     imageViewer.show();
+    StartupReport::mark("show");
     return app.exec();
 }
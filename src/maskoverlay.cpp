@@ -0,0 +1,466 @@
+#include <QColor>
+#include <QPainter>
+#include <QThread>
+#include <QTimer>
+#include <string.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#  include <emmintrin.h>
+#  define MASK_SSE2
+#endif
+#include "maskoverlay.h"
+#include "QImageViewer.h"
+#include "parallelfor.h"
+
+bool canUseAsMask(const QImage &mask)
+{
+    switch (mask.format()) {
+    case QImage::Format_Grayscale8:
+    case QImage::Format_Grayscale16:
+    case QImage::Format_Indexed8:
+        return true;
+    default:
+        return false;
+    }
+}
+
+QVector<QRgb> maskPalette(int entries)
+{
+    QVector<QRgb> palette(entries, 0);
+    for (int i = 1; i < entries; i++) {
+        const int hue = int(i * 137.508) % 360;
+        const int saturation = 255 - (i % 3) * 50;
+        const int value = 255 - (i / 3 % 2) * 70;
+        palette[i] = QColor::fromHsv(hue, saturation, value).rgb();
+    }
+    return palette;
+}
+
+/**
+ * @brief dst = (dst * (256 - a) + color * a) >> 8 per channel, a being the
+ * colour's alpha stretched to 0..256. Every term fits an unsigned 16-bit
+ * lane, so the SSE2 path is exact and matches the scalar loop.
+ */
+static void blendRow(QRgb *dst, const QRgb *color, int width)
+{
+    int x = 0;
+#ifdef MASK_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(256);
+    const __m128i opaque = _mm_set1_epi32(int(0xff000000));
+    auto blend = [&](__m128i d, __m128i c) {
+        // alpha of each pixel in all four of its lanes
+        __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+        a = _mm_add_epi16(a, _mm_srli_epi16(a, 7));
+        return _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(d, _mm_sub_epi16(full, a)), _mm_mullo_epi16(c, a)), 8);
+    };
+    for (; x + 4 <= width; x += 4) {
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(color + x));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_srli_epi32(c, 24), zero)) == 0xffff)
+            continue; // background
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + x));
+        const __m128i lo = blend(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(c, zero));
+        const __m128i hi = blend(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(c, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_or_si128(_mm_packus_epi16(lo, hi), opaque));
+    }
+#endif
+    for (; x < width; x++) {
+        const QRgb c = color[x];
+        int a = qAlpha(c);
+        if (a == 0)
+            continue;
+        a += a >> 7;
+        const QRgb d = dst[x];
+        dst[x] = qRgb((qRed(d) * (256 - a) + qRed(c) * a) >> 8,
+                      (qGreen(d) * (256 - a) + qGreen(c) * a) >> 8,
+                      (qBlue(d) * (256 - a) + qBlue(c) * a) >> 8);
+    }
+}
+
+void blendMask(QImage *base, const QImage &labels, const QVector<QRgb> &palette)
+{
+    const int width = qMin(base->width(), labels.width());
+    const int height = qMin(base->height(), labels.height());
+    const bool wide = labels.format() == QImage::Format_Grayscale16;
+    const int entries = palette.size();
+    const QRgb *table = palette.constData();
+    uchar *bits = base->bits();
+    const qsizetype bpl = base->bytesPerLine();
+    parallelFor(height, 64, [&](int begin, int end) {
+        QVector<QRgb> colors(width);
+        QRgb *row = colors.data();
+        for (int y = begin; y < end; y++) {
+            if (wide) {
+                const quint16 *in = reinterpret_cast<const quint16*>(labels.constScanLine(y));
+                for (int x = 0; x < width; x++)
+                    row[x] = in[x] < entries ? table[in[x]] : 0;
+            } else {
+                const uchar *in = labels.constScanLine(y);
+                for (int x = 0; x < width; x++)
+                    row[x] = in[x] < entries ? table[in[x]] : 0;
+            }
+            blendRow(reinterpret_cast<QRgb*>(bits + y * bpl), row, width);
+        }
+    });
+}
+
+/// nearest label of @a rect at @a size, never a mix of two classes
+static QImage sampleLabels(const QImage &labels, const QRect &rect, const QSize &size)
+{
+    if (size == rect.size())
+        return labels.copy(rect);
+    QImage out(size, labels.format());
+    if (out.isNull())
+        return out;
+    const bool wide = labels.format() == QImage::Format_Grayscale16;
+    QVector<int> columns(size.width());
+    for (int x = 0; x < size.width(); x++)
+        columns[x] = rect.left() + qMin(rect.width() - 1, int((x + 0.5) * rect.width() / size.width()));
+    for (int y = 0; y < size.height(); y++) {
+        const int sy = rect.top() + qMin(rect.height() - 1, int((y + 0.5) * rect.height() / size.height()));
+        if (wide) {
+            const quint16 *in = reinterpret_cast<const quint16*>(labels.constScanLine(sy));
+            quint16 *o = reinterpret_cast<quint16*>(out.scanLine(y));
+            for (int x = 0; x < size.width(); x++)
+                o[x] = in[columns[x]];
+        } else {
+            const uchar *in = labels.constScanLine(sy);
+            uchar *o = out.scanLine(y);
+            for (int x = 0; x < size.width(); x++)
+                o[x] = in[columns[x]];
+        }
+    }
+    return out;
+}
+
+static QImage blended(const QImage &base, const QImage &labels, const QVector<QRgb> &palette)
+{
+    QImage out = base.copy();
+    if (!out.isNull())
+        blendMask(&out, labels, palette);
+    return out;
+}
+
+/// the unblended inputs of a tile, the base scaled while drawing
+static bool makeTile(const QImage &base, const QImage &labels, const RegionRequest &request,
+                     QImage *tileBase, QImage *tileLabels)
+{
+    QImage region;
+    if (request.size == request.rect.size()) {
+        region = base.copy(request.rect).convertToFormat(QImage::Format_RGB32);
+    } else {
+        // the full resolution rect is never copied
+        region = QImage(request.size, QImage::Format_RGB32);
+        if (region.isNull())
+            return false;
+        QPainter painter(&region);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+        painter.drawImage(QRect(QPoint(0, 0), request.size), base, request.rect);
+    }
+    if (region.isNull())
+        return false;
+
+    *tileBase = region;
+    *tileLabels = sampleLabels(labels, request.rect, request.size);
+    return !tileLabels->isNull();
+}
+
+MaskOverlay::MaskOverlay(QImageViewer *viewer, QObject *parent)
+    : QObject(parent)
+    , viewer_(viewer)
+    , opacity_(50)
+    , serial_(0)
+    , generation_(new QAtomicInt(0))
+    , overview_dirty_(false)
+    , overview_update_(false)
+    , busy_(false)
+    , queued_(false)
+{
+    // coalesce scrolling and zooming before blending tiles
+    tile_timer_ = new QTimer(this);
+    tile_timer_->setSingleShot(true);
+    tile_timer_->setInterval(30);
+    connect(tile_timer_, &QTimer::timeout, this, &MaskOverlay::updateTiles);
+    connect(viewer_, &QImageViewer::viewChanged, this, [this] {
+        if (isShown())
+            tile_timer_->start();
+    });
+    tiles_.setMaxCost(256 * 1024);
+}
+
+void MaskOverlay::setMask(const QImage &mask)
+{
+    clearMask();
+    if (!canUseAsMask(mask))
+        return;
+
+    if (mask.format() == QImage::Format_Indexed8) {
+        // the indices are the labels, not the colours of the table
+        labels_ = QImage(mask.size(), QImage::Format_Grayscale8);
+        if (labels_.isNull())
+            return;
+        for (int y = 0; y < mask.height(); y++)
+            memcpy(labels_.scanLine(y), mask.constScanLine(y), mask.width());
+    } else {
+        labels_ = mask;
+    }
+    colors_ = maskPalette(labels_.format() == QImage::Format_Grayscale16 ? 65536 : 256);
+
+    const QSize size = labels_.size();
+    overview_labels_ = qMax(size.width(), size.height()) > kOverviewSize
+        ? sampleLabels(labels_, labels_.rect(), size.scaled(kOverviewSize, kOverviewSize, Qt::KeepAspectRatio))
+        : labels_;
+    setOpacity(opacity_);
+}
+
+void MaskOverlay::clearMask()
+{
+    release();
+    labels_ = QImage();
+    overview_labels_ = QImage();
+    colors_.clear();
+    palette_.clear();
+}
+
+int MaskOverlay::labelAt(const QPoint &pos) const
+{
+    if (!labels_.valid(pos))
+        return -1;
+    if (labels_.format() == QImage::Format_Grayscale16)
+        return reinterpret_cast<const quint16*>(labels_.constScanLine(pos.y()))[pos.x()];
+    return labels_.constScanLine(pos.y())[pos.x()];
+}
+
+void MaskOverlay::setOpacity(int percent)
+{
+    opacity_ = qBound(0, percent, 100);
+    const QRgb alpha = QRgb((opacity_ * 255 + 50) / 100) << 24;
+    palette_.resize(colors_.size());
+    for (int i = 0; i < colors_.size(); i++)
+        palette_[i] = colors_[i] ? (colors_[i] & 0xffffff) | alpha : 0;
+
+    // only the overview and the visible tiles are blended again
+    if (isShown()) {
+        invalidate();
+        overview_dirty_ = true;
+        updateTiles();
+    }
+}
+
+void MaskOverlay::setCacheLimit(int megabytes)
+{
+    tiles_.setMaxCost(qMax(1, megabytes) * 1024);
+}
+
+qint64 MaskOverlay::bytes() const
+{
+    qint64 bytes = labels_.sizeInBytes() + qint64(tiles_.totalCost()) * 1024;
+    if (overview_labels_.cacheKey() != labels_.cacheKey())
+        bytes += overview_labels_.sizeInBytes();
+    return bytes + overview_base_.sizeInBytes();
+}
+
+void MaskOverlay::show(const QImage &base, bool update)
+{
+    if (!hasMask() || base.size() != labels_.size())
+        return;
+    if (base.cacheKey() != base_.cacheKey()) {
+        tiles_.clear();
+        overview_base_ = QImage(); // scaled down by the next MaskBlendTask
+    }
+    base_ = base;
+    invalidate();
+    overview_dirty_ = true;
+    overview_update_ = overview_update_ || update;
+    updateTiles();
+}
+
+void MaskOverlay::release()
+{
+    tile_timer_->stop();
+    base_ = QImage();
+    overview_base_ = QImage();
+    tiles_.clear();
+    invalidate();
+    overview_dirty_ = false;
+    overview_update_ = false;
+}
+
+void MaskOverlay::invalidate()
+{
+    serial_++;
+    generation_->ref();
+    wanted_.clear();
+}
+
+void MaskOverlay::updateTiles()
+{
+    if (!isShown())
+        return;
+    if (busy_) {
+        queued_ = true; // asked again by blendDone()
+        return;
+    }
+
+    // a new overview drops all tiles in the viewer, they follow once it is shown
+    const bool overview = overview_dirty_;
+    QVector<MaskTileJob> jobs;
+    if (!overview) {
+        if (!viewer_->isVirtual())
+            return;
+
+        // tiles only once the overview is coarser than the screen
+        const QSize size = base_.size();
+        const double scale = viewer_->getZoomScale();
+        const int overviewWidth = overview_labels_.width();
+        QSet<qint64> wanted;
+        if (overviewWidth < size.width() && scale > double(overviewWidth) / size.width()) {
+            const QVector<RegionRequest> tiles = VirtualImage::visibleTiles(
+                viewer_->visibleSceneRect(), scale, size);
+            for (const RegionRequest &tile : tiles) {
+                wanted.insert(tile.key);
+                if (viewer_->hasVirtualTile(tile.key))
+                    continue;
+                const Tile *cached = tiles_.object(tile.key);
+                jobs.append(MaskTileJob{tile, cached ? cached->base : QImage(),
+                                        cached ? cached->labels : QImage()});
+            }
+        }
+        if (wanted != wanted_) {
+            // tiles of the batch in flight that are not blended yet are skipped
+            generation_->ref();
+            wanted_ = wanted;
+        }
+        viewer_->retainVirtualTiles(wanted);
+        if (jobs.isEmpty())
+            return;
+    }
+    busy_ = true;
+    overview_dirty_ = false;
+
+    QThread* thread = new QThread();
+    MaskBlendTask* task = new MaskBlendTask();
+    if (overview)
+        task->setOverview(base_, overview_base_, overview_labels_);
+    else
+        task->setTiles(base_, labels_, jobs);
+    task->setPalette(palette_, serial_);
+    task->setGeneration(generation_, generation_->loadAcquire());
+
+    // move the task object to the thread BEFORE connecting any signal/slots
+    task->moveToThread(thread);
+
+    connect(thread, &QThread::started, task, &MaskBlendTask::run);
+    connect(task, &MaskBlendTask::workFinished, thread, &QThread::quit);
+    connect(task, &MaskBlendTask::overviewReady, this, &MaskOverlay::overviewReady);
+    connect(task, &MaskBlendTask::tileReady, this, &MaskOverlay::tileReady);
+    connect(task, &MaskBlendTask::workFinished, this, &MaskOverlay::blendDone);
+
+    // automatically delete thread and task object when work is done:
+    connect(task, &MaskBlendTask::workFinished, task, &MaskBlendTask::deleteLater);
+    connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+
+    emit taskStarted(thread);
+    thread->start();
+}
+
+void MaskOverlay::overviewReady(int serial, qint64 baseKey, QImage overviewBase, QImage overview)
+{
+    if (baseKey == base_.cacheKey() && overview_base_.isNull())
+        overview_base_ = overviewBase; // scaled once per base image
+    if (serial != serial_ || overview.isNull())
+        return; // changed meanwhile, blended again
+    viewer_->displayVirtual(overview, base_.size(), overview_update_);
+    overview_update_ = false;
+}
+
+void MaskOverlay::tileReady(int serial, qint64 key, QRect rect, QImage base, QImage labels, QImage blended)
+{
+    if (serial != serial_)
+        return; // changed meanwhile
+    if (!tiles_.contains(key)) {
+        const qint64 bytes = base.sizeInBytes() + labels.sizeInBytes();
+        tiles_.insert(key, new Tile{base, labels}, qMax(1, int(bytes / 1024)));
+    }
+    if (wanted_.contains(key) && viewer_->isVirtual())
+        viewer_->setVirtualTile(key, rect, blended);
+}
+
+/**
+ * @brief One batch is blended at a time; what changed meanwhile is asked
+ * for once it is done. Its results came in before this.
+ */
+void MaskOverlay::blendDone()
+{
+    busy_ = false;
+    if (queued_) {
+        queued_ = false;
+        updateTiles();
+    }
+}
+
+
+MaskBlendTask::MaskBlendTask(QObject *parent)
+    : QObject(parent)
+    , overview(false)
+    , serial(0)
+    , generation(0)
+{
+
+}
+
+void MaskBlendTask::setOverview(const QImage &base, const QImage &overviewBase, const QImage &overviewLabels)
+{
+    this->base = base;
+    this->overviewBase = overviewBase;
+    this->overviewLabels = overviewLabels;
+    overview = true;
+}
+
+void MaskBlendTask::setTiles(const QImage &base, const QImage &labels, const QVector<MaskTileJob> &tiles)
+{
+    this->base = base;
+    this->labels = labels;
+    this->tiles = tiles;
+}
+
+void MaskBlendTask::setPalette(const QVector<QRgb> &palette, int serial)
+{
+    this->palette = palette;
+    this->serial = serial;
+}
+
+void MaskBlendTask::setGeneration(QSharedPointer<QAtomicInt> current, int generation)
+{
+    this->current = current;
+    this->generation = generation;
+}
+
+void MaskBlendTask::run()
+{
+    if (overview) {
+        QImage scaled = overviewBase;
+        if (scaled.isNull()) {
+            scaled = overviewLabels.size() == base.size()
+                ? base.convertToFormat(QImage::Format_RGB32)
+                : base.scaled(overviewLabels.size(), Qt::IgnoreAspectRatio, Qt::SmoothTransformation)
+                      .convertToFormat(QImage::Format_RGB32);
+        }
+        emit overviewReady(serial, base.cacheKey(), scaled, blended(scaled, overviewLabels, palette));
+    }
+
+    // the tiles in parallel, and blendMask() over the rows of each
+    parallelFor(tiles.size(), 1, [this](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            if (current && current->loadAcquire() != generation)
+                continue; // the view moved on, the owner asks again for what it wants now
+            const MaskTileJob &job = tiles[i];
+            QImage tileBase = job.base;
+            QImage tileLabels = job.labels;
+            if (tileBase.isNull() && !makeTile(base, labels, job.request, &tileBase, &tileLabels))
+                continue;
+            emit tileReady(serial, job.request.key, job.request.rect, tileBase, tileLabels,
+                           blended(tileBase, tileLabels, palette));
+        }
+    });
+    emit workFinished();
+}
@@ -0,0 +1,151 @@
+#ifndef MASKOVERLAY_H
+#define MASKOVERLAY_H
+
+#include <QObject>
+#include <QImage>
+#include <QCache>
+#include <QVector>
+#include <QSet>
+#include <QSharedPointer>
+#include <QAtomicInt>
+#include "virtualimage.h"
+
+class QImageViewer;
+class QThread;
+class QTimer;
+
+/// label images: Grayscale8, Grayscale16, or Indexed8 whose indices are the labels
+bool canUseAsMask(const QImage &mask);
+
+/**
+ * @brief Colours of @a entries classes: class 0 is transparent, the others
+ * opaque golden angle hues that vary in saturation and value too.
+ */
+QVector<QRgb> maskPalette(int entries);
+
+/**
+ * @brief Blend the class colours of @a labels over @a base in place.
+ *
+ * @a base is Format_RGB32, @a labels a Grayscale8 or Grayscale16 image of
+ * the same size, and the alpha of each @a palette entry is its weight.
+ * Colours are looked up per row, then blended four pixels at a time with
+ * SSE2 (rows in parallel); runs of background pixels are skipped.
+ */
+void blendMask(QImage *base, const QImage &labels, const QVector<QRgb> &palette);
+
+/**
+ * @brief A segmentation mask shown over the image in a QImageViewer.
+ *
+ * The blend is never done for the whole image: the viewer is put in
+ * virtual mode with a blended overview (at most kOverviewSize pixels on
+ * the long side) for best fit, and once zoomed in past it the tiles around
+ * the viewport are blended at the pyramid level of the view, like the
+ * region decoder does. Blending runs in a MaskBlendTask, one batch at a
+ * time. The unblended tile inputs are kept in an LRU cache, so an opacity
+ * change only blends the overview and the visible tiles.
+ */
+class MaskOverlay : public QObject
+{
+    Q_OBJECT
+public:
+    static const int kOverviewSize = 2048;
+
+    MaskOverlay(QImageViewer *viewer, QObject *parent = nullptr);
+
+    /// shared, not copied; Indexed8 is turned into Grayscale8 of its indices
+    void setMask(const QImage &mask);
+    void clearMask();
+    bool hasMask() const { return !labels_.isNull(); }
+    QSize size() const { return labels_.size(); }
+    int labelAt(const QPoint &pos) const; /// -1 outside
+
+    void setOpacity(int percent);
+    int opacity() const { return opacity_; }
+    void setCacheLimit(int megabytes);
+    qint64 bytes() const; /// labels, overviews and cached tiles
+
+    /// show @a base, the size of the mask, blended in the viewer
+    void show(const QImage &base, bool update);
+    /// forget the shown image when the viewer shows something else
+    void release();
+    bool isShown() const { return !base_.isNull(); }
+
+signals:
+    void taskStarted(QThread *thread); /// a blend worker, running until it finishes
+
+private slots:
+    void overviewReady(int serial, qint64 baseKey, QImage overviewBase, QImage overview);
+    void tileReady(int serial, qint64 key, QRect rect, QImage base, QImage labels, QImage blended);
+    void blendDone();
+
+private:
+    struct Tile
+    {
+        QImage base; // RGB32
+        QImage labels;
+    };
+
+    void invalidate(); /// what is blended or being blended is stale
+    void updateTiles();
+
+    QImageViewer *viewer_;
+    QImage labels_;
+    QVector<QRgb> colors_; // maskPalette() of the label depth
+    QVector<QRgb> palette_; // colors_ with the opacity as alpha
+    int opacity_;
+    QImage base_;
+    QImage overview_base_;
+    QImage overview_labels_;
+    QTimer *tile_timer_;
+    QCache<qint64, Tile> tiles_; // cost in KB
+    int serial_; // bumped by invalidate(), older results are dropped
+    QSharedPointer<QAtomicInt> generation_; // bumped when wanted_ changes too
+    QSet<qint64> wanted_; // tiles around the viewport
+    bool overview_dirty_; // blended again by the next batch
+    bool overview_update_; // and shown with displayVirtual(update)
+    bool busy_; // a MaskBlendTask is running
+    bool queued_; // and something changed meanwhile
+};
+
+/// a tile to blend, with its unblended inputs when they are cached
+struct MaskTileJob
+{
+    RegionRequest request;
+    QImage base;
+    QImage labels;
+};
+
+/**
+ * @brief Blends the overview, or a batch of tiles, of a mask over its base
+ * image. Tiles not started yet are skipped once the generation moves on.
+ */
+class MaskBlendTask : public QObject
+{
+    Q_OBJECT
+public:
+    MaskBlendTask(QObject *parent = nullptr);
+    /// @a overviewBase is scaled down from @a base when it is null
+    void setOverview(const QImage &base, const QImage &overviewBase, const QImage &overviewLabels);
+    void setTiles(const QImage &base, const QImage &labels, const QVector<MaskTileJob> &tiles);
+    void setPalette(const QVector<QRgb> &palette, int serial);
+    void setGeneration(QSharedPointer<QAtomicInt> current, int generation);
+public slots:
+    void run();
+signals:
+    void overviewReady(int serial, qint64 baseKey, QImage overviewBase, QImage overview);
+    void tileReady(int serial, qint64 key, QRect rect, QImage base, QImage labels, QImage blended);
+    void workFinished();
+private:
+    QImage base;
+    QImage labels;
+    QImage overviewBase;
+    QImage overviewLabels;
+    bool overview;
+    QVector<MaskTileJob> tiles;
+    QVector<QRgb> palette;
+    int serial;
+    QSharedPointer<QAtomicInt> current;
+    int generation;
+};
+
+#endif // MASKOVERLAY_H
@@ -0,0 +1,122 @@
+#include <QMouseEvent>
+#include <QPainter>
+#include "minimap.h"
+
+
+MiniMap::MiniMap(QWidget *parent)
+    : QWidget(parent)
+{
+    setAttribute(Qt::WA_OpaquePaintEvent, false);
+    setCursor(Qt::PointingHandCursor);
+    setFixedSize(sizeHint());
+}
+
+QSize MiniMap::sizeHint() const
+{
+    return QSize(kProxySize / 4 * 3 + 8, kProxySize / 4 * 3 + 8);
+}
+
+QImage MiniMap::makeProxy(const QImage &image)
+{
+    if (image.isNull())
+        return QImage();
+    if (image.width() <= kProxySize && image.height() <= kProxySize)
+        return image.convertToFormat(QImage::Format_RGB32);
+    // area averaging of the whole image, run it off the GUI thread
+    return image.scaled(kProxySize, kProxySize, Qt::KeepAspectRatio, Qt::SmoothTransformation)
+        .convertToFormat(QImage::Format_RGB32);
+}
+
+void MiniMap::setProxy(const QImage &proxy, const QSizeF &sceneSize)
+{
+    proxy_ = QPixmap::fromImage(proxy);
+    scene_size_ = sceneSize;
+    QWidget::update();
+}
+
+void MiniMap::setViewRect(const QRectF &rect)
+{
+    if (rect == view_rect_)
+        return;
+    view_rect_ = rect;
+    QWidget::update();
+}
+
+void MiniMap::clear()
+{
+    proxy_ = QPixmap();
+    scene_size_ = QSizeF();
+    view_rect_ = QRectF();
+    QWidget::update();
+}
+
+QRectF MiniMap::imageRect() const
+{
+    if (proxy_.isNull())
+        return QRectF();
+    QSizeF size = proxy_.size();
+    size.scale(QSizeF(rect().adjusted(4, 4, -4, -4).size()), Qt::KeepAspectRatio);
+    return QRectF(QPointF((width() - size.width()) / 2, (height() - size.height()) / 2), size);
+}
+
+QPointF MiniMap::toScene(const QPointF &pos) const
+{
+    const QRectF r = imageRect();
+    if (r.isEmpty())
+        return QPointF();
+    return QPointF((pos.x() - r.x()) * scene_size_.width() / r.width(),
+                   (pos.y() - r.y()) * scene_size_.height() / r.height());
+}
+
+void MiniMap::paintEvent(QPaintEvent *)
+{
+    QPainter painter(this);
+    painter.fillRect(rect(), QColor(0, 0, 0, 128));
+    if (proxy_.isNull())
+        return;
+
+    const QRectF r = imageRect();
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    painter.drawPixmap(r, proxy_, QRectF(proxy_.rect()));
+
+    if (view_rect_.isValid() && !scene_size_.isEmpty()) {
+        const double sx = r.width() / scene_size_.width();
+        const double sy = r.height() / scene_size_.height();
+        const QRectF view(r.x() + view_rect_.x() * sx, r.y() + view_rect_.y() * sy,
+                          view_rect_.width() * sx, view_rect_.height() * sy);
+        painter.setPen(QPen(QColor(255, 0, 0), 1));
+        painter.drawRect(view.intersected(r));
+    }
+}
+
+void MiniMap::mousePressEvent(QMouseEvent *e)
+{
+    if (e->button() == Qt::LeftButton && !proxy_.isNull())
+        emit centerRequested(toScene(e->pos()));
+}
+
+void MiniMap::mouseMoveEvent(QMouseEvent *e)
+{
+    if (e->buttons() & Qt::LeftButton && !proxy_.isNull())
+        emit centerRequested(toScene(e->pos()));
+}
+
+
+MiniMapProxyTask::MiniMapProxyTask(QObject *parent)
+    : QObject(parent)
+    , serial(0)
+{
+
+}
+
+void MiniMapProxyTask::setImage(QImage inputImage, int serial)
+{
+    image = inputImage;
+    this->serial = serial;
+}
+
+void MiniMapProxyTask::run()
+{
+    emit resultReady(MiniMap::makeProxy(image), serial);
+    emit workFinished();
+}
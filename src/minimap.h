@@ -0,0 +1,63 @@
+#ifndef MINIMAP_H
+#define MINIMAP_H
+
+#include <QWidget>
+#include <QImage>
+#include <QPixmap>
+
+/**
+ * @brief Overview of the whole image with the visible part outlined.
+ *
+ * Only a small proxy (longest side kProxySize) is ever drawn here, the full
+ * resolution pixmap is never touched while the user drags in the minimap.
+ */
+class MiniMap : public QWidget
+{
+    Q_OBJECT
+public:
+    static const int kProxySize = 256;
+
+    MiniMap(QWidget *parent = nullptr);
+
+    static QImage makeProxy(const QImage &image);
+    void setProxy(const QImage &proxy, const QSizeF &sceneSize);
+    bool hasProxy() const { return !proxy_.isNull(); }
+    void setViewRect(const QRectF &rect);
+    void clear();
+
+    QSize sizeHint() const override;
+
+signals:
+    void centerRequested(const QPointF &scenePos);
+
+protected:
+    void paintEvent(QPaintEvent *e) override;
+    void mousePressEvent(QMouseEvent *e) override;
+    void mouseMoveEvent(QMouseEvent *e) override;
+
+private:
+    QRectF imageRect() const;
+    QPointF toScene(const QPointF &pos) const;
+
+    QPixmap proxy_;
+    QSizeF scene_size_;
+    QRectF view_rect_;
+};
+
+class MiniMapProxyTask : public QObject
+{
+    Q_OBJECT
+public:
+    MiniMapProxyTask(QObject *parent = nullptr);
+    void setImage(QImage inputImage, int serial);
+public slots:
+    void run();
+signals:
+    void resultReady(QImage proxy, int serial);
+    void workFinished();
+private:
+    QImage image;
+    int serial;
+};
+
+#endif // MINIMAP_H
@@ -0,0 +1,33 @@
+#ifndef PARALLELFOR_H
+#define PARALLELFOR_H
+
+#include <QPair>
+#include <QVector>
+#include <QtConcurrent/QtConcurrentMap>
+
+/**
+ * @brief Split [0, count) into bands of @a grain items and call fn(begin, end)
+ * for each band on the global thread pool. Blocks until all bands are done.
+ */
+template <typename Fn>
+void parallelFor(int count, int grain, Fn fn)
+{
+    if (count <= 0)
+        return;
+    grain = qMax(1, grain);
+    if (count <= grain) {
+        fn(0, count);
+        return;
+    }
+
+    QVector<QPair<int, int>> bands;
+    bands.reserve((count + grain - 1) / grain);
+    for (int begin = 0; begin < count; begin += grain)
+        bands.append(qMakePair(begin, qMin(count, begin + grain)));
+
+    QtConcurrent::blockingMap(bands, [&fn](const QPair<int, int> &band) {
+        fn(band.first, band.second);
+    });
+}
+
+#endif // PARALLELFOR_H
@@ -0,0 +1,195 @@
+#include "printtask.h"
+
+#if defined(QT_PRINTSUPPORT_LIB) && QT_CONFIG(printer)
+#include <QPainter>
+#include <QPrinter>
+#include <cmath>
+#include <vector>
+#include "colormap.h"
+#include "parallelfor.h"
+
+/**
+ * @brief Source taps of every output sample along one axis.
+ * Bilinear when enlarging, area average when reducing.
+ */
+struct ResampleAxis
+{
+    std::vector<int> first;
+    std::vector<int> count;
+    std::vector<int> offset;
+    std::vector<float> weight;
+};
+
+static ResampleAxis resampleAxis(int dstLen, int srcLen)
+{
+    ResampleAxis axis;
+    axis.first.resize(dstLen);
+    axis.count.resize(dstLen);
+    axis.offset.resize(dstLen);
+    const double scale = double(srcLen) / dstLen;
+    for (int i = 0; i < dstLen; i++) {
+        axis.offset[i] = int(axis.weight.size());
+        if (scale <= 1.0) {
+            const double center = (i + 0.5) * scale - 0.5;
+            int i0 = int(std::floor(center));
+            double f = center - i0;
+            if (i0 < 0) {
+                i0 = 0;
+                f = 0;
+            } else if (i0 >= srcLen - 1) {
+                i0 = srcLen - 1;
+                f = 0;
+            }
+            axis.first[i] = i0;
+            axis.count[i] = f > 0 ? 2 : 1;
+            axis.weight.push_back(float(1 - f));
+            if (f > 0)
+                axis.weight.push_back(float(f));
+        } else {
+            const double begin = i * scale, end = (i + 1) * scale;
+            const int s0 = int(std::floor(begin));
+            const int s1 = qMin(srcLen, int(std::ceil(end)));
+            axis.first[i] = s0;
+            axis.count[i] = s1 - s0;
+            for (int s = s0; s < s1; s++)
+                axis.weight.push_back(float((qMin(end, s + 1.0) - qMax(begin, double(s))) / scale));
+        }
+    }
+    return axis;
+}
+
+/**
+ * @brief Output rows [y0, y0 + rows) of the resampled image. Only the
+ * source rows under the band are converted to RGB32.
+ */
+static QImage resampleBand(const QImage &image, const QVector<QRgb> &colorTable,
+                           const ResampleAxis &hx, const ResampleAxis &vy, int y0, int rows)
+{
+    const int sy0 = vy.first[y0];
+    const int sy1 = vy.first[y0 + rows - 1] + vy.count[y0 + rows - 1];
+    QImage src = image.copy(0, sy0, image.width(), sy1 - sy0);
+    if (!colorTable.isEmpty() && src.format() == QImage::Format_Grayscale8) {
+        src = applyColorMap(src, colorTable);
+    } else if (src.hasAlphaChannel()) {
+        // paper is white
+        QImage flat(src.size(), QImage::Format_RGB32);
+        flat.fill(Qt::white);
+        QPainter painter(&flat);
+        painter.drawImage(0, 0, src);
+        painter.end();
+        src = flat;
+    } else {
+        src = src.convertToFormat(QImage::Format_RGB32);
+    }
+
+    const int width = int(hx.first.size());
+    QImage band(width, rows, QImage::Format_RGB32);
+    if (src.isNull() || band.isNull())
+        return QImage();
+    uchar *dst_bits = band.bits();
+    const qsizetype dst_bpl = band.bytesPerLine();
+    parallelFor(rows, 16, [&](int begin, int end) {
+        std::vector<float> acc(size_t(width) * 3);
+        for (int r = begin; r < end; r++) {
+            std::fill(acc.begin(), acc.end(), 0.0f);
+            const int y = y0 + r;
+            for (int k = 0; k < vy.count[y]; k++) {
+                const float wv = vy.weight[vy.offset[y] + k];
+                const QRgb *src_ptr = reinterpret_cast<const QRgb*>(src.constScanLine(vy.first[y] + k - sy0));
+                for (int x = 0; x < width; x++) {
+                    const QRgb *tap = src_ptr + hx.first[x];
+                    const float *w = &hx.weight[hx.offset[x]];
+                    float red = 0, green = 0, blue = 0;
+                    for (int j = 0; j < hx.count[x]; j++) {
+                        red += w[j] * qRed(tap[j]);
+                        green += w[j] * qGreen(tap[j]);
+                        blue += w[j] * qBlue(tap[j]);
+                    }
+                    acc[3 * x] += wv * red;
+                    acc[3 * x + 1] += wv * green;
+                    acc[3 * x + 2] += wv * blue;
+                }
+            }
+            QRgb *dst_ptr = reinterpret_cast<QRgb*>(dst_bits + r * dst_bpl);
+            for (int x = 0; x < width; x++) {
+                dst_ptr[x] = qRgb(qBound(0, int(acc[3 * x] + 0.5f), 255),
+                                  qBound(0, int(acc[3 * x + 1] + 0.5f), 255),
+                                  qBound(0, int(acc[3 * x + 2] + 0.5f), 255));
+            }
+        }
+    });
+    return band;
+}
+
+
+PrintTask::PrintTask(QObject *parent)
+    : QObject(parent)
+    , bandBytes(64 << 20)
+{
+
+}
+
+void PrintTask::setPrinter(QSharedPointer<QPrinter> printer)
+{
+    this->printer = printer;
+}
+
+void PrintTask::setImage(QImage inputImage, const QVector<QRgb> &colorTable)
+{
+    image = inputImage;
+    this->colorTable = colorTable;
+}
+
+void PrintTask::setBandBytes(qint64 bytes)
+{
+    bandBytes = qMax<qint64>(1 << 20, bytes);
+}
+
+void PrintTask::setCancelFlag(QSharedPointer<QAtomicInt> flag)
+{
+    canceled = flag;
+}
+
+void PrintTask::run()
+{
+    QPainter painter;
+    if (image.isNull() || !printer || !painter.begin(printer.data())) {
+        emit printFinished(false, tr("Cannot start printing"));
+        emit workFinished();
+        return;
+    }
+
+    const QRect rect = painter.viewport();
+    QSize size = image.size();
+    size.scale(rect.size(), Qt::KeepAspectRatio);
+    const ResampleAxis hx = resampleAxis(size.width(), image.width());
+    const ResampleAxis vy = resampleAxis(size.height(), image.height());
+    const int bandRows = int(qBound<qint64>(1, bandBytes / (qint64(size.width()) * 4), size.height()));
+
+    for (int y = 0; y < size.height(); y += bandRows) {
+        if (canceled && canceled->loadRelaxed()) {
+            printer->abort();
+            painter.end();
+            emit printFinished(false, tr("Printing canceled"));
+            emit workFinished();
+            return;
+        }
+        const int rows = qMin(bandRows, size.height() - y);
+        const QImage band = resampleBand(image, colorTable, hx, vy, y, rows);
+        if (band.isNull()) {
+            printer->abort();
+            painter.end();
+            emit printFinished(false, tr("Out of memory while printing"));
+            emit workFinished();
+            return;
+        }
+        painter.drawImage(rect.x(), rect.y() + y, band);
+        emit progress(int(qint64(y + rows) * 100 / size.height()));
+    }
+    painter.end();
+
+    emit printFinished(true, tr("Printed %1x%2 at %3 dpi")
+                       .arg(size.width()).arg(size.height()).arg(printer->resolution()));
+    emit workFinished();
+}
+#endif
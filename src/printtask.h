@@ -0,0 +1,56 @@
+#ifndef PRINTTASK_H
+#define PRINTTASK_H
+
+#include <QObject>
+#include <QImage>
+#include <QAtomicInt>
+#include <QSharedPointer>
+#include <QVector>
+
+#if defined(QT_PRINTSUPPORT_LIB)
+#  include <QtPrintSupport/qtprintsupportglobal.h>
+#endif
+
+#if defined(QT_PRINTSUPPORT_LIB) && QT_CONFIG(printer)
+QT_BEGIN_NAMESPACE
+class QPrinter;
+QT_END_NAMESPACE
+
+/**
+ * @brief Resample @a image to the printer's resolution and paint it in
+ * horizontal bands.
+ *
+ * QPainter may paint on a QPrinter from a worker thread, so the whole job
+ * runs off the GUI thread. Only one band of at most @a bandBytes of printer
+ * pixels and the source rows it needs are converted at a time. Grayscale8
+ * input goes through @a colorTable when it is not empty.
+ *
+ * The task shares ownership of the printer, so it outlives the window that
+ * configured it. Setting the shared cancel flag from any thread stops it
+ * at the next band, also once the task itself is gone.
+ */
+class PrintTask : public QObject
+{
+    Q_OBJECT
+public:
+    PrintTask(QObject *parent = nullptr);
+    void setPrinter(QSharedPointer<QPrinter> printer);
+    void setImage(QImage inputImage, const QVector<QRgb> &colorTable = QVector<QRgb>());
+    void setBandBytes(qint64 bytes);
+    void setCancelFlag(QSharedPointer<QAtomicInt> flag);
+public slots:
+    void run();
+signals:
+    void progress(int percent);
+    void printFinished(bool ok, const QString &message);
+    void workFinished();
+private:
+    QSharedPointer<QPrinter> printer;
+    QImage image;
+    QVector<QRgb> colorTable;
+    qint64 bandBytes;
+    QSharedPointer<QAtomicInt> canceled;
+};
+#endif
+
+#endif // PRINTTASK_H
@@ -0,0 +1,368 @@
+#include <QColorSpace>
+#include <QTransform>
+#include <string.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#  include <emmintrin.h>
+#  define ROTATEFLIP_SSE2
+#endif
+#include "rotateflip.h"
+#include "parallelfor.h"
+
+// 64x64 pixels of 32 bits is 16 KB on each side, both fit in L1/L2
+static const int kTile = 64;
+
+struct Pixel24
+{
+    uchar c[3];
+};
+
+/**
+ * @brief Quarter turn of the destination block [dy0, dy1) x [dx0, dx1).
+ * Clockwise: dst(dx, dy) = src(dy, sh - 1 - dx),
+ * otherwise: dst(dx, dy) = src(sw - 1 - dy, dx).
+ */
+template <typename Pixel>
+static void rotateBlock(const uchar *src, qsizetype sbpl, uchar *dst, qsizetype dbpl,
+                        int sw, int sh, bool clockwise, int dy0, int dy1, int dx0, int dx1)
+{
+    for (int dy = dy0; dy < dy1; dy++) {
+        Pixel *line = reinterpret_cast<Pixel*>(dst + dy * dbpl);
+        if (clockwise) {
+            const uchar *column = src + qsizetype(dy) * qsizetype(sizeof(Pixel));
+            for (int dx = dx0; dx < dx1; dx++)
+                line[dx] = *reinterpret_cast<const Pixel*>(column + (sh - 1 - dx) * sbpl);
+        } else {
+            const uchar *column = src + qsizetype(sw - 1 - dy) * qsizetype(sizeof(Pixel));
+            for (int dx = dx0; dx < dx1; dx++)
+                line[dx] = *reinterpret_cast<const Pixel*>(column + dx * sbpl);
+        }
+    }
+}
+
+template <typename Pixel>
+static inline void rotateTile(const uchar *src, qsizetype sbpl, uchar *dst, qsizetype dbpl,
+                              int sw, int sh, bool clockwise, int dy0, int dy1, int dx0, int dx1)
+{
+    rotateBlock<Pixel>(src, sbpl, dst, dbpl, sw, sh, clockwise, dy0, dy1, dx0, dx1);
+}
+
+template <typename Pixel>
+static inline void reverseRow(const uchar *in, uchar *out, int width)
+{
+    const Pixel *from = reinterpret_cast<const Pixel*>(in);
+    Pixel *to = reinterpret_cast<Pixel*>(out);
+    for (int x = 0; x < width; x++)
+        to[x] = from[width - 1 - x];
+}
+
+#ifdef ROTATEFLIP_SSE2
+static inline void transpose4x4(__m128i &r0, __m128i &r1, __m128i &r2, __m128i &r3)
+{
+    const __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+    const __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+    const __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+    const __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+    r0 = _mm_unpacklo_epi64(t0, t1);
+    r1 = _mm_unpackhi_epi64(t0, t1);
+    r2 = _mm_unpacklo_epi64(t2, t3);
+    r3 = _mm_unpackhi_epi64(t2, t3);
+}
+
+static inline __m128i load4(const uchar *p)
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+static inline void store4(uchar *p, __m128i v)
+{
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+}
+
+/**
+ * @brief 32-bit tiles go through 4x4 register transposes, the ragged edge
+ * of the tile through rotateBlock().
+ */
+template <>
+inline void rotateTile<quint32>(const uchar *src, qsizetype sbpl, uchar *dst, qsizetype dbpl,
+                                int sw, int sh, bool clockwise, int dy0, int dy1, int dx0, int dx1)
+{
+    const int dyEnd = dy0 + (dy1 - dy0) / 4 * 4;
+    const int dxEnd = dx0 + (dx1 - dx0) / 4 * 4;
+    for (int dy = dy0; dy < dyEnd; dy += 4) {
+        uchar *out = dst + dy * dbpl;
+        for (int dx = dx0; dx < dxEnd; dx += 4) {
+            __m128i r0, r1, r2, r3;
+            if (clockwise) {
+                // source rows sh-1-dx .. sh-4-dx, columns dy .. dy+3
+                const uchar *in = src + qsizetype(sh - 1 - dx) * sbpl + qsizetype(dy) * 4;
+                r0 = load4(in);
+                r1 = load4(in - sbpl);
+                r2 = load4(in - 2 * sbpl);
+                r3 = load4(in - 3 * sbpl);
+                transpose4x4(r0, r1, r2, r3);
+            } else {
+                // source rows dx .. dx+3, columns sw-4-dy .. sw-1-dy read backwards
+                const uchar *in = src + qsizetype(dx) * sbpl + qsizetype(sw - 4 - dy) * 4;
+                __m128i c0 = load4(in);
+                __m128i c1 = load4(in + sbpl);
+                __m128i c2 = load4(in + 2 * sbpl);
+                __m128i c3 = load4(in + 3 * sbpl);
+                transpose4x4(c0, c1, c2, c3);
+                r0 = c3;
+                r1 = c2;
+                r2 = c1;
+                r3 = c0;
+            }
+            store4(out + qsizetype(dx) * 4, r0);
+            store4(out + dbpl + qsizetype(dx) * 4, r1);
+            store4(out + 2 * dbpl + qsizetype(dx) * 4, r2);
+            store4(out + 3 * dbpl + qsizetype(dx) * 4, r3);
+        }
+    }
+    rotateBlock<quint32>(src, sbpl, dst, dbpl, sw, sh, clockwise, dy0, dyEnd, dxEnd, dx1);
+    rotateBlock<quint32>(src, sbpl, dst, dbpl, sw, sh, clockwise, dyEnd, dy1, dx0, dx1);
+}
+
+/**
+ * @brief Byte transpose of sixteen rows: four rounds of interleaving row i
+ * with row i + 8, each round moving one bit of the column index into the
+ * row index.
+ */
+static inline void transpose16x16(__m128i r[16])
+{
+    __m128i t[16];
+    for (int round = 0; round < 4; round++) {
+        for (int i = 0; i < 8; i++) {
+            t[2 * i] = _mm_unpacklo_epi8(r[i], r[i + 8]);
+            t[2 * i + 1] = _mm_unpackhi_epi8(r[i], r[i + 8]);
+        }
+        for (int i = 0; i < 16; i++)
+            r[i] = t[i];
+    }
+}
+
+/**
+ * @brief 8-bit tiles go through 16x16 byte transposes, the ragged edge of
+ * the tile through rotateBlock().
+ */
+template <>
+inline void rotateTile<quint8>(const uchar *src, qsizetype sbpl, uchar *dst, qsizetype dbpl,
+                               int sw, int sh, bool clockwise, int dy0, int dy1, int dx0, int dx1)
+{
+    const int dyEnd = dy0 + (dy1 - dy0) / 16 * 16;
+    const int dxEnd = dx0 + (dx1 - dx0) / 16 * 16;
+    __m128i r[16];
+    for (int dy = dy0; dy < dyEnd; dy += 16) {
+        uchar *out = dst + dy * dbpl;
+        for (int dx = dx0; dx < dxEnd; dx += 16) {
+            if (clockwise) {
+                // source rows sh-1-dx .. sh-16-dx, columns dy .. dy+15
+                const uchar *in = src + qsizetype(sh - 1 - dx) * sbpl + dy;
+                for (int k = 0; k < 16; k++)
+                    r[k] = load4(in - k * sbpl);
+                transpose16x16(r);
+                for (int j = 0; j < 16; j++)
+                    store4(out + j * dbpl + dx, r[j]);
+            } else {
+                // source rows dx .. dx+15, columns sw-16-dy .. sw-1-dy read backwards
+                const uchar *in = src + qsizetype(dx) * sbpl + (sw - 16 - dy);
+                for (int k = 0; k < 16; k++)
+                    r[k] = load4(in + k * sbpl);
+                transpose16x16(r);
+                for (int j = 0; j < 16; j++)
+                    store4(out + j * dbpl + dx, r[15 - j]);
+            }
+        }
+    }
+    rotateBlock<quint8>(src, sbpl, dst, dbpl, sw, sh, clockwise, dy0, dyEnd, dxEnd, dx1);
+    rotateBlock<quint8>(src, sbpl, dst, dbpl, sw, sh, clockwise, dyEnd, dy1, dx0, dx1);
+}
+
+template <>
+inline void reverseRow<quint8>(const uchar *in, uchar *out, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        // reverse the words, then the bytes of each word
+        __m128i v = load4(in + (width - 16 - x));
+        v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+        v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        store4(out + x, v);
+    }
+    for (; x < width; x++)
+        out[x] = in[width - 1 - x];
+}
+
+template <>
+inline void reverseRow<quint32>(const uchar *in, uchar *out, int width)
+{
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        const __m128i v = load4(in + qsizetype(width - 4 - x) * 4);
+        store4(out + qsizetype(x) * 4, _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3)));
+    }
+    const quint32 *from = reinterpret_cast<const quint32*>(in);
+    quint32 *to = reinterpret_cast<quint32*>(out);
+    for (; x < width; x++)
+        to[x] = from[width - 1 - x];
+}
+#endif // ROTATEFLIP_SSE2
+
+template <typename Pixel>
+static QImage rotateQuarter(const QImage &src, bool clockwise)
+{
+    const int sw = src.width();
+    const int sh = src.height();
+    QImage dst(sh, sw, src.format());
+    if (dst.isNull())
+        return dst;
+
+    const uchar *in = src.constBits();
+    uchar *out = dst.bits();
+    const qsizetype sbpl = src.bytesPerLine();
+    const qsizetype dbpl = dst.bytesPerLine();
+    // one band of tiles across the destination per job
+    const int bands = (sw + kTile - 1) / kTile;
+    parallelFor(bands, 1, [&](int begin, int end) {
+        for (int band = begin; band < end; band++) {
+            const int dy0 = band * kTile;
+            const int dy1 = qMin(dy0 + kTile, sw);
+            for (int dx0 = 0; dx0 < sh; dx0 += kTile)
+                rotateTile<Pixel>(in, sbpl, out, dbpl, sw, sh, clockwise,
+                                  dy0, dy1, dx0, qMin(dx0 + kTile, sh));
+        }
+    });
+    dst.setDotsPerMeterX(src.dotsPerMeterY());
+    dst.setDotsPerMeterY(src.dotsPerMeterX());
+    return dst;
+}
+
+template <typename Pixel>
+static QImage mirrorRows(const QImage &src, bool horizontal, bool vertical)
+{
+    QImage dst(src.size(), src.format());
+    if (dst.isNull())
+        return dst;
+
+    const int width = src.width();
+    const int height = src.height();
+    const uchar *in = src.constBits();
+    uchar *out = dst.bits();
+    const qsizetype sbpl = src.bytesPerLine();
+    const qsizetype dbpl = dst.bytesPerLine(); // differs for wrapped buffers
+    parallelFor(height, 64, [&](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            const uchar *from = in + (vertical ? height - 1 - y : y) * sbpl;
+            uchar *to = out + y * dbpl;
+            if (horizontal)
+                reverseRow<Pixel>(from, to, width);
+            else
+                memcpy(to, from, size_t(qMin(sbpl, dbpl)));
+        }
+    });
+    dst.setDotsPerMeterX(src.dotsPerMeterX());
+    dst.setDotsPerMeterY(src.dotsPerMeterY());
+    return dst;
+}
+
+template <typename Pixel>
+static QImage rotateFlipPixels(const QImage &src, RotateFlip op)
+{
+    QImage dst;
+    switch (op) {
+    case RotateFlip::Rotate90:
+        dst = rotateQuarter<Pixel>(src, true);
+        break;
+    case RotateFlip::Rotate270:
+        dst = rotateQuarter<Pixel>(src, false);
+        break;
+    case RotateFlip::Rotate180:
+        dst = mirrorRows<Pixel>(src, true, true);
+        break;
+    case RotateFlip::FlipHorizontal:
+        dst = mirrorRows<Pixel>(src, true, false);
+        break;
+    case RotateFlip::FlipVertical:
+        dst = mirrorRows<Pixel>(src, false, true);
+        break;
+    }
+    if (!dst.isNull() && src.colorCount() > 0)
+        dst.setColorTable(src.colorTable());
+    if (!dst.isNull() && src.colorSpace().isValid())
+        dst.setColorSpace(src.colorSpace());
+    return dst;
+}
+
+QImage rotateFlip(const QImage &src, RotateFlip op)
+{
+    if (src.isNull())
+        return QImage();
+
+    switch (src.depth()) {
+    case 8:
+        return rotateFlipPixels<quint8>(src, op);
+    case 16:
+        return rotateFlipPixels<quint16>(src, op);
+    case 24:
+        return rotateFlipPixels<Pixel24>(src, op);
+    case 32:
+        return rotateFlipPixels<quint32>(src, op);
+    case 64:
+        return rotateFlipPixels<quint64>(src, op);
+    default:
+        break;
+    }
+
+    // 1-bit formats
+    switch (op) {
+    case RotateFlip::Rotate90:
+        return src.transformed(QTransform().rotate(90));
+    case RotateFlip::Rotate180:
+        return src.mirrored(true, true);
+    case RotateFlip::Rotate270:
+        return src.transformed(QTransform().rotate(270));
+    case RotateFlip::FlipHorizontal:
+        return src.mirrored(true, false);
+    case RotateFlip::FlipVertical:
+        return src.mirrored(false, true);
+    }
+    return QImage();
+}
+
+QImage rotateFlipPanes(const QImage &src, bool stacked, RotateFlip op)
+{
+    if (src.isNull() || src.depth() % 8 != 0)
+        return QImage();
+
+    const int paneWidth = stacked ? src.width() : src.width() / 3;
+    const int paneHeight = stacked ? src.height() / 3 : src.height();
+    const bool quarter = op == RotateFlip::Rotate90 || op == RotateFlip::Rotate270;
+    const int width = quarter ? paneHeight : paneWidth;
+    const int height = quarter ? paneWidth : paneHeight;
+    // the same rule as the split itself
+    const bool toStacked = width >= 2 * height;
+    QImage dst(toStacked ? width : 3 * width, toStacked ? 3 * height : height, src.format());
+    if (dst.isNull())
+        return dst;
+
+    const int bytes = src.depth() / 8;
+    const qsizetype sbpl = src.bytesPerLine();
+    const qsizetype dbpl = dst.bytesPerLine();
+    for (int i = 0; i < 3; i++) {
+        // a view of the pane, only read by the kernels above
+        const QImage pane(src.constBits() + (stacked ? i * paneHeight * sbpl : qsizetype(i) * paneWidth * bytes),
+                          paneWidth, paneHeight, sbpl, src.format());
+        const QImage turned = rotateFlip(pane, op);
+        if (turned.isNull())
+            return QImage();
+        uchar *out = dst.bits() + (toStacked ? i * height * dbpl : qsizetype(i) * width * bytes);
+        for (int y = 0; y < height; y++)
+            memcpy(out + y * dbpl, turned.constScanLine(y), size_t(width) * bytes);
+    }
+    dst.setDotsPerMeterX(quarter ? src.dotsPerMeterY() : src.dotsPerMeterX());
+    dst.setDotsPerMeterY(quarter ? src.dotsPerMeterX() : src.dotsPerMeterY());
+    if (src.colorSpace().isValid())
+        dst.setColorSpace(src.colorSpace());
+    return dst;
+}
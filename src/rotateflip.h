@@ -0,0 +1,33 @@
+#ifndef ROTATEFLIP_H
+#define ROTATEFLIP_H
+
+#include <QImage>
+
+enum class RotateFlip
+{
+    Rotate90,  // clockwise
+    Rotate180,
+    Rotate270, // counter-clockwise by 90
+    FlipHorizontal,
+    FlipVertical
+};
+
+/**
+ * @brief Lossless rotation or mirroring in the source format.
+ *
+ * 8, 16, 24, 32 and 64-bit formats are handled directly: quarter turns
+ * transpose 64x64 pixel tiles in parallel so both the reads and the writes
+ * stay in cache, with SSE2 16x16 byte transposes for 8-bit and 4x4 register
+ * transposes for 32-bit pixels. Flips and half turns copy or reverse rows
+ * in parallel. Anything else goes through QImage::transformed() / mirrored().
+ */
+QImage rotateFlip(const QImage &src, RotateFlip op);
+
+/**
+ * @brief rotateFlip() of the three panes of a one-buffer channel split,
+ * side by side or @a stacked, each turned where it is. The panes keep
+ * their order and are laid out as a split of the turned image would be.
+ */
+QImage rotateFlipPanes(const QImage &src, bool stacked, RotateFlip op);
+
+#endif // ROTATEFLIP_H
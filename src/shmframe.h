@@ -0,0 +1,62 @@
+#ifndef SHMFRAME_H
+#define SHMFRAME_H
+
+#include <QtGlobal>
+#include <chrono>
+
+/**
+ * Shared-memory frame layout used by FrameIngestServer and the bundled
+ * shmproducer tool.
+ *
+ * The producer creates a QSharedMemory segment holding a ShmFrameHeader
+ * followed by slotCount slots of slotSize bytes. Each slot starts with a
+ * ShmSlotHeader, the pixels follow at kShmSlotDataOffset with 32-bit
+ * aligned scanlines. The viewer copies each frame out of its slot once
+ * and never keeps a QImage over the segment, see FrameIngestServer.
+ *
+ * Notifications go over a QLocalSocket as text lines:
+ *   producer -> viewer: "ATTACH <key>", "FRAME <slot>"
+ *   viewer -> producer: "SHOWN <slot>" once the frame has been painted,
+ *                       "DONE <slot>" once the slot may be overwritten;
+ *                       frames the viewer skips only get a DONE
+ */
+
+static const quint32 kShmFrameMagic = 0x46535649; // 'IVSF'
+static const quint32 kShmFrameVersion = 1;
+static const int kShmHeaderSize = 64;
+static const int kShmSlotDataOffset = 64;
+
+struct ShmFrameHeader
+{
+    quint32 magic;
+    quint32 version;
+    quint32 slotCount;
+    quint32 slotSize;
+};
+
+struct ShmSlotHeader
+{
+    quint64 sequence;
+    qint64 timestampUs;  // producer clock, microseconds since epoch
+    qint32 width;
+    qint32 height;
+    qint32 format;       // QImage::Format
+    qint32 stride;       // bytes per line
+};
+
+Q_STATIC_ASSERT(sizeof(ShmFrameHeader) <= kShmHeaderSize);
+Q_STATIC_ASSERT(sizeof(ShmSlotHeader) <= kShmSlotDataOffset);
+
+inline qint64 shmSlotOffset(int slot, quint32 slotSize)
+{
+    return kShmHeaderSize + qint64(slot) * slotSize;
+}
+
+/** @brief wall clock shared by both processes, for latency measurement */
+inline qint64 shmNowUs()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+#endif // SHMFRAME_H
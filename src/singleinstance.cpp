@@ -0,0 +1,65 @@
+#include <QFileInfo>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include "singleinstance.h"
+
+
+SingleInstance::SingleInstance(QObject *parent)
+    : QObject(parent)
+    , server_(new QLocalServer(this))
+{
+    connect(server_, &QLocalServer::newConnection, this, &SingleInstance::newConnection);
+}
+
+QString SingleInstance::serverName()
+{
+    QString user = qEnvironmentVariable("USER");
+    if (user.isEmpty())
+        user = qEnvironmentVariable("USERNAME");
+    return QStringLiteral("ImageViewer-") + user;
+}
+
+bool SingleInstance::forward(const QStringList &files)
+{
+    QLocalSocket socket;
+    socket.connectToServer(serverName());
+    if (!socket.waitForConnected(200))
+        return false;
+
+    QByteArray data;
+    for (const QString &file : files)
+        data += QFileInfo(file).absoluteFilePath().toUtf8() + '\n';
+    socket.write(data);
+    if (!socket.waitForBytesWritten(1000))
+        return false;
+    socket.disconnectFromServer();
+    if (socket.state() != QLocalSocket::UnconnectedState)
+        socket.waitForDisconnected(1000);
+    return true;
+}
+
+bool SingleInstance::listen()
+{
+    if (server_->listen(serverName()))
+        return true;
+
+    // nobody answered in forward(), so the socket file is left from a crash
+    QLocalServer::removeServer(serverName());
+    return server_->listen(serverName());
+}
+
+void SingleInstance::newConnection()
+{
+    while (QLocalSocket *socket = server_->nextPendingConnection()) {
+        connect(socket, &QLocalSocket::disconnected, this, [this, socket]() {
+            QStringList files;
+            const QList<QByteArray> lines = socket->readAll().split('\n');
+            for (const QByteArray &line : lines) {
+                if (!line.isEmpty())
+                    files.append(QString::fromUtf8(line));
+            }
+            socket->deleteLater();
+            emit filesReceived(files);
+        });
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef SINGLEINSTANCE_H
+#define SINGLEINSTANCE_H
+
+#include <QObject>
+#include <QStringList>
+
+QT_BEGIN_NAMESPACE
+class QLocalServer;
+QT_END_NAMESPACE
+
+/**
+ * @brief Hand command line files to an already running viewer.
+ *
+ * The first instance listens on a per-user local server. Later launches
+ * connect, write the absolute paths one per line and exit before any GUI
+ * is created.
+ */
+class SingleInstance : public QObject
+{
+    Q_OBJECT
+public:
+    SingleInstance(QObject *parent = nullptr);
+
+    static QString serverName();
+    static bool forward(const QStringList &files); // true if a running instance took them
+    bool listen();
+
+signals:
+    void filesReceived(const QStringList &files);
+
+private slots:
+    void newConnection();
+
+private:
+    QLocalServer *server_;
+};
+
+#endif // SINGLEINSTANCE_H
@@ -0,0 +1,66 @@
+#include <QElapsedTimer>
+#include <QEvent>
+#include <QPair>
+#include <QTimer>
+#include <QVector>
+#include <QWidget>
+#include <stdio.h>
+#include "startupreport.h"
+
+static bool report_enabled = false;
+static QElapsedTimer report_clock;
+static QVector<QPair<const char*, qint64>> report_marks;
+
+void StartupReport::start(bool enabled)
+{
+    report_enabled = enabled;
+    if (!enabled)
+        return;
+    report_clock.start();
+    mark("main");
+}
+
+bool StartupReport::isEnabled()
+{
+    return report_enabled;
+}
+
+void StartupReport::mark(const char *milestone)
+{
+    if (report_enabled)
+        report_marks.append(qMakePair(milestone, report_clock.nsecsElapsed()));
+}
+
+void StartupReport::watchFirstPaint(QWidget *widget)
+{
+    if (report_enabled)
+        widget->installEventFilter(new StartupReport(widget));
+}
+
+bool StartupReport::eventFilter(QObject *obj, QEvent *event)
+{
+    if (event->type() == QEvent::Paint) {
+        obj->removeEventFilter(this);
+        mark("first paint");
+        // report once the paint event has been handled
+        QTimer::singleShot(0, []() {
+            mark("first paint done");
+            print();
+        });
+        deleteLater();
+    }
+    return false;
+}
+
+void StartupReport::print()
+{
+    qint64 previous = 0;
+    fprintf(stderr, "startup report (ms since main)\n");
+    for (const auto &m : report_marks) {
+        fprintf(stderr, "  %-24s %9.2f  (+%.2f)\n", m.first,
+                m.second / 1e6, (m.second - previous) / 1e6);
+        previous = m.second;
+    }
+    fflush(stderr);
+    report_enabled = false;
+}
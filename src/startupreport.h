@@ -0,0 +1,33 @@
+#ifndef STARTUPREPORT_H
+#define STARTUPREPORT_H
+
+#include <QObject>
+
+QT_BEGIN_NAMESPACE
+class QWidget;
+QT_END_NAMESPACE
+
+/**
+ * @brief Milestones from main() to the first painted frame (--startup-report).
+ *
+ * mark() is a no-op unless the report was enabled, the summary is printed
+ * to stderr right after the watched widget has painted for the first time.
+ */
+class StartupReport : public QObject
+{
+    Q_OBJECT
+public:
+    static void start(bool enabled); // call first thing in main()
+    static bool isEnabled();
+    static void mark(const char *milestone);
+    static void watchFirstPaint(QWidget *widget);
+
+protected:
+    bool eventFilter(QObject *obj, QEvent *event) override;
+
+private:
+    StartupReport(QObject *parent) : QObject(parent) {}
+    static void print();
+};
+
+#endif // STARTUPREPORT_H
@@ -0,0 +1,194 @@
+#include <QAction>
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QMouseEvent>
+#include <QThread>
+#include <QTimer>
+#include <QWheelEvent>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <vector>
+#include <stdio.h>
+#include "uibench.h"
+#include "imageviewer.h"
+#include "parallelfor.h"
+
+static const QSize kWindowSize(1280, 800);
+
+/**
+ * @brief Deterministic 4:3 test card: gradients plus an XOR pattern so
+ * neither compression nor a flat colour can make painting look cheap.
+ */
+static QImage syntheticImage(int megapixels)
+{
+    const int height = int(std::sqrt(megapixels * 1e6 * 3 / 4));
+    const int width = height * 4 / 3;
+    QImage image(width, height, QImage::Format_RGB32);
+    if (image.isNull())
+        return image;
+    uchar *bits = image.bits();
+    const qsizetype bpl = image.bytesPerLine();
+    parallelFor(height, 64, [&](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            QRgb *line = reinterpret_cast<QRgb*>(bits + y * bpl);
+            for (int x = 0; x < width; x++)
+                line[x] = qRgb(x * 255 / width, y * 255 / height, (x ^ y) & 255);
+        }
+    });
+    return image;
+}
+
+struct Samples
+{
+    std::vector<qint64> handle;
+    std::vector<qint64> paint;
+};
+
+static double percentile(std::vector<qint64> values, double q)
+{
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    const size_t index = qMin(values.size() - 1, size_t(q * (values.size() - 1) + 0.5));
+    return values[index] / 1e6;
+}
+
+/**
+ * @brief Time one step: the event handling itself, then a synchronous
+ * repaint of the viewport.
+ */
+static void measure(QWidget *viewport, Samples &samples, const std::function<void()> &step)
+{
+    QElapsedTimer timer;
+    timer.start();
+    step();
+    samples.handle.push_back(timer.nsecsElapsed());
+
+    timer.restart();
+    viewport->repaint();
+    samples.paint.push_back(timer.nsecsElapsed());
+}
+
+static void sendMouse(QWidget *target, QEvent::Type type, const QPoint &pos,
+                      Qt::MouseButton button, Qt::MouseButtons buttons)
+{
+    QMouseEvent event(type, QPointF(pos), QPointF(target->mapToGlobal(pos)),
+                      button, buttons, Qt::NoModifier);
+    QCoreApplication::sendEvent(target, &event);
+}
+
+static void sendWheel(QWidget *target, const QPoint &pos, int steps)
+{
+    QWheelEvent event(QPointF(pos), QPointF(target->mapToGlobal(pos)), QPoint(),
+                      QPoint(0, 120 * steps), Qt::NoButton, Qt::NoModifier,
+                      Qt::NoScrollPhase, false);
+    QCoreApplication::sendEvent(target, &event);
+}
+
+/**
+ * @brief Let worker results (splits, minimap proxy, regions, prints) land
+ * before the next scenario so they are not billed to it. Those run on
+ * their own QThreads, the viewer reports when the last one has finished;
+ * a result that starts another task keeps the count above zero.
+ */
+void UiBench::settle(ImageViewer *viewer)
+{
+    if (viewer->runningTasks > 0) {
+        QEventLoop loop;
+        QObject::connect(viewer, &ImageViewer::tasksFinished, &loop, &QEventLoop::quit);
+        QTimer::singleShot(30000, &loop, &QEventLoop::quit); // a stuck task must not hang the run
+        loop.exec();
+    }
+    // debounce timers and the paint that follows a result
+    for (int i = 0; i < 10; i++) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+        QThread::msleep(5);
+    }
+}
+
+static void report(int megapixels, const char *scenario, const Samples &samples)
+{
+    printf("%d\t%s\t%d\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\n", megapixels, scenario,
+           int(samples.handle.size()),
+           percentile(samples.handle, 0.50), percentile(samples.handle, 0.95), percentile(samples.handle, 0.99),
+           percentile(samples.paint, 0.50), percentile(samples.paint, 0.95), percentile(samples.paint, 0.99));
+    fflush(stdout);
+}
+
+int UiBench::run(ImageViewer *viewer, const QList<int> &megapixels)
+{
+    viewer->resize(kWindowSize);
+    viewer->show();
+    settle(viewer);
+
+    QWidget *viewport = viewer->imageViewer->viewport();
+    printf("# ImageViewer ui-bench, Qt %s, %s, window %dx%d, %d threads\n",
+           qVersion(), qPrintable(QGuiApplication::platformName()),
+           kWindowSize.width(), kWindowSize.height(), QThread::idealThreadCount());
+    printf("# MP\tscenario\tevents\thandle_p50_ms\thandle_p95_ms\thandle_p99_ms"
+           "\tpaint_p50_ms\tpaint_p95_ms\tpaint_p99_ms\n");
+
+    for (int mp : megapixels) {
+        const QImage image = syntheticImage(mp);
+        if (image.isNull()) {
+            fprintf(stderr, "ui-bench: cannot allocate a %d MP image\n", mp);
+            return 1;
+        }
+        viewer->filePath.clear();
+        viewer->setImage(image);
+        settle(viewer);
+
+        const QPoint center = viewport->rect().center();
+
+        Samples wheel;
+        for (int i = 0; i < 10; i++)
+            measure(viewport, wheel, [&] { sendWheel(viewport, center, 1); });
+        for (int i = 0; i < 10; i++)
+            measure(viewport, wheel, [&] { sendWheel(viewport, center, -1); });
+        report(mp, "wheel", wheel);
+        settle(viewer);
+
+        // zoomed in so there is something to pan over
+        viewer->imageViewer->zoomOriginal();
+        settle(viewer);
+        Samples pan;
+        QPoint pos = center;
+        measure(viewport, pan, [&] { sendMouse(viewport, QEvent::MouseButtonPress, pos, Qt::LeftButton, Qt::LeftButton); });
+        for (int i = 0; i < 60; i++) {
+            pos += QPoint(i < 30 ? 8 : -8, i % 2 ? 4 : -4);
+            measure(viewport, pan, [&] { sendMouse(viewport, QEvent::MouseMove, pos, Qt::NoButton, Qt::LeftButton); });
+        }
+        measure(viewport, pan, [&] { sendMouse(viewport, QEvent::MouseButtonRelease, pos, Qt::LeftButton, Qt::NoButton); });
+        report(mp, "pan", pan);
+        settle(viewer);
+
+        // cursor readout on every move
+        Samples hover;
+        const QRect area = viewport->rect().adjusted(20, 20, -20, -20);
+        for (int i = 0; i < 200; i++) {
+            const QPoint p(area.left() + (i * 37) % area.width(), area.top() + (i * 23) % area.height());
+            measure(viewport, hover, [&] { sendMouse(viewport, QEvent::MouseMove, p, Qt::NoButton, Qt::NoButton); });
+        }
+        report(mp, "hover", hover);
+        sendMouse(viewport, QEvent::MouseMove, QPoint(-1, -1), Qt::NoButton, Qt::NoButton);
+        settle(viewer);
+
+        // above large_image_size the splits finish on a worker, only the
+        // hand-off is timed then
+        Samples toggle;
+        for (int i = 0; i < 3; i++) {
+            measure(viewport, toggle, [&] { viewer->split1Act->trigger(); });
+            settle(viewer);
+            measure(viewport, toggle, [&] { viewer->convertAct->trigger(); });
+            settle(viewer);
+            measure(viewport, toggle, [&] { viewer->toggleBilinearTransform(i % 2 == 0); });
+            measure(viewport, toggle, [&] { viewer->dispOrigAct->trigger(); });
+            settle(viewer);
+        }
+        report(mp, "toggle", toggle);
+        settle(viewer);
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef UIBENCH_H
+#define UIBENCH_H
+
+#include <QList>
+
+class ImageViewer;
+
+/**
+ * @brief Scripted interaction replay for catching UI latency regressions
+ * (--ui-bench, on the offscreen platform unless QT_QPA_PLATFORM is set).
+ *
+ * For each synthetic image size the viewer is fed wheel zoom, drag-pan,
+ * hover and mode-toggle sequences. Every event is delivered with
+ * sendEvent() and timed, then the viewport is repainted synchronously and
+ * timed separately. Percentiles go to stdout as tab separated rows with a
+ * fixed window size, fixed images and fixed scripts, so runs on different
+ * commits can be diffed. @a viewer should be built on default settings
+ * (main() gives it a temporary file), a user's own would skew the numbers.
+ */
+class UiBench
+{
+public:
+    static int run(ImageViewer *viewer, const QList<int> &megapixels);
+private:
+    static void settle(ImageViewer *viewer);
+};
+
+#endif // UIBENCH_H
@@ -0,0 +1,159 @@
+#include <QImageReader>
+#include <QPainter>
+#include <cmath>
+#include "virtualimage.h"
+#include "parallelfor.h"
+
+// bounds the transient buffer of one band while building an overview
+static const qint64 kBandBytes = 64 << 20;
+
+bool VirtualImage::canDecodeRegions(const QString &fileName)
+{
+    QImageReader reader(fileName);
+    return reader.supportsOption(QImageIOHandler::ClipRect);
+}
+
+QImage VirtualImage::decodeOverview(const QString &fileName, const QSize &size, int maxSide)
+{
+    QSize target = size;
+    if (qMax(size.width(), size.height()) > maxSide)
+        target = size.scaled(maxSide, maxSide, Qt::KeepAspectRatio);
+    target = target.expandedTo(QSize(1, 1));
+
+    {
+        QImageReader reader(fileName);
+        reader.setAutoTransform(false); // tiles are in file coordinates
+        if (reader.supportsOption(QImageIOHandler::ScaledSize)) {
+            reader.setScaledSize(target);
+            return reader.read();
+        }
+    }
+
+    // bands through clip rects, each one scaled down on its own
+    QImage overview;
+    const int bandRows = int(qBound<qint64>(1, kBandBytes / (qint64(size.width()) * 4), size.height()));
+    for (int y = 0; y < size.height(); y += bandRows) {
+        const int rows = qMin(bandRows, size.height() - y);
+        QImageReader reader(fileName);
+        reader.setAutoTransform(false);
+        reader.setClipRect(QRect(0, y, size.width(), rows));
+        const QImage band = reader.read();
+        if (band.isNull())
+            return QImage();
+        if (overview.isNull()) {
+            overview = QImage(target, band.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied
+                                                            : QImage::Format_RGB32);
+            if (overview.isNull())
+                return overview;
+            overview.fill(Qt::transparent);
+        }
+        const double top = double(y) * target.height() / size.height();
+        const double bottom = double(y + rows) * target.height() / size.height();
+        QPainter painter(&overview);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+        painter.drawImage(QRectF(0, top, target.width(), bottom - top), band);
+    }
+    return overview;
+}
+
+int VirtualImage::levelForScale(double scale)
+{
+    if (scale <= 0)
+        return 0;
+    return qBound(0, int(std::floor(std::log2(1.0 / scale))), 16);
+}
+
+QRect VirtualImage::tileRect(int column, int row, int level, const QSize &size)
+{
+    const int span = kTileSize << level;
+    return QRect(column * span, row * span, span, span) & QRect(QPoint(0, 0), size);
+}
+
+qint64 VirtualImage::tileKey(int column, int row, int level)
+{
+    return (qint64(level) << 48) | (qint64(row) << 24) | qint64(column);
+}
+
+QVector<RegionRequest> VirtualImage::visibleTiles(const QRectF &visible, double scale, const QSize &size)
+{
+    const int level = levelForScale(scale);
+    const int span = kTileSize << level;
+    const QRect area = visible.adjusted(-span / 2, -span / 2, span / 2, span / 2).toAlignedRect()
+        & QRect(QPoint(0, 0), size);
+    QVector<RegionRequest> tiles;
+    if (area.isEmpty())
+        return tiles;
+    for (int row = area.top() / span; row <= area.bottom() / span; row++) {
+        for (int column = area.left() / span; column <= area.right() / span; column++) {
+            const QRect rect = tileRect(column, row, level, size);
+            tiles.append(RegionRequest{tileKey(column, row, level), rect,
+                QSize((rect.width() + (1 << level) - 1) >> level,
+                      (rect.height() + (1 << level) - 1) >> level)});
+        }
+    }
+    return tiles;
+}
+
+
+VirtualOverviewTask::VirtualOverviewTask(QObject *parent)
+    : QObject(parent)
+    , maxSide(0)
+    , serial(0)
+{
+
+}
+
+void VirtualOverviewTask::setFile(const QString &fileName, const QSize &size, int maxSide, int serial)
+{
+    this->fileName = fileName;
+    this->size = size;
+    this->maxSide = maxSide;
+    this->serial = serial;
+}
+
+void VirtualOverviewTask::run()
+{
+    emit resultReady(serial, size, VirtualImage::decodeOverview(fileName, size, maxSide));
+    emit workFinished();
+}
+
+
+RegionDecodeTask::RegionDecodeTask(QObject *parent)
+    : QObject(parent)
+    , serial(0)
+    , generation(0)
+{
+
+}
+
+void RegionDecodeTask::setRegions(const QString &fileName, const QVector<RegionRequest> &regions, int serial)
+{
+    this->fileName = fileName;
+    this->regions = regions;
+    this->serial = serial;
+}
+
+void RegionDecodeTask::setGeneration(QSharedPointer<QAtomicInt> current, int generation)
+{
+    this->current = current;
+    this->generation = generation;
+}
+
+void RegionDecodeTask::run()
+{
+    // one reader per tile, the handlers are not shared between threads
+    parallelFor(regions.size(), 1, [this](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            if (current && current->loadAcquire() != generation)
+                continue; // the view moved on, the owner asks again for what it wants now
+            const RegionRequest &request = regions[i];
+            QImageReader reader(fileName);
+            reader.setAutoTransform(false);
+            reader.setClipRect(request.rect);
+            if (request.size != request.rect.size())
+                reader.setScaledSize(request.size);
+            emit regionReady(serial, request.key, request.rect, reader.read());
+        }
+    });
+    emit workFinished();
+}
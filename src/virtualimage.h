@@ -0,0 +1,88 @@
+#ifndef VIRTUALIMAGE_H
+#define VIRTUALIMAGE_H
+
+#include <QObject>
+#include <QImage>
+#include <QVector>
+#include <QSharedPointer>
+#include <QAtomicInt>
+
+/**
+ * @brief A tile to decode: @a rect in file pixels, decoded to @a size
+ */
+struct RegionRequest
+{
+    qint64 key;
+    QRect rect;
+    QSize size;
+};
+
+/**
+ * @brief Very large files shown without decoding them in full.
+ *
+ * A scaled overview is decoded once for best fit. When the view zooms past
+ * the overview's resolution, only the tiles around the viewport are decoded
+ * with QImageReader::setClipRect(), at the coarsest power of two that is
+ * still at least as sharp as the screen. This only pays off for handlers
+ * that decode clip rects natively (ClipRect in QImageIOHandler terms).
+ */
+class VirtualImage
+{
+public:
+    static const int kTileSize = 1024; // decoded pixels per tile side
+
+    static bool canDecodeRegions(const QString &fileName);
+
+    /// at most @a maxSide pixels on the long side, through ScaledSize when the
+    /// handler has it, else in bands of clip rects scaled down one at a time
+    static QImage decodeOverview(const QString &fileName, const QSize &size, int maxSide);
+
+    /// pyramid level for a view scale: each level halves the resolution
+    static int levelForScale(double scale);
+    static QRect tileRect(int column, int row, int level, const QSize &size);
+    static qint64 tileKey(int column, int row, int level);
+    /// the tiles of @a size around the @a visible scene rect, half a tile
+    /// span beyond it, at the level of @a scale
+    static QVector<RegionRequest> visibleTiles(const QRectF &visible, double scale, const QSize &size);
+};
+
+class VirtualOverviewTask : public QObject
+{
+    Q_OBJECT
+public:
+    VirtualOverviewTask(QObject *parent = nullptr);
+    void setFile(const QString &fileName, const QSize &size, int maxSide, int serial);
+public slots:
+    void run();
+signals:
+    void resultReady(int serial, QSize size, QImage overview); /// null if it cannot be decoded
+    void workFinished();
+private:
+    QString fileName;
+    QSize size;
+    int maxSide;
+    int serial;
+};
+
+class RegionDecodeTask : public QObject
+{
+    Q_OBJECT
+public:
+    RegionDecodeTask(QObject *parent = nullptr);
+    void setRegions(const QString &fileName, const QVector<RegionRequest> &regions, int serial);
+    /// tiles not started yet are skipped once @a current moves on from @a generation
+    void setGeneration(QSharedPointer<QAtomicInt> current, int generation);
+public slots:
+    void run();
+signals:
+    void regionReady(int serial, qint64 key, QRect rect, QImage region);
+    void workFinished();
+private:
+    QString fileName;
+    QVector<RegionRequest> regions;
+    int serial;
+    QSharedPointer<QAtomicInt> current;
+    int generation;
+};
+
+#endif // VIRTUALIMAGE_H
@@ -0,0 +1,190 @@
+/**
+ * Test producer for the viewer's "Listen for Frames" mode.
+ *
+ * Pushes synthetic frames through the shared-memory ring described in
+ * src/shmframe.h and reports end-to-end latency (frame written -> frame on
+ * screen) and the sustained frame rate.
+ *
+ *   shmproducer --width 4096 --height 3072 --format rgb32 --fps 30 --frames 600
+ *   shmproducer --fps 0     # closed loop, measures the maximum rate
+ */
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QLocalSocket>
+#include <QSharedMemory>
+#include <QTextStream>
+#include <QTimer>
+#include <QVector>
+#include <algorithm>
+#include <string.h>
+
+#include "shmframe.h"
+
+static double percentile(QVector<double> values, double p)
+{
+    if (values.isEmpty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    const int idx = qBound(0, int(p * (values.size() - 1) + 0.5), values.size() - 1);
+    return values[idx];
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption serverOpt("server", "Local server name of the viewer.", "name", "ImageViewerIngest");
+    QCommandLineOption keyOpt("key", "Shared memory key.", "key", "ImageViewerFrames");
+    QCommandLineOption widthOpt("width", "Frame width.", "px", "2048");
+    QCommandLineOption heightOpt("height", "Frame height.", "px", "2048");
+    QCommandLineOption formatOpt("format", "gray8, rgb888 or rgb32.", "format", "gray8");
+    QCommandLineOption slotsOpt("slots", "Number of ring slots (>= 2).", "n", "4");
+    QCommandLineOption framesOpt("frames", "Number of frames to send.", "n", "600");
+    QCommandLineOption fpsOpt("fps", "Target rate, 0 sends the next frame once the previous is shown.", "fps", "30");
+    parser.addOptions({serverOpt, keyOpt, widthOpt, heightOpt, formatOpt, slotsOpt, framesOpt, fpsOpt});
+    parser.process(app);
+
+    QTextStream out(stdout);
+    const int width = parser.value(widthOpt).toInt();
+    const int height = parser.value(heightOpt).toInt();
+    const int slotCount = qMax(2, parser.value(slotsOpt).toInt());
+    const int totalFrames = parser.value(framesOpt).toInt();
+    const int fps = parser.value(fpsOpt).toInt();
+
+    QImage::Format format = QImage::Format_Grayscale8;
+    int bytesPerPixel = 1;
+    if (parser.value(formatOpt) == "rgb888") {
+        format = QImage::Format_RGB888;
+        bytesPerPixel = 3;
+    } else if (parser.value(formatOpt) == "rgb32") {
+        format = QImage::Format_RGB32;
+        bytesPerPixel = 4;
+    }
+
+    const int stride = (width * bytesPerPixel + 63) / 64 * 64;
+    const quint32 slotSize = quint32((kShmSlotDataOffset + qint64(stride) * height + 63) / 64 * 64);
+
+    QSharedMemory shm(parser.value(keyOpt));
+    if (!shm.create(int(shmSlotOffset(slotCount, slotSize)))) {
+        // a crashed producer may have left the segment behind
+        if (shm.attach())
+            shm.detach();
+        if (!shm.create(int(shmSlotOffset(slotCount, slotSize)))) {
+            out << "Cannot create shared memory: " << shm.errorString() << "\n";
+            return 1;
+        }
+    }
+    uchar *base = static_cast<uchar*>(shm.data());
+    ShmFrameHeader *header = reinterpret_cast<ShmFrameHeader*>(base);
+    header->magic = kShmFrameMagic;
+    header->version = kShmFrameVersion;
+    header->slotCount = quint32(slotCount);
+    header->slotSize = slotSize;
+
+    QLocalSocket socket;
+    socket.connectToServer(parser.value(serverOpt));
+    if (!socket.waitForConnected(3000)) {
+        out << "Cannot connect to viewer: " << socket.errorString() << "\n";
+        return 1;
+    }
+    socket.write("ATTACH " + parser.value(keyOpt).toUtf8() + '\n');
+
+    QVector<int> freeSlots;
+    for (int i = 0; i < slotCount; i++)
+        freeSlots.append(i);
+    QVector<qint64> sentAt(slotCount, 0);
+    QVector<double> latencies;
+    quint64 sequence = 0;
+    int sent = 0, dropped = 0;
+    QElapsedTimer clock;
+
+    auto sendFrame = [&]() {
+        if (sent >= totalFrames)
+            return;
+        if (freeSlots.isEmpty()) {
+            dropped++; // viewer holds every slot, producer would block here
+            return;
+        }
+        const int slot = freeSlots.takeFirst();
+        uchar *slotPtr = base + shmSlotOffset(slot, slotSize);
+        ShmSlotHeader *slotHeader = reinterpret_cast<ShmSlotHeader*>(slotPtr);
+        uchar *pixels = slotPtr + kShmSlotDataOffset;
+        for (int y = 0; y < height; y++)
+            memset(pixels + qint64(y) * stride, int((y + sequence * 4) & 255), size_t(width) * bytesPerPixel);
+
+        slotHeader->sequence = ++sequence;
+        slotHeader->width = width;
+        slotHeader->height = height;
+        slotHeader->format = format;
+        slotHeader->stride = stride;
+        slotHeader->timestampUs = sentAt[slot] = shmNowUs();
+
+        socket.write("FRAME " + QByteArray::number(slot) + '\n');
+        socket.flush();
+        sent++;
+    };
+
+    QTimer pacer;
+    pacer.setTimerType(Qt::PreciseTimer);
+    QObject::connect(&pacer, &QTimer::timeout, sendFrame);
+
+    bool finished = false;
+    auto report = [&]() {
+        if (finished)
+            return;
+        finished = true;
+        const double secs = qMax<qint64>(1, clock.elapsed()) / 1000.0;
+        out << "frames sent " << sent << ", shown " << latencies.size()
+            << ", skipped by viewer " << sent - latencies.size()
+            << ", dropped (no free slot) " << dropped << "\n";
+        out << "sustained " << latencies.size() / secs << " fps over " << secs << " s\n";
+        out << "latency ms: p50 " << percentile(latencies, 0.5)
+            << "  p90 " << percentile(latencies, 0.9)
+            << "  p99 " << percentile(latencies, 0.99)
+            << "  max " << percentile(latencies, 1.0) << "\n";
+        out.flush();
+        app.quit();
+    };
+
+    QObject::connect(&socket, &QLocalSocket::readyRead, [&]() {
+        while (socket.canReadLine()) {
+            const QList<QByteArray> cmd = socket.readLine().trimmed().split(' ');
+            if (cmd.size() != 2)
+                continue;
+            const int slot = cmd[1].toInt();
+            if (slot < 0 || slot >= slotCount)
+                continue;
+            if (cmd[0] == "SHOWN") {
+                latencies.append((shmNowUs() - sentAt[slot]) / 1000.0);
+                if (fps <= 0)
+                    QTimer::singleShot(0, sendFrame);
+            } else if (cmd[0] == "DONE") {
+                freeSlots.append(slot);
+            }
+        }
+        if (sent >= totalFrames && latencies.size() >= sent)
+            report();
+    });
+    QObject::connect(&socket, &QLocalSocket::disconnected, report);
+
+    QTimer::singleShot(0, [&]() {
+        clock.start();
+        if (fps > 0)
+            pacer.start(qMax(1, 1000 / fps));
+        else
+            sendFrame();
+    });
+    // frames the viewer skipped never get a SHOWN, don't wait for them forever
+    QTimer watchdog;
+    QObject::connect(&watchdog, &QTimer::timeout, [&]() {
+        if (sent >= totalFrames)
+            report();
+    });
+    watchdog.start(2000);
+
+    return app.exec();
+}
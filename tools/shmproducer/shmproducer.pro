@@ -0,0 +1,7 @@
+QT += network
+CONFIG += console
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../../src
+HEADERS       = ../../src/shmframe.h
+SOURCES       = main.cpp